@@ -3,43 +3,192 @@
 
 #include <CL/cl.hpp>
 
+#include "census_matcher.hpp"
+#include "compute_device.hpp"
 #include "graphics_factory.hpp"
 #include "image.hpp"
+#include "kernel_variants.hpp"
+#include "memory_planner.hpp"
+#include "stereo_calibration.hpp"
 #include "util.hpp"
-
-struct Volume
-{
-        int* voxels = NULL;
-        int cube_width;
-};
+#include "volume_shift.hpp"
+#include "work_group_tuner.hpp"
 
 class Algorithm
 {
         public:
-                Algorithm();
+                // Stereo matching cost, census is computed on the device or on the host with hardware popcount
+                enum class MatchingCost
+                {
+                        SAD,
+                        SAD_AGGREGATED,
+                        CENSUS,
+                        CENSUS_HOST
+                };
+
+                // Packed vertex and normal maps, shared with the host copies
+                static const unsigned int VERTEX_WORDS_PER_PIXEL = 2;
+                static const unsigned int NORMAL_WORDS_PER_PIXEL = 1;
+
+                // Point-to-plane residuals of the packed correspondences of the last frame tracked
+                struct TrackingStatistics
+                {
+                        unsigned int correspondence_count = 0;
+                        double residual_rms = 0;
+                        double residual_max = 0;
+                        unsigned int outlier_count = 0;
+                };
+
+                // Host-device traffic and map coverage, accumulated until taken once per frame
+                struct FrameStatistics
+                {
+                        uint64_t bytes_uploaded = 0;
+                        uint64_t bytes_downloaded = 0;
+                        unsigned int valid_depth_pixels = 0;
+                        uint64_t occupied_voxels = 0;
+                        uint64_t voxel_count = 0;
+                };
+
+                Algorithm(ComputeDevice* compute_device = NULL);
                 ~Algorithm();
-                void initialise(GraphicsFactory* graphics_factory, unsigned int width, unsigned int height);
-                void generateDisparityMap(Image* left, Image* right, unsigned int window_size, Image* disparity_map);
+                MemoryPlanner createMemoryPlanner();
+                bool planMemory(MemoryPlanner& planner, unsigned int width, unsigned int height, const Util::VolumeConfig& volume_config,
+                        Util::VolumeConfig& planned_volume_config);
+                void initialise(GraphicsFactory* graphics_factory, unsigned int width, unsigned int height, const Util::VolumeConfig& volume_config);
+                void setRectification(const StereoCalibration& calibration, unsigned int bytes_per_pixel);
+                void setTemporalSeeding(unsigned int band);
+                void setConsistencyCheck(bool enabled);
+                void setBrickStoreFilename(std::string filename);
+                void setDisparityRange(unsigned int disparity_range);
+                bool setAggregation(unsigned int range, unsigned int batch_size);
+                unsigned int getAggregatedRange();
+                void prepareDisparityMap(unsigned int width, unsigned int window_size, MatchingCost matching_cost, unsigned int range);
+                void generateDisparityMap(Image* left, Image* right, unsigned int window_size, MatchingCost matching_cost,
+                        const Util::Vector3D& camera_motion, int baseline_mm, Image* disparity_map);
                 void convertDisparityMapToDepthMap(Image* disparity_map, int focal_length, int baseline_mm, Image* depth_map);
                 void trackCamera(Image* depth_map, Image* vertex_map, Image* normal_map, const Util::CameraConfig& camera_config, const Util::Transformation& transformation);
                 void tempSetVoxels(Image* image);
-                void render(int eye_x, int eye_y, int eye_z, int screen_z, float angle, float distance, Image* screen);
+                void shiftVolume(const Util::Transformation& camera_pose);
+                bool saveVolume(std::string filename, const Util::Transformation& camera_pose);
+                bool loadVolume(std::string filename, Util::Transformation& camera_pose);
+                bool extractMesh(std::string filename);
+                const TrackingStatistics& getTrackingStatistics() const;
+                FrameStatistics takeFrameStatistics();
+                void render(int eye_x, int eye_y, int eye_z, int screen_z, float angle, float distance, unsigned int render_scale, Image* screen);
 
         private:
+                static const cl::ImageFormat VERTEX_FORMAT;
+                static const cl::ImageFormat NORMAL_FORMAT;
+
                 void initialiseOpenCL();
-                std::string loadSource(std::string filename);
+                void uploadLuminance(Image* image, cl::Image2D& luminance);
+                void uploadRectified(Image* left, Image* right);
+                cl::Program& getSadProgram(unsigned int window_size, int max_disparity);
+                cl::Program& getCensusProgram(int max_disparity);
+                int getMaxDisparity(unsigned int range, unsigned int width);
+                void reduceCorrespondences(unsigned int count);
+                void aggregateDisparity(unsigned int width, unsigned int height, unsigned int window_size, bool reverse);
+                void generateReverseDisparityMap(unsigned int width, unsigned int height, unsigned int window_size,
+                        MatchingCost matching_cost, int max_disparity);
+                void buildValidityMask(unsigned int width, unsigned int height);
+                const uint8_t* getHostLuminance(Image* image, std::vector<uint8_t>& luminance);
+                void enqueueImageKernel(cl::Kernel& kernel, unsigned int width, unsigned int height);
+                void readImage(cl::Image2D& buffer, Image* out_image);
                 void executeImageKernel(cl::Kernel& kernel, cl::Image2D& out_buffer, Image* out_image);
+                size_t getVoxelCount();
+                uint64_t countOccupiedVoxels();
+                size_t getVoxelIndex(int x, int y, int z);
+                bool readVolumeSnapshot(std::string filename, cl::Buffer& staging, int origin[3], Util::Transformation& camera_pose);
 
+                // Programs come from the device, which may be shared with other pipelines, the queue is this pipeline's own
+                ComputeDevice* compute_device = NULL;
+                bool owns_compute_device = false;
                 cl::Device device;
                 cl::Context context;
                 cl::CommandQueue command_queue;
-                cl::Program::Sources sources;
+                KernelVariants* kernel_variants = NULL;
                 cl::Program program;
+                WorkGroupTuner work_group_tuner;
+                std::string work_group_cache_filename = "out/work_groups.cache";
                 cl::Buffer buffer_voxels;
 
+                // Device resident stereo matching images, single channel except for the staging and display images
+                cl::Image2D clImage_frame_rgba;
+                cl::Image2D clImage_left_luminance;
+                cl::Image2D clImage_right_luminance;
+                cl::Image2D clImage_disparity;
+                cl::Image2D clImage_disparity_rgba;
+                cl::Image2D clImage_previous_disparity;
+                cl::Buffer clBuffer_left_census;
+                cl::Buffer clBuffer_right_census;
+
+                // Raw frames are rectified on the device through per pixel remap tables when calibrated
+                bool rectify = false;
+                cl::Image2D clImage_raw_left;
+                cl::Image2D clImage_raw_right;
+                cl::Buffer clBuffer_left_remap;
+                cl::Buffer clBuffer_right_remap;
+
+                // Largest disparity searched, 0 searches the whole row. Aggregated SAD searches disparities
+                // [0, disparity range) a batch at a time, aggregated_range unless set. The packed costs leave
+                // 8 bits for the disparity, so it never searches beyond 256.
+                unsigned int disparity_range = 0;
+                unsigned int aggregated_range = 64;
+                unsigned int disparity_batch_size = 16;
+                cl::Buffer clBuffer_row_sums;
+                cl::Buffer clBuffer_best_costs;
+
+                // Temporally seeded SAD searches band disparities either side of the previous frame's, with
+                // a full search every refresh interval and for pixels whose mean difference exceeds the threshold
+                unsigned int temporal_band = 0;
+                const unsigned int temporal_refresh_interval = 30;
+                const unsigned int temporal_cost_threshold = 16;
+                unsigned int frames_since_refresh = 0;
+
+                // Host census matching
+                CensusMatcher census_matcher;
+                std::vector<uint8_t> host_left_luminance;
+                std::vector<uint8_t> host_right_luminance;
+                std::vector<uint16_t> host_disparity;
+                std::vector<uint16_t> host_reverse_disparity;
+
+                // Bit per pixel of the disparity map that found a match, packed 32 pixels of a row to a word.
+                // With the consistency check the left view is matched against the right as well, and only
+                // pixels whose match finds them again are kept. Every later stage skips the rest.
+                bool consistency_check = false;
+                unsigned int validity_words_per_row = 0;
+                cl::Image2D clImage_reverse_disparity;
+                cl::Buffer clBuffer_validity;
+                std::vector<uint32_t> host_validity;
+
+                // Depth map quantised to CPU voxel values by tempSetVoxels
+                std::vector<uint8_t> host_quantized_depth;
+
+                // Per pixel matches, packed into (pixel index, source, destination, normal) tuples of
+                // 10 words with their count, and the point-to-plane residual of each
                 cl::Buffer clBuffer_correspondences;
+                cl::Buffer clBuffer_packed_correspondences;
+                cl::Buffer clBuffer_correspondence_count;
+                cl::Buffer clBuffer_residuals;
+                const size_t correspondence_size_in_bytes = 10 * sizeof(float);
+                unsigned int compaction_group_size = 256;
+                std::vector<float> host_residuals;
+
+                // Residuals of the last frame beyond the outlier factor times the RMS are counted as outliers
+                const double outlier_factor = 3.0;
+                TrackingStatistics tracking_statistics;
+
+                // Traffic is counted where it is enqueued, occupancy is kept alongside the host volume
+                FrameStatistics frame_statistics;
+
+                // Rays are cast into the samples, then upsampled into the render
+                cl::Image2D clImage_render;
+                cl::Buffer clBuffer_render_samples;
 
                 Volume volume;
+                BrickStore brick_store;
+                std::string brick_store_filename = "out/volume.bricks";
+                bool brick_store_opened = false;
                 Image* prev_vertex_map;
                 Image* prev_normal_map;
 };
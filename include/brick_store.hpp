@@ -0,0 +1,68 @@
+#ifndef BRICK_STORE_HPP
+#define BRICK_STORE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+// Out-of-core storage for cubic bricks of voxels that have left the active volume, keyed by their
+// world brick coordinates. Bricks are run-length encoded and appended to a single scratch file by a
+// background thread; the newest record for a brick wins.
+class BrickStore
+{
+        public:
+                BrickStore();
+                ~BrickStore();
+                bool open(std::string filename, unsigned int brick_width);
+                void close();
+                bool isOpen();
+                void store(int brick_x, int brick_y, int brick_z, const int* voxels);
+                bool load(int brick_x, int brick_y, int brick_z, int* voxels);
+                void flush();
+
+        private:
+                typedef std::tuple<int, int, int> Key;
+
+                struct Record
+                {
+                        int32_t brick_x;
+                        int32_t brick_y;
+                        int32_t brick_z;
+                        uint32_t brick_width;
+                        uint64_t encoded_size_in_bytes;
+                };
+
+                struct Pending
+                {
+                        uint64_t generation;
+                        std::vector<int> voxels;
+                };
+
+                void writeLoop();
+
+                int m_file_descriptor = -1;
+                unsigned int m_brick_width = 0;
+                size_t m_brick_voxel_count = 0;
+                uint64_t m_end_offset = 0;
+                uint64_t m_generation = 0;
+
+                std::map<Key, uint64_t> m_index;
+                std::map<Key, Pending> m_pending;
+                std::deque<Key> m_queue;
+                std::set<Key> m_queued;
+                std::mutex m_mutex;
+                std::condition_variable m_queue_condition;
+                std::condition_variable m_idle_condition;
+                std::thread m_writer;
+                bool m_writing = false;
+                bool m_stopping = false;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef CENSUS_MATCHER_HPP
+#define CENSUS_MATCHER_HPP
+
+#include <cstdint>
+#include <vector>
+
+// Host implementation of census transform stereo matching, mirroring the census and
+// disparityCensus kernels. Each pixel is described by a 64-bit mask of which neighbours in a
+// 9x7 window are darker than it, and candidates are compared by the Hamming distance between
+// masks, which is insensitive to exposure differences between the cameras.
+class CensusMatcher
+{
+        public:
+                static const int WINDOW_WIDTH = 9;
+                static const int WINDOW_HEIGHT = 7;
+
+                CensusMatcher();
+                void match(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+                        unsigned int max_disparity, uint16_t* disparity);
+                static void transform(const uint8_t* luminance, unsigned int width, unsigned int height, uint64_t* descriptors);
+                static bool hasHardwarePopcount();
+
+        private:
+                void matchRows(unsigned int first_row, unsigned int row_count, uint16_t* disparity);
+
+                std::vector<uint64_t> m_left_descriptors;
+                std::vector<uint64_t> m_right_descriptors;
+                unsigned int m_width = 0;
+                unsigned int m_height = 0;
+                unsigned int m_max_disparity = 0;
+                unsigned int m_thread_count = 1;
+                bool m_hardware_popcount = false;
+};
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef COMPUTE_DEVICE_HPP
+#define COMPUTE_DEVICE_HPP
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+#include "kernel_variants.hpp"
+
+// An OpenCL device with its context and every kernel variant built for it. Pipelines sharing a
+// device share its programs, so each variant is compiled once, while each pipeline keeps its own
+// command queue and memory. The device's global memory is budgeted evenly between its pipelines,
+// and host memory evenly between the pipelines of every device in the process.
+class ComputeDevice
+{
+        public:
+                ComputeDevice(const cl::Device& device);
+                static cl::Device getDefaultDevice();
+                static std::vector<cl::Device> getDevices();
+                const cl::Device& getDevice();
+                const cl::Context& getContext();
+                KernelVariants& getKernelVariants();
+                std::string getName();
+                void setPipelineCount(unsigned int pipeline_count);
+                unsigned int getPipelineCount();
+                void setHostPipelineCount(unsigned int host_pipeline_count);
+                unsigned int getHostPipelineCount();
+
+        private:
+                static cl::Platform getPlatform();
+                static std::string loadSource(std::string filename);
+
+                cl::Device m_device;
+                cl::Context m_context;
+                KernelVariants m_kernel_variants;
+                unsigned int m_pipeline_count = 1;
+                unsigned int m_host_pipeline_count = 1;
+};
+
+#endif
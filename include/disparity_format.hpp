@@ -0,0 +1,18 @@
+#ifndef DISPARITY_FORMAT_HPP
+#define DISPARITY_FORMAT_HPP
+
+#include <cstdint>
+
+// Disparity maps are 16-bit 12.4 fixed point, as DISPARITY_FRACTION_BITS in the kernels, with 0
+// meaning no match. Host matchers and the kernel references share the sub-pixel refinement here.
+namespace Disparity
+{
+        const unsigned int FRACTION_BITS = 4;
+
+        // Fixed point disparity of the match at window_x moved to the vertex of the parabola through
+        // the costs either side of it, as subPixelDisparity in the kernels. A negative cost marks a side
+        // outside the search, and disparities too large for the map are stored as 0.
+        uint16_t subPixel(int window_x, int x, int cost_before, int cost, int cost_after);
+};
+
+#endif
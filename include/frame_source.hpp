@@ -0,0 +1,18 @@
+#ifndef FRAME_SOURCE_HPP
+#define FRAME_SOURCE_HPP
+
+#include "graphics_factory.hpp"
+#include "image.hpp"
+
+// Abstract base class for sources of rectified stereo footage
+class FrameSource
+{
+        public:
+                virtual ~FrameSource();
+                virtual Image* createFrameImage(GraphicsFactory* graphics_factory) = 0;
+                virtual bool loadFrame(unsigned int frame_index, Image* left, Image* right) = 0;
+                virtual unsigned int getFrameCount();
+                virtual void stop();
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef FRAME_SOURCE_PNG_HPP
+#define FRAME_SOURCE_PNG_HPP
+
+#include <string>
+
+#include "frame_source.hpp"
+
+// Concrete implementation of FrameSource, reads numbered l_NNNN.png/r_NNNN.png pairs
+class FrameSourcePng : public FrameSource
+{
+        public:
+                FrameSourcePng(std::string footage_directory);
+                virtual Image* createFrameImage(GraphicsFactory* graphics_factory);
+                virtual bool loadFrame(unsigned int frame_index, Image* left, Image* right);
+                virtual unsigned int getFrameCount();
+                static std::string getFilename(std::string footage_directory, std::string side, unsigned int frame_index);
+
+        private:
+                std::string m_footage_directory;
+};
+
+#endif
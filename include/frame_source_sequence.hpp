@@ -0,0 +1,25 @@
+#ifndef FRAME_SOURCE_SEQUENCE_HPP
+#define FRAME_SOURCE_SEQUENCE_HPP
+
+#include <string>
+
+#include "frame_source.hpp"
+#include "sequence_file.hpp"
+
+// Concrete implementation of FrameSource, hands out frames of a packed sequence file without copying
+class FrameSourceSequence : public FrameSource
+{
+        public:
+                FrameSourceSequence(std::string filename);
+                bool isOpen();
+                Util::CameraConfig getCameraConfig();
+                virtual Image* createFrameImage(GraphicsFactory* graphics_factory);
+                virtual bool loadFrame(unsigned int frame_index, Image* left, Image* right);
+                virtual unsigned int getFrameCount();
+
+        private:
+                SequenceReader m_reader;
+                bool m_open = false;
+};
+
+#endif
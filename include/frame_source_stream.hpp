@@ -0,0 +1,65 @@
+#ifndef FRAME_SOURCE_STREAM_HPP
+#define FRAME_SOURCE_STREAM_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "frame_source.hpp"
+#include "stream_protocol.hpp"
+
+// Concrete implementation of FrameSource, receives frames from a pipe or socket (see Stream).
+// A reader thread fills a small ring of frame slots ahead of the pipeline. Once every slot is
+// full it stops reading, so the sender is held back by the pipe or socket instead of frames
+// piling up in memory. Frames are handed over by pointing the images at a slot, without copying.
+class FrameSourceStream : public FrameSource
+{
+        public:
+                FrameSourceStream(std::string address);
+                ~FrameSourceStream();
+                bool isOpen();
+                Util::CameraConfig getCameraConfig();
+                virtual Image* createFrameImage(GraphicsFactory* graphics_factory);
+                virtual bool loadFrame(unsigned int frame_index, Image* left, Image* right);
+                virtual void stop();
+
+        private:
+                struct Slot
+                {
+                        std::vector<uint32_t> left;
+                        std::vector<uint32_t> right;
+                        unsigned int frame_index;
+                };
+
+                void readLoop();
+                bool readFrame(Slot& slot);
+                bool readPayload(size_t size_in_bytes, std::vector<uint32_t>& pixels);
+                bool decodePng(std::vector<uint32_t>& pixels);
+
+                static const unsigned int SLOT_COUNT = 4;
+
+                int m_fd = -1;
+                bool m_open = false;
+                Stream::Header m_header;
+                size_t m_frame_size_in_bytes = 0;
+                size_t m_max_encoded_size_in_bytes = 0;
+                std::vector<uint8_t> m_encoded;
+
+                // Slots move from free, to filled by the reader thread, to current while the pipeline uses them
+                std::vector<Slot> m_slots;
+                std::deque<unsigned int> m_free_slots;
+                std::deque<unsigned int> m_filled_slots;
+                int m_current_slot = -1;
+                bool m_finished = false;
+                std::atomic<bool> m_stopping{false};
+                std::mutex m_mutex;
+                std::condition_variable m_slot_freed;
+                std::condition_variable m_slot_filled;
+                std::thread m_reader;
+};
+
+#endif
@@ -11,6 +11,7 @@ class GraphicsFactory
                 virtual WindowManager* createWindowManager() = 0;
                 virtual Image* createImage(unsigned int width, unsigned int height, unsigned int words_per_pixel) = 0;
                 virtual Image* createImageMemory(unsigned int width, unsigned int height, unsigned int words_per_pixel);
+                virtual Image* createImageMapped(unsigned int width, unsigned int height, unsigned int words_per_pixel);
 
         protected:
                 std::vector<WindowManager*> window_managers;
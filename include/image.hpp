@@ -14,6 +14,7 @@ class Image
                 virtual unsigned int getWidth();
                 virtual unsigned int getHeight();
                 virtual unsigned int getWordsPerPixel();
+                virtual unsigned int getBytesPerPixel();
                 virtual uint32_t* getPixels() = 0;
                 virtual void load(std::string filename) = 0;
                 virtual void save(std::string prefix) = 0;
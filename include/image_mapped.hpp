@@ -0,0 +1,24 @@
+#ifndef IMAGE_MAPPED_HPP
+#define IMAGE_MAPPED_HPP
+
+#include "image.hpp"
+
+// Concrete implementation of Image the class, for pixel data owned elsewhere (e.g. a memory mapped file)
+class ImageMapped : public Image
+{
+        public:
+                ImageMapped(unsigned int width, unsigned int height, unsigned int words_per_pixel);
+                virtual uint32_t* getPixels();
+                virtual unsigned int getBytesPerPixel();
+                void setBytesPerPixel(unsigned int bytes_per_pixel);
+                void map(uint32_t* pixels);
+                virtual void load(std::string filename);
+                virtual void save(std::string prefix);
+                virtual void fill(unsigned int colour);
+
+        private:
+                uint32_t* m_data = NULL;
+                unsigned int m_bytes_per_pixel = 0;
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef IMAGE_OPS_HPP
+#define IMAGE_OPS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Host pixel operations shared by the Image classes, the frame sources and the CPU volume. Each
+// has an AVX2 and an SSE2 variant, picked once for the processor running, and large images are
+// split into bands of rows across threads. Every variant gives exactly the results of the scalar
+// code it replaced, float rounding included, so host paths still match the kernels.
+class ImageOps
+{
+        public:
+                // Packed 32-bit formats are named as SDL names them, most significant byte first, so ABGR is
+                // R, G, B, A in memory (the RGBA8 of the device images and sequences) and ARGB is the layout
+                // of ImageSdl surfaces. R8 is one byte of luminance per pixel.
+                enum class Format
+                {
+                        ABGR,
+                        ARGB,
+                        R8
+                };
+
+                static void fill(uint32_t* words, size_t count, uint32_t value);
+                static void convert(const void* source, Format source_format, void* destination, Format destination_format, size_t count);
+                static void grayscale(uint32_t* pixels, Format format, size_t count);
+                static void quantizeDepth(const uint32_t* depth, size_t count, uint8_t* quantized);
+                static std::string getInstructionSet();
+};
+
+#endif
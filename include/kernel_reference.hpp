@@ -0,0 +1,75 @@
+#ifndef KERNEL_REFERENCE_HPP
+#define KERNEL_REFERENCE_HPP
+
+#include <cstdint>
+
+#include "disparity_format.hpp"
+
+// Straightforward scalar versions of the kernels in reconstruction.cl, one pixel at a time with no
+// tricks, for checking the kernels and any optimised host paths against. Images are row-major
+// arrays of width * height pixels and reads outside them give 0, as the clamping sampler does.
+// Vertices are 3 floats per pixel, correspondences 4 (w is 1 for a match) and render samples 2
+// (shade, depth). Validity masks are a bit per pixel, rows packed into words of 32 pixels.
+class KernelReference
+{
+        public:
+                // Packed correspondence, laid out as the Correspondence struct of the kernels
+                struct Correspondence
+                {
+                        float source[3];
+                        float destination[3];
+                        float normal[3];
+                        uint32_t pixel_index;
+                };
+
+                // Matches REMAP_FRACTION_BITS and CONSISTENCY_TOLERANCE of the kernels and MISS_DEPTH of the
+                // render kernel. Disparities are 12.4 fixed point (see disparity_format.hpp).
+                static const unsigned int REMAP_FRACTION_BITS = 4;
+                static const int CONSISTENCY_TOLERANCE = 1 << Disparity::FRACTION_BITS;
+                static constexpr float MISS_DEPTH = 1e30f;
+
+                static void luminance(const uint8_t* rgba, unsigned int width, unsigned int height, uint8_t* luminance);
+                static void rectify(const uint8_t* raw, unsigned int bytes_per_pixel, const uint32_t* remap,
+                        unsigned int width, unsigned int height, uint8_t* luminance);
+                static void expandLuminance(const uint8_t* luminance, unsigned int width, unsigned int height, uint8_t* rgba);
+                static void expandDisparity(const uint16_t* disparity, unsigned int width, unsigned int height, uint8_t* rgba);
+                static void disparity(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+                        int window_size, int max_disparity, uint16_t* disparity);
+                static void disparityTemporal(const uint16_t* previous_disparity, const uint8_t* left, const uint8_t* right,
+                        unsigned int width, unsigned int height, int window_size, int band, unsigned int cost_threshold,
+                        float warp_x, float warp_y, int max_disparity, uint16_t* disparity);
+                static void disparityAggregated(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+                        int window_size, unsigned int disparity_count, uint16_t* disparity);
+                static void census(const uint8_t* luminance, unsigned int width, unsigned int height, uint64_t* descriptors);
+                static void disparityCensus(const uint64_t* left, const uint64_t* right, unsigned int width, unsigned int height,
+                        int max_disparity, uint16_t* disparity);
+                static void validityMask(const uint16_t* disparity, const uint16_t* reverse_disparity, unsigned int width,
+                        unsigned int height, bool check_consistency, uint32_t* validity);
+                static void disparityToDepth(const uint16_t* disparity, const uint32_t* validity, unsigned int width, unsigned int height,
+                        int focal_length, int baseline_mm, uint32_t* depth);
+                static void generateVertexMap(const uint32_t* depth, const uint32_t* validity, unsigned int width, unsigned int height, int focal_length,
+                        int scale_x, int scale_y, int skew_coeff, float principal_point_x, float principal_point_y, float* vertices);
+                static void generateNormalMap(const float* vertices, const uint32_t* validity, unsigned int width, unsigned int height, uint32_t* normals);
+                static void findCorrespondences(const uint32_t* validity, const float* prev_vertices, const uint32_t* prev_normals,
+                        const float* vertices, const uint32_t* normals, unsigned int width, unsigned int height,
+                        const float translation[3], const float rotation[9], float focal_length,
+                        float principal_point_x, float principal_point_y, float* correspondences);
+                static unsigned int compactCorrespondences(const float* correspondences, const float* prev_vertices,
+                        const uint32_t* prev_normals, unsigned int width, unsigned int height, Correspondence* compact);
+                static void pointToPlaneResiduals(const Correspondence* correspondences, unsigned int count, float* residuals);
+                static void render(const int* voxels, const int dimensions[3], float voxel_size, const int origin[3],
+                        int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, int render_scale,
+                        int screen_width, int screen_height, float* samples);
+                static void upsampleRender(const float* samples, int render_scale, int samples_width, int samples_height,
+                        float voxel_size, unsigned int width, unsigned int height, uint8_t* screen);
+
+                // Packed formats shared with the device
+                static unsigned int getValidityWordsPerRow(unsigned int width);
+                static bool isValid(const uint32_t* validity, unsigned int width, unsigned int height, int x, int y);
+                static uint32_t encodeNormal(const float normal[3]);
+                static void decodeNormal(uint32_t code, float normal[3]);
+                static uint16_t floatToHalf(float value);
+                static float halfToFloat(uint16_t half);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef KERNEL_VARIANTS_HPP
+#define KERNEL_VARIANTS_HPP
+
+#include <CL/cl.hpp>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Builds the kernel source once per set of build options and keeps every program built. Kernels
+// specialised with -D constants for the active configuration (window size, disparity range,
+// volume dimensions) have their loops unrolled and folded by the compiler, with no options the
+// values are taken from the kernel arguments. Programs may be requested from several threads, each
+// variant is still only built once.
+class KernelVariants
+{
+        public:
+                void initialise(const cl::Context& context, const cl::Device& device, std::string source);
+                cl::Program& getProgram(std::string options);
+                static std::string define(std::string name, int value);
+
+        private:
+                cl::Context m_context;
+                cl::Device m_device;
+                std::string m_source;
+                std::map<std::string, cl::Program> m_programs;
+                std::mutex m_mutex;
+};
+
+#endif
@@ -1,59 +1,142 @@
 #ifndef MANAGER_HPP
 #define MANAGER_HPP
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include "algorithm.hpp"
+#include "compute_device.hpp"
+#include "frame_source.hpp"
 #include "graphics_factory.hpp"
 #include "image.hpp"
+#include "real_time_scheduler.hpp"
+#include "stereo_calibration.hpp"
+#include "telemetry.hpp"
+#include "triple_buffer.hpp"
 #include "window_manager.hpp"
 #include "util.hpp"
 
 class Manager
 {
         public:
-                Manager(GraphicsFactory* graphics_factory, std::string footage_directory, Util::CameraConfig& camera_config);
+                // Time spent on the frames reconstructed so far, in total and in each stage
+                struct Timings
+                {
+                        unsigned int frame_count = 0;
+                        double total_ms = 0;
+                        double stage_ms[Telemetry::STAGE_COUNT] = {};
+                };
+
+                Manager(GraphicsFactory* graphics_factory, FrameSource* frame_source, Util::CameraConfig& camera_config,
+                        const Util::VolumeConfig& volume_config, ComputeDevice* compute_device = NULL);
                 ~Manager();
+                bool isValid();
+                void setMatchingCost(Algorithm::MatchingCost matching_cost, unsigned int window_size);
+                bool setAggregation(unsigned int range, unsigned int batch_size);
+                void setRectification(const StereoCalibration& calibration);
+                void setTemporalSeeding(unsigned int band);
+                void setConsistencyCheck(bool enabled);
+                void setRenderScale(unsigned int render_scale);
+                void setRealTime(double frames_per_second);
+                bool setTelemetry(std::string destination);
+                void setOutputDirectory(std::string directory);
+                void setFrameRange(unsigned int first_frame, unsigned int frame_count);
+                const Timings& getTimings();
+                const std::vector<Util::Transformation>& getCameraPoses();
                 void start();
+                void process();
+                void extractMesh();
 
         private:
+                void reconstruct();
+                void reconstructFrame(bool render);
+                void handleRequests();
+                void runStage(std::string stage, void (Manager::*function)());
+                void applyQuality();
+                void recordTelemetry(double frame_ms);
                 void computeDisparity();
                 void disparityToDepth();
                 void trackCamera();
                 void fuseIntoVolume();
                 void renderVolume();
                 void refreshWindow();
+                void saveSnapshot();
+                void loadSnapshot();
 
                 bool loadNextFrame();
                 void getInput();
 
                 Algorithm m_algorithm;
 
+                // Left false when the first frame could not be loaded or the pipeline does not fit in memory
+                bool m_valid = false;
+
+                // Raw frames when rectifying on the device
                 Image* m_left_rectified = NULL;
                 Image* m_right_rectified = NULL;
                 Image* m_disparity_map = NULL;
                 Image* m_depth_map = NULL;
                 Image* m_vertex_map = NULL;
                 Image* m_normal_map = NULL;
-                Image* m_render = NULL;
+                Image* m_renders[3] = { NULL, NULL, NULL };
                 Image* m_output = NULL;
 
+                // Rendered frames are handed from the reconstruction thread to the display thread
+                TripleBuffer m_render_buffer;
+                std::thread m_reconstruction_thread;
+                const unsigned int m_display_period_ms = 16;
+
                 WindowManager* m_window_manager = NULL;
-                bool m_volume_allocated = false;
-                int* m_voxels = NULL;
+                Window* m_window = NULL;
                 bool m_more_frames = true;
                 unsigned int m_frame_index = 0;
-                unsigned int m_volume_size;
 
-                std::string m_footage_directory;
+                // Frames past the end of the range are not loaded, 0 runs to the end of the footage
+                unsigned int m_end_frame = 0;
+                Algorithm::MatchingCost m_matching_cost = Algorithm::MatchingCost::SAD;
+                unsigned int m_window_size = 9;
+                unsigned int m_render_scale = 1;
+
+                // View of the last render, a moving view is rendered at 1/2 or 1/4 resolution and refined
+                // to full resolution once idle, an idle view of an unchanged volume is not rendered at all
+                int m_rendered_degrees = 0;
+                float m_rendered_cam_distance = 0;
+                unsigned int m_rendered_scale = 0;
+                bool m_volume_changed = true;
+                unsigned int m_moving_render_scale = 2;
+                const unsigned int m_min_moving_render_scale = 2;
+                const unsigned int m_max_moving_render_scale = 4;
+
+                // Only set in real-time mode
+                RealTimeScheduler* m_scheduler = NULL;
+
+                // Only set when exporting telemetry, stage timings are gathered into the record of the current frame
+                Telemetry* m_telemetry = NULL;
+                Telemetry::Record m_telemetry_record = Telemetry::Record();
+                Timings m_timings;
+
+                GraphicsFactory* m_graphics_factory = NULL;
+                FrameSource* m_frame_source = NULL;
                 Util::CameraConfig m_camera_config;
+                Util::Transformation m_camera_pose = Util::Transformation();
+                std::vector<Util::Transformation> m_camera_poses;
+                Util::Vector3D m_previous_camera_position = Util::Vector3D();
+                Util::Vector3D m_camera_motion = Util::Vector3D();
+                std::string m_snapshot_filename = "out/volume.snapshot";
+                std::string m_mesh_filename = "out/mesh.ply";
 
-                // Keyboard input
-                bool m_done = false;
+                // Keyboard input, the view and requests are read by the reconstruction thread
+                std::atomic<bool> m_done{false};
                 bool m_left = false;
                 bool m_up = false;
                 bool m_right = false;
                 bool m_down = false;
-                int m_degrees = 0;
-                float m_cam_distance = 240;
+                std::atomic<int> m_degrees{0};
+                std::atomic<float> m_cam_distance{240};
+                std::atomic<bool> m_save_requested{false};
+                std::atomic<bool> m_load_requested{false};
+                std::atomic<bool> m_mesh_requested{false};
 };
 
 #endif
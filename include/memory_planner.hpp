@@ -0,0 +1,37 @@
+#ifndef MEMORY_PLANNER_HPP
+#define MEMORY_PLANNER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Tallies the host and device memory a configuration needs before anything is allocated, and
+// checks it against the device's global memory, its largest single allocation and host RAM
+class MemoryPlanner
+{
+        public:
+                MemoryPlanner(uint64_t device_global_bytes, uint64_t device_max_allocation_bytes, uint64_t host_bytes);
+                void addHost(std::string name, uint64_t size_in_bytes);
+                void addDevice(std::string name, uint64_t size_in_bytes);
+                bool fits(std::string* reason);
+                uint64_t getHostBytes();
+                uint64_t getDeviceBytes();
+                void print();
+
+                static uint64_t getPhysicalHostBytes();
+
+        private:
+                struct Allocation
+                {
+                        std::string name;
+                        uint64_t size_in_bytes;
+                        bool device;
+                };
+
+                std::vector<Allocation> m_allocations;
+                uint64_t m_device_global_bytes;
+                uint64_t m_device_max_allocation_bytes;
+                uint64_t m_host_bytes;
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef MESH_EXTRACTOR_HPP
+#define MESH_EXTRACTOR_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Extracts a triangle mesh from the voxel volume with marching cubes and streams it out as binary PLY.
+// The volume is read as a cyclic buffer starting at the given world origin (see Volume).
+// Runs as three multithreaded passes over z slices:
+//   1. Classification, counting the vertices and triangles each slice produces
+//   2. A prefix sum of those counts, giving every slice its vertex and triangle offsets
+//   3. Generation, emitting one vertex per crossed voxel edge (so vertices are welded by edge ID)
+//      and the triangles that index them, written to disk a batch of slices at a time
+class MeshExtractor
+{
+        public:
+                MeshExtractor();
+                bool extract(const int* voxels, const int dimensions[3], float voxel_size, const int origin[3], std::string filename);
+                unsigned int getVertexCount();
+                unsigned int getTriangleCount();
+
+        private:
+                struct CaseTable
+                {
+                        // Edges are numbered by axis * 4 + the index of their lower corner among the 4 with that axis bit clear
+                        unsigned int edge_corner[12];
+                        unsigned int edge_axis[12];
+                        int8_t triangles[256][31];
+                        uint8_t triangle_count[256];
+                };
+
+                static const CaseTable& getCaseTable();
+                static void buildCaseTable(CaseTable& table);
+
+                const int* getRow(int y, int z);
+                unsigned int isInside(const int* row, int x);
+                unsigned int getColumn(const int* rows[4], int x);
+                unsigned int countSliceVertices(int z);
+                unsigned int countSliceTriangles(int z);
+                void buildVertexIndices(int z, uint32_t first_vertex, std::vector<uint32_t>& vertex_indices);
+                void generateSliceVertices(int z, std::vector<char>& output);
+                void generateSliceTriangles(int z, std::vector<uint32_t>& indices, std::vector<uint32_t>& next_indices, std::vector<char>& output);
+                void parallelFor(int begin, int end, std::function<void(int, unsigned int)> function);
+                bool streamSlices(std::function<void(int, unsigned int, std::vector<char>&)> generate);
+
+                const int* m_voxels = NULL;
+                int m_dimensions[3];
+                float m_voxel_size = 1.0f;
+                int m_grid_width = 0;
+                int m_grid_height = 0;
+                int m_origin[3];
+                int m_origin_slot[3];
+                unsigned int m_thread_count = 1;
+                std::ofstream m_stream;
+                std::vector<int> m_empty_row;
+                std::vector<uint32_t> m_slice_vertex_offsets;
+                std::vector<uint32_t> m_slice_triangle_offsets;
+                std::vector<std::vector<uint32_t> > m_thread_indices;
+                std::vector<std::vector<uint32_t> > m_thread_next_indices;
+};
+
+#endif
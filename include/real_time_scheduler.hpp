@@ -0,0 +1,76 @@
+#ifndef REAL_TIME_SCHEDULER_HPP
+#define REAL_TIME_SCHEDULER_HPP
+
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Keeps a live rate stream within its frame deadline. Frames are taken as they would arrive from a
+// live source, so frames that went stale while the pipeline was busy are dropped rather than
+// queued, and per stage timings decide which quality knob to lower when the pipeline falls behind
+// and restore once it has headroom again. Every change is reported on stdout.
+class RealTimeScheduler
+{
+        public:
+                struct Quality
+                {
+                        // 0 searches the whole row
+                        unsigned int disparity_range;
+                        unsigned int window_size;
+                        unsigned int render_scale;
+                };
+
+                enum class Knob
+                {
+                        DISPARITY_RANGE,
+                        WINDOW_SIZE,
+                        RENDER_SCALE
+                };
+
+                RealTimeScheduler(double frames_per_second, const Quality& full_quality);
+                void holdKnob(Knob knob);
+                std::vector<Quality> getDisparityLadder();
+                void start();
+                unsigned int selectFrame(unsigned int next_index);
+                void beginFrame();
+                void beginStage(std::string stage);
+                void endStage(std::string stage);
+                bool endFrame();
+                const Quality& getQuality();
+                unsigned int getDroppedFrames();
+                double getAverageFrameMs();
+
+        private:
+                struct Change
+                {
+                        Knob knob;
+                        unsigned int previous_value;
+                };
+
+                bool lower(const std::string& stage);
+                bool lowerKnob(Knob knob);
+                unsigned int getLowered(Knob knob, unsigned int value);
+                void raise();
+                unsigned int& getValue(Knob knob);
+                std::string getName(Knob knob);
+                double getAverageStageMs(const std::string& stage);
+                double getElapsedMs(std::chrono::steady_clock::time_point since);
+
+                double m_frame_period_ms;
+                Quality m_quality;
+                std::set<Knob> m_held_knobs;
+                std::vector<Change> m_changes;
+
+                std::chrono::steady_clock::time_point m_start;
+                std::chrono::steady_clock::time_point m_frame_start;
+                std::map<std::string, std::chrono::steady_clock::time_point> m_stage_starts;
+                std::map<std::string, double> m_stage_average_ms;
+                double m_average_frame_ms = 0;
+                unsigned int m_frames_over = 0;
+                unsigned int m_frames_under = 0;
+                unsigned int m_dropped_frames = 0;
+};
+
+#endif
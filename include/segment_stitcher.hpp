@@ -0,0 +1,70 @@
+#ifndef SEGMENT_STITCHER_HPP
+#define SEGMENT_STITCHER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// Joins the volumes of a sequence reconstructed as overlapping segments, each tracked from the
+// identity pose at its own first frame so segments can run side by side. Neighbouring segments
+// share their overlap frames, and the offset between them is the mean over those frames of the
+// camera pose in the earlier segment composed with the inverse of its pose in the later one.
+// Offsets are chained from the first segment, whose frame becomes the global one, then every
+// segment volume is resampled into a global volume covering them all. Voxels seen by several
+// segments keep the mean of their occupied values.
+class SegmentStitcher
+{
+        public:
+                struct Segment
+                {
+                        unsigned int first_frame;
+                        unsigned int frame_count;
+                        std::vector<Util::Transformation> camera_poses;
+                        std::string snapshot_filename;
+                };
+
+                SegmentStitcher();
+                static std::vector<Segment> split(unsigned int frame_count, unsigned int segment_length, unsigned int overlap);
+                bool stitch(const std::vector<Segment>& segments, std::string snapshot_filename, std::string mesh_filename);
+
+        private:
+                // Rigid transform of points p to R p + t, R row-major
+                struct Pose
+                {
+                        double rotation[9];
+                        double translation[3];
+                };
+
+                struct SegmentVolume
+                {
+                        std::vector<int> voxels;
+                        int dimensions[3];
+                        int origin[3];
+                        float voxel_size;
+                };
+
+                static Pose toPose(const Util::Transformation& transformation);
+                static Util::Transformation toTransformation(const Pose& pose);
+                static Pose compose(const Pose& a, const Pose& b);
+                static Pose invert(const Pose& pose);
+                static void apply(const Pose& pose, const double point[3], double transformed[3]);
+                static Pose align(const Segment& earlier, const Segment& later);
+                static bool loadVolume(std::string filename, bool header_only, SegmentVolume& volume);
+
+                void findBounds(const SegmentVolume& volume, const Pose& offset, int minimum[3], int maximum[3]);
+                void mergeVolume(const SegmentVolume& volume, const Pose& offset);
+                void parallelFor(int begin, int end, std::function<void(int)> function);
+
+                // Global volume, a cyclic buffer like the pipeline's with the voxel size of the first segment
+                std::vector<int> m_voxels;
+                std::vector<uint8_t> m_weights;
+                int m_dimensions[3];
+                int m_origin[3];
+                float m_voxel_size = 1.0f;
+                unsigned int m_thread_count = 1;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SEQUENCE_FILE_HPP
+#define SEQUENCE_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// Packed stereo sequence container. Layout on disk:
+//   SequenceHeader | frame data (each eye aligned to SEQUENCE_ALIGNMENT) | SequenceFrameEntry[frame_count]
+// The header is rewritten once the index has been appended, so a file with a frame_count of zero
+// was not finalised.
+namespace Sequence
+{
+        const char MAGIC[4] = { 'S', 'R', 'S', 'Q' };
+        const uint32_t VERSION = 1;
+        const uint64_t ALIGNMENT = 64;
+
+        enum PixelFormat : uint32_t {
+                RGBA8 = 0,
+                LUMA8 = 1
+        };
+
+        enum Compression : uint32_t {
+                NONE = 0
+        };
+
+        struct Header
+        {
+                char magic[4];
+                uint32_t version;
+                uint32_t width;
+                uint32_t height;
+                uint32_t pixel_format;
+                uint32_t frame_count;
+                uint32_t baseline;
+                uint32_t focal_length;
+                uint32_t principal_point_x;
+                uint32_t principal_point_y;
+                uint32_t scale_x;
+                uint32_t scale_y;
+                uint32_t skew_coeff;
+                uint32_t reserved;
+                uint64_t index_offset;
+        };
+
+        struct FrameEntry
+        {
+                uint64_t left_offset;
+                uint64_t right_offset;
+                uint32_t size_in_bytes;
+                uint32_t compression;
+        };
+
+        unsigned int getBytesPerPixel(uint32_t pixel_format);
+};
+
+// Appends raw stereo frames to a sequence file and writes the frame index on close
+class SequenceWriter
+{
+        public:
+                SequenceWriter();
+                ~SequenceWriter();
+                bool open(std::string filename, unsigned int width, unsigned int height, uint32_t pixel_format, const Util::CameraConfig& camera_config);
+                bool appendFrame(const void* left, const void* right);
+                bool close();
+
+        private:
+                bool writeAligned(const void* data, size_t size_in_bytes, uint64_t* offset);
+
+                std::ofstream m_stream;
+                Sequence::Header m_header;
+                std::vector<Sequence::FrameEntry> m_index;
+};
+
+// Memory maps a sequence file and hands out pointers directly into the mapping
+class SequenceReader
+{
+        public:
+                SequenceReader();
+                ~SequenceReader();
+                bool open(std::string filename);
+                void close();
+                unsigned int getWidth();
+                unsigned int getHeight();
+                unsigned int getFrameCount();
+                uint32_t getPixelFormat();
+                Util::CameraConfig getCameraConfig();
+                uint32_t* getLeftPixels(unsigned int frame_index);
+                uint32_t* getRightPixels(unsigned int frame_index);
+                void prefetch(unsigned int frame_index);
+
+        private:
+                uint8_t* m_mapping = NULL;
+                size_t m_mapping_size = 0;
+                const Sequence::Header* m_header = NULL;
+                const Sequence::FrameEntry* m_index = NULL;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef STEREO_CALIBRATION_HPP
+#define STEREO_CALIBRATION_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// Calibration of a stereo rig, as produced by OpenCV's stereoCalibrate and stereoRectify, read
+// from a text file of whitespace separated values keyed by name:
+//
+//      size <width> <height>
+//      left_intrinsics <fx> <fy> <cx> <cy>
+//      left_distortion <k1> <k2> <p1> <p2> <k3>
+//      left_rotation <r00> <r01> ... <r22>
+//      right_intrinsics, right_distortion, right_rotation likewise
+//      rectified <fx> <fy> <cx> <cy>
+//      baseline <mm>
+//
+// Lines starting with # are ignored. The rotations take each raw camera into the common
+// rectified orientation, and both rectified cameras share the rectified projection.
+class StereoCalibration
+{
+        public:
+                enum Side
+                {
+                        LEFT = 0,
+                        RIGHT = 1
+                };
+
+                // Remap entries pack the 12.4 fixed point source coordinates of a rectified pixel, x in
+                // the low half, so bilinear weights are the fraction bits. Sources outside the raw frame
+                // are marked with INVALID_REMAP.
+                static const unsigned int REMAP_FRACTION_BITS = 4;
+                static const unsigned int MAX_REMAP_WIDTH = (1 << (16 - REMAP_FRACTION_BITS)) - 1;
+                static const uint32_t INVALID_REMAP = 0xFFFFFFFF;
+
+                bool load(std::string filename);
+                void buildRemapTable(Side side, std::vector<uint32_t>& table) const;
+                unsigned int getWidth() const;
+                unsigned int getHeight() const;
+                Util::CameraConfig getCameraConfig() const;
+
+        private:
+                struct Camera
+                {
+                        double intrinsics[4] = { 0, 0, 0, 0 };
+                        double distortion[5] = { 0, 0, 0, 0, 0 };
+                        double rotation[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+                };
+
+                Camera m_cameras[2];
+                double m_rectified[4] = { 0, 0, 0, 0 };
+                double m_baseline = 0;
+                unsigned int m_width = 0;
+                unsigned int m_height = 0;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef STREAM_PROTOCOL_HPP
+#define STREAM_PROTOCOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "util.hpp"
+
+// Live stereo stream format, as sent down a pipe or socket:
+//   Stream::Header | (Stream::FrameHeader | left payload | right payload)...
+// Raw payloads are exactly width * height pixels of the header's pixel format (see Sequence),
+// PNG payloads are whole encoded images of whatever length the frame header gives. The stream
+// ends when the sender closes it.
+//
+// Addresses are "-" for stdin/stdout, "pipe:<path>" for a named pipe, "tcp://<host>:<port>" or
+// "unix:<path>". The sender listens on sockets and the reconstructor connects.
+namespace Stream
+{
+        const char MAGIC[4] = { 'S', 'R', 'S', 'M' };
+        const uint32_t VERSION = 1;
+
+        // Largest frame side accepted, so a corrupt header cannot size the frame slots
+        const uint32_t MAX_FRAME_SIDE = 16384;
+
+        enum Compression : uint32_t {
+                RAW = 0,
+                PNG = 1
+        };
+
+        struct Header
+        {
+                char magic[4];
+                uint32_t version;
+                uint32_t width;
+                uint32_t height;
+                uint32_t pixel_format;
+                uint32_t compression;
+                uint32_t baseline;
+                uint32_t focal_length;
+                uint32_t principal_point_x;
+                uint32_t principal_point_y;
+                uint32_t scale_x;
+                uint32_t scale_y;
+                uint32_t skew_coeff;
+                uint32_t reserved;
+        };
+
+        struct FrameHeader
+        {
+                uint32_t frame_index;
+                uint32_t left_size_in_bytes;
+                uint32_t right_size_in_bytes;
+                uint32_t reserved;
+        };
+
+        bool isAddress(std::string address);
+        int openInput(std::string address);
+        int openOutput(std::string address);
+        bool readFully(int fd, void* data, size_t size_in_bytes, const std::atomic<bool>* cancelled);
+        bool writeFully(int fd, const void* data, size_t size_in_bytes);
+        Util::CameraConfig getCameraConfig(const Header& header);
+};
+
+#endif
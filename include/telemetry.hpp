@@ -0,0 +1,87 @@
+#ifndef TELEMETRY_HPP
+#define TELEMETRY_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records a fixed size summary of every frame into a lock-free single producer, single consumer
+// ring, which an exporter thread drains periodically as JSON lines. The destination is a file,
+// appended to, or unix:<path> to listen on a Unix socket and stream to every monitor connected.
+// The reconstruction thread never blocks on the export, records are dropped (and counted) if the
+// ring is full.
+class Telemetry
+{
+        public:
+                enum Stage
+                {
+                        DISPARITY,
+                        DEPTH,
+                        TRACKING,
+                        FUSION,
+                        RENDER,
+                        STAGE_COUNT
+                };
+
+                struct Record
+                {
+                        uint32_t frame_index;
+                        double timestamp_ms;
+                        double frame_ms;
+                        double stage_ms[STAGE_COUNT];
+                        uint64_t bytes_uploaded;
+                        uint64_t bytes_downloaded;
+                        uint32_t valid_depth_pixels;
+                        uint32_t correspondence_count;
+                        double icp_residual_rms;
+
+                        // Tracking makes a single pass, so always 1 for now. Kept so the records keep one schema
+                        // once tracking iterates to convergence.
+                        uint32_t icp_iterations;
+                        uint64_t occupied_voxels;
+                        double volume_occupancy;
+                        uint32_t dropped_frames;
+                };
+
+                static const size_t CAPACITY = 1024;
+
+                Telemetry();
+                ~Telemetry();
+                bool open(std::string destination);
+                void record(const Record& record);
+                static int findStage(const std::string& name);
+
+        private:
+                bool pop(Record& record);
+                void exportRecords();
+                void flush();
+                void acceptMonitors();
+                void send(const std::string& lines);
+                std::string format(const Record& record);
+
+                // Ring of records, head is only written by the producer and tail by the consumer
+                std::vector<Record> m_records;
+                std::atomic<size_t> m_head{0};
+                std::atomic<size_t> m_tail{0};
+                std::atomic<uint64_t> m_dropped_records{0};
+
+                std::thread m_exporter;
+                std::mutex m_mutex;
+                std::condition_variable m_condition;
+                bool m_stopping = false;
+                const unsigned int m_flush_period_ms = 1000;
+                std::chrono::steady_clock::time_point m_start;
+
+                std::ofstream m_file;
+                std::string m_socket_path;
+                int m_listener = -1;
+                std::vector<int> m_monitors;
+};
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+
+// Lock-free hand over of frames from one producer thread to one consumer thread. The caller owns
+// three buffers and this tracks which is being written, which is being read and which holds the
+// latest finished frame. Neither side ever waits, the producer overwrites frames the consumer
+// never picked up and the consumer keeps its frame until a newer one is published.
+class TripleBuffer
+{
+        public:
+                unsigned int getWriteIndex();
+                void publish();
+                bool acquire();
+                unsigned int getReadIndex();
+
+        private:
+                // The middle buffer's index, with a flag set while it holds a frame not yet acquired
+                static const unsigned int FRESH = 4;
+                static const unsigned int INDEX_MASK = 3;
+
+                std::atomic<unsigned int> m_middle{1};
+                unsigned int m_write_index = 0;
+                unsigned int m_read_index = 2;
+};
+
+#endif
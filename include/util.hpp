@@ -19,6 +19,15 @@ namespace Util
                 unsigned int skew_coeff;
         };
 
+        // Voxel dimensions are taken from the first non-zero of dimensions, extent / voxel_size, or a
+        // cube as wide as the larger image dimension. Lengths are in the units of the camera translation.
+        struct VolumeConfig
+        {
+                unsigned int dimensions[3];
+                float extent[3];
+                float voxel_size;
+        };
+
         struct Vector3D
         {
                 double x;
@@ -32,6 +41,9 @@ namespace Util
                 Vector3D rotation;
         };
 
+        // Row-major matrix of the rotation by rotation.x about the x axis, then y, then z (radians)
+        void getRotationMatrix(const Vector3D& rotation, float matrix[9]);
+
         void startDebugTimer(std::string tag);
         void endDebugTimer(std::string tag);
 };
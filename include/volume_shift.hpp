@@ -0,0 +1,35 @@
+#ifndef VOLUME_SHIFT_HPP
+#define VOLUME_SHIFT_HPP
+
+#include <cstddef>
+
+#include "brick_store.hpp"
+#include "util.hpp"
+
+// Cyclic buffer covering the world voxels [origin, origin + dimensions) on each axis. World voxel
+// (x, y, z) lives in the slot (x, y, z) modulo dimensions, so shifting the region only touches the
+// bricks entering and leaving it.
+struct Volume
+{
+        int* voxels = NULL;
+        int dimensions[3];
+        float voxel_size;
+        int brick_width;
+        int origin[3] = { 0, 0, 0 };
+};
+
+// Moves the volume to follow the camera, in whole bricks, working on the host copy of the voxels.
+// Voxel y and z run opposite to the world axes (as in the render kernel). Bricks leaving the region
+// are streamed to a BrickStore and their slots reused by the bricks entering it, which are reloaded
+// from the store when seen before and empty otherwise.
+namespace VolumeShift
+{
+        // Origin centring the volume on the camera. Returns false while the camera is within a quarter
+        // of the volume of the current origin, so small motion doesn't thrash.
+        bool getOrigin(const Volume& volume, const Util::Transformation& camera_pose, int origin[3]);
+
+        // Moves the volume to the origin and counts the bricks streamed out and those reloaded
+        void shift(Volume& volume, const int origin[3], BrickStore& brick_store, unsigned int& bricks_out, unsigned int& bricks_in);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef VOLUME_SNAPSHOT_HPP
+#define VOLUME_SNAPSHOT_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+
+// Volume checkpoint format. Layout on disk:
+//   Snapshot::Header | (Snapshot::ChunkHeader | encoded voxels)[chunk_count]
+// Each chunk covers a run of whole z slices of the cyclic buffer, whose world origin is in the header.
+// Voxels are run-length encoded as repeated (zero run length, literal count, literal voxels...)
+// groups, so empty space costs 8 bytes a run.
+namespace Snapshot
+{
+        const char MAGIC[4] = { 'S', 'R', 'V', 'S' };
+        const uint32_t VERSION = 3;
+
+        // Target size of the uncompressed voxels in a chunk, bounds the memory used while streaming
+        const uint64_t CHUNK_SIZE_IN_BYTES = 4 * 1024 * 1024;
+
+        struct Header
+        {
+                char magic[4];
+                uint32_t version;
+                uint32_t dimensions[3];
+                float voxel_size;
+                uint32_t bytes_per_voxel;
+                uint32_t chunk_count;
+                int32_t origin[3];
+                double translation[3];
+                double rotation[3];
+        };
+
+        struct ChunkHeader
+        {
+                uint32_t first_slice;
+                uint32_t slice_count;
+                uint64_t encoded_size_in_bytes;
+        };
+
+        unsigned int getSlicesPerChunk(size_t slice_voxel_count);
+        void encode(const int* voxels, size_t voxel_count, std::vector<int>& encoded);
+        bool decode(const std::vector<int>& encoded, int* voxels, size_t voxel_count);
+};
+
+// Streams run-length encoded chunks of a volume to disk
+class SnapshotWriter
+{
+        public:
+                bool open(std::string filename, const int dimensions[3], float voxel_size, const int origin[3], const Util::Transformation& camera_pose);
+                bool writeChunk(unsigned int first_slice, unsigned int slice_count, const int* voxels);
+                bool close();
+
+        private:
+                std::ofstream m_stream;
+                Snapshot::Header m_header;
+                std::vector<int> m_encoded;
+};
+
+// Reads a snapshot back one chunk at a time
+class SnapshotReader
+{
+        public:
+                bool open(std::string filename);
+                void getDimensions(int dimensions[3]);
+                float getVoxelSize();
+                Util::Transformation getCameraPose();
+                void getOrigin(int origin[3]);
+                bool readChunk(unsigned int* first_slice, unsigned int* slice_count, std::vector<int>& voxels);
+                bool isFinished();
+
+        private:
+                std::ifstream m_stream;
+                Snapshot::Header m_header;
+                unsigned int m_chunks_read = 0;
+                std::vector<int> m_encoded;
+};
+
+#endif
@@ -13,10 +13,12 @@ class Window
                 };
 
                 Window(Image* image, const PixelFormat& pixel_format, std::string title);
+                virtual void setImage(Image* image);
                 virtual void refresh() = 0;
 
         protected:
                 Image* m_image = NULL;
+                bool m_image_changed = true;
 };
 
 #endif
@@ -0,0 +1,44 @@
+#ifndef WORK_GROUP_TUNER_HPP
+#define WORK_GROUP_TUNER_HPP
+
+#include <CL/cl.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+// Picks the 2D local work-group size of each image kernel on the active device by timing the
+// candidate shapes over its first launches at each image size, the driver's own choice among
+// them. Global ranges are padded to whole work-groups, so kernels must ignore work items past
+// the image. Tuned sizes are kept in a cache file shared by every device, keyed by device name
+// and driver version, and reused on later runs. Tuners of pipelines running side by side may share
+// the cache, each keeps the others' lines when saving.
+class WorkGroupTuner
+{
+        public:
+                void load(const cl::Device& device, std::string cache_filename);
+                void enqueue(cl::CommandQueue& command_queue, cl::Kernel& kernel, unsigned int width, unsigned int height);
+
+        private:
+                struct Tuning
+                {
+                        std::vector<cl::NDRange> candidates;
+                        std::vector<double> best_ms;
+                        unsigned int trials = 0;
+                        bool tuned = false;
+                        cl::NDRange local = cl::NullRange;
+                };
+
+                void createCandidates(cl::Kernel& kernel, Tuning& tuning);
+                void choose(std::string key, Tuning& tuning);
+                void save();
+                static std::string formatLocal(const cl::NDRange& local);
+
+                cl::Device m_device;
+                std::string m_device_key;
+                std::string m_cache_filename;
+
+                // Keyed by kernel name and image size
+                std::map<std::string, Tuning> m_tunings;
+};
+
+#endif
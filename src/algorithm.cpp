@@ -1,13 +1,29 @@
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdio.h>
 
 #include "algorithm.hpp"
+#include "image_ops.hpp"
+#include "mesh_extractor.hpp"
+#include "volume_snapshot.hpp"
 
-Algorithm::Algorithm()
+// Vertices are half floats in metres, normals octahedral encoded into 32 bits (see readVertex and
+// readNormal in the kernels)
+const cl::ImageFormat Algorithm::VERTEX_FORMAT = cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT);
+const cl::ImageFormat Algorithm::NORMAL_FORMAT = cl::ImageFormat(CL_R, CL_UNSIGNED_INT32);
+
+Algorithm::Algorithm(ComputeDevice* compute_device)
 {
+        // Without a shared device the pipeline has the default device to itself
+        if (compute_device == NULL)
+        {
+                compute_device = new ComputeDevice(ComputeDevice::getDefaultDevice());
+                owns_compute_device = true;
+        }
+        this->compute_device = compute_device;
         initialiseOpenCL();
 }
 
@@ -15,86 +31,436 @@ Algorithm::~Algorithm()
 {
         // ?? Temp: CPU voxel storage
         delete [] volume.voxels;
+
+        if (owns_compute_device)
+        {
+                delete compute_device;
+        }
 }
 
 
-void Algorithm::initialise(GraphicsFactory* graphics_factory, unsigned int image_width, unsigned int image_height)
+MemoryPlanner Algorithm::createMemoryPlanner()
+{
+        // Budgets against this pipeline's share of the device and of the physical memory of the host
+        uint64_t device_global_bytes = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+        device_global_bytes /= compute_device->getPipelineCount();
+        uint64_t device_max_allocation_bytes = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        uint64_t host_bytes = MemoryPlanner::getPhysicalHostBytes() / compute_device->getHostPipelineCount();
+        return MemoryPlanner(device_global_bytes, device_max_allocation_bytes, host_bytes);
+}
+
+bool Algorithm::planMemory(MemoryPlanner& planner, unsigned int image_width, unsigned int image_height, const Util::VolumeConfig& volume_config,
+        Util::VolumeConfig& config)
+{
+        // Resolves the voxel dimensions of each axis
+        config = volume_config;
+        if (config.voxel_size <= 0)
+        {
+                config.voxel_size = 1.0f;
+        }
+        bool automatic = true;
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                if (config.dimensions[axis] != 0)
+                {
+                        automatic = false;
+                }
+                else if (config.extent[axis] > 0)
+                {
+                        // Rounded up to whole bricks so the rolling volume can stream them
+                        unsigned int voxels = std::ceil(config.extent[axis] / config.voxel_size);
+                        config.dimensions[axis] = (voxels + 15) / 16 * 16;
+                        automatic = false;
+                }
+                else
+                {
+                        config.dimensions[axis] = std::max(image_width, image_height);
+                }
+        }
+
+        // Per frame images, sized by the camera resolution
+        uint64_t pixel_count = (uint64_t) image_width * image_height;
+        planner.addDevice("RGBA frame staging", pixel_count * 4);
+        planner.addDevice("Left and right luminance", pixel_count * 2);
+        planner.addDevice("Current and previous disparity maps", pixel_count * 2 * 2);
+        planner.addDevice("Reverse disparity map", pixel_count * 2);
+        uint64_t validity_bytes = (uint64_t) (image_width + 31) / 32 * sizeof(uint32_t) * image_height;
+        planner.addDevice("Validity mask", validity_bytes);
+        planner.addHost("Validity mask", validity_bytes);
+        planner.addDevice("RGBA disparity map", pixel_count * 4);
+        planner.addDevice("Census descriptors", pixel_count * 8 * 2);
+        planner.addDevice("Aggregated SAD row sums", pixel_count * 4 * disparity_batch_size);
+        planner.addDevice("Aggregated SAD best costs", pixel_count * 4);
+        planner.addDevice("Depth maps", pixel_count * 4 * 2);
+        planner.addDevice("Vertex maps", pixel_count * VERTEX_WORDS_PER_PIXEL * 4 * 2);
+        planner.addDevice("Normal maps", pixel_count * NORMAL_WORDS_PER_PIXEL * 4 * 2);
+        planner.addDevice("Previous vertex and normal maps", pixel_count * (VERTEX_WORDS_PER_PIXEL + NORMAL_WORDS_PER_PIXEL) * 4);
+        planner.addDevice("Correspondences", pixel_count * 16);
+        planner.addDevice("Packed correspondences", pixel_count * correspondence_size_in_bytes);
+        planner.addDevice("Point-to-plane residuals", pixel_count * 4);
+        planner.addHost("Point-to-plane residuals", pixel_count * 4);
+        planner.addDevice("Render samples", pixel_count * 8);
+        planner.addHost("Previous vertex and normal maps", pixel_count * (VERTEX_WORDS_PER_PIXEL + NORMAL_WORDS_PER_PIXEL) * 4);
+
+        // The volume is held on both sides, an automatic volume trades resolution for size until it fits
+        while (true)
+        {
+                MemoryPlanner plan = planner;
+                uint64_t volume_bytes = (uint64_t) config.dimensions[0] * config.dimensions[1] * config.dimensions[2] * sizeof(int);
+                plan.addHost("Volume", volume_bytes);
+                plan.addDevice("Volume", volume_bytes);
+
+                std::string reason;
+                if (plan.fits(&reason))
+                {
+                        planner = plan;
+                        break;
+                }
+
+                unsigned int smallest = std::min(config.dimensions[0], std::min(config.dimensions[1], config.dimensions[2]));
+                if (!automatic || smallest <= 16)
+                {
+                        plan.print();
+                        std::cerr << reason << std::endl;
+                        std::cerr << "Volume of " << config.dimensions[0] << "x" << config.dimensions[1] << "x" << config.dimensions[2]
+                                << " voxels does not fit, reduce its dimensions or increase the voxel size" << std::endl;
+                        return false;
+                }
+
+                // Halves the resolution, covering the same extent
+                for (unsigned int axis = 0; axis < 3; axis++)
+                {
+                        config.dimensions[axis] /= 2;
+                }
+                config.voxel_size *= 2;
+                std::cout << reason << ", volume reduced to " << config.dimensions[0] << "x" << config.dimensions[1] << "x"
+                        << config.dimensions[2] << " voxels of size " << config.voxel_size << std::endl;
+        }
+
+        planner.print();
+        return true;
+}
+
+void Algorithm::initialise(GraphicsFactory* graphics_factory, unsigned int image_width, unsigned int image_height, const Util::VolumeConfig& volume_config)
 {
         // ?? Temp: Allocates memory on the CPU
-        unsigned int cube_width = std::max(image_width, image_height);
-        unsigned int voxel_count = cube_width * cube_width * cube_width;
-        volume.voxels = new int[voxel_count];
-        volume.cube_width = cube_width;
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                volume.dimensions[axis] = volume_config.dimensions[axis];
+        }
+        volume.voxel_size = volume_config.voxel_size;
+        size_t voxel_count = getVoxelCount();
+        volume.voxels = new int[voxel_count]();
+        frame_statistics.voxel_count = voxel_count;
+
+        // Bricks streamed out of the rolling volume must tile it exactly
+        volume.brick_width = 16;
+        while (volume.dimensions[0] % volume.brick_width != 0 || volume.dimensions[1] % volume.brick_width != 0 ||
+                volume.dimensions[2] % volume.brick_width != 0)
+        {
+                volume.brick_width /= 2;
+        }
 
         // Allocates a buffer on the GPU for the volume
         buffer_voxels = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(int) * voxel_count);
         command_queue.enqueueWriteBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * voxel_count, volume.voxels);
 
-        prev_normal_map = graphics_factory->createImageMemory(image_width, image_height, 4);
-        prev_vertex_map = graphics_factory->createImageMemory(image_width, image_height, 4);
+        // Allocates the stereo matching images on the GPU, reused every frame
+        clImage_frame_rgba = cl::Image2D(context, CL_MEM_READ_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), image_width, image_height);
+        clImage_left_luminance = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), image_width, image_height);
+        clImage_right_luminance = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), image_width, image_height);
+        clImage_disparity = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), image_width, image_height);
+        clImage_previous_disparity = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), image_width, image_height);
+        clImage_disparity_rgba = cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), image_width, image_height);
+        clImage_reverse_disparity = cl::Image2D(context, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), image_width, image_height);
+
+        // A bit per pixel, each row padded to whole words
+        validity_words_per_row = (image_width + 31) / 32;
+        host_validity.resize((size_t) validity_words_per_row * image_height);
+        clBuffer_validity = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint32_t) * host_validity.size());
+
+        // One 64-bit census descriptor per pixel
+        clBuffer_left_census = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint64_t) * image_width * image_height);
+        clBuffer_right_census = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint64_t) * image_width * image_height);
+
+        // Row sums of one batch of disparities, and the packed cost and disparity of the best match so far
+        std::vector<uint32_t> no_costs(image_width * image_height, 0xFFFFFFFF);
+        clBuffer_row_sums = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint32_t) * image_width * image_height * disparity_batch_size);
+        clBuffer_best_costs = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint32_t) * image_width * image_height);
+        command_queue.enqueueWriteBuffer(clBuffer_best_costs, CL_TRUE, 0, sizeof(uint32_t) * no_costs.size(), no_costs.data());
+
+        // Correspondences are written as a float4 per pixel, then packed with at most one per pixel
+        size_t pixel_count = (size_t) image_width * image_height;
+        clBuffer_correspondences = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * 4 * pixel_count);
+        clBuffer_packed_correspondences = cl::Buffer(context, CL_MEM_READ_WRITE, correspondence_size_in_bytes * pixel_count);
+        clBuffer_correspondence_count = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint32_t));
+        clBuffer_residuals = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * pixel_count);
+
+        // The scan runs in a single power of two work-group of at most 256 items
+        size_t max_group_size = device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+        while (compaction_group_size > max_group_size)
+        {
+                compaction_group_size /= 2;
+        }
+
+        // The render is the size of the frames, with a shade and depth sample per ray
+        clImage_render = cl::Image2D(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), image_width, image_height);
+        clBuffer_render_samples = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(float) * 2 * image_width * image_height);
+
+        prev_normal_map = graphics_factory->createImageMemory(image_width, image_height, NORMAL_WORDS_PER_PIXEL);
+        prev_vertex_map = graphics_factory->createImageMemory(image_width, image_height, VERTEX_WORDS_PER_PIXEL);
 }
 
 void Algorithm::initialiseOpenCL()
 {
-        // Retrieves the OpenCL platform to be used
-        std::vector<cl::Platform> platforms;
-        cl::Platform::get(&platforms);
-        if (platforms.size() == 0)
+        device = compute_device->getDevice();
+        context = compute_device->getContext();
+        kernel_variants = &compute_device->getKernelVariants();
+        program = kernel_variants->getProgram("");
+
+        // Command queue
+        command_queue = cl::CommandQueue(context, device);
+
+        // Reuses the work-group sizes tuned for this device on earlier runs
+        work_group_tuner.load(device, work_group_cache_filename);
+}
+
+void Algorithm::setRectification(const StereoCalibration& calibration, unsigned int bytes_per_pixel)
+{
+        // The tables are built once, every frame is then a single lookup per pixel and camera
+        std::vector<uint32_t> table;
+        size_t table_bytes = sizeof(uint32_t) * calibration.getWidth() * calibration.getHeight();
+        calibration.buildRemapTable(StereoCalibration::LEFT, table);
+        clBuffer_left_remap = cl::Buffer(context, CL_MEM_READ_ONLY, table_bytes);
+        command_queue.enqueueWriteBuffer(clBuffer_left_remap, CL_TRUE, 0, table_bytes, table.data());
+        calibration.buildRemapTable(StereoCalibration::RIGHT, table);
+        clBuffer_right_remap = cl::Buffer(context, CL_MEM_READ_ONLY, table_bytes);
+        command_queue.enqueueWriteBuffer(clBuffer_right_remap, CL_TRUE, 0, table_bytes, table.data());
+
+        // Raw frames are uploaded as decoded, the kernel reduces them to luminance as it samples
+        cl::ImageFormat format = bytes_per_pixel == 1 ? cl::ImageFormat(CL_R, CL_UNSIGNED_INT8) : cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8);
+        clImage_raw_left = cl::Image2D(context, CL_MEM_READ_ONLY, format, calibration.getWidth(), calibration.getHeight());
+        clImage_raw_right = cl::Image2D(context, CL_MEM_READ_ONLY, format, calibration.getWidth(), calibration.getHeight());
+        rectify = true;
+}
+
+void Algorithm::setTemporalSeeding(unsigned int band)
+{
+        // A band of 0 searches every frame from scratch
+        temporal_band = band;
+        frames_since_refresh = 0;
+}
+
+void Algorithm::setConsistencyCheck(bool enabled)
+{
+        consistency_check = enabled;
+}
+
+void Algorithm::setBrickStoreFilename(std::string filename)
+{
+        // Pipelines running side by side each stream bricks to their own file, opened by the first shift
+        if (brick_store.isOpen())
         {
-                std::cerr << "No platforms found, check OpencL installation." << std::endl;
-                exit(EXIT_FAILURE);
+                brick_store.close();
         }
-        cl::Platform platform = platforms.at(0);
-        std::cout << "Using platform: " << platform.getInfo<CL_PLATFORM_NAME>() << std::endl;
+        brick_store_filename = filename;
+        brick_store_opened = false;
+}
 
-        // Retrieves the default device of the platform
-        std::vector<cl::Device> devices;
-        platform.getDevices(CL_DEVICE_TYPE_DEFAULT, &devices);
-        if (devices.size() == 0)
+void Algorithm::setDisparityRange(unsigned int range)
+{
+        disparity_range = range;
+}
+
+unsigned int Algorithm::getAggregatedRange()
+{
+        return aggregated_range;
+}
+
+void Algorithm::prepareDisparityMap(unsigned int width, unsigned int window_size, MatchingCost matching_cost, unsigned int range)
+{
+        // Builds the kernel variant the matching cost runs at this quality, so switching to it later doesn't
+        // stall a frame. Aggregated SAD and host census use no variants.
+        int max_disparity = getMaxDisparity(range, width);
+        if (matching_cost == MatchingCost::SAD)
         {
-                std::cerr << "No devices found, check OpencL installation." << std::endl;
-                exit(EXIT_FAILURE);
+                getSadProgram(window_size, max_disparity);
         }
-        device = devices.at(0);
-        std::cout << "Using device: " << device.getInfo<CL_DEVICE_NAME>() << std::endl;
-
-        context = cl::Context({device});
+        else if (matching_cost == MatchingCost::CENSUS)
+        {
+                getCensusProgram(max_disparity);
+        }
+}
 
-        // Loads and builds the kernel
-        std::string kernel_code = loadSource("src/kernels/reconstruction.cl");
-        std::cout << "Loaded kernel" << std::endl << "Building kernel..." << std::endl;
-        sources.push_back({kernel_code.c_str(), kernel_code.length()});
-        program = cl::Program(context, sources);
-        if (program.build({device}) != CL_SUCCESS)
+bool Algorithm::setAggregation(unsigned int range, unsigned int batch_size)
+{
+        if (range == 0 || range > 256 || batch_size == 0)
         {
-                std::cerr << "Error building " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
-                exit(EXIT_FAILURE);
+                std::cerr << "Aggregated SAD searches 1 to 256 disparities in batches of at least 1" << std::endl;
+                return false;
         }
-        else
+        aggregated_range = range;
+        batch_size = std::min(batch_size, range);
+        if (batch_size == disparity_batch_size)
         {
-                std::cout << "Success!" << std::endl;
+                return true;
         }
 
-        // Command queue
-        command_queue = cl::CommandQueue(context, device);
+        // The memory plan counted the default batch, a different one is checked as it is reallocated
+        uint64_t pixel_count = (uint64_t) clImage_disparity.getImageInfo<CL_IMAGE_WIDTH>() * clImage_disparity.getImageInfo<CL_IMAGE_HEIGHT>();
+        uint64_t row_sums_bytes = sizeof(uint32_t) * pixel_count * batch_size;
+        uint64_t device_max_allocation_bytes = device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>();
+        if (row_sums_bytes > device_max_allocation_bytes)
+        {
+                std::cerr << "Aggregated SAD row sums of " << row_sums_bytes << " bytes for a batch of " << batch_size
+                        << " disparities exceed the largest device allocation" << std::endl;
+                return false;
+        }
+        disparity_batch_size = batch_size;
+        clBuffer_row_sums = cl::Buffer(context, CL_MEM_READ_WRITE, row_sums_bytes);
+        return true;
 }
 
-void Algorithm::generateDisparityMap(Image* left, Image* right, unsigned int window_size, Image* disparity_map)
+void Algorithm::generateDisparityMap(Image* left, Image* right, unsigned int window_size, MatchingCost matching_cost,
+        const Util::Vector3D& camera_motion, int baseline_mm, Image* disparity_map)
 {
         Util::startDebugTimer("Disparity map");
 
-        // Allocates buffers on the device
-        cl::Image2D clImage_left(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), left->getWidth(), left->getHeight(), 0, (void*) left->getPixels());
-        cl::Image2D clImage_right(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), right->getWidth(), right->getHeight(), 0, (void*) right->getPixels());
-        cl::Image2D clImage_disparity(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), disparity_map->getWidth(), disparity_map->getHeight());
+        cl::size_t<3> origin;
+        origin[0] = 0;
+        origin[1] = 0;
+        origin[2] = 0;
+
+        cl::size_t<3> region;
+        region[0] = disparity_map->getWidth();
+        region[1] = disparity_map->getHeight();
+        region[2] = 1;
 
-        cl::Kernel reconstruction_kernel(program, "disparity");
-        reconstruction_kernel.setArg(0, clImage_disparity);
-        reconstruction_kernel.setArg(1, clImage_left);
-        reconstruction_kernel.setArg(2, clImage_right);
-        reconstruction_kernel.setArg(3, window_size);
+        int max_disparity = getMaxDisparity(disparity_range, disparity_map->getWidth());
 
-        executeImageKernel(reconstruction_kernel, clImage_disparity, disparity_map);
+        if (matching_cost == MatchingCost::CENSUS_HOST)
+        {
+                // Matches on the CPU, then hands the result to the device like the kernels would
+                const uint8_t* left_luminance;
+                const uint8_t* right_luminance;
+                if (rectify)
+                {
+                        // Rectification only runs on the device, so the rectified luminance is read back
+                        uploadRectified(left, right);
+                        host_left_luminance.resize(disparity_map->getWidth() * disparity_map->getHeight());
+                        host_right_luminance.resize(host_left_luminance.size());
+                        command_queue.enqueueReadImage(clImage_left_luminance, CL_TRUE, origin, region, 0, 0, host_left_luminance.data());
+                        command_queue.enqueueReadImage(clImage_right_luminance, CL_TRUE, origin, region, 0, 0, host_right_luminance.data());
+                        frame_statistics.bytes_downloaded += host_left_luminance.size() * 2;
+                        left_luminance = host_left_luminance.data();
+                        right_luminance = host_right_luminance.data();
+                }
+                else
+                {
+                        left_luminance = getHostLuminance(left, host_left_luminance);
+                        right_luminance = getHostLuminance(right, host_right_luminance);
+                }
+                host_disparity.resize(disparity_map->getWidth() * disparity_map->getHeight());
+                census_matcher.match(left_luminance, right_luminance, disparity_map->getWidth(), disparity_map->getHeight(), max_disparity, host_disparity.data());
+                command_queue.enqueueWriteImage(clImage_disparity, CL_TRUE, origin, region, 0, 0, host_disparity.data());
+                frame_statistics.bytes_uploaded += host_disparity.size() * sizeof(uint16_t);
+
+                // The views swapped match every left view pixel for the consistency check
+                if (consistency_check)
+                {
+                        host_reverse_disparity.resize(host_disparity.size());
+                        census_matcher.match(right_luminance, left_luminance, disparity_map->getWidth(), disparity_map->getHeight(), max_disparity, host_reverse_disparity.data());
+                        command_queue.enqueueWriteImage(clImage_reverse_disparity, CL_TRUE, origin, region, 0, 0, host_reverse_disparity.data());
+                        frame_statistics.bytes_uploaded += host_reverse_disparity.size() * sizeof(uint16_t);
+                }
+        }
+        else
+        {
+                // Matching only needs luminance, so both frames are reduced to a single channel first
+                if (rectify)
+                {
+                        uploadRectified(left, right);
+                }
+                else
+                {
+                        uploadLuminance(left, clImage_left_luminance);
+                        uploadLuminance(right, clImage_right_luminance);
+                }
+
+                if (matching_cost == MatchingCost::CENSUS)
+                {
+                        // Describes every pixel once, so each candidate costs a single XOR and popcount
+                        cl::Kernel left_census_kernel(program, "census");
+                        left_census_kernel.setArg(0, clImage_left_luminance);
+                        left_census_kernel.setArg(1, clBuffer_left_census);
+                        enqueueImageKernel(left_census_kernel, disparity_map->getWidth(), disparity_map->getHeight());
+
+                        cl::Kernel right_census_kernel(program, "census");
+                        right_census_kernel.setArg(0, clImage_right_luminance);
+                        right_census_kernel.setArg(1, clBuffer_right_census);
+                        enqueueImageKernel(right_census_kernel, disparity_map->getWidth(), disparity_map->getHeight());
+
+                        cl::Kernel reconstruction_kernel(getCensusProgram(max_disparity), "disparityCensus");
+                        reconstruction_kernel.setArg(0, clImage_disparity);
+                        reconstruction_kernel.setArg(1, clBuffer_left_census);
+                        reconstruction_kernel.setArg(2, clBuffer_right_census);
+                        reconstruction_kernel.setArg(3, max_disparity);
+                        enqueueImageKernel(reconstruction_kernel, disparity_map->getWidth(), disparity_map->getHeight());
+                }
+                else if (matching_cost == MatchingCost::SAD_AGGREGATED)
+                {
+                        aggregateDisparity(disparity_map->getWidth(), disparity_map->getHeight(), window_size, false);
+                }
+                else if (temporal_band > 0 && frames_since_refresh > 0)
+                {
+                        // The last map becomes the prior, the new one is written over the map before it
+                        std::swap(clImage_disparity, clImage_previous_disparity);
+
+                        // Points move disparity * translation / baseline pixels as the camera translates
+                        float warp_x = camera_motion.x / baseline_mm;
+                        float warp_y = camera_motion.y / baseline_mm;
+
+                        cl::Kernel reconstruction_kernel(getSadProgram(window_size, max_disparity), "disparityTemporal");
+                        reconstruction_kernel.setArg(0, clImage_disparity);
+                        reconstruction_kernel.setArg(1, clImage_previous_disparity);
+                        reconstruction_kernel.setArg(2, clImage_left_luminance);
+                        reconstruction_kernel.setArg(3, clImage_right_luminance);
+                        reconstruction_kernel.setArg(4, window_size);
+                        reconstruction_kernel.setArg(5, temporal_band);
+                        reconstruction_kernel.setArg(6, temporal_cost_threshold);
+                        reconstruction_kernel.setArg(7, warp_x);
+                        reconstruction_kernel.setArg(8, warp_y);
+                        reconstruction_kernel.setArg(9, max_disparity);
+                        enqueueImageKernel(reconstruction_kernel, disparity_map->getWidth(), disparity_map->getHeight());
+                }
+                else
+                {
+                        cl::Kernel reconstruction_kernel(getSadProgram(window_size, max_disparity), "disparity");
+                        reconstruction_kernel.setArg(0, clImage_disparity);
+                        reconstruction_kernel.setArg(1, clImage_left_luminance);
+                        reconstruction_kernel.setArg(2, clImage_right_luminance);
+                        reconstruction_kernel.setArg(3, window_size);
+                        reconstruction_kernel.setArg(4, max_disparity);
+                        enqueueImageKernel(reconstruction_kernel, disparity_map->getWidth(), disparity_map->getHeight());
+                }
+
+                if (consistency_check)
+                {
+                        generateReverseDisparityMap(disparity_map->getWidth(), disparity_map->getHeight(), window_size, matching_cost, max_disparity);
+                }
+        }
+        buildValidityMask(disparity_map->getWidth(), disparity_map->getHeight());
+
+        // Counts frames since the last full search, any other matching cost leaves no prior
+        bool temporal = temporal_band > 0 && matching_cost == MatchingCost::SAD;
+        frames_since_refresh = temporal ? (frames_since_refresh + 1) % temporal_refresh_interval : 0;
+
+        // The disparity map stays on the device, the host copy is expanded to whole disparities in RGBA
+        // for display
+        cl::Kernel expand_kernel(program, "expandDisparity");
+        expand_kernel.setArg(0, clImage_disparity);
+        expand_kernel.setArg(1, clImage_disparity_rgba);
+        executeImageKernel(expand_kernel, clImage_disparity_rgba, disparity_map);
 
         Util::endDebugTimer("Disparity map");
 }
@@ -103,17 +469,23 @@ void Algorithm::convertDisparityMapToDepthMap(Image* disparity_map, int focal_le
 {
         Util::startDebugTimer("Depth map");
 
-        cl::Image2D clImage_disparity(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), disparity_map->getWidth(), disparity_map->getHeight(), 0, (void*) disparity_map->getPixels());
+        // Reads the single channel disparity map left on the device by generateDisparityMap()
         cl::Image2D clImage_depth(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), depth_map->getWidth(), depth_map->getHeight());
 
         cl::Kernel reconstruction_kernel(program, "disparityToDepth");
         reconstruction_kernel.setArg(0, clImage_depth);
         reconstruction_kernel.setArg(1, clImage_disparity);
-        reconstruction_kernel.setArg(2, focal_length);
-        reconstruction_kernel.setArg(3, baseline_mm);
+        reconstruction_kernel.setArg(2, clBuffer_validity);
+        reconstruction_kernel.setArg(3, focal_length);
+        reconstruction_kernel.setArg(4, baseline_mm);
 
         executeImageKernel(reconstruction_kernel, clImage_depth, depth_map);
 
+        // Pixels without a valid match are left at zero depth
+        size_t pixel_count = depth_map->getWidth() * depth_map->getHeight();
+        const uint32_t* depths = depth_map->getPixels();
+        frame_statistics.valid_depth_pixels = pixel_count - std::count(depths, depths + pixel_count, 0u);
+
         Util::endDebugTimer("Depth map");
 }
 
@@ -123,29 +495,42 @@ void Algorithm::trackCamera(Image* depth_map, Image* vertex_map, Image* normal_m
         Util::startDebugTimer("Vertex map");
 
         cl::Image2D clImage_depth(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), depth_map->getWidth(), depth_map->getHeight(), 0, (void*) depth_map->getPixels());
-        cl::Image2D clImage_vertex_write(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT32), vertex_map->getWidth(), vertex_map->getHeight());
+        cl::Image2D clImage_vertex_write(context, CL_MEM_WRITE_ONLY, VERTEX_FORMAT, vertex_map->getWidth(), vertex_map->getHeight());
+        frame_statistics.bytes_uploaded += depth_map->getWidth() * depth_map->getHeight() * depth_map->getBytesPerPixel();
+
+        // Footage without a calibrated principal point is assumed centred
+        float principal_point_x = camera_config.principal_point_x;
+        float principal_point_y = camera_config.principal_point_y;
+        if (principal_point_x == 0 && principal_point_y == 0)
+        {
+                principal_point_x = depth_map->getWidth() / 2.0f;
+                principal_point_y = depth_map->getHeight() / 2.0f;
+        }
 
         cl::Kernel vertex_kernel(program, "generateVertexMap");
         vertex_kernel.setArg(0, clImage_depth);
-        vertex_kernel.setArg(1, camera_config.focal_length);
-        vertex_kernel.setArg(2, camera_config.scale_x);
-        vertex_kernel.setArg(3, camera_config.scale_y);
-        vertex_kernel.setArg(4, camera_config.skew_coeff);
-        vertex_kernel.setArg(5, camera_config.principal_point_x);
-        vertex_kernel.setArg(6, camera_config.principal_point_y);
-        vertex_kernel.setArg(7, clImage_vertex_write);
+        vertex_kernel.setArg(1, clBuffer_validity);
+        vertex_kernel.setArg(2, camera_config.focal_length);
+        vertex_kernel.setArg(3, camera_config.scale_x);
+        vertex_kernel.setArg(4, camera_config.scale_y);
+        vertex_kernel.setArg(5, camera_config.skew_coeff);
+        vertex_kernel.setArg(6, principal_point_x);
+        vertex_kernel.setArg(7, principal_point_y);
+        vertex_kernel.setArg(8, clImage_vertex_write);
 
         executeImageKernel(vertex_kernel, clImage_vertex_write, vertex_map);
         Util::endDebugTimer("Vertex map");
 
         // Normal map generation
         Util::startDebugTimer("Normal map");
-        cl::Image2D clImage_vertex_read(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT32), vertex_map->getWidth(), vertex_map->getHeight(), 0, (void*) vertex_map->getPixels());
-        cl::Image2D clImage_normal(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_FLOAT), normal_map->getWidth(), normal_map->getHeight());
+        cl::Image2D clImage_vertex_read(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, VERTEX_FORMAT, vertex_map->getWidth(), vertex_map->getHeight(), 0, (void*) vertex_map->getPixels());
+        cl::Image2D clImage_normal(context, CL_MEM_WRITE_ONLY, NORMAL_FORMAT, normal_map->getWidth(), normal_map->getHeight());
+        frame_statistics.bytes_uploaded += vertex_map->getWidth() * vertex_map->getHeight() * vertex_map->getBytesPerPixel();
 
         cl::Kernel normal_kernel(program, "generateNormalMap");
         normal_kernel.setArg(0, clImage_vertex_read);
-        normal_kernel.setArg(1, clImage_normal);
+        normal_kernel.setArg(1, clBuffer_validity);
+        normal_kernel.setArg(2, clImage_normal);
 
         executeImageKernel(normal_kernel, clImage_normal, normal_map);
         Util::endDebugTimer("Normal map");
@@ -153,14 +538,14 @@ void Algorithm::trackCamera(Image* depth_map, Image* vertex_map, Image* normal_m
         // Determines point correspondences to the previous frame
         Util::startDebugTimer("Correspondences");
 
-        cl::Image2D clImage_prev_vertex(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT32), prev_vertex_map->getWidth(), prev_vertex_map->getHeight(), 0, (void*) prev_vertex_map->getPixels());
-        cl::Image2D clImage_prev_normal(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_FLOAT), prev_normal_map->getWidth(), prev_normal_map->getHeight(), 0, (void*) prev_normal_map->getPixels());
-        cl::Image2D clImage_normal_read(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, cl::ImageFormat(CL_RGBA, CL_FLOAT), normal_map->getWidth(), normal_map->getHeight(), 0, (void*) normal_map->getPixels());
-        unsigned int pixel_count = vertex_map->getWidth() * vertex_map->getHeight();
-        clBuffer_correspondences = cl::Buffer(context, CL_MEM_READ_ONLY, sizeof(int) * pixel_count);
+        cl::Image2D clImage_prev_vertex(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, VERTEX_FORMAT, prev_vertex_map->getWidth(), prev_vertex_map->getHeight(), 0, (void*) prev_vertex_map->getPixels());
+        cl::Image2D clImage_prev_normal(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, NORMAL_FORMAT, prev_normal_map->getWidth(), prev_normal_map->getHeight(), 0, (void*) prev_normal_map->getPixels());
+        cl::Image2D clImage_normal_read(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, NORMAL_FORMAT, normal_map->getWidth(), normal_map->getHeight(), 0, (void*) normal_map->getPixels());
+        frame_statistics.bytes_uploaded += (prev_vertex_map->getWidth() * prev_vertex_map->getHeight() * prev_vertex_map->getBytesPerPixel()) +
+                2 * (normal_map->getWidth() * normal_map->getHeight() * normal_map->getBytesPerPixel());
 
         cl::Kernel correspondences_kernel(program, "findCorrespondences");
-        correspondences_kernel.setArg(0, clImage_depth);
+        correspondences_kernel.setArg(0, clBuffer_validity);
         correspondences_kernel.setArg(1, clImage_prev_vertex);
         correspondences_kernel.setArg(2, clImage_prev_normal);
         correspondences_kernel.setArg(3, clImage_vertex_read);
@@ -168,86 +553,591 @@ void Algorithm::trackCamera(Image* depth_map, Image* vertex_map, Image* normal_m
         correspondences_kernel.setArg(5, transformation.translation.x);
         correspondences_kernel.setArg(6, transformation.translation.y);
         correspondences_kernel.setArg(7, transformation.translation.z);
-        correspondences_kernel.setArg(8, transformation.rotation.x);
-        correspondences_kernel.setArg(9, transformation.rotation.x);
-        correspondences_kernel.setArg(10, transformation.rotation.x);
-        correspondences_kernel.setArg(11, clBuffer_correspondences);
+        // The rotation is the same for every pixel, so its matrix is computed once here
+        float rotation[9];
+        Util::getRotationMatrix(transformation.rotation, rotation);
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                cl_float4 rotation_row = {{ rotation[row * 3], rotation[row * 3 + 1], rotation[row * 3 + 2], 0.0f }};
+                correspondences_kernel.setArg(8 + row, rotation_row);
+        }
+        correspondences_kernel.setArg(11, (float) camera_config.focal_length);
+        correspondences_kernel.setArg(12, principal_point_x);
+        correspondences_kernel.setArg(13, principal_point_y);
+        correspondences_kernel.setArg(14, clBuffer_correspondences);
+        enqueueImageKernel(correspondences_kernel, depth_map->getWidth(), depth_map->getHeight());
 
-        executeImageKernel(correspondences_kernel, clImage_normal, normal_map);
+        // Packs the matches so the system is only built from real correspondences
+        uint32_t pixel_count = depth_map->getWidth() * depth_map->getHeight();
+        uint32_t count = 0;
+        command_queue.enqueueWriteBuffer(clBuffer_correspondence_count, CL_FALSE, 0, sizeof(uint32_t), &count);
+
+        cl::Program& compaction_program = kernel_variants->getProgram(KernelVariants::define("COMPACTION_GROUP_SIZE", compaction_group_size));
+        cl::Kernel compact_kernel(compaction_program, "compactCorrespondences");
+        compact_kernel.setArg(0, clBuffer_correspondences);
+        compact_kernel.setArg(1, clImage_prev_vertex);
+        compact_kernel.setArg(2, clImage_prev_normal);
+        compact_kernel.setArg(3, pixel_count);
+        compact_kernel.setArg(4, clBuffer_packed_correspondences);
+        compact_kernel.setArg(5, clBuffer_correspondence_count);
+        size_t compaction_range = (pixel_count + compaction_group_size - 1) / compaction_group_size * compaction_group_size;
+        command_queue.enqueueNDRangeKernel(compact_kernel, cl::NullRange, cl::NDRange(compaction_range), cl::NDRange(compaction_group_size));
+        command_queue.enqueueReadBuffer(clBuffer_correspondence_count, CL_TRUE, 0, sizeof(uint32_t), &count);
+        frame_statistics.bytes_uploaded += sizeof(uint32_t);
+        frame_statistics.bytes_downloaded += sizeof(uint32_t);
+
+        reduceCorrespondences(count);
 
         // Keeps a copy of these vertex and normal maps for the next frame
-        size_t size_in_bytes = vertex_map->getWidth() * vertex_map->getHeight() *
-                vertex_map->getWordsPerPixel() * sizeof(uint32_t);
-        memcpy(prev_vertex_map->getPixels(), vertex_map->getPixels(), size_in_bytes);
-        memcpy(prev_normal_map->getPixels(), normal_map->getPixels(), size_in_bytes);
+        memcpy(prev_vertex_map->getPixels(), vertex_map->getPixels(), pixel_count * VERTEX_WORDS_PER_PIXEL * sizeof(uint32_t));
+        memcpy(prev_normal_map->getPixels(), normal_map->getPixels(), pixel_count * NORMAL_WORDS_PER_PIXEL * sizeof(uint32_t));
 
         Util::endDebugTimer("Correspondences");
 }
 
+void Algorithm::reduceCorrespondences(unsigned int count)
+{
+        tracking_statistics = TrackingStatistics();
+        tracking_statistics.correspondence_count = count;
+        if (count == 0)
+        {
+                return;
+        }
+
+        // One residual per packed correspondence, read back for the tracking statistics
+        cl::Kernel residuals_kernel(program, "pointToPlaneResiduals");
+        residuals_kernel.setArg(0, clBuffer_packed_correspondences);
+        residuals_kernel.setArg(1, count);
+        residuals_kernel.setArg(2, clBuffer_residuals);
+        command_queue.enqueueNDRangeKernel(residuals_kernel, cl::NullRange, cl::NDRange(count), cl::NullRange);
+
+        host_residuals.resize(count);
+        command_queue.enqueueReadBuffer(clBuffer_residuals, CL_TRUE, 0, sizeof(float) * host_residuals.size(), host_residuals.data());
+        frame_statistics.bytes_downloaded += sizeof(float) * host_residuals.size();
+
+        // Accumulates the residuals
+        double squared_residuals = 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+                double residual = host_residuals[i];
+                squared_residuals += residual * residual;
+                tracking_statistics.residual_max = std::max(tracking_statistics.residual_max, std::fabs(residual));
+        }
+        tracking_statistics.residual_rms = std::sqrt(squared_residuals / count);
+
+        double outlier_residual = outlier_factor * tracking_statistics.residual_rms;
+        for (unsigned int i = 0; i < count; i++)
+        {
+                if (std::fabs(host_residuals[i]) > outlier_residual)
+                {
+                        tracking_statistics.outlier_count++;
+                }
+        }
+}
+
+const Algorithm::TrackingStatistics& Algorithm::getTrackingStatistics() const
+{
+        return tracking_statistics;
+}
+
+Algorithm::FrameStatistics Algorithm::takeFrameStatistics()
+{
+        // Traffic restarts from zero for the next frame, coverage carries over until it is next measured
+        FrameStatistics statistics = frame_statistics;
+        frame_statistics.bytes_uploaded = 0;
+        frame_statistics.bytes_downloaded = 0;
+        return statistics;
+}
+
 // ?? Temp: Pushing the entire volume to the GPU each frame
 void Algorithm::tempSetVoxels(Image* image)
 {
-        // Updates the CPU volume
+        // Updates the CPU volume, placing the image at the current origin of the rolling volume
         Util::startDebugTimer("Set CPU voxels");
-        for (int y = 0; y < image->getHeight(); y++)
+        int width = image->getWidth();
+        int height = image->getHeight();
+        host_quantized_depth.resize((size_t) width * height);
+        ImageOps::quantizeDepth(image->getPixels(), host_quantized_depth.size(), host_quantized_depth.data());
+
+        // Pixels without a valid match leave the volume as it was
+        command_queue.enqueueReadBuffer(clBuffer_validity, CL_TRUE, 0, sizeof(uint32_t) * host_validity.size(), host_validity.data());
+        frame_statistics.bytes_downloaded += sizeof(uint32_t) * host_validity.size();
+
+        // Voxel columns and depths are looked up rather than divided out for every pixel
+        std::vector<int> voxel_columns(width);
+        for (int x = 0; x < width; x++)
+        {
+                voxel_columns[x] = x / volume.voxel_size;
+        }
+        int voxel_depths[256];
+        for (int value = 0; value < 256; value++)
+        {
+                voxel_depths[value] = std::min((value / 255.0) * volume.dimensions[2], volume.dimensions[2] - 1.0);
+        }
+
+        for (int y = 0; y < height; y++)
         {
-                for (int x = 0; x < image->getWidth(); x++)
+                int voxel_y = y / volume.voxel_size;
+                if (voxel_y >= volume.dimensions[1])
+                {
+                        break;
+                }
+
+                const uint8_t* row = host_quantized_depth.data() + (size_t) y * width;
+                const uint32_t* validity_row = host_validity.data() + (size_t) y * validity_words_per_row;
+                for (int x = 0; x < width && voxel_columns[x] < volume.dimensions[0]; x++)
                 {
-                        int pixel_index = y * image->getWidth() + x;
-                        unsigned int pixel = ((float)image->getPixels()[pixel_index] / 300.0f) * 244 ;
+                        if (!(validity_row[x / 32] >> (x % 32) & 1))
+                        {
+                                continue;
+                        }
 
-                        int volume_width = std::max(image->getWidth(), image->getHeight());
-                        int voxel_z = ((pixel & 0xFF) / 255.0) * volume_width;
-                        int voxel_index = voxel_z * volume_width * volume_width + y * volume_width + x;
-                        volume.voxels[voxel_index] = pixel & 0xFF;
+                        int voxel = row[x];
+                        size_t voxel_index = getVoxelIndex(volume.origin[0] + voxel_columns[x], volume.origin[1] + voxel_y, volume.origin[2] + voxel_depths[voxel]);
+                        frame_statistics.occupied_voxels += (voxel != 0) - (volume.voxels[voxel_index] != 0);
+                        volume.voxels[voxel_index] = voxel;
                 }
         }
         Util::endDebugTimer("Set CPU voxels");
 
         // Pushes the volume to the GPU
         Util::startDebugTimer("Push voxels");
-        unsigned int voxel_count = image->getWidth() * image->getWidth() * image->getWidth();
-        command_queue.enqueueWriteBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * voxel_count, volume.voxels);
+        command_queue.enqueueWriteBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * getVoxelCount(), volume.voxels);
+        frame_statistics.bytes_uploaded += sizeof(int) * getVoxelCount();
         Util::endDebugTimer("Push voxels");
 
 }
 
-void Algorithm::render(int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, Image* screen)
+void Algorithm::shiftVolume(const Util::Transformation& camera_pose)
+{
+        // The store is opened lazily, so only the file finally chosen is ever created
+        if (!brick_store_opened)
+        {
+                brick_store_opened = true;
+                if (!brick_store.open(brick_store_filename, volume.brick_width))
+                {
+                        std::cerr << "Volume will not follow the camera" << std::endl;
+                }
+        }
+        if (!brick_store.isOpen())
+        {
+                return;
+        }
+
+        // Centres the volume on the camera, in whole bricks
+        int new_origin[3];
+        if (!VolumeShift::getOrigin(volume, camera_pose, new_origin))
+        {
+                return;
+        }
+
+        Util::startDebugTimer("Shift volume");
+
+        size_t voxel_count = getVoxelCount();
+        command_queue.enqueueReadBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * voxel_count, volume.voxels);
+        frame_statistics.bytes_downloaded += sizeof(int) * voxel_count;
+
+        unsigned int bricks_out = 0;
+        unsigned int bricks_in = 0;
+        VolumeShift::shift(volume, new_origin, brick_store, bricks_out, bricks_in);
+
+        command_queue.enqueueWriteBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * voxel_count, volume.voxels);
+        frame_statistics.bytes_uploaded += sizeof(int) * voxel_count;
+        frame_statistics.occupied_voxels = countOccupiedVoxels();
+
+        std::cout << "Volume origin moved to (" << volume.origin[0] << ", " << volume.origin[1] << ", " << volume.origin[2]
+                << "), " << bricks_out << " bricks out, " << bricks_in << " reloaded" << std::endl;
+        Util::endDebugTimer("Shift volume");
+}
+
+size_t Algorithm::getVoxelCount()
+{
+        return (size_t) volume.dimensions[0] * volume.dimensions[1] * volume.dimensions[2];
+}
+
+uint64_t Algorithm::countOccupiedVoxels()
+{
+        size_t voxel_count = getVoxelCount();
+        return voxel_count - std::count(volume.voxels, volume.voxels + voxel_count, 0);
+}
+
+inline size_t Algorithm::getVoxelIndex(int x, int y, int z)
+{
+        // Wraps world voxel coordinates into the cyclic buffer
+        const int* dimensions = volume.dimensions;
+        size_t slot_x = ((x % dimensions[0]) + dimensions[0]) % dimensions[0];
+        size_t slot_y = ((y % dimensions[1]) + dimensions[1]) % dimensions[1];
+        size_t slot_z = ((z % dimensions[2]) + dimensions[2]) % dimensions[2];
+        return (slot_z * dimensions[1] + slot_y) * dimensions[0] + slot_x;
+}
+
+bool Algorithm::saveVolume(std::string filename, const Util::Transformation& camera_pose)
+{
+        Util::startDebugTimer("Save volume");
+
+        SnapshotWriter writer;
+        bool success = writer.open(filename, volume.dimensions, volume.voxel_size, volume.origin, camera_pose);
+
+        // Streams the device volume out a few slices at a time so only one chunk is held on the host
+        unsigned int slices = volume.dimensions[2];
+        size_t slice_voxel_count = (size_t) volume.dimensions[0] * volume.dimensions[1];
+        unsigned int slices_per_chunk = Snapshot::getSlicesPerChunk(slice_voxel_count);
+        std::vector<int> chunk(success ? slices_per_chunk * slice_voxel_count : 0);
+        for (unsigned int first_slice = 0; success && first_slice < slices; first_slice += slices_per_chunk)
+        {
+                unsigned int slice_count = std::min(slices_per_chunk, slices - first_slice);
+                size_t offset = first_slice * slice_voxel_count * sizeof(int);
+                size_t size_in_bytes = slice_count * slice_voxel_count * sizeof(int);
+                command_queue.enqueueReadBuffer(buffer_voxels, CL_TRUE, offset, size_in_bytes, chunk.data());
+
+                if (!writer.writeChunk(first_slice, slice_count, chunk.data()))
+                {
+                        std::cerr << "Failed to write volume snapshot " << filename << std::endl;
+                        success = false;
+                }
+        }
+
+        success = success && writer.close();
+        Util::endDebugTimer("Save volume");
+        return success;
+}
+
+bool Algorithm::loadVolume(std::string filename, Util::Transformation& camera_pose)
 {
-        cl::Image2D clImage_screen(context, CL_MEM_WRITE_ONLY, cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), screen->getWidth(), screen->getHeight());
+        Util::startDebugTimer("Load volume");
 
-        cl::Kernel reconstruction_kernel(program, "render");
+        // Chunks are uploaded into a staging buffer as they decode while the device volume stays live,
+        // and only after the last one is it copied over the volume and the origin and pose taken. A
+        // corrupt or truncated snapshot leaves the volume and camera as they were, the host copy being
+        // read back from the device.
+        int origin[3];
+        Util::Transformation snapshot_pose;
+        cl::Buffer staging;
+        bool success = readVolumeSnapshot(filename, staging, origin, snapshot_pose);
+        if (success)
+        {
+                command_queue.enqueueCopyBuffer(staging, buffer_voxels, 0, 0, sizeof(int) * getVoxelCount());
+                command_queue.finish();
+                std::copy(origin, origin + 3, volume.origin);
+                camera_pose = snapshot_pose;
+        }
+        else
+        {
+                command_queue.enqueueReadBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * getVoxelCount(), volume.voxels);
+        }
+        frame_statistics.occupied_voxels = countOccupiedVoxels();
+
+        Util::endDebugTimer("Load volume");
+        return success;
+}
+
+bool Algorithm::readVolumeSnapshot(std::string filename, cl::Buffer& staging, int origin[3], Util::Transformation& camera_pose)
+{
+        SnapshotReader reader;
+        if (!reader.open(filename))
+        {
+                return false;
+        }
+
+        int dimensions[3];
+        reader.getDimensions(dimensions);
+        if (dimensions[0] != volume.dimensions[0] || dimensions[1] != volume.dimensions[1] || dimensions[2] != volume.dimensions[2] ||
+                reader.getVoxelSize() != volume.voxel_size)
+        {
+                std::cerr << "Snapshot volume of " << dimensions[0] << "x" << dimensions[1] << "x" << dimensions[2] << " voxels of size "
+                        << reader.getVoxelSize() << " does not match the current volume of " << volume.dimensions[0] << "x"
+                        << volume.dimensions[1] << "x" << volume.dimensions[2] << " voxels of size " << volume.voxel_size << std::endl;
+                return false;
+        }
+
+        // Held only while loading, so it is not part of the memory plan
+        cl_int error;
+        staging = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(int) * getVoxelCount(), NULL, &error);
+        if (error != CL_SUCCESS)
+        {
+                std::cerr << "Not enough device memory to stage volume snapshot " << filename << std::endl;
+                return false;
+        }
+
+        // Each chunk goes through its slices of the host copy, so its upload overlaps decoding the next.
+        // Chunks must follow on from each other, so no slice of the staging buffer is left unwritten.
+        size_t slice_voxel_count = (size_t) volume.dimensions[0] * volume.dimensions[1];
+        unsigned int next_slice = 0;
+        unsigned int first_slice;
+        unsigned int slice_count;
+        std::vector<int> chunk;
+        while (reader.readChunk(&first_slice, &slice_count, chunk))
+        {
+                if (first_slice != next_slice)
+                {
+                        std::cerr << "Volume snapshot " << filename << " skips or repeats slices" << std::endl;
+                        return false;
+                }
+                next_slice = first_slice + slice_count;
+                int* slices = volume.voxels + first_slice * slice_voxel_count;
+                std::copy(chunk.begin(), chunk.end(), slices);
+                command_queue.enqueueWriteBuffer(staging, CL_FALSE, first_slice * slice_voxel_count * sizeof(int), chunk.size() * sizeof(int), slices);
+                frame_statistics.bytes_uploaded += chunk.size() * sizeof(int);
+        }
+
+        if (!reader.isFinished() || next_slice != (unsigned int) volume.dimensions[2])
+        {
+                std::cerr << "Volume snapshot " << filename << " is truncated" << std::endl;
+                return false;
+        }
+
+        camera_pose = reader.getCameraPose();
+        reader.getOrigin(origin);
+        return true;
+}
+
+bool Algorithm::extractMesh(std::string filename)
+{
+        Util::startDebugTimer("Extract mesh");
+
+        // Brings the host copy of the volume up to date with the device
+        command_queue.enqueueReadBuffer(buffer_voxels, CL_TRUE, 0, sizeof(int) * getVoxelCount(), volume.voxels);
+
+        MeshExtractor mesh_extractor;
+        bool success = mesh_extractor.extract(volume.voxels, volume.dimensions, volume.voxel_size, volume.origin, filename);
+        if (success)
+        {
+                std::cout << "Extracted " << mesh_extractor.getVertexCount() << " vertices and "
+                        << mesh_extractor.getTriangleCount() << " triangles to " << filename << std::endl;
+        }
+
+        Util::endDebugTimer("Extract mesh");
+        return success;
+}
+
+void Algorithm::render(int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, unsigned int render_scale, Image* screen)
+{
+        // One ray per block of the screen
+        int screen_width = screen->getWidth();
+        int screen_height = screen->getHeight();
+        int samples_width = (screen_width + render_scale - 1) / render_scale;
+        int samples_height = (screen_height + render_scale - 1) / render_scale;
+
+        // Wrapping into the cyclic volume folds to shifts and masks for power of two dimensions
+        std::string volume_options = KernelVariants::define("VOLUME_X", volume.dimensions[0]) +
+                KernelVariants::define("VOLUME_Y", volume.dimensions[1]) + KernelVariants::define("VOLUME_Z", volume.dimensions[2]);
+        cl::Kernel reconstruction_kernel(kernel_variants->getProgram(volume_options), "render");
         reconstruction_kernel.setArg(0, buffer_voxels);
-        reconstruction_kernel.setArg(1, volume.cube_width);
-        reconstruction_kernel.setArg(2, eye_x);
-        reconstruction_kernel.setArg(3, eye_y);
-        reconstruction_kernel.setArg(4, eye_z);
-        reconstruction_kernel.setArg(5, screen_z);
-        reconstruction_kernel.setArg(6, angle);
-        reconstruction_kernel.setArg(7, cam_distance);
-        reconstruction_kernel.setArg(8, clImage_screen);
+        reconstruction_kernel.setArg(1, volume.dimensions[0]);
+        reconstruction_kernel.setArg(2, volume.dimensions[1]);
+        reconstruction_kernel.setArg(3, volume.dimensions[2]);
+        reconstruction_kernel.setArg(4, volume.voxel_size);
+        reconstruction_kernel.setArg(5, volume.origin[0]);
+        reconstruction_kernel.setArg(6, volume.origin[1]);
+        reconstruction_kernel.setArg(7, volume.origin[2]);
+        reconstruction_kernel.setArg(8, eye_x);
+        reconstruction_kernel.setArg(9, eye_y);
+        reconstruction_kernel.setArg(10, eye_z);
+        reconstruction_kernel.setArg(11, screen_z);
+        reconstruction_kernel.setArg(12, angle);
+        reconstruction_kernel.setArg(13, cam_distance);
+        reconstruction_kernel.setArg(14, render_scale);
+        reconstruction_kernel.setArg(15, screen_width);
+        reconstruction_kernel.setArg(16, screen_height);
+        reconstruction_kernel.setArg(17, clBuffer_render_samples);
+        enqueueImageKernel(reconstruction_kernel, samples_width, samples_height);
 
-        executeImageKernel(reconstruction_kernel, clImage_screen, screen);
+        // Fills in the pixels between rays without blending across depth edges
+        cl::Kernel upsample_kernel(program, "upsampleRender");
+        upsample_kernel.setArg(0, clBuffer_render_samples);
+        upsample_kernel.setArg(1, render_scale);
+        upsample_kernel.setArg(2, samples_width);
+        upsample_kernel.setArg(3, samples_height);
+        upsample_kernel.setArg(4, volume.voxel_size);
+        upsample_kernel.setArg(5, clImage_render);
+        executeImageKernel(upsample_kernel, clImage_render, screen);
 }
 
-std::string Algorithm::loadSource(std::string filename)
+void Algorithm::uploadLuminance(Image* image, cl::Image2D& luminance)
 {
-        std::ifstream t(filename);
-        std::stringstream buffer;
-        buffer << t.rdbuf();
-        return buffer.str();
+        // Offset and rectangle of the whole image
+        cl::size_t<3> origin;
+        origin[0] = 0;
+        origin[1] = 0;
+        origin[2] = 0;
+
+        cl::size_t<3> region;
+        region[0] = image->getWidth();
+        region[1] = image->getHeight();
+        region[2] = 1;
+
+        // Frames already converted at decode time are written directly
+        if (image->getBytesPerPixel() == 1)
+        {
+                command_queue.enqueueWriteImage(luminance, CL_TRUE, origin, region, 0, 0, image->getPixels());
+                frame_statistics.bytes_uploaded += image->getWidth() * image->getHeight();
+                return;
+        }
+
+        // Otherwise the RGBA frame is staged and converted on the device
+        command_queue.enqueueWriteImage(clImage_frame_rgba, CL_TRUE, origin, region, 0, 0, image->getPixels());
+        frame_statistics.bytes_uploaded += image->getWidth() * image->getHeight() * image->getBytesPerPixel();
+
+        cl::Kernel luminance_kernel(program, "luminance");
+        luminance_kernel.setArg(0, clImage_frame_rgba);
+        luminance_kernel.setArg(1, luminance);
+        enqueueImageKernel(luminance_kernel, image->getWidth(), image->getHeight());
 }
 
-inline void Algorithm::executeImageKernel(cl::Kernel& kernel, cl::Image2D& out_buffer, Image* out_image)
+void Algorithm::uploadRectified(Image* left, Image* right)
 {
-        // Enqueues the execution of the kernel
-        command_queue.enqueueNDRangeKernel(
-                kernel,
-                cl::NullRange,
-                cl::NDRange(out_image->getWidth(), out_image->getHeight()),
-                cl::NullRange
-        );
+        cl::size_t<3> origin;
+        origin[0] = 0;
+        origin[1] = 0;
+        origin[2] = 0;
+
+        cl::size_t<3> region;
+        region[0] = left->getWidth();
+        region[1] = left->getHeight();
+        region[2] = 1;
+
+        command_queue.enqueueWriteImage(clImage_raw_left, CL_FALSE, origin, region, 0, 0, left->getPixels());
+        command_queue.enqueueWriteImage(clImage_raw_right, CL_TRUE, origin, region, 0, 0, right->getPixels());
+        frame_statistics.bytes_uploaded += 2 * left->getWidth() * left->getHeight() * left->getBytesPerPixel();
 
+        // Remaps, interpolates and converts both frames in one launch
+        cl::Kernel rectify_kernel(program, "rectify");
+        rectify_kernel.setArg(0, clImage_raw_left);
+        rectify_kernel.setArg(1, clImage_raw_right);
+        rectify_kernel.setArg(2, clBuffer_left_remap);
+        rectify_kernel.setArg(3, clBuffer_right_remap);
+        rectify_kernel.setArg(4, clImage_left_luminance);
+        rectify_kernel.setArg(5, clImage_right_luminance);
+        enqueueImageKernel(rectify_kernel, left->getWidth(), left->getHeight());
+}
+
+cl::Program& Algorithm::getSadProgram(unsigned int window_size, int max_disparity)
+{
+        // The window loops unroll fully once its size is known at compile time
+        return kernel_variants->getProgram(KernelVariants::define("WINDOW_SIZE", window_size) + KernelVariants::define("MAX_DISPARITY", max_disparity));
+}
+
+cl::Program& Algorithm::getCensusProgram(int max_disparity)
+{
+        return kernel_variants->getProgram(KernelVariants::define("MAX_DISPARITY", max_disparity));
+}
+
+int Algorithm::getMaxDisparity(unsigned int range, unsigned int width)
+{
+        // Searching the whole row allows any disparity
+        return range == 0 ? width : range;
+}
+
+void Algorithm::aggregateDisparity(unsigned int width, unsigned int height, unsigned int window_size, bool reverse)
+{
+        // Box filters the absolute differences of each batch of disparities, rows then columns. The
+        // packed costs leave 8 bits for the disparity, which is refined to sub-pixel as it is resolved.
+        // The reverse map matches the left view against the right, looking the other way along the row.
+        cl::Image2D& base = reverse ? clImage_left_luminance : clImage_right_luminance;
+        cl::Image2D& searched = reverse ? clImage_right_luminance : clImage_left_luminance;
+        int direction = reverse ? -1 : 1;
+        unsigned int max_disparity = disparity_range == 0 ? aggregated_range : std::min(disparity_range, 256u);
+        for (unsigned int first_disparity = 0; first_disparity < max_disparity; first_disparity += disparity_batch_size)
+        {
+                unsigned int batch_size = std::min(disparity_batch_size, max_disparity - first_disparity);
+
+                cl::Kernel rows_kernel(program, "aggregateRows");
+                rows_kernel.setArg(0, searched);
+                rows_kernel.setArg(1, base);
+                rows_kernel.setArg(2, window_size);
+                rows_kernel.setArg(3, first_disparity);
+                rows_kernel.setArg(4, direction);
+                rows_kernel.setArg(5, clBuffer_row_sums);
+                command_queue.enqueueNDRangeKernel(rows_kernel, cl::NullRange, cl::NDRange(height, batch_size), cl::NullRange);
+
+                cl::Kernel columns_kernel(program, "aggregateColumns");
+                columns_kernel.setArg(0, clBuffer_row_sums);
+                columns_kernel.setArg(1, width);
+                columns_kernel.setArg(2, height);
+                columns_kernel.setArg(3, window_size);
+                columns_kernel.setArg(4, first_disparity);
+                columns_kernel.setArg(5, clBuffer_best_costs);
+                command_queue.enqueueNDRangeKernel(columns_kernel, cl::NullRange, cl::NDRange(width, batch_size), cl::NullRange);
+        }
+
+        cl::Kernel resolve_kernel(program, "resolveAggregatedDisparity");
+        resolve_kernel.setArg(0, clBuffer_best_costs);
+        resolve_kernel.setArg(1, searched);
+        resolve_kernel.setArg(2, base);
+        resolve_kernel.setArg(3, window_size);
+        resolve_kernel.setArg(4, direction);
+        resolve_kernel.setArg(5, max_disparity);
+        resolve_kernel.setArg(6, reverse ? clImage_reverse_disparity : clImage_disparity);
+        enqueueImageKernel(resolve_kernel, width, height);
+}
+
+void Algorithm::generateReverseDisparityMap(unsigned int width, unsigned int height, unsigned int window_size,
+        MatchingCost matching_cost, int max_disparity)
+{
+        // The same search with the views swapped, so every left view pixel finds its match in the right
+        if (matching_cost == MatchingCost::CENSUS)
+        {
+                cl::Kernel reverse_kernel(getCensusProgram(max_disparity), "disparityCensus");
+                reverse_kernel.setArg(0, clImage_reverse_disparity);
+                reverse_kernel.setArg(1, clBuffer_right_census);
+                reverse_kernel.setArg(2, clBuffer_left_census);
+                reverse_kernel.setArg(3, max_disparity);
+                enqueueImageKernel(reverse_kernel, width, height);
+        }
+        else if (matching_cost == MatchingCost::SAD_AGGREGATED)
+        {
+                aggregateDisparity(width, height, window_size, true);
+        }
+        else
+        {
+                // Temporal priors are of the right view, so the left view is always searched in full
+                cl::Kernel reverse_kernel(getSadProgram(window_size, max_disparity), "disparity");
+                reverse_kernel.setArg(0, clImage_reverse_disparity);
+                reverse_kernel.setArg(1, clImage_right_luminance);
+                reverse_kernel.setArg(2, clImage_left_luminance);
+                reverse_kernel.setArg(3, window_size);
+                reverse_kernel.setArg(4, max_disparity);
+                enqueueImageKernel(reverse_kernel, width, height);
+        }
+}
+
+void Algorithm::buildValidityMask(unsigned int width, unsigned int height)
+{
+        // Without the check any pixel that found a match is valid, the reverse map is not read
+        cl::Kernel mask_kernel(program, "validityMask");
+        mask_kernel.setArg(0, clImage_disparity);
+        mask_kernel.setArg(1, consistency_check ? clImage_reverse_disparity : clImage_disparity);
+        mask_kernel.setArg(2, (int) consistency_check);
+        mask_kernel.setArg(3, clBuffer_validity);
+
+        // One work item packs each 32 pixel word of a row
+        enqueueImageKernel(mask_kernel, (width + 31) / 32, height);
+}
+
+const uint8_t* Algorithm::getHostLuminance(Image* image, std::vector<uint8_t>& luminance)
+{
+        // Frames already converted at decode time are used in place
+        const uint8_t* pixels = (const uint8_t*) image->getPixels();
+        if (image->getBytesPerPixel() == 1)
+        {
+                return pixels;
+        }
+
+        // Otherwise converts with the same weights as the luminance kernel
+        size_t pixel_count = image->getWidth() * image->getHeight();
+        luminance.resize(pixel_count);
+        ImageOps::convert(pixels, ImageOps::Format::ABGR, luminance.data(), ImageOps::Format::R8, pixel_count);
+        return luminance.data();
+}
+
+void Algorithm::enqueueImageKernel(cl::Kernel& kernel, unsigned int width, unsigned int height)
+{
+        // Enqueues the execution of the kernel with the tuned work-group size, leaving the output on the device
+        work_group_tuner.enqueue(command_queue, kernel, width, height);
+}
+
+void Algorithm::readImage(cl::Image2D& buffer, Image* out_image)
+{
         // Offset from which to begin reading
         cl::size_t<3> origin;
         origin[0] = 0;
@@ -261,5 +1151,12 @@ inline void Algorithm::executeImageKernel(cl::Kernel& kernel, cl::Image2D& out_b
         region[2] = 1;
 
         uint32_t* pixel_data = out_image->getPixels();
-        command_queue.enqueueReadImage(out_buffer, CL_TRUE, origin, region, 0, 0, pixel_data, NULL, NULL);
+        command_queue.enqueueReadImage(buffer, CL_TRUE, origin, region, 0, 0, pixel_data, NULL, NULL);
+        frame_statistics.bytes_downloaded += out_image->getWidth() * out_image->getHeight() * out_image->getBytesPerPixel();
+}
+
+inline void Algorithm::executeImageKernel(cl::Kernel& kernel, cl::Image2D& out_buffer, Image* out_image)
+{
+        enqueueImageKernel(kernel, out_image->getWidth(), out_image->getHeight());
+        readImage(out_buffer, out_image);
 }
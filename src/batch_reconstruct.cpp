@@ -0,0 +1,566 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include <SDL2/SDL_image.h>
+
+#include "compute_device.hpp"
+#include "frame_source_png.hpp"
+#include "frame_source_sequence.hpp"
+#include "graphics_factory_sdl.hpp"
+#include "manager.hpp"
+#include "segment_stitcher.hpp"
+#include "telemetry.hpp"
+#include "util.hpp"
+
+// Reconstructs every sequence of a manifest offline, running several pipelines side by side.
+// Pipelines are spread over the devices of the platform, each with its own command queue and
+// memory, while those on the same device share its compiled programs. Long sequences can be split
+// into overlapping segments that are reconstructed side by side and stitched together once the
+// last one finishes. Every sequence gets its own output directory, and its timings are written as
+// soon as it finishes.
+namespace
+{
+        // Queues beyond this many per device stop overlapping and only compete for its memory
+        const unsigned int MAX_PIPELINES_PER_DEVICE = 4;
+
+        // Job segment of a sequence reconstructed whole
+        const unsigned int WHOLE_SEQUENCE = UINT32_MAX;
+
+        struct Sequence
+        {
+                std::string name;
+                std::string footage;
+                Util::CameraConfig camera_config;
+                bool has_camera_config;
+        };
+
+        // Segments of a sequence finish in any order, the last to finish stitches them
+        struct SequenceProgress
+        {
+                std::vector<SegmentStitcher::Segment> segments;
+                std::atomic<unsigned int> remaining_segments{0};
+                std::atomic<unsigned int> failed_segments{0};
+                std::mutex mutex;
+                Manager::Timings timings;
+                std::string device_names;
+        };
+
+        struct Job
+        {
+                unsigned int sequence;
+                unsigned int segment;
+        };
+
+        struct Batch
+        {
+                std::vector<Sequence> sequences;
+                std::vector<SequenceProgress> progress;
+                std::vector<Job> jobs;
+                std::atomic<unsigned int> next_job{0};
+                std::string output_directory;
+                Util::VolumeConfig volume_config;
+                Algorithm::MatchingCost matching_cost;
+                unsigned int window_size;
+                unsigned int aggregated_range;
+                unsigned int aggregated_batch;
+                bool consistency_check;
+
+                // Summary lines are appended by whichever pipeline finishes
+                std::mutex summary_mutex;
+                std::ofstream summary;
+        };
+
+        bool isSequenceFile(std::string footage)
+        {
+                std::string sequence_extension = ".seq";
+                return footage.size() > sequence_extension.size() &&
+                        footage.compare(footage.size() - sequence_extension.size(), sequence_extension.size(), sequence_extension) == 0;
+        }
+
+        bool loadManifest(std::string filename, std::vector<Sequence>& sequences)
+        {
+                std::ifstream stream(filename.c_str());
+                if (!stream.good())
+                {
+                        std::cerr << "Could not open manifest " << filename << std::endl;
+                        return false;
+                }
+
+                // Each line is a name, the footage and, for PNG footage, the baseline in mm and focal length
+                std::string line;
+                unsigned int line_number = 0;
+                while (std::getline(stream, line))
+                {
+                        line_number++;
+                        std::istringstream fields(line);
+                        Sequence sequence;
+                        if (!(fields >> sequence.name) || sequence.name[0] == '#')
+                        {
+                                continue;
+                        }
+
+                        sequence.camera_config = Util::CameraConfig();
+                        sequence.camera_config.scale_x = 1;
+                        sequence.camera_config.scale_y = 1;
+                        sequence.has_camera_config = false;
+                        if (!(fields >> sequence.footage))
+                        {
+                                std::cerr << "Line " << line_number << " of " << filename << " has no footage" << std::endl;
+                                return false;
+                        }
+                        if (fields >> sequence.camera_config.baseline >> sequence.camera_config.focal_length)
+                        {
+                                sequence.has_camera_config = true;
+                        }
+                        else if (!isSequenceFile(sequence.footage))
+                        {
+                                std::cerr << "Line " << line_number << " of " << filename << " needs the baseline and focal length of its PNG footage" << std::endl;
+                                return false;
+                        }
+                        sequences.push_back(sequence);
+                }
+
+                if (sequences.empty())
+                {
+                        std::cerr << "No sequences in manifest " << filename << std::endl;
+                        return false;
+                }
+                return true;
+        }
+
+        bool createDirectory(std::string directory)
+        {
+                // Creates each missing parent in turn, as mkdir -p does
+                std::string::size_type separator = 0;
+                do
+                {
+                        separator = directory.find('/', separator + 1);
+                        std::string parent = directory.substr(0, separator);
+                        if (!parent.empty() && mkdir(parent.c_str(), 0755) != 0 && errno != EEXIST)
+                        {
+                                std::cerr << "Could not create output directory " << parent << std::endl;
+                                return false;
+                        }
+                } while (separator != std::string::npos);
+                return true;
+        }
+
+        FrameSource* openFrameSource(const Sequence& sequence, Util::CameraConfig& camera_config)
+        {
+                // Packed sequences carry their own camera configuration unless the manifest overrides it
+                camera_config = sequence.camera_config;
+                if (!isSequenceFile(sequence.footage))
+                {
+                        return new FrameSourcePng(sequence.footage);
+                }
+
+                FrameSourceSequence* frame_source_sequence = new FrameSourceSequence(sequence.footage);
+                if (!frame_source_sequence->isOpen())
+                {
+                        delete frame_source_sequence;
+                        return NULL;
+                }
+                if (!sequence.has_camera_config)
+                {
+                        camera_config = frame_source_sequence->getCameraConfig();
+                }
+                return frame_source_sequence;
+        }
+
+        void addTimings(Manager::Timings& total, const Manager::Timings& timings)
+        {
+                total.frame_count += timings.frame_count;
+                total.total_ms += timings.total_ms;
+                for (unsigned int stage = 0; stage < Telemetry::STAGE_COUNT; stage++)
+                {
+                        total.stage_ms[stage] += timings.stage_ms[stage];
+                }
+        }
+
+        void writeTimings(Batch& batch, const Sequence& sequence, std::string device_names, const Manager::Timings& timings,
+                unsigned int segment_count, double stitch_ms)
+        {
+                const char* stage_names[Telemetry::STAGE_COUNT] = { "disparity", "depth", "tracking", "fusion", "render" };
+                double frame_count = std::max(timings.frame_count, 1u);
+
+                std::string filename = batch.output_directory + "/" + sequence.name + "/timings.txt";
+                std::ofstream timings_file(filename.c_str());
+                timings_file << "device\t" << device_names << std::endl;
+                timings_file << "frames\t" << timings.frame_count << std::endl;
+                timings_file << "total_ms\t" << timings.total_ms << std::endl;
+                timings_file << "frame_ms\t" << timings.total_ms / frame_count << std::endl;
+
+                // Nothing is rendered offline
+                for (unsigned int stage = 0; stage < Telemetry::RENDER; stage++)
+                {
+                        timings_file << stage_names[stage] << "_ms\t" << timings.stage_ms[stage] / frame_count << std::endl;
+                }
+                timings_file << "segments\t" << segment_count << std::endl;
+                timings_file << "stitch_ms\t" << stitch_ms << std::endl;
+
+                // One line per sequence, in the order they finish
+                std::lock_guard<std::mutex> lock(batch.summary_mutex);
+                batch.summary << sequence.name << "\t" << device_names << "\t" << timings.frame_count << "\t"
+                        << timings.total_ms << "\t" << timings.total_ms / frame_count;
+                for (unsigned int stage = 0; stage < Telemetry::RENDER; stage++)
+                {
+                        batch.summary << "\t" << timings.stage_ms[stage] / frame_count;
+                }
+                batch.summary << "\t" << segment_count << "\t" << stitch_ms << std::endl;
+
+                std::cout << "Finished " << sequence.name << ": " << timings.frame_count << " frames in " << timings.total_ms << " ms" << std::endl;
+        }
+
+        void writeFailure(Batch& batch, const Sequence& sequence, std::string reason)
+        {
+                // Failed sequences still get a line, so a summary never silently lacks one
+                std::cerr << "Could not reconstruct " << sequence.name << ": " << reason << std::endl;
+
+                std::lock_guard<std::mutex> lock(batch.summary_mutex);
+                batch.summary << sequence.name << "\tfailed: " << reason << std::endl;
+        }
+
+        void stitchSequence(Batch& batch, unsigned int sequence_index)
+        {
+                // Frames shared by neighbouring segments are counted once per segment in the timings
+                const Sequence& sequence = batch.sequences[sequence_index];
+                SequenceProgress& progress = batch.progress[sequence_index];
+                std::string output_directory = batch.output_directory + "/" + sequence.name;
+
+                // Neighbours are aligned over their shared frames, so a missing segment breaks the chain
+                if (progress.failed_segments > 0)
+                {
+                        std::ostringstream reason;
+                        reason << progress.failed_segments << " of " << progress.segments.size() << " segments failed";
+                        writeFailure(batch, sequence, reason.str());
+                        return;
+                }
+
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                SegmentStitcher stitcher;
+                if (!stitcher.stitch(progress.segments, output_directory + "/volume.snapshot", output_directory + "/mesh.ply"))
+                {
+                        writeFailure(batch, sequence, "the segments could not be stitched");
+                        return;
+                }
+                double stitch_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+                writeTimings(batch, sequence, progress.device_names, progress.timings, progress.segments.size(), stitch_ms);
+        }
+
+        bool reconstructSegment(Batch& batch, const Job& job, ComputeDevice* compute_device)
+        {
+                const Sequence& sequence = batch.sequences[job.sequence];
+                SequenceProgress& progress = batch.progress[job.sequence];
+                std::string output_directory = batch.output_directory + "/" + sequence.name;
+                if (!createDirectory(output_directory))
+                {
+                        return false;
+                }
+
+                // Each segment streams its bricks and saves its volume into a directory of its own
+                if (job.segment != WHOLE_SEQUENCE)
+                {
+                        std::ostringstream segment_directory;
+                        segment_directory << output_directory << "/segment_" << std::setfill('0') << std::setw(3) << job.segment;
+                        output_directory = segment_directory.str();
+                        if (!createDirectory(output_directory))
+                        {
+                                return false;
+                        }
+                }
+
+                Util::CameraConfig camera_config;
+                FrameSource* frame_source = openFrameSource(sequence, camera_config);
+                if (frame_source == NULL)
+                {
+                        return false;
+                }
+
+                // Each pipeline owns its images, the factory outlives the manager using them
+                {
+                        GraphicsFactorySdl graphics_factory = GraphicsFactorySdl();
+                        Manager manager(&graphics_factory, frame_source, camera_config, batch.volume_config, compute_device);
+                        manager.setMatchingCost(batch.matching_cost, batch.window_size);
+                        if (!manager.isValid() || !manager.setAggregation(batch.aggregated_range, batch.aggregated_batch))
+                        {
+                                delete frame_source;
+                                return false;
+                        }
+                        manager.setConsistencyCheck(batch.consistency_check);
+                        manager.setOutputDirectory(output_directory);
+                        if (job.segment == WHOLE_SEQUENCE)
+                        {
+                                manager.process();
+                                manager.extractMesh();
+                                writeTimings(batch, sequence, compute_device->getName(), manager.getTimings(), 1, 0);
+                        }
+                        else
+                        {
+                                SegmentStitcher::Segment& segment = progress.segments[job.segment];
+                                manager.setFrameRange(segment.first_frame, segment.frame_count);
+                                manager.process();
+                                segment.camera_poses = manager.getCameraPoses();
+                                segment.snapshot_filename = output_directory + "/volume.snapshot";
+
+                                std::lock_guard<std::mutex> lock(progress.mutex);
+                                addTimings(progress.timings, manager.getTimings());
+                                std::string device_name = compute_device->getName();
+                                if (progress.device_names.find(device_name) == std::string::npos)
+                                {
+                                        progress.device_names += (progress.device_names.empty() ? "" : ",") + device_name;
+                                }
+                        }
+                }
+
+                delete frame_source;
+                return true;
+        }
+
+        void reconstructJob(Batch& batch, const Job& job, ComputeDevice* compute_device)
+        {
+                const Sequence& sequence = batch.sequences[job.sequence];
+                SequenceProgress& progress = batch.progress[job.sequence];
+                bool success = reconstructSegment(batch, job, compute_device);
+                if (job.segment == WHOLE_SEQUENCE)
+                {
+                        if (!success)
+                        {
+                                writeFailure(batch, sequence, "the footage, output directory or pipeline could not be set up");
+                        }
+                        return;
+                }
+
+                // Every segment counts down whether or not it succeeded, so the last always settles the sequence
+                if (!success)
+                {
+                        std::cerr << "Could not reconstruct segment " << job.segment << " of " << sequence.name << std::endl;
+                        progress.failed_segments++;
+                }
+                if (--progress.remaining_segments == 0)
+                {
+                        stitchSequence(batch, job.sequence);
+                }
+        }
+
+        void runPipeline(Batch& batch, ComputeDevice* compute_device)
+        {
+                // Takes the next job nobody has started until there are none left
+                unsigned int index;
+                while ((index = batch.next_job++) < batch.jobs.size())
+                {
+                        reconstructJob(batch, batch.jobs[index], compute_device);
+                }
+        }
+
+        bool planJobs(Batch& batch, unsigned int segment_length, unsigned int overlap)
+        {
+                // Sequences longer than a segment are split, the rest are reconstructed whole
+                batch.progress = std::vector<SequenceProgress>(batch.sequences.size());
+                for (unsigned int i = 0; i < batch.sequences.size(); i++)
+                {
+                        unsigned int frame_count = 0;
+                        if (segment_length > 0)
+                        {
+                                Util::CameraConfig camera_config;
+                                FrameSource* frame_source = openFrameSource(batch.sequences[i], camera_config);
+                                if (frame_source == NULL)
+                                {
+                                        return false;
+                                }
+                                frame_count = frame_source->getFrameCount();
+                                delete frame_source;
+                        }
+
+                        if (frame_count <= segment_length + overlap)
+                        {
+                                batch.jobs.push_back({ i, WHOLE_SEQUENCE });
+                                continue;
+                        }
+
+                        SequenceProgress& progress = batch.progress[i];
+                        progress.segments = SegmentStitcher::split(frame_count, segment_length, overlap);
+                        progress.remaining_segments = progress.segments.size();
+                        for (unsigned int segment = 0; segment < progress.segments.size(); segment++)
+                        {
+                                batch.jobs.push_back({ i, segment });
+                        }
+                        std::cout << batch.sequences[i].name << ": " << frame_count << " frames in " << progress.segments.size()
+                                << " segments" << std::endl;
+                }
+                return true;
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        if (argc < 2)
+        {
+                std::cerr << "Usage: " << argv[0] << " <manifest> [--output directory] [--jobs count] [--segment-length frames] [--overlap frames]"
+                        << " [--matching sad|sad-aggregated|census|census-host] [--window-size size]"
+                        << " [--aggregated-range disparities] [--aggregated-batch disparities] [--consistency-check]" << std::endl;
+                std::cerr << "  e.g. " << argv[0] << " res/batch.manifest --output out/batch" << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        Batch batch;
+        batch.output_directory = "out/batch";
+        batch.volume_config = Util::VolumeConfig();
+        batch.volume_config.voxel_size = 1.0f;
+        batch.matching_cost = Algorithm::MatchingCost::SAD;
+        batch.window_size = 9;
+        batch.aggregated_range = 64;
+        batch.aggregated_batch = 16;
+        batch.consistency_check = false;
+        unsigned int pipeline_count = 0;
+
+        // Segment length 0 reconstructs every sequence whole
+        unsigned int segment_length = 0;
+        unsigned int overlap = 8;
+
+        for (int i = 2; i < argc; i++)
+        {
+                std::string argument = argv[i];
+                bool has_value = i + 1 < argc;
+                if (argument == "--output" && has_value)
+                {
+                        batch.output_directory = argv[++i];
+                }
+                else if (argument == "--jobs" && has_value)
+                {
+                        pipeline_count = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--segment-length" && has_value)
+                {
+                        segment_length = std::max(0, atoi(argv[++i]));
+                }
+                else if (argument == "--overlap" && has_value)
+                {
+                        overlap = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--matching" && has_value)
+                {
+                        std::string cost = argv[++i];
+                        if (cost == "sad")
+                        {
+                                batch.matching_cost = Algorithm::MatchingCost::SAD;
+                        }
+                        else if (cost == "sad-aggregated")
+                        {
+                                batch.matching_cost = Algorithm::MatchingCost::SAD_AGGREGATED;
+                        }
+                        else if (cost == "census")
+                        {
+                                batch.matching_cost = Algorithm::MatchingCost::CENSUS;
+                        }
+                        else if (cost == "census-host")
+                        {
+                                batch.matching_cost = Algorithm::MatchingCost::CENSUS_HOST;
+                        }
+                        else
+                        {
+                                std::cerr << "Unknown matching cost " << cost << ", expected sad, sad-aggregated, census or census-host" << std::endl;
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (argument == "--window-size" && has_value)
+                {
+                        batch.window_size = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--aggregated-range" && has_value)
+                {
+                        batch.aggregated_range = std::max(0, atoi(argv[++i]));
+                }
+                else if (argument == "--aggregated-batch" && has_value)
+                {
+                        batch.aggregated_batch = std::max(0, atoi(argv[++i]));
+                }
+                else if (argument == "--consistency-check")
+                {
+                        batch.consistency_check = true;
+                }
+                else
+                {
+                        std::cerr << "Unknown argument " << argument << std::endl;
+                        return EXIT_FAILURE;
+                }
+        }
+
+        if (!loadManifest(argv[1], batch.sequences) || !createDirectory(batch.output_directory))
+        {
+                return EXIT_FAILURE;
+        }
+
+        int flags = IMG_INIT_PNG;
+        if ((IMG_Init(flags) & flags) != flags)
+        {
+                std::cerr << "Failed to initialise SDL_image" << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        if (!planJobs(batch, segment_length, overlap))
+        {
+                return EXIT_FAILURE;
+        }
+
+        // One pipeline per core by default, each keeps a core busy decoding frames and running the
+        // host stages, with no more pipelines than jobs or than the devices can overlap
+        std::vector<cl::Device> devices = ComputeDevice::getDevices();
+        unsigned int core_count = std::max(1u, std::thread::hardware_concurrency());
+        if (pipeline_count == 0)
+        {
+                pipeline_count = std::min(core_count, (unsigned int) devices.size() * MAX_PIPELINES_PER_DEVICE);
+        }
+        pipeline_count = std::min(pipeline_count, (unsigned int) batch.jobs.size());
+
+        // Pipelines are dealt out to the devices in turn, so each device only builds its programs once
+        std::vector<ComputeDevice*> compute_devices;
+        for (unsigned int i = 0; i < std::min(pipeline_count, (unsigned int) devices.size()); i++)
+        {
+                compute_devices.push_back(new ComputeDevice(devices[i]));
+        }
+        for (unsigned int i = 0; i < compute_devices.size(); i++)
+        {
+                compute_devices[i]->setPipelineCount((pipeline_count - i + compute_devices.size() - 1) / compute_devices.size());
+                compute_devices[i]->setHostPipelineCount(pipeline_count);
+        }
+
+        std::string summary_filename = batch.output_directory + "/summary.tsv";
+        batch.summary.open(summary_filename.c_str());
+        if (!batch.summary.good())
+        {
+                std::cerr << "Could not write summary " << summary_filename << std::endl;
+                return EXIT_FAILURE;
+        }
+        batch.summary << "sequence\tdevice\tframes\ttotal_ms\tframe_ms\tdisparity_ms\tdepth_ms\ttracking_ms\tfusion_ms\tsegments\tstitch_ms" << std::endl;
+
+        std::cout << "Reconstructing " << batch.sequences.size() << " sequences as " << batch.jobs.size() << " jobs with "
+                << pipeline_count << " pipelines on " << compute_devices.size() << " devices" << std::endl;
+        std::vector<std::thread> pipelines;
+        for (unsigned int i = 0; i < pipeline_count; i++)
+        {
+                pipelines.push_back(std::thread(runPipeline, std::ref(batch), compute_devices[i % compute_devices.size()]));
+        }
+        for (std::thread& pipeline : pipelines)
+        {
+                pipeline.join();
+        }
+
+        for (ComputeDevice* compute_device : compute_devices)
+        {
+                delete compute_device;
+        }
+
+        return EXIT_SUCCESS;
+}
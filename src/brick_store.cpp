@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#include "brick_store.hpp"
+#include "volume_snapshot.hpp"
+
+BrickStore::BrickStore()
+{
+        // Default empty constructor
+}
+
+BrickStore::~BrickStore()
+{
+        close();
+}
+
+bool BrickStore::open(std::string filename, unsigned int brick_width)
+{
+        close();
+
+        // Each session starts with an empty store
+        m_file_descriptor = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_file_descriptor == -1)
+        {
+                std::cerr << "Could not open brick store " << filename << std::endl;
+                return false;
+        }
+
+        m_brick_width = brick_width;
+        m_brick_voxel_count = (size_t) brick_width * brick_width * brick_width;
+        m_end_offset = 0;
+
+        m_stopping = false;
+        m_writer = std::thread(&BrickStore::writeLoop, this);
+        return true;
+}
+
+void BrickStore::close()
+{
+        if (m_file_descriptor == -1)
+        {
+                return;
+        }
+
+        // Drains the queue before stopping the writer
+        {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+        }
+        m_queue_condition.notify_all();
+        m_writer.join();
+
+        ::close(m_file_descriptor);
+        m_file_descriptor = -1;
+        m_index.clear();
+        m_pending.clear();
+        m_queued.clear();
+}
+
+bool BrickStore::isOpen()
+{
+        return m_file_descriptor != -1;
+}
+
+void BrickStore::store(int brick_x, int brick_y, int brick_z, const int* voxels)
+{
+        Key key(brick_x, brick_y, brick_z);
+
+        bool empty = true;
+        for (size_t i = 0; i < m_brick_voxel_count && empty; i++)
+        {
+                empty = voxels[i] == 0;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Empty space that was never stored doesn't need a record
+        bool known = m_index.find(key) != m_index.end() || m_pending.find(key) != m_pending.end();
+        if (empty && !known)
+        {
+                return;
+        }
+
+        // Queues a copy of the brick, replacing any version still waiting to be written
+        if (m_queued.insert(key).second)
+        {
+                m_queue.push_back(key);
+        }
+        Pending& pending = m_pending[key];
+        pending.generation = m_generation++;
+        pending.voxels.assign(voxels, voxels + m_brick_voxel_count);
+        m_queue_condition.notify_one();
+}
+
+bool BrickStore::load(int brick_x, int brick_y, int brick_z, int* voxels)
+{
+        Key key(brick_x, brick_y, brick_z);
+        uint64_t offset;
+        {
+                std::lock_guard<std::mutex> lock(m_mutex);
+
+                // Bricks still queued are served from memory
+                std::map<Key, Pending>::iterator pending = m_pending.find(key);
+                if (pending != m_pending.end())
+                {
+                        std::copy(pending->second.voxels.begin(), pending->second.voxels.end(), voxels);
+                        return true;
+                }
+
+                std::map<Key, uint64_t>::iterator entry = m_index.find(key);
+                if (entry == m_index.end())
+                {
+                        return false;
+                }
+                offset = entry->second;
+        }
+
+        Record record;
+        if (pread(m_file_descriptor, &record, sizeof(record), offset) != sizeof(record))
+        {
+                std::cerr << "Failed to read brick record" << std::endl;
+                return false;
+        }
+
+        std::vector<int> encoded(record.encoded_size_in_bytes / sizeof(int));
+        ssize_t size_in_bytes = record.encoded_size_in_bytes;
+        if (pread(m_file_descriptor, encoded.data(), size_in_bytes, offset + sizeof(record)) != size_in_bytes ||
+                !Snapshot::decode(encoded, voxels, m_brick_voxel_count))
+        {
+                std::cerr << "Brick (" << brick_x << ", " << brick_y << ", " << brick_z << ") is corrupt" << std::endl;
+                return false;
+        }
+
+        return true;
+}
+
+void BrickStore::flush()
+{
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle_condition.wait(lock, [this]() { return m_queue.empty() && !m_writing; });
+}
+
+void BrickStore::writeLoop()
+{
+        std::vector<int> voxels;
+        std::vector<int> encoded;
+        while (true)
+        {
+                Key key;
+                uint64_t generation;
+                {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_queue_condition.wait(lock, [this]() { return !m_queue.empty() || m_stopping; });
+                        if (m_queue.empty())
+                        {
+                                return;
+                        }
+
+                        key = m_queue.front();
+                        m_queue.pop_front();
+                        m_queued.erase(key);
+                        Pending& pending = m_pending[key];
+                        generation = pending.generation;
+                        voxels = pending.voxels;
+                        m_writing = true;
+                }
+
+                // Encodes and appends the brick without holding the lock
+                Snapshot::encode(voxels.data(), voxels.size(), encoded);
+                Record record;
+                record.brick_x = std::get<0>(key);
+                record.brick_y = std::get<1>(key);
+                record.brick_z = std::get<2>(key);
+                record.brick_width = m_brick_width;
+                record.encoded_size_in_bytes = encoded.size() * sizeof(int);
+
+                uint64_t offset = m_end_offset;
+                bool written =
+                        pwrite(m_file_descriptor, &record, sizeof(record), offset) == sizeof(record) &&
+                        pwrite(m_file_descriptor, encoded.data(), record.encoded_size_in_bytes, offset + sizeof(record)) == (ssize_t) record.encoded_size_in_bytes;
+
+                {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if (written)
+                        {
+                                m_end_offset += sizeof(record) + record.encoded_size_in_bytes;
+                                m_index[key] = offset;
+                        }
+                        else
+                        {
+                                std::cerr << "Failed to write brick, keeping it in memory" << std::endl;
+                        }
+
+                        // A newer version queued meanwhile stays pending
+                        std::map<Key, Pending>::iterator pending = m_pending.find(key);
+                        if (written && pending != m_pending.end() && pending->second.generation == generation)
+                        {
+                                m_pending.erase(pending);
+                        }
+                        m_writing = false;
+                }
+                m_idle_condition.notify_all();
+        }
+}
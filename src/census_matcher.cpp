@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <thread>
+
+#include "census_matcher.hpp"
+#include "disparity_format.hpp"
+
+namespace
+{
+        // Finds the disparity of each pixel in a run of rows, comparing against every candidate within
+        // max_disparity in the row as the disparity kernel does. Inlined into both variants below so the popcount builtin
+        // compiles to the popcnt instruction where the target allows it.
+        inline __attribute__((always_inline)) void matchRowRange(const uint64_t* left, const uint64_t* right,
+                unsigned int width, unsigned int max_disparity, unsigned int first_row, unsigned int row_count, uint16_t* disparity)
+        {
+                for (unsigned int y = first_row; y < first_row + row_count; y++)
+                {
+                        const uint64_t* left_row = left + (size_t) y * width;
+                        const uint64_t* right_row = right + (size_t) y * width;
+                        for (unsigned int x = 0; x < width; x++)
+                        {
+                                uint64_t descriptor = right_row[x];
+                                int minimum_distance = 65;
+                                unsigned int best_x = x;
+                                int previous_distance = -1;
+                                int distance_before = -1;
+                                int distance_after = -1;
+                                unsigned int first_x = x > max_disparity ? x - max_disparity : 0;
+                                unsigned int end_x = std::min(x + max_disparity + 1, width);
+                                for (unsigned int window_x = first_x; window_x < end_x; window_x++)
+                                {
+                                        int distance = __builtin_popcountll(left_row[window_x] ^ descriptor);
+                                        if (distance < minimum_distance)
+                                        {
+                                                minimum_distance = distance;
+                                                best_x = window_x;
+                                                distance_before = previous_distance;
+                                                distance_after = -1;
+                                        }
+                                        else if (window_x == best_x + 1)
+                                        {
+                                                distance_after = distance;
+                                        }
+                                        previous_distance = distance;
+                                }
+
+                                disparity[(size_t) y * width + x] = Disparity::subPixel(best_x, x, distance_before, minimum_distance, distance_after);
+                        }
+                }
+        }
+
+        void matchRowRangeGeneric(const uint64_t* left, const uint64_t* right, unsigned int width,
+                unsigned int max_disparity, unsigned int first_row, unsigned int row_count, uint16_t* disparity)
+        {
+                matchRowRange(left, right, width, max_disparity, first_row, row_count, disparity);
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        __attribute__((target("popcnt"))) void matchRowRangePopcount(const uint64_t* left, const uint64_t* right,
+                unsigned int width, unsigned int max_disparity, unsigned int first_row, unsigned int row_count, uint16_t* disparity)
+        {
+                matchRowRange(left, right, width, max_disparity, first_row, row_count, disparity);
+        }
+#endif
+}
+
+CensusMatcher::CensusMatcher()
+{
+        m_thread_count = std::max(1u, std::thread::hardware_concurrency());
+        m_hardware_popcount = hasHardwarePopcount();
+}
+
+void CensusMatcher::match(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+        unsigned int max_disparity, uint16_t* disparity)
+{
+        m_width = width;
+        m_height = height;
+        m_max_disparity = max_disparity;
+        m_left_descriptors.resize((size_t) width * height);
+        m_right_descriptors.resize((size_t) width * height);
+        transform(left, width, height, m_left_descriptors.data());
+        transform(right, width, height, m_right_descriptors.data());
+
+        // Splits the rows evenly between the threads, every row costs the same
+        unsigned int rows_per_thread = (height + m_thread_count - 1) / m_thread_count;
+        std::vector<std::thread> threads;
+        for (unsigned int first_row = 0; first_row < height; first_row += rows_per_thread)
+        {
+                unsigned int row_count = std::min(rows_per_thread, height - first_row);
+                threads.push_back(std::thread(&CensusMatcher::matchRows, this, first_row, row_count, disparity));
+        }
+
+        for (std::thread& thread : threads)
+        {
+                thread.join();
+        }
+}
+
+void CensusMatcher::transform(const uint8_t* luminance, unsigned int width, unsigned int height, uint64_t* descriptors)
+{
+        // Neighbours outside the image read as 0, matching the clamping sampler of the kernels
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        uint8_t centre = luminance[(size_t) y * width + x];
+                        uint64_t descriptor = 0;
+                        for (int j = -WINDOW_HEIGHT / 2; j <= WINDOW_HEIGHT / 2; j++)
+                        {
+                                for (int i = -WINDOW_WIDTH / 2; i <= WINDOW_WIDTH / 2; i++)
+                                {
+                                        if (i == 0 && j == 0)
+                                        {
+                                                continue;
+                                        }
+
+                                        int neighbour_x = x + i;
+                                        int neighbour_y = y + j;
+                                        bool inside = neighbour_x >= 0 && neighbour_x < (int) width && neighbour_y >= 0 && neighbour_y < (int) height;
+                                        uint8_t neighbour = inside ? luminance[(size_t) neighbour_y * width + neighbour_x] : 0;
+                                        descriptor = (descriptor << 1) | (neighbour < centre);
+                                }
+                        }
+                        descriptors[(size_t) y * width + x] = descriptor;
+                }
+        }
+}
+
+bool CensusMatcher::hasHardwarePopcount()
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_cpu_supports("popcnt");
+#else
+        return false;
+#endif
+}
+
+void CensusMatcher::matchRows(unsigned int first_row, unsigned int row_count, uint16_t* disparity)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        if (m_hardware_popcount)
+        {
+                matchRowRangePopcount(m_left_descriptors.data(), m_right_descriptors.data(), m_width, m_max_disparity, first_row, row_count, disparity);
+                return;
+        }
+#endif
+        matchRowRangeGeneric(m_left_descriptors.data(), m_right_descriptors.data(), m_width, m_max_disparity, first_row, row_count, disparity);
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#include "compute_device.hpp"
+
+ComputeDevice::ComputeDevice(const cl::Device& device)
+{
+        m_device = device;
+        std::cout << "Using device: " << getName() << std::endl;
+
+        m_context = cl::Context({m_device});
+
+        // Loads and builds the generic kernels, specialised variants are built as they are needed
+        std::string kernel_code = loadSource("src/kernels/reconstruction.cl");
+        std::cout << "Loaded kernel" << std::endl << "Building kernel..." << std::endl;
+        m_kernel_variants.initialise(m_context, m_device, kernel_code);
+        m_kernel_variants.getProgram("");
+}
+
+cl::Device ComputeDevice::getDefaultDevice()
+{
+        // Retrieves the default device of the platform
+        std::vector<cl::Device> devices;
+        getPlatform().getDevices(CL_DEVICE_TYPE_DEFAULT, &devices);
+        if (devices.size() == 0)
+        {
+                std::cerr << "No devices found, check OpencL installation." << std::endl;
+                exit(EXIT_FAILURE);
+        }
+        return devices.at(0);
+}
+
+std::vector<cl::Device> ComputeDevice::getDevices()
+{
+        // Every device of the platform, GPUs first as they take the bulk of the work
+        std::vector<cl::Device> devices;
+        getPlatform().getDevices(CL_DEVICE_TYPE_ALL, &devices);
+        if (devices.size() == 0)
+        {
+                std::cerr << "No devices found, check OpencL installation." << std::endl;
+                exit(EXIT_FAILURE);
+        }
+        std::stable_sort(devices.begin(), devices.end(), [](const cl::Device& a, const cl::Device& b)
+        {
+                cl_device_type a_type = a.getInfo<CL_DEVICE_TYPE>();
+                cl_device_type b_type = b.getInfo<CL_DEVICE_TYPE>();
+                return (a_type & CL_DEVICE_TYPE_GPU) > (b_type & CL_DEVICE_TYPE_GPU);
+        });
+        return devices;
+}
+
+const cl::Device& ComputeDevice::getDevice()
+{
+        return m_device;
+}
+
+const cl::Context& ComputeDevice::getContext()
+{
+        return m_context;
+}
+
+KernelVariants& ComputeDevice::getKernelVariants()
+{
+        return m_kernel_variants;
+}
+
+std::string ComputeDevice::getName()
+{
+        // Some bindings keep the terminating null in the returned string
+        std::string name = m_device.getInfo<CL_DEVICE_NAME>();
+        return std::string(name.c_str());
+}
+
+void ComputeDevice::setPipelineCount(unsigned int pipeline_count)
+{
+        m_pipeline_count = std::max(pipeline_count, 1u);
+}
+
+unsigned int ComputeDevice::getPipelineCount()
+{
+        return m_pipeline_count;
+}
+
+void ComputeDevice::setHostPipelineCount(unsigned int host_pipeline_count)
+{
+        m_host_pipeline_count = std::max(host_pipeline_count, 1u);
+}
+
+unsigned int ComputeDevice::getHostPipelineCount()
+{
+        return m_host_pipeline_count;
+}
+
+cl::Platform ComputeDevice::getPlatform()
+{
+        // Retrieves the OpenCL platform to be used
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        if (platforms.size() == 0)
+        {
+                std::cerr << "No platforms found, check OpencL installation." << std::endl;
+                exit(EXIT_FAILURE);
+        }
+        cl::Platform platform = platforms.at(0);
+        std::cout << "Using platform: " << platform.getInfo<CL_PLATFORM_NAME>() << std::endl;
+        return platform;
+}
+
+std::string ComputeDevice::loadSource(std::string filename)
+{
+        std::ifstream t(filename);
+        std::stringstream buffer;
+        buffer << t.rdbuf();
+        return buffer.str();
+}
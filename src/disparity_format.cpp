@@ -0,0 +1,27 @@
+#include <cstdlib>
+
+#include "disparity_format.hpp"
+
+namespace Disparity
+{
+        uint16_t subPixel(int window_x, int x, int cost_before, int cost, int cost_after)
+        {
+                const int scale = 1 << FRACTION_BITS;
+                int disparity = std::abs(window_x - x);
+                if (disparity == 0 || disparity > (0xFFFF >> FRACTION_BITS))
+                {
+                        return 0;
+                }
+
+                int curvature = cost_before - 2 * cost + cost_after;
+                if (cost_before < 0 || cost_after < 0 || curvature <= 0)
+                {
+                        return disparity * scale;
+                }
+
+                // Rounded to the nearest step, half steps away from zero
+                int numerator = (cost_before - cost_after) * scale;
+                int offset = (numerator >= 0 ? numerator + curvature : numerator - curvature) / (2 * curvature);
+                return window_x > x ? disparity * scale + offset : disparity * scale - offset;
+        }
+};
@@ -0,0 +1,17 @@
+#include "frame_source.hpp"
+
+FrameSource::~FrameSource()
+{
+        // Default empty destructor
+}
+
+unsigned int FrameSource::getFrameCount()
+{
+        // Sources which can't know their length up front report zero frames
+        return 0;
+}
+
+void FrameSource::stop()
+{
+        // Sources that never wait on input have nothing to interrupt
+}
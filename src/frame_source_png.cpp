@@ -0,0 +1,62 @@
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "frame_source_png.hpp"
+
+FrameSourcePng::FrameSourcePng(std::string footage_directory)
+{
+        m_footage_directory = footage_directory;
+}
+
+Image* FrameSourcePng::createFrameImage(GraphicsFactory* graphics_factory)
+{
+        // Decoded images are resized on load
+        return graphics_factory->createImage(1, 1, 1);
+}
+
+bool FrameSourcePng::loadFrame(unsigned int frame_index, Image* left, Image* right)
+{
+        // Loads the left frame
+        std::string filename = getFilename(m_footage_directory, "l_", frame_index);
+        std::ifstream image_stream = std::ifstream(filename.c_str());
+        if (!image_stream.good())
+        {
+                std::cout << "End of footage" << std::endl;
+                return false;
+        }
+        left->load(filename);
+
+        // Loads the right frame
+        filename = getFilename(m_footage_directory, "r_", frame_index);
+        image_stream = std::ifstream(filename.c_str());
+        if (!image_stream.good())
+        {
+                std::cout << std::endl << "End of footage" << std::endl;
+                return false;
+        }
+        right->load(filename);
+
+        return true;
+}
+
+unsigned int FrameSourcePng::getFrameCount()
+{
+        // Footage runs until the first missing pair
+        unsigned int frame_count = 0;
+        while (std::ifstream(getFilename(m_footage_directory, "l_", frame_count).c_str()).good() &&
+                std::ifstream(getFilename(m_footage_directory, "r_", frame_count).c_str()).good())
+        {
+                frame_count++;
+        }
+        return frame_count;
+}
+
+std::string FrameSourcePng::getFilename(std::string footage_directory, std::string side, unsigned int frame_index)
+{
+        std::string extension = ".png";
+        std::stringstream filename_stream;
+        filename_stream << footage_directory << side << std::setfill('0') << std::setw(4) << frame_index << extension;
+        return filename_stream.str();
+}
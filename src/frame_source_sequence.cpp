@@ -0,0 +1,50 @@
+#include <iostream>
+
+#include "frame_source_sequence.hpp"
+#include "image_mapped.hpp"
+
+FrameSourceSequence::FrameSourceSequence(std::string filename)
+{
+        m_open = m_reader.open(filename);
+}
+
+bool FrameSourceSequence::isOpen()
+{
+        return m_open;
+}
+
+Util::CameraConfig FrameSourceSequence::getCameraConfig()
+{
+        return m_reader.getCameraConfig();
+}
+
+Image* FrameSourceSequence::createFrameImage(GraphicsFactory* graphics_factory)
+{
+        unsigned int words_per_pixel = 1;
+        Image* image = graphics_factory->createImageMapped(m_reader.getWidth(), m_reader.getHeight(), words_per_pixel);
+        static_cast<ImageMapped*>(image)->setBytesPerPixel(Sequence::getBytesPerPixel(m_reader.getPixelFormat()));
+        return image;
+}
+
+bool FrameSourceSequence::loadFrame(unsigned int frame_index, Image* left, Image* right)
+{
+        if (!m_open || frame_index >= m_reader.getFrameCount())
+        {
+                std::cout << std::endl << "End of footage" << std::endl;
+                return false;
+        }
+
+        // The images were created by createFrameImage(), so they only need pointing at the mapping
+        static_cast<ImageMapped*>(left)->map(m_reader.getLeftPixels(frame_index));
+        static_cast<ImageMapped*>(right)->map(m_reader.getRightPixels(frame_index));
+
+        // Pages in the next frame while this one is processed
+        m_reader.prefetch(frame_index + 1);
+
+        return true;
+}
+
+unsigned int FrameSourceSequence::getFrameCount()
+{
+        return m_reader.getFrameCount();
+}
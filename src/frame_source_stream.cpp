@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "frame_source_stream.hpp"
+#include "image_mapped.hpp"
+#include "image_ops.hpp"
+#include "sequence_file.hpp"
+
+FrameSourceStream::FrameSourceStream(std::string address)
+{
+        m_fd = Stream::openInput(address);
+        if (m_fd < 0)
+        {
+                return;
+        }
+
+        // The header describes every frame that follows
+        if (!Stream::readFully(m_fd, &m_header, sizeof(m_header), NULL) ||
+                memcmp(m_header.magic, Stream::MAGIC, sizeof(Stream::MAGIC)) != 0 || m_header.version != Stream::VERSION)
+        {
+                std::cerr << "Stream " << address << " is invalid" << std::endl;
+                return;
+        }
+
+        unsigned int bytes_per_pixel = Sequence::getBytesPerPixel(m_header.pixel_format);
+        if (bytes_per_pixel == 0 || (m_header.compression != Stream::RAW && m_header.compression != Stream::PNG))
+        {
+                std::cerr << "Stream " << address << " has an unsupported pixel format or compression" << std::endl;
+                return;
+        }
+        if (m_header.width == 0 || m_header.height == 0 || m_header.width > Stream::MAX_FRAME_SIDE || m_header.height > Stream::MAX_FRAME_SIDE)
+        {
+                std::cerr << "Stream " << address << " has an invalid frame size " << m_header.width << "x" << m_header.height << std::endl;
+                return;
+        }
+        m_frame_size_in_bytes = (size_t) m_header.width * m_header.height * bytes_per_pixel;
+
+        // A PNG frame holds at most 4 bytes and a filter byte per row of each pixel, and deflate adds
+        // only a few bytes per block it cannot compress, so twice the RGBA size bounds any valid frame
+        m_max_encoded_size_in_bytes = (size_t) m_header.width * m_header.height * 4 * 2 + 65536;
+
+        // Whole words, as the images address pixels as uint32_t
+        size_t word_count = (m_frame_size_in_bytes + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+        m_slots.resize(SLOT_COUNT);
+        for (unsigned int i = 0; i < SLOT_COUNT; i++)
+        {
+                m_slots[i].left.resize(word_count);
+                m_slots[i].right.resize(word_count);
+                m_free_slots.push_back(i);
+        }
+
+        m_open = true;
+        m_reader = std::thread(&FrameSourceStream::readLoop, this);
+}
+
+FrameSourceStream::~FrameSourceStream()
+{
+        stop();
+
+        if (m_reader.joinable())
+        {
+                m_reader.join();
+        }
+        if (m_fd > STDERR_FILENO)
+        {
+                close(m_fd);
+        }
+}
+
+void FrameSourceStream::stop()
+{
+        // Wakes the reader thread and any loadFrame waiting for a frame, neither waits for the sender again
+        {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stopping = true;
+        }
+        m_slot_freed.notify_all();
+        m_slot_filled.notify_all();
+}
+
+bool FrameSourceStream::isOpen()
+{
+        return m_open;
+}
+
+Util::CameraConfig FrameSourceStream::getCameraConfig()
+{
+        return Stream::getCameraConfig(m_header);
+}
+
+Image* FrameSourceStream::createFrameImage(GraphicsFactory* graphics_factory)
+{
+        unsigned int words_per_pixel = 1;
+        Image* image = graphics_factory->createImageMapped(m_header.width, m_header.height, words_per_pixel);
+        static_cast<ImageMapped*>(image)->setBytesPerPixel(Sequence::getBytesPerPixel(m_header.pixel_format));
+        return image;
+}
+
+bool FrameSourceStream::loadFrame(unsigned int frame_index, Image* left, Image* right)
+{
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // The pipeline is done with the previous frame once it asks for the next
+        if (m_current_slot >= 0)
+        {
+                m_free_slots.push_back(m_current_slot);
+                m_current_slot = -1;
+                m_slot_freed.notify_one();
+        }
+
+        while (m_open && !m_stopping)
+        {
+                // Wakes up periodically, so a sender that stalls can't hold up shutdown
+                if (!m_slot_filled.wait_for(lock, std::chrono::milliseconds(100),
+                        [this]() { return !m_filled_slots.empty() || m_finished || m_stopping; }))
+                {
+                        continue;
+                }
+                if (m_stopping || m_filled_slots.empty())
+                {
+                        break;
+                }
+
+                unsigned int slot = m_filled_slots.front();
+                m_filled_slots.pop_front();
+
+                // Frames older than the one asked for are stale (e.g. skipped by the real-time scheduler)
+                if (m_slots[slot].frame_index < frame_index)
+                {
+                        m_free_slots.push_back(slot);
+                        m_slot_freed.notify_one();
+                        continue;
+                }
+
+                m_current_slot = slot;
+                static_cast<ImageMapped*>(left)->map(m_slots[slot].left.data());
+                static_cast<ImageMapped*>(right)->map(m_slots[slot].right.data());
+                return true;
+        }
+
+        if (!m_stopping)
+        {
+                std::cout << std::endl << "End of stream" << std::endl;
+        }
+        return false;
+}
+
+void FrameSourceStream::readLoop()
+{
+        while (true)
+        {
+                // Holds off reading until the pipeline frees a slot, applying backpressure to the sender
+                unsigned int slot;
+                {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_slot_freed.wait(lock, [this]() { return !m_free_slots.empty() || m_stopping; });
+                        if (m_stopping)
+                        {
+                                break;
+                        }
+                        slot = m_free_slots.front();
+                        m_free_slots.pop_front();
+                }
+
+                bool success = readFrame(m_slots[slot]);
+
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!success)
+                {
+                        m_free_slots.push_back(slot);
+                        break;
+                }
+                m_filled_slots.push_back(slot);
+                m_slot_filled.notify_one();
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished = true;
+        m_slot_filled.notify_all();
+}
+
+bool FrameSourceStream::readFrame(Slot& slot)
+{
+        Stream::FrameHeader frame_header;
+        if (!Stream::readFully(m_fd, &frame_header, sizeof(frame_header), &m_stopping))
+        {
+                return false;
+        }
+
+        slot.frame_index = frame_header.frame_index;
+        return readPayload(frame_header.left_size_in_bytes, slot.left) && readPayload(frame_header.right_size_in_bytes, slot.right);
+}
+
+bool FrameSourceStream::readPayload(size_t size_in_bytes, std::vector<uint32_t>& pixels)
+{
+        // Raw frames are read straight into the slot
+        if (m_header.compression == Stream::RAW)
+        {
+                if (size_in_bytes != m_frame_size_in_bytes)
+                {
+                        std::cerr << "Stream frame of " << size_in_bytes << " bytes, expected " << m_frame_size_in_bytes << std::endl;
+                        return false;
+                }
+                return Stream::readFully(m_fd, pixels.data(), size_in_bytes, &m_stopping);
+        }
+
+        // The size comes off the wire, so is checked before anything is allocated for it
+        if (size_in_bytes > m_max_encoded_size_in_bytes)
+        {
+                std::cerr << "Stream frame of " << size_in_bytes << " bytes, at most " << m_max_encoded_size_in_bytes << " expected" << std::endl;
+                return false;
+        }
+        m_encoded.resize(size_in_bytes);
+        return Stream::readFully(m_fd, m_encoded.data(), size_in_bytes, &m_stopping) && decodePng(pixels);
+}
+
+bool FrameSourceStream::decodePng(std::vector<uint32_t>& pixels)
+{
+        SDL_Surface* loaded = IMG_Load_RW(SDL_RWFromConstMem(m_encoded.data(), m_encoded.size()), 1);
+        if (loaded == NULL)
+        {
+                std::cerr << "Failed to decode stream frame, SDL error " << SDL_GetError() << std::endl;
+                return false;
+        }
+
+        // Byte order R, G, B, A as in packed sequences
+        SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ABGR8888, 0);
+        SDL_FreeSurface(loaded);
+        if (converted == NULL || (unsigned int) converted->w != m_header.width || (unsigned int) converted->h != m_header.height)
+        {
+                std::cerr << "Stream frame does not match the stream dimensions" << std::endl;
+                SDL_FreeSurface(converted);
+                return false;
+        }
+
+        uint8_t* destination = (uint8_t*) pixels.data();
+        for (int y = 0; y < converted->h; y++)
+        {
+                const uint8_t* row = (const uint8_t*) converted->pixels + y * converted->pitch;
+                if (m_header.pixel_format == Sequence::LUMA8)
+                {
+                        // Same weights as the device conversion
+                        ImageOps::convert(row, ImageOps::Format::ABGR, destination, ImageOps::Format::R8, converted->w);
+                        destination += converted->w;
+                }
+                else
+                {
+                        memcpy(destination, row, converted->w * sizeof(uint32_t));
+                        destination += converted->w * sizeof(uint32_t);
+                }
+        }
+
+        SDL_FreeSurface(converted);
+        return true;
+}
@@ -1,4 +1,5 @@
 #include "graphics_factory.hpp"
+#include "image_mapped.hpp"
 #include "image_memory.hpp"
 
 GraphicsFactory::~GraphicsFactory()
@@ -20,3 +21,10 @@ Image* GraphicsFactory::createImageMemory(unsigned int width, unsigned int heigh
         images.push_back(image);
         return image;
 }
+
+Image* GraphicsFactory::createImageMapped(unsigned int width, unsigned int height, unsigned int words_per_pixel)
+{
+        Image* image = new ImageMapped(width, height, words_per_pixel);
+        images.push_back(image);
+        return image;
+}
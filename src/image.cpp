@@ -24,3 +24,8 @@ unsigned int Image::getWordsPerPixel()
 {
         return m_words_per_pixel;
 }
+
+unsigned int Image::getBytesPerPixel()
+{
+        return m_words_per_pixel * sizeof(uint32_t);
+}
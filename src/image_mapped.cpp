@@ -0,0 +1,61 @@
+#include <cstring>
+
+#include "image_mapped.hpp"
+#include "image_ops.hpp"
+
+ImageMapped::ImageMapped(unsigned int width, unsigned int height, unsigned int words_per_pixel)
+{
+        m_width = width;
+        m_height = height;
+        m_words_per_pixel = words_per_pixel;
+        m_bytes_per_pixel = words_per_pixel * sizeof(uint32_t);
+}
+
+uint32_t* ImageMapped::getPixels()
+{
+        return m_data;
+}
+
+unsigned int ImageMapped::getBytesPerPixel()
+{
+        return m_bytes_per_pixel;
+}
+
+void ImageMapped::setBytesPerPixel(unsigned int bytes_per_pixel)
+{
+        // Allows sub-word pixels (e.g. 8-bit luminance) to be described
+        m_bytes_per_pixel = bytes_per_pixel;
+}
+
+void ImageMapped::map(uint32_t* pixels)
+{
+        // Points the image at the new pixel data without copying it
+        m_data = pixels;
+}
+
+void ImageMapped::load(std::string filename)
+{
+        // No implementation
+}
+
+void ImageMapped::save(std::string prefix)
+{
+        // No implementation
+}
+
+void ImageMapped::fill(unsigned int colour)
+{
+        if (m_data == NULL)
+        {
+                return;
+        }
+
+        // Single byte pixels take the lowest byte of the colour
+        if (m_bytes_per_pixel < sizeof(uint32_t))
+        {
+                memset(m_data, colour & 0xFF, m_width * m_height * m_bytes_per_pixel);
+                return;
+        }
+
+        ImageOps::fill(m_data, (size_t) m_width * m_height * m_words_per_pixel, colour);
+}
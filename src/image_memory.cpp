@@ -1,4 +1,5 @@
 #include "image_memory.hpp"
+#include "image_ops.hpp"
 
 ImageMemory::ImageMemory(unsigned int width, unsigned int height, unsigned int words_per_pixel)
 {
@@ -30,16 +31,6 @@ void ImageMemory::save(std::string prefix)
 
 void ImageMemory::fill(unsigned int colour)
 {
-        for (unsigned int y = 0; y < m_height; y++)
-        {
-                for (unsigned int x = 0; x < m_width; x++)
-                {
-                        // Fills multi-word pixels
-                        unsigned int pixel_index = y * m_width + x;
-                        for (unsigned int channel_index = 0; channel_index < m_words_per_pixel; channel_index++)
-                        {
-                                m_data[pixel_index + channel_index] = colour;
-                        }
-                }
-        }
+        // Multi-word pixels take the colour in every word
+        ImageOps::fill(m_data, (size_t) m_width * m_height * m_words_per_pixel, colour);
 }
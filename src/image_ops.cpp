@@ -0,0 +1,566 @@
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "image_ops.hpp"
+
+namespace
+{
+        // Below this many pixels a band isn't worth the cost of handing it to another thread
+        const size_t MIN_BAND_PIXELS = 65536;
+
+        // Weights of the luminance kernel
+        const float RED_WEIGHT = 0.212671f;
+        const float GREEN_WEIGHT = 0.715160f;
+        const float BLUE_WEIGHT = 0.072169f;
+
+        // Depth to CPU voxel value scaling, as tempSetVoxels has always used
+        const float DEPTH_DIVISOR = 300.0f;
+        const float DEPTH_SCALE = 244.0f;
+
+        // One implementation of every operation, each working through a run of count pixels
+        struct Functions
+        {
+                std::string name;
+                void (*fill)(uint32_t* words, size_t count, uint32_t value);
+                void (*luminance)(const uint32_t* pixels, size_t count, unsigned int red_shift, uint8_t* luminance);
+                void (*grayscale)(const uint32_t* pixels, size_t count, unsigned int red_shift, uint32_t* grayscale);
+                void (*expand)(const uint8_t* luminance, size_t count, uint32_t* pixels);
+                void (*swapRedBlue)(const uint32_t* pixels, size_t count, uint32_t* swapped);
+                void (*quantizeDepth)(const uint32_t* depth, size_t count, uint8_t* quantized);
+        };
+
+        inline unsigned int pixelLuminance(uint32_t pixel, unsigned int red_shift)
+        {
+                unsigned int red = pixel >> red_shift & 0xFF;
+                unsigned int green = pixel >> 8 & 0xFF;
+                unsigned int blue = pixel >> (16 - red_shift) & 0xFF;
+                unsigned int value = RED_WEIGHT * red + GREEN_WEIGHT * green + BLUE_WEIGHT * blue;
+                return std::min(value, 255u);
+        }
+
+        void fillGeneric(uint32_t* words, size_t count, uint32_t value)
+        {
+                std::fill(words, words + count, value);
+        }
+
+        void luminanceGeneric(const uint32_t* pixels, size_t count, unsigned int red_shift, uint8_t* luminance)
+        {
+                for (size_t i = 0; i < count; i++)
+                {
+                        luminance[i] = pixelLuminance(pixels[i], red_shift);
+                }
+        }
+
+        void grayscaleGeneric(const uint32_t* pixels, size_t count, unsigned int red_shift, uint32_t* grayscale)
+        {
+                for (size_t i = 0; i < count; i++)
+                {
+                        grayscale[i] = 0xFF000000 | pixelLuminance(pixels[i], red_shift) * 0x010101;
+                }
+        }
+
+        void expandGeneric(const uint8_t* luminance, size_t count, uint32_t* pixels)
+        {
+                // Every byte takes the luminance, alpha included, as the expandLuminance kernel does
+                for (size_t i = 0; i < count; i++)
+                {
+                        pixels[i] = luminance[i] * 0x01010101u;
+                }
+        }
+
+        void swapRedBlueGeneric(const uint32_t* pixels, size_t count, uint32_t* swapped)
+        {
+                for (size_t i = 0; i < count; i++)
+                {
+                        uint32_t pixel = pixels[i];
+                        swapped[i] = (pixel & 0xFF00FF00) | (pixel & 0xFF) << 16 | (pixel >> 16 & 0xFF);
+                }
+        }
+
+        void quantizeDepthGeneric(const uint32_t* depth, size_t count, uint8_t* quantized)
+        {
+                for (size_t i = 0; i < count; i++)
+                {
+                        unsigned int value = ((float) depth[i] / DEPTH_DIVISOR) * DEPTH_SCALE;
+                        quantized[i] = value & 0xFF;
+                }
+        }
+
+#if defined(__x86_64__) || defined(__i386__)
+        // SSE2, four pixels to a register. Loops take 16 pixels at a time so results pack into whole
+        // registers of bytes, and leave the remainder to the scalar versions.
+        __attribute__((target("sse2"))) inline __m128i weightedLuminanceSse2(__m128i pixels, __m128i red_shift, __m128i blue_shift)
+        {
+                const __m128i byte_mask = _mm_set1_epi32(0xFF);
+                __m128 red = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, red_shift), byte_mask));
+                __m128 green = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(pixels, 8), byte_mask));
+                __m128 blue = _mm_cvtepi32_ps(_mm_and_si128(_mm_srl_epi32(pixels, blue_shift), byte_mask));
+
+                // Summed in the order of the scalar expression so rounding is identical
+                __m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(RED_WEIGHT), red), _mm_mul_ps(_mm_set1_ps(GREEN_WEIGHT), green));
+                value = _mm_add_ps(value, _mm_mul_ps(_mm_set1_ps(BLUE_WEIGHT), blue));
+                return _mm_cvttps_epi32(value);
+        }
+
+        __attribute__((target("sse2"))) inline __m128i quantizedDepthSse2(__m128i depth)
+        {
+                // Converts as unsigned, the high and low halves are exact so the sum rounds once like the scalar cast
+                __m128 high = _mm_cvtepi32_ps(_mm_srli_epi32(depth, 16));
+                __m128 low = _mm_cvtepi32_ps(_mm_and_si128(depth, _mm_set1_epi32(0xFFFF)));
+                __m128 value = _mm_add_ps(_mm_mul_ps(high, _mm_set1_ps(65536.0f)), low);
+                value = _mm_mul_ps(_mm_div_ps(value, _mm_set1_ps(DEPTH_DIVISOR)), _mm_set1_ps(DEPTH_SCALE));
+
+                // Values past the signed range are brought into it first, which leaves the low byte unchanged
+                const __m128 sign_limit = _mm_set1_ps(2147483648.0f);
+                value = _mm_sub_ps(value, _mm_and_ps(_mm_cmpge_ps(value, sign_limit), sign_limit));
+                return _mm_and_si128(_mm_cvttps_epi32(value), _mm_set1_epi32(0xFF));
+        }
+
+        __attribute__((target("sse2"))) void fillSse2(uint32_t* words, size_t count, uint32_t value)
+        {
+                __m128i values = _mm_set1_epi32(value);
+                size_t i = 0;
+                for (; i + 4 <= count; i += 4)
+                {
+                        _mm_storeu_si128((__m128i*) (words + i), values);
+                }
+                fillGeneric(words + i, count - i, value);
+        }
+
+        __attribute__((target("sse2"))) void luminanceSse2(const uint32_t* pixels, size_t count, unsigned int red_shift, uint8_t* luminance)
+        {
+                __m128i red = _mm_cvtsi32_si128(red_shift);
+                __m128i blue = _mm_cvtsi32_si128(16 - red_shift);
+                size_t i = 0;
+                for (; i + 16 <= count; i += 16)
+                {
+                        const __m128i* source = (const __m128i*) (pixels + i);
+                        __m128i first = weightedLuminanceSse2(_mm_loadu_si128(source), red, blue);
+                        __m128i second = weightedLuminanceSse2(_mm_loadu_si128(source + 1), red, blue);
+                        __m128i third = weightedLuminanceSse2(_mm_loadu_si128(source + 2), red, blue);
+                        __m128i fourth = weightedLuminanceSse2(_mm_loadu_si128(source + 3), red, blue);
+
+                        // Saturating packs clamp at 255 as the scalar version does
+                        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(first, second), _mm_packs_epi32(third, fourth));
+                        _mm_storeu_si128((__m128i*) (luminance + i), packed);
+                }
+                luminanceGeneric(pixels + i, count - i, red_shift, luminance + i);
+        }
+
+        __attribute__((target("sse2"))) void grayscaleSse2(const uint32_t* pixels, size_t count, unsigned int red_shift, uint32_t* grayscale)
+        {
+                __m128i red = _mm_cvtsi32_si128(red_shift);
+                __m128i blue = _mm_cvtsi32_si128(16 - red_shift);
+                __m128i alpha = _mm_set1_epi32(0xFF000000);
+                size_t i = 0;
+                for (; i + 4 <= count; i += 4)
+                {
+                        __m128i value = weightedLuminanceSse2(_mm_loadu_si128((const __m128i*) (pixels + i)), red, blue);
+                        value = _mm_or_si128(value, _mm_slli_epi32(value, 8));
+                        value = _mm_or_si128(value, _mm_slli_epi32(value, 8));
+                        _mm_storeu_si128((__m128i*) (grayscale + i), _mm_or_si128(value, alpha));
+                }
+                grayscaleGeneric(pixels + i, count - i, red_shift, grayscale + i);
+        }
+
+        __attribute__((target("sse2"))) void expandSse2(const uint8_t* luminance, size_t count, uint32_t* pixels)
+        {
+                size_t i = 0;
+                for (; i + 16 <= count; i += 16)
+                {
+                        __m128i values = _mm_loadu_si128((const __m128i*) (luminance + i));
+                        __m128i low = _mm_unpacklo_epi8(values, values);
+                        __m128i high = _mm_unpackhi_epi8(values, values);
+                        __m128i* destination = (__m128i*) (pixels + i);
+                        _mm_storeu_si128(destination, _mm_unpacklo_epi16(low, low));
+                        _mm_storeu_si128(destination + 1, _mm_unpackhi_epi16(low, low));
+                        _mm_storeu_si128(destination + 2, _mm_unpacklo_epi16(high, high));
+                        _mm_storeu_si128(destination + 3, _mm_unpackhi_epi16(high, high));
+                }
+                expandGeneric(luminance + i, count - i, pixels + i);
+        }
+
+        __attribute__((target("sse2"))) void swapRedBlueSse2(const uint32_t* pixels, size_t count, uint32_t* swapped)
+        {
+                __m128i green_alpha = _mm_set1_epi32(0xFF00FF00);
+                __m128i byte_mask = _mm_set1_epi32(0xFF);
+                size_t i = 0;
+                for (; i + 4 <= count; i += 4)
+                {
+                        __m128i pixel = _mm_loadu_si128((const __m128i*) (pixels + i));
+                        __m128i result = _mm_and_si128(pixel, green_alpha);
+                        result = _mm_or_si128(result, _mm_slli_epi32(_mm_and_si128(pixel, byte_mask), 16));
+                        result = _mm_or_si128(result, _mm_and_si128(_mm_srli_epi32(pixel, 16), byte_mask));
+                        _mm_storeu_si128((__m128i*) (swapped + i), result);
+                }
+                swapRedBlueGeneric(pixels + i, count - i, swapped + i);
+        }
+
+        __attribute__((target("sse2"))) void quantizeDepthSse2(const uint32_t* depth, size_t count, uint8_t* quantized)
+        {
+                size_t i = 0;
+                for (; i + 16 <= count; i += 16)
+                {
+                        const __m128i* source = (const __m128i*) (depth + i);
+                        __m128i first = quantizedDepthSse2(_mm_loadu_si128(source));
+                        __m128i second = quantizedDepthSse2(_mm_loadu_si128(source + 1));
+                        __m128i third = quantizedDepthSse2(_mm_loadu_si128(source + 2));
+                        __m128i fourth = quantizedDepthSse2(_mm_loadu_si128(source + 3));
+                        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(first, second), _mm_packs_epi32(third, fourth));
+                        _mm_storeu_si128((__m128i*) (quantized + i), packed);
+                }
+                quantizeDepthGeneric(depth + i, count - i, quantized + i);
+        }
+
+        // AVX2, eight pixels to a register. Only plain multiplies and adds are used, never fused, so
+        // rounding still matches the scalar code.
+        __attribute__((target("avx2"))) inline __m256i weightedLuminanceAvx2(__m256i pixels, __m128i red_shift, __m128i blue_shift)
+        {
+                const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+                __m256 red = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixels, red_shift), byte_mask));
+                __m256 green = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(pixels, 8), byte_mask));
+                __m256 blue = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srl_epi32(pixels, blue_shift), byte_mask));
+                __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(RED_WEIGHT), red), _mm256_mul_ps(_mm256_set1_ps(GREEN_WEIGHT), green));
+                value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_set1_ps(BLUE_WEIGHT), blue));
+                return _mm256_cvttps_epi32(value);
+        }
+
+        __attribute__((target("avx2"))) inline __m256i quantizedDepthAvx2(__m256i depth)
+        {
+                __m256 high = _mm256_cvtepi32_ps(_mm256_srli_epi32(depth, 16));
+                __m256 low = _mm256_cvtepi32_ps(_mm256_and_si256(depth, _mm256_set1_epi32(0xFFFF)));
+                __m256 value = _mm256_add_ps(_mm256_mul_ps(high, _mm256_set1_ps(65536.0f)), low);
+                value = _mm256_mul_ps(_mm256_div_ps(value, _mm256_set1_ps(DEPTH_DIVISOR)), _mm256_set1_ps(DEPTH_SCALE));
+                const __m256 sign_limit = _mm256_set1_ps(2147483648.0f);
+                value = _mm256_sub_ps(value, _mm256_and_ps(_mm256_cmp_ps(value, sign_limit, _CMP_GE_OQ), sign_limit));
+                return _mm256_and_si256(_mm256_cvttps_epi32(value), _mm256_set1_epi32(0xFF));
+        }
+
+        // Packs two registers of 32-bit values no greater than 255 into 16 bytes, in order
+        __attribute__((target("avx2"))) inline __m128i packBytesAvx2(__m256i first, __m256i second)
+        {
+                // Packing works within 128-bit lanes, so the halves are put back in order after each step
+                __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(first, second), 0xD8);
+                __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0x08);
+                return _mm256_castsi256_si128(bytes);
+        }
+
+        __attribute__((target("avx2"))) void fillAvx2(uint32_t* words, size_t count, uint32_t value)
+        {
+                __m256i values = _mm256_set1_epi32(value);
+                size_t i = 0;
+                for (; i + 8 <= count; i += 8)
+                {
+                        _mm256_storeu_si256((__m256i*) (words + i), values);
+                }
+                fillGeneric(words + i, count - i, value);
+        }
+
+        __attribute__((target("avx2"))) void luminanceAvx2(const uint32_t* pixels, size_t count, unsigned int red_shift, uint8_t* luminance)
+        {
+                __m128i red = _mm_cvtsi32_si128(red_shift);
+                __m128i blue = _mm_cvtsi32_si128(16 - red_shift);
+                size_t i = 0;
+                for (; i + 16 <= count; i += 16)
+                {
+                        const __m256i* source = (const __m256i*) (pixels + i);
+                        __m256i first = weightedLuminanceAvx2(_mm256_loadu_si256(source), red, blue);
+                        __m256i second = weightedLuminanceAvx2(_mm256_loadu_si256(source + 1), red, blue);
+                        _mm_storeu_si128((__m128i*) (luminance + i), packBytesAvx2(first, second));
+                }
+                luminanceGeneric(pixels + i, count - i, red_shift, luminance + i);
+        }
+
+        __attribute__((target("avx2"))) void grayscaleAvx2(const uint32_t* pixels, size_t count, unsigned int red_shift, uint32_t* grayscale)
+        {
+                __m128i red = _mm_cvtsi32_si128(red_shift);
+                __m128i blue = _mm_cvtsi32_si128(16 - red_shift);
+                __m256i alpha = _mm256_set1_epi32(0xFF000000);
+                size_t i = 0;
+                for (; i + 8 <= count; i += 8)
+                {
+                        __m256i value = weightedLuminanceAvx2(_mm256_loadu_si256((const __m256i*) (pixels + i)), red, blue);
+                        value = _mm256_or_si256(value, _mm256_slli_epi32(value, 8));
+                        value = _mm256_or_si256(value, _mm256_slli_epi32(value, 8));
+                        _mm256_storeu_si256((__m256i*) (grayscale + i), _mm256_or_si256(value, alpha));
+                }
+                grayscaleGeneric(pixels + i, count - i, red_shift, grayscale + i);
+        }
+
+        __attribute__((target("avx2"))) void expandAvx2(const uint8_t* luminance, size_t count, uint32_t* pixels)
+        {
+                size_t i = 0;
+                for (; i + 8 <= count; i += 8)
+                {
+                        __m256i value = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (luminance + i)));
+                        value = _mm256_or_si256(value, _mm256_slli_epi32(value, 8));
+                        value = _mm256_or_si256(value, _mm256_slli_epi32(value, 16));
+                        _mm256_storeu_si256((__m256i*) (pixels + i), value);
+                }
+                expandGeneric(luminance + i, count - i, pixels + i);
+        }
+
+        __attribute__((target("avx2"))) void swapRedBlueAvx2(const uint32_t* pixels, size_t count, uint32_t* swapped)
+        {
+                // Swaps bytes 0 and 2 of every pixel
+                const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+                size_t i = 0;
+                for (; i + 8 <= count; i += 8)
+                {
+                        __m256i pixel = _mm256_loadu_si256((const __m256i*) (pixels + i));
+                        _mm256_storeu_si256((__m256i*) (swapped + i), _mm256_shuffle_epi8(pixel, order));
+                }
+                swapRedBlueGeneric(pixels + i, count - i, swapped + i);
+        }
+
+        __attribute__((target("avx2"))) void quantizeDepthAvx2(const uint32_t* depth, size_t count, uint8_t* quantized)
+        {
+                size_t i = 0;
+                for (; i + 16 <= count; i += 16)
+                {
+                        const __m256i* source = (const __m256i*) (depth + i);
+                        __m256i first = quantizedDepthAvx2(_mm256_loadu_si256(source));
+                        __m256i second = quantizedDepthAvx2(_mm256_loadu_si256(source + 1));
+                        _mm_storeu_si128((__m128i*) (quantized + i), packBytesAvx2(first, second));
+                }
+                quantizeDepthGeneric(depth + i, count - i, quantized + i);
+        }
+#endif
+
+        Functions selectFunctions()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+                if (__builtin_cpu_supports("avx2"))
+                {
+                        return { "avx2", fillAvx2, luminanceAvx2, grayscaleAvx2, expandAvx2, swapRedBlueAvx2, quantizeDepthAvx2 };
+                }
+                if (__builtin_cpu_supports("sse2"))
+                {
+                        return { "sse2", fillSse2, luminanceSse2, grayscaleSse2, expandSse2, swapRedBlueSse2, quantizeDepthSse2 };
+                }
+#endif
+                return { "generic", fillGeneric, luminanceGeneric, grayscaleGeneric, expandGeneric, swapRedBlueGeneric, quantizeDepthGeneric };
+        }
+
+        const Functions& getFunctions()
+        {
+                static const Functions functions = selectFunctions();
+                return functions;
+        }
+
+        // Threads kept for the life of the process, so the several conversions of every frame don't each
+        // pay to start them. A run hands bands 0 to band_count - 2 to the workers and the last to the
+        // caller. Only one run uses the workers at a time, callers that find them busy are told so.
+        class BandWorkers
+        {
+                public:
+                        BandWorkers(size_t worker_count)
+                        {
+                                for (size_t i = 0; i < worker_count; i++)
+                                {
+                                        m_threads.push_back(std::thread(&BandWorkers::work, this, i));
+                                }
+                        }
+
+                        ~BandWorkers()
+                        {
+                                {
+                                        std::lock_guard<std::mutex> lock(m_mutex);
+                                        m_stopping = true;
+                                }
+                                m_start.notify_all();
+                                for (std::thread& thread : m_threads)
+                                {
+                                        thread.join();
+                                }
+                        }
+
+                        bool run(size_t band_count, const std::function<void(size_t)>& band)
+                        {
+                                std::unique_lock<std::mutex> run_lock(m_run_mutex, std::try_to_lock);
+                                if (!run_lock.owns_lock())
+                                {
+                                        return false;
+                                }
+
+                                {
+                                        std::lock_guard<std::mutex> lock(m_mutex);
+                                        m_band = &band;
+                                        m_worker_band_count = band_count - 1;
+                                        m_remaining = band_count - 1;
+                                        m_generation++;
+                                }
+                                m_start.notify_all();
+                                band(band_count - 1);
+
+                                std::unique_lock<std::mutex> lock(m_mutex);
+                                m_done.wait(lock, [this]() { return m_remaining == 0; });
+                                return true;
+                        }
+
+                private:
+                        void work(size_t index)
+                        {
+                                uint64_t generation = 0;
+                                std::unique_lock<std::mutex> lock(m_mutex);
+                                while (true)
+                                {
+                                        m_start.wait(lock, [&]() { return m_stopping || m_generation != generation; });
+                                        if (m_stopping)
+                                        {
+                                                return;
+                                        }
+                                        generation = m_generation;
+                                        if (index >= m_worker_band_count)
+                                        {
+                                                continue;
+                                        }
+
+                                        const std::function<void(size_t)>& band = *m_band;
+                                        lock.unlock();
+                                        band(index);
+                                        lock.lock();
+                                        if (--m_remaining == 0)
+                                        {
+                                                m_done.notify_one();
+                                        }
+                                }
+                        }
+
+                        std::vector<std::thread> m_threads;
+                        std::mutex m_run_mutex;
+                        std::mutex m_mutex;
+                        std::condition_variable m_start;
+                        std::condition_variable m_done;
+                        const std::function<void(size_t)>* m_band = NULL;
+                        size_t m_worker_band_count = 0;
+                        size_t m_remaining = 0;
+                        uint64_t m_generation = 0;
+                        bool m_stopping = false;
+        };
+
+        size_t getThreadCount()
+        {
+                static const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+                return thread_count;
+        }
+
+        BandWorkers& getBandWorkers()
+        {
+                static BandWorkers band_workers(getThreadCount() - 1);
+                return band_workers;
+        }
+
+        // Splits count pixels into bands, one per thread, running the last on the calling thread.
+        // Bands are whole multiples of 64 pixels so only the final band has a scalar remainder. While
+        // another caller has the workers the whole run stays on the calling thread.
+        template <typename Function> void parallelFor(size_t count, const Function& function)
+        {
+                size_t band_count = std::min(getThreadCount(), std::max<size_t>(1, count / MIN_BAND_PIXELS));
+                if (band_count > 1)
+                {
+                        size_t band_size = ((count + band_count - 1) / band_count + 63) / 64 * 64;
+                        band_count = (count + band_size - 1) / band_size;
+                        std::function<void(size_t)> band = [&](size_t index)
+                        {
+                                size_t begin = index * band_size;
+                                function(begin, std::min(begin + band_size, count));
+                        };
+                        if (band_count > 1 && getBandWorkers().run(band_count, band))
+                        {
+                                return;
+                        }
+                }
+                function(0, count);
+        }
+
+        // Bit offset of the red channel within a packed 32-bit pixel, blue is at 16 minus this
+        unsigned int getRedShift(ImageOps::Format format)
+        {
+                return format == ImageOps::Format::ARGB ? 16 : 0;
+        }
+}
+
+void ImageOps::fill(uint32_t* words, size_t count, uint32_t value)
+{
+        const Functions& functions = getFunctions();
+        parallelFor(count, [&](size_t begin, size_t end)
+        {
+                functions.fill(words + begin, end - begin, value);
+        });
+}
+
+void ImageOps::convert(const void* source, Format source_format, void* destination, Format destination_format, size_t count)
+{
+        const Functions& functions = getFunctions();
+        const uint32_t* source_pixels = (const uint32_t*) source;
+        const uint8_t* source_bytes = (const uint8_t*) source;
+        uint32_t* destination_pixels = (uint32_t*) destination;
+        uint8_t* destination_bytes = (uint8_t*) destination;
+        if (source_format == destination_format)
+        {
+                memcpy(destination, source, count * (source_format == Format::R8 ? 1 : sizeof(uint32_t)));
+        }
+        else if (destination_format == Format::R8)
+        {
+                unsigned int red_shift = getRedShift(source_format);
+                parallelFor(count, [&](size_t begin, size_t end)
+                {
+                        functions.luminance(source_pixels + begin, end - begin, red_shift, destination_bytes + begin);
+                });
+        }
+        else if (source_format == Format::R8)
+        {
+                parallelFor(count, [&](size_t begin, size_t end)
+                {
+                        functions.expand(source_bytes + begin, end - begin, destination_pixels + begin);
+                });
+        }
+        else
+        {
+                // ABGR and ARGB differ only in the order of red and blue
+                parallelFor(count, [&](size_t begin, size_t end)
+                {
+                        functions.swapRedBlue(source_pixels + begin, end - begin, destination_pixels + begin);
+                });
+        }
+}
+
+void ImageOps::grayscale(uint32_t* pixels, Format format, size_t count)
+{
+        if (format == Format::R8)
+        {
+                return;
+        }
+
+        const Functions& functions = getFunctions();
+        unsigned int red_shift = getRedShift(format);
+        parallelFor(count, [&](size_t begin, size_t end)
+        {
+                functions.grayscale(pixels + begin, end - begin, red_shift, pixels + begin);
+        });
+}
+
+void ImageOps::quantizeDepth(const uint32_t* depth, size_t count, uint8_t* quantized)
+{
+        const Functions& functions = getFunctions();
+        parallelFor(count, [&](size_t begin, size_t end)
+        {
+                functions.quantizeDepth(depth + begin, end - begin, quantized + begin);
+        });
+}
+
+std::string ImageOps::getInstructionSet()
+{
+        return getFunctions().name;
+}
@@ -5,6 +5,7 @@
 #include <SDL2/SDL_image.h>
 #include <string>
 
+#include "image_ops.hpp"
 #include "image_sdl.hpp"
 
 ImageSdl::ImageSdl(unsigned int width, unsigned int height, unsigned int words_per_pixel)
@@ -77,36 +78,13 @@ void ImageSdl::save(std::string prefix)
 
 void ImageSdl::fill(unsigned int colour)
 {
-        for (unsigned int y = 0; y < m_height; y++)
-        {
-                for (unsigned int x = 0; x < m_width; x++)
-                {
-                    unsigned int index = y * m_width + x;
-                    ((unsigned int*) m_surface->pixels)[index] = colour;
-                }
-        }
+        ImageOps::fill(getPixels(), m_width * m_height, colour);
 }
 
 void ImageSdl::grayscale()
 {
-        unsigned int* pixels = (unsigned int*) m_surface->pixels;
-
-        for (unsigned int y = 0; y < m_height; y++)
-        {
-                for (unsigned int x = 0; x < m_width; x++)
-                {
-                        unsigned int index = y * m_width + x;
-                        unsigned int pixel = pixels[index];
-
-                        unsigned int r = pixel >> 16 & 0xFF;
-                        unsigned int g = pixel >> 8 & 0xFF;
-                        unsigned int b = pixel & 0xFF;
-                        unsigned int v = 0.212671f * r + 0.715160f * g + 0.072169f * b;
-                        unsigned int gray_pixel = (0xFF << 24) | (v << 16) | (v << 8) | v;
-
-                        pixels[index] = gray_pixel;
-                }
-        }
+        // Surfaces are created with red in the third byte
+        ImageOps::grayscale(getPixels(), ImageOps::Format::ARGB, m_width * m_height);
 }
 
 std::string ImageSdl::getDateTime()
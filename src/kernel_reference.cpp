@@ -0,0 +1,803 @@
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "disparity_format.hpp"
+#include "kernel_reference.hpp"
+
+constexpr float KernelReference::MISS_DEPTH;
+
+namespace
+{
+        // Reads of single channel images, 0 outside as with the clamping sampler
+        template <typename T> T readPixel(const T* image, unsigned int width, unsigned int height, int x, int y)
+        {
+                if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+                {
+                        return 0;
+                }
+                return image[(size_t) y * width + x];
+        }
+
+        void readVertex(const float* vertices, unsigned int width, unsigned int height, int x, int y, float vertex[3])
+        {
+                if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+                {
+                        vertex[0] = vertex[1] = vertex[2] = 0;
+                        return;
+                }
+                memcpy(vertex, vertices + ((size_t) y * width + x) * 3, sizeof(float) * 3);
+        }
+
+        float dot(const float a[3], const float b[3])
+        {
+                return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+        }
+
+        // Nearest whole disparity of a fixed point one
+        int wholeDisparity(int disparity)
+        {
+                return (disparity + (1 << Disparity::FRACTION_BITS) / 2) >> Disparity::FRACTION_BITS;
+        }
+
+        float length(const float a[3])
+        {
+                return std::sqrt(dot(a, a));
+        }
+
+        // Luminance of a pixel of an RGBA or single channel frame, as pixelLuminance does
+        unsigned int pixelLuminance(const uint8_t* image, unsigned int bytes_per_pixel, unsigned int width, unsigned int height, int x, int y)
+        {
+                if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+                {
+                        return 0;
+                }
+                const uint8_t* pixel = image + ((size_t) y * width + x) * bytes_per_pixel;
+                if (bytes_per_pixel == 1)
+                {
+                        return pixel[0];
+                }
+                unsigned int value = 0.212671f * pixel[0] + 0.715160f * pixel[1] + 0.072169f * pixel[2];
+                return std::min(value, 255u);
+        }
+
+        unsigned int windowSad(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+                int window_x, int x, int y, int window_size)
+        {
+                unsigned int sum = 0;
+                for (int i = -window_size / 2; i < window_size / 2; i++)
+                {
+                        for (int j = -window_size / 2; j < window_size / 2; j++)
+                        {
+                                int left_pixel = readPixel(left, width, height, window_x + i, y + j);
+                                int right_pixel = readPixel(right, width, height, x + i, y + j);
+                                sum += std::abs(left_pixel - right_pixel);
+                        }
+                }
+                return sum;
+        }
+
+        uint16_t searchRow(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+                int x, int y, int window_size, int max_disparity, unsigned int* minimum_sad)
+        {
+                // Costs every window first, then fits the cheapest to its neighbours
+                int first_x = std::max(x - max_disparity, 0);
+                int end_x = std::min(x + max_disparity + 1, (int) width);
+                unsigned int minimum = 1000000000;
+                int best_x = x;
+                for (int window_x = first_x; window_x < end_x; window_x++)
+                {
+                        unsigned int sad = windowSad(left, right, width, height, window_x, x, y, window_size);
+                        if (sad < minimum)
+                        {
+                                minimum = sad;
+                                best_x = window_x;
+                        }
+                }
+                *minimum_sad = minimum;
+
+                int before = best_x - 1 >= first_x ? (int) windowSad(left, right, width, height, best_x - 1, x, y, window_size) : -1;
+                int after = best_x + 1 < end_x ? (int) windowSad(left, right, width, height, best_x + 1, x, y, window_size) : -1;
+                return Disparity::subPixel(best_x, x, before, minimum, after);
+        }
+
+        bool intersect(const float origin[3], const float direction[3], const float box_a[3], const float box_b[3], float intersection[3])
+        {
+                float enter = -1000000000;
+                float leave = 1000000000;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                        if (direction[axis] != 0)
+                        {
+                                float distance_a = (box_a[axis] - origin[axis]) / direction[axis];
+                                float distance_b = (box_b[axis] - origin[axis]) / direction[axis];
+                                if (axis == 0)
+                                {
+                                        enter = std::min(distance_a, distance_b);
+                                        leave = std::max(distance_a, distance_b);
+                                }
+                                else
+                                {
+                                        enter = std::max(enter, std::min(distance_a, distance_b));
+                                        leave = std::min(leave, std::max(distance_a, distance_b));
+                                }
+                        }
+                }
+
+                if (enter <= leave)
+                {
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                                intersection[axis] = origin[axis] + direction[axis] * enter;
+                        }
+                        return true;
+                }
+                return false;
+        }
+}
+
+void KernelReference::luminance(const uint8_t* rgba, unsigned int width, unsigned int height, uint8_t* luminance)
+{
+        for (unsigned int y = 0; y < height; y++)
+        {
+                for (unsigned int x = 0; x < width; x++)
+                {
+                        luminance[(size_t) y * width + x] = pixelLuminance(rgba, 4, width, height, x, y);
+                }
+        }
+}
+
+void KernelReference::rectify(const uint8_t* raw, unsigned int bytes_per_pixel, const uint32_t* remap,
+        unsigned int width, unsigned int height, uint8_t* luminance)
+{
+        const unsigned int scale = 1 << REMAP_FRACTION_BITS;
+        for (unsigned int y = 0; y < height; y++)
+        {
+                for (unsigned int x = 0; x < width; x++)
+                {
+                        size_t index = (size_t) y * width + x;
+                        uint32_t entry = remap[index];
+                        if (entry == 0xFFFFFFFF)
+                        {
+                                luminance[index] = 0;
+                                continue;
+                        }
+
+                        // Bilinear interpolation at the 12.4 fixed point source coordinates
+                        int fixed_x = entry & 0xFFFF;
+                        int fixed_y = entry >> 16;
+                        int source_x = fixed_x >> REMAP_FRACTION_BITS;
+                        int source_y = fixed_y >> REMAP_FRACTION_BITS;
+                        unsigned int weight_x = fixed_x & (scale - 1);
+                        unsigned int weight_y = fixed_y & (scale - 1);
+                        unsigned int top = pixelLuminance(raw, bytes_per_pixel, width, height, source_x, source_y) * (scale - weight_x) +
+                                pixelLuminance(raw, bytes_per_pixel, width, height, source_x + 1, source_y) * weight_x;
+                        unsigned int bottom = pixelLuminance(raw, bytes_per_pixel, width, height, source_x, source_y + 1) * (scale - weight_x) +
+                                pixelLuminance(raw, bytes_per_pixel, width, height, source_x + 1, source_y + 1) * weight_x;
+                        luminance[index] = (top * (scale - weight_y) + bottom * weight_y + scale * scale / 2) >> (2 * REMAP_FRACTION_BITS);
+                }
+        }
+}
+
+void KernelReference::expandLuminance(const uint8_t* luminance, unsigned int width, unsigned int height, uint8_t* rgba)
+{
+        for (size_t i = 0; i < (size_t) width * height; i++)
+        {
+                memset(rgba + i * 4, luminance[i], 4);
+        }
+}
+
+void KernelReference::expandDisparity(const uint16_t* disparity, unsigned int width, unsigned int height, uint8_t* rgba)
+{
+        for (size_t i = 0; i < (size_t) width * height; i++)
+        {
+                memset(rgba + i * 4, std::min(disparity[i] >> Disparity::FRACTION_BITS, 255), 4);
+        }
+}
+
+void KernelReference::disparity(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+        int window_size, int max_disparity, uint16_t* disparity)
+{
+        for (unsigned int y = 0; y < height; y++)
+        {
+                for (unsigned int x = 0; x < width; x++)
+                {
+                        unsigned int minimum_sad;
+                        disparity[(size_t) y * width + x] = searchRow(left, right, width, height, x, y, window_size, max_disparity, &minimum_sad);
+                }
+        }
+}
+
+void KernelReference::disparityTemporal(const uint16_t* previous_disparity, const uint8_t* left, const uint8_t* right,
+        unsigned int width, unsigned int height, int window_size, int band, unsigned int cost_threshold,
+        float warp_x, float warp_y, int max_disparity, uint16_t* disparity)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        // Prior sampled where the pixel is predicted to have been
+                        int prior = wholeDisparity(readPixel(previous_disparity, width, height, x, y));
+                        int previous_x = x + (int) std::round(prior * warp_x);
+                        int previous_y = y - (int) std::round(prior * warp_y);
+                        prior = wholeDisparity(readPixel(previous_disparity, width, height, previous_x, previous_y));
+
+                        unsigned int minimum_sad = UINT_MAX;
+                        int best_x = x;
+                        for (int candidate = std::max(prior - band, 0); candidate <= std::min(prior + band, max_disparity); candidate++)
+                        {
+                                for (int side = -1; side <= 1; side += 2)
+                                {
+                                        if (candidate == 0 && side > 0)
+                                        {
+                                                continue;
+                                        }
+                                        unsigned int sad = windowSad(left, right, width, height, x + side * candidate, x, y, window_size);
+                                        if (sad < minimum_sad)
+                                        {
+                                                minimum_sad = sad;
+                                                best_x = x + side * candidate;
+                                        }
+                                }
+                        }
+
+                        // Falls back to the full search when the band holds no good match
+                        unsigned int window_width = window_size / 2 * 2;
+                        if (minimum_sad > cost_threshold * window_width * window_width)
+                        {
+                                disparity[(size_t) y * width + x] = searchRow(left, right, width, height, x, y, window_size, max_disparity, &minimum_sad);
+                                continue;
+                        }
+
+                        // Neighbours of the match are costed within the range of the full search
+                        int first_x = std::max(x - max_disparity, 0);
+                        int end_x = std::min(x + max_disparity + 1, (int) width);
+                        int before = best_x - 1 >= first_x ? (int) windowSad(left, right, width, height, best_x - 1, x, y, window_size) : -1;
+                        int after = best_x + 1 < end_x ? (int) windowSad(left, right, width, height, best_x + 1, x, y, window_size) : -1;
+                        disparity[(size_t) y * width + x] = Disparity::subPixel(best_x, x, before, minimum_sad, after);
+                }
+        }
+}
+
+void KernelReference::disparityAggregated(const uint8_t* left, const uint8_t* right, unsigned int width, unsigned int height,
+        int window_size, unsigned int disparity_count, uint16_t* disparity)
+{
+        // Sums every window directly with windowSad rather than with running sums
+        std::vector<int> costs(disparity_count);
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        uint32_t best = 0xFFFFFFFF;
+                        for (unsigned int d = 0; d < disparity_count; d++)
+                        {
+                                uint32_t cost = windowSad(left, right, width, height, x + d, x, y, window_size);
+
+                                // Saturates to the 24 bits left beside the disparity, as aggregateColumns does
+                                cost = std::min(cost, (uint32_t) 0xFFFFFF);
+                                costs[d] = cost;
+                                best = std::min(best, (cost << 8) | d);
+                        }
+
+                        // Matches lie d along the row, so the cost before the match is that of d - 1
+                        int d = best & 0xFF;
+                        int before = d > 0 ? costs[d - 1] : -1;
+                        int after = d + 1 < (int) disparity_count ? costs[d + 1] : -1;
+                        disparity[(size_t) y * width + x] = Disparity::subPixel(x + d, x, before, best >> 8, after);
+                }
+        }
+}
+
+void KernelReference::census(const uint8_t* luminance, unsigned int width, unsigned int height, uint64_t* descriptors)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        uint8_t centre = luminance[(size_t) y * width + x];
+                        uint64_t descriptor = 0;
+                        for (int j = -3; j <= 3; j++)
+                        {
+                                for (int i = -4; i <= 4; i++)
+                                {
+                                        if (i == 0 && j == 0)
+                                        {
+                                                continue;
+                                        }
+                                        descriptor = (descriptor << 1) | (readPixel(luminance, width, height, x + i, y + j) < centre);
+                                }
+                        }
+                        descriptors[(size_t) y * width + x] = descriptor;
+                }
+        }
+}
+
+void KernelReference::disparityCensus(const uint64_t* left, const uint64_t* right, unsigned int width, unsigned int height,
+        int max_disparity, uint16_t* disparity)
+{
+        std::vector<int> distances(width);
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        uint64_t descriptor = right[(size_t) y * width + x];
+                        int first_x = std::max(x - max_disparity, 0);
+                        int end_x = std::min(x + max_disparity + 1, (int) width);
+                        int minimum_distance = 65;
+                        int best_x = x;
+                        for (int window_x = first_x; window_x < end_x; window_x++)
+                        {
+                                // Counts the differing bits one at a time
+                                uint64_t differences = left[(size_t) y * width + window_x] ^ descriptor;
+                                int distance = 0;
+                                for (int bit = 0; bit < 64; bit++)
+                                {
+                                        distance += (differences >> bit) & 1;
+                                }
+                                distances[window_x] = distance;
+                                if (distance < minimum_distance)
+                                {
+                                        minimum_distance = distance;
+                                        best_x = window_x;
+                                }
+                        }
+
+                        int before = best_x - 1 >= first_x ? distances[best_x - 1] : -1;
+                        int after = best_x + 1 < end_x ? distances[best_x + 1] : -1;
+                        disparity[(size_t) y * width + x] = Disparity::subPixel(best_x, x, before, minimum_distance, after);
+                }
+        }
+}
+
+void KernelReference::validityMask(const uint16_t* disparity, const uint16_t* reverse_disparity, unsigned int width,
+        unsigned int height, bool check_consistency, uint32_t* validity)
+{
+        unsigned int words_per_row = getValidityWordsPerRow(width);
+        std::fill(validity, validity + (size_t) words_per_row * height, 0u);
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        int value = disparity[(size_t) y * width + x];
+                        bool valid = value != 0;
+                        if (valid && check_consistency)
+                        {
+                                // The match may lie either side, as the search runs both ways
+                                int offset = wholeDisparity(value);
+                                bool ahead = x + offset < (int) width &&
+                                        std::abs(readPixel(reverse_disparity, width, height, x + offset, y) - value) <= CONSISTENCY_TOLERANCE;
+                                bool behind = x - offset >= 0 &&
+                                        std::abs(readPixel(reverse_disparity, width, height, x - offset, y) - value) <= CONSISTENCY_TOLERANCE;
+                                valid = ahead || behind;
+                        }
+                        validity[(size_t) y * words_per_row + x / 32] |= (uint32_t) valid << (x % 32);
+                }
+        }
+}
+
+void KernelReference::disparityToDepth(const uint16_t* disparity, const uint32_t* validity, unsigned int width, unsigned int height,
+        int focal_length, int baseline_mm, uint32_t* depth)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        size_t index = (size_t) y * width + x;
+                        uint32_t value = disparity[index];
+                        depth[index] = isValid(validity, width, height, x, y) ?
+                                (uint32_t) (focal_length * baseline_mm << Disparity::FRACTION_BITS) / value : 0;
+                }
+        }
+}
+
+void KernelReference::generateVertexMap(const uint32_t* depth, const uint32_t* validity, unsigned int width, unsigned int height, int focal_length,
+        int scale_x, int scale_y, int skew_coeff, float principal_point_x, float principal_point_y, float* vertices)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        size_t index = (size_t) y * width + x;
+                        if (!isValid(validity, width, height, x, y))
+                        {
+                                std::fill(vertices + index * 3, vertices + index * 3 + 3, 0.0f);
+                                continue;
+                        }
+                        float metres = depth[index] / 1000.0f;
+                        float normalised_y = (y - principal_point_y) / (focal_length * scale_y);
+                        float normalised_x = (x - principal_point_x - skew_coeff * normalised_y) / (focal_length * scale_x);
+                        vertices[index * 3] = normalised_x * metres;
+                        vertices[index * 3 + 1] = normalised_y * metres;
+                        vertices[index * 3 + 2] = metres;
+                }
+        }
+}
+
+void KernelReference::generateNormalMap(const float* vertices, const uint32_t* validity, unsigned int width, unsigned int height, uint32_t* normals)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        if (!isValid(validity, width, height, x, y) || !isValid(validity, width, height, x + 1, y) ||
+                                !isValid(validity, width, height, x, y + 1))
+                        {
+                                normals[(size_t) y * width + x] = 0;
+                                continue;
+                        }
+
+                        float centre[3];
+                        float right[3];
+                        float down[3];
+                        readVertex(vertices, width, height, x, y, centre);
+                        readVertex(vertices, width, height, x + 1, y, right);
+                        readVertex(vertices, width, height, x, y + 1, down);
+
+                        float a[3] = { right[0] - centre[0], right[1] - centre[1], right[2] - centre[2] };
+                        float b[3] = { down[0] - centre[0], down[1] - centre[1], down[2] - centre[2] };
+                        float normal[3] = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0] };
+                        normals[(size_t) y * width + x] = encodeNormal(normal);
+                }
+        }
+}
+
+void KernelReference::findCorrespondences(const uint32_t* validity, const float* prev_vertices, const uint32_t* prev_normals,
+        const float* vertices, const uint32_t* normals, unsigned int width, unsigned int height,
+        const float translation[3], const float rotation[9], float focal_length,
+        float principal_point_x, float principal_point_y, float* correspondences)
+{
+        const float distance_threshold = 0.1f;
+        const float normal_threshold = 1.0f;
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        size_t index = (size_t) y * width + x;
+                        float* correspondence = correspondences + index * 4;
+                        std::fill(correspondence, correspondence + 4, 0.0f);
+                        if (!isValid(validity, width, height, x, y))
+                        {
+                                continue;
+                        }
+
+                        // Previous global vertex into camera coordinates with the transposed rotation
+                        float prev_global_vertex[3];
+                        readVertex(prev_vertices, width, height, x, y, prev_global_vertex);
+                        float offset[3];
+                        float prev_camera_vertex[3] = { 0, 0, 0 };
+                        for (int row = 0; row < 3; row++)
+                        {
+                                offset[row] = prev_global_vertex[row] - translation[row];
+                        }
+                        for (int row = 0; row < 3; row++)
+                        {
+                                for (int column = 0; column < 3; column++)
+                                {
+                                        prev_camera_vertex[column] += rotation[row * 3 + column] * offset[row];
+                                }
+                        }
+
+                        int image_x = (int) std::round(focal_length * prev_camera_vertex[0] / prev_camera_vertex[2] + principal_point_x);
+                        int image_y = (int) std::round(focal_length * prev_camera_vertex[1] / prev_camera_vertex[2] + principal_point_y);
+                        if (image_x < 0 || image_x >= (int) width || image_y < 0 || image_y >= (int) height)
+                        {
+                                continue;
+                        }
+
+                        // Current vertex and normal at the projection into global coordinates
+                        float camera_vertex[3];
+                        float camera_normal[3];
+                        float prev_global_normal[3];
+                        readVertex(vertices, width, height, image_x, image_y, camera_vertex);
+                        decodeNormal(normals[(size_t) image_y * width + image_x], camera_normal);
+                        decodeNormal(prev_normals[index], prev_global_normal);
+                        float global_vertex[3];
+                        float global_normal[3];
+                        float difference[3];
+                        for (int row = 0; row < 3; row++)
+                        {
+                                global_vertex[row] = dot(rotation + row * 3, camera_vertex) + translation[row];
+                                global_normal[row] = dot(rotation + row * 3, camera_normal);
+                                difference[row] = global_vertex[row] - prev_global_vertex[row];
+                        }
+
+                        if (length(difference) < distance_threshold && std::fabs(dot(global_normal, prev_global_normal)) < normal_threshold)
+                        {
+                                memcpy(correspondence, global_vertex, sizeof(float) * 3);
+                                correspondence[3] = 1.0f;
+                        }
+                }
+        }
+}
+
+unsigned int KernelReference::compactCorrespondences(const float* correspondences, const float* prev_vertices,
+        const uint32_t* prev_normals, unsigned int width, unsigned int height, Correspondence* compact)
+{
+        // In pixel order, the kernel only keeps pixel order within each work-group
+        unsigned int count = 0;
+        for (size_t index = 0; index < (size_t) width * height; index++)
+        {
+                const float* source = correspondences + index * 4;
+                if (source[3] == 0.0f)
+                {
+                        continue;
+                }
+
+                Correspondence& correspondence = compact[count++];
+                memcpy(correspondence.source, source, sizeof(float) * 3);
+                readVertex(prev_vertices, width, height, index % width, index / width, correspondence.destination);
+                decodeNormal(prev_normals[index], correspondence.normal);
+                correspondence.pixel_index = index;
+        }
+        return count;
+}
+
+void KernelReference::pointToPlaneResiduals(const Correspondence* correspondences, unsigned int count, float* residuals)
+{
+        for (unsigned int i = 0; i < count; i++)
+        {
+                const float* normal = correspondences[i].normal;
+                residuals[i] = dot(normal, correspondences[i].destination) - dot(normal, correspondences[i].source);
+        }
+}
+
+void KernelReference::render(const int* voxels, const int dimensions[3], float voxel_size, const int origin[3],
+        int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, int render_scale,
+        int screen_width, int screen_height, float* samples)
+{
+        int samples_width = (screen_width + render_scale - 1) / render_scale;
+        int samples_height = (screen_height + render_scale - 1) / render_scale;
+        float cos_angle = std::cos(angle);
+        float sin_angle = std::sin(angle);
+        for (int sample_y = 0; sample_y < samples_height; sample_y++)
+        {
+                for (int sample_x = 0; sample_x < samples_width; sample_x++)
+                {
+                        int screen_x = sample_x * render_scale - screen_width / 2;
+                        int screen_y = screen_height / 2 - sample_y * render_scale;
+
+                        // Ray through the corner of the block, orbited about the y axis
+                        float eye[3] = { (float) eye_x, (float) eye_y, (float) eye_z };
+                        float direction[3] = { screen_x - eye[0], screen_y - eye[1], screen_z - eye[2] };
+                        float direction_length = length(direction);
+                        float eye_length = length(eye);
+                        float ray_origin[3];
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                                direction[axis] /= direction_length;
+                                ray_origin[axis] = eye[axis] / eye_length;
+                        }
+                        float origin_x = cam_distance * (ray_origin[0] * cos_angle - ray_origin[2] * sin_angle);
+                        float origin_z = cam_distance * (ray_origin[0] * sin_angle + ray_origin[2] * cos_angle);
+                        ray_origin[0] = origin_x;
+                        ray_origin[2] = origin_z;
+                        float direction_x = direction[0] * cos_angle - direction[2] * sin_angle;
+                        float direction_z = direction[0] * sin_angle + direction[2] * cos_angle;
+                        direction[0] = direction_x;
+                        direction[2] = direction_z;
+
+                        // Steps a voxel at a time from where the ray enters the rolling volume
+                        float shade = 0;
+                        float depth = MISS_DEPTH;
+                        float box_centre[3] = { origin[0] * voxel_size, -origin[1] * voxel_size, -origin[2] * voxel_size };
+                        float box_a[3];
+                        float box_b[3];
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                                float half = (dimensions[axis] / 2) * voxel_size;
+                                box_a[axis] = box_centre[axis] - half;
+                                box_b[axis] = box_centre[axis] + half;
+                        }
+                        float box_intersection[3];
+                        if (intersect(ray_origin, direction, box_a, box_b, box_intersection))
+                        {
+                                int max_steps = dimensions[0] + dimensions[1] + dimensions[2];
+                                for (int i = 0; i < max_steps; i++)
+                                {
+                                        float point[3];
+                                        float position[3];
+                                        for (int axis = 0; axis < 3; axis++)
+                                        {
+                                                point[axis] = box_intersection[axis] + direction[axis] * (i * voxel_size);
+                                                position[axis] = point[axis] / voxel_size;
+                                        }
+                                        int voxel_x = (int) (position[0] + dimensions[0] / 2);
+                                        int voxel_y = dimensions[1] - (int) (position[1] + dimensions[1] / 2);
+                                        int voxel_z = dimensions[2] - (int) (position[2] + dimensions[2] / 2);
+                                        if (voxel_x < origin[0] || voxel_x >= origin[0] + dimensions[0] ||
+                                                voxel_y < origin[1] || voxel_y >= origin[1] + dimensions[1] ||
+                                                voxel_z < origin[2] || voxel_z >= origin[2] + dimensions[2])
+                                        {
+                                                shade = 0;
+                                                continue;
+                                        }
+
+                                        int slot_x = ((voxel_x % dimensions[0]) + dimensions[0]) % dimensions[0];
+                                        int slot_y = ((voxel_y % dimensions[1]) + dimensions[1]) % dimensions[1];
+                                        int slot_z = ((voxel_z % dimensions[2]) + dimensions[2]) % dimensions[2];
+                                        int voxel = voxels[((size_t) slot_z * dimensions[1] + slot_y) * dimensions[0] + slot_x];
+                                        if (voxel != 0)
+                                        {
+                                                float offset[3] = { point[0] - ray_origin[0], point[1] - ray_origin[1], point[2] - ray_origin[2] };
+                                                shade = 255 - voxel;
+                                                depth = length(offset);
+                                                break;
+                                        }
+                                }
+                        }
+
+                        float* sample = samples + ((size_t) sample_y * samples_width + sample_x) * 2;
+                        sample[0] = shade;
+                        sample[1] = depth;
+                }
+        }
+}
+
+void KernelReference::upsampleRender(const float* samples, int render_scale, int samples_width, int samples_height,
+        float voxel_size, unsigned int width, unsigned int height, uint8_t* screen)
+{
+        for (int y = 0; y < (int) height; y++)
+        {
+                for (int x = 0; x < (int) width; x++)
+                {
+                        float position_x = (float) x / render_scale;
+                        float position_y = (float) y / render_scale;
+                        int base_x = (int) std::floor(position_x);
+                        int base_y = (int) std::floor(position_y);
+                        float fraction_x = position_x - base_x;
+                        float fraction_y = position_y - base_y;
+                        int nearest_x = std::min((int) std::round(position_x), samples_width - 1);
+                        int nearest_y = std::min((int) std::round(position_y), samples_height - 1);
+                        float reference_depth = samples[((size_t) nearest_y * samples_width + nearest_x) * 2 + 1];
+
+                        // Bilinear weights, lowered for samples at a different depth to the nearest
+                        float shade = 0;
+                        float total_weight = 0;
+                        for (int j = 0; j < 2; j++)
+                        {
+                                for (int i = 0; i < 2; i++)
+                                {
+                                        int sample_x = std::min(base_x + i, samples_width - 1);
+                                        int sample_y = std::min(base_y + j, samples_height - 1);
+                                        const float* sample = samples + ((size_t) sample_y * samples_width + sample_x) * 2;
+                                        float bilinear = (i ? fraction_x : 1 - fraction_x) * (j ? fraction_y : 1 - fraction_y);
+                                        float weight = bilinear / (1 + std::fabs(sample[1] - reference_depth) / voxel_size);
+                                        shade += sample[0] * weight;
+                                        total_weight += weight;
+                                }
+                        }
+
+                        unsigned int value = shade / total_weight + 0.5f;
+                        screen[(size_t) y * width + x] = std::min(value, 255u);
+                }
+        }
+}
+
+unsigned int KernelReference::getValidityWordsPerRow(unsigned int width)
+{
+        return (width + 31) / 32;
+}
+
+bool KernelReference::isValid(const uint32_t* validity, unsigned int width, unsigned int height, int x, int y)
+{
+        if (x < 0 || y < 0 || x >= (int) width || y >= (int) height)
+        {
+                return false;
+        }
+        return (validity[(size_t) y * getValidityWordsPerRow(width) + x / 32] >> (x % 32)) & 1;
+}
+
+uint32_t KernelReference::encodeNormal(const float normal[3])
+{
+        float sum = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+        if (!(sum > 0))
+        {
+                return 0;
+        }
+        float x = normal[0] / sum;
+        float y = normal[1] / sum;
+        float z = normal[2] / sum;
+
+        // Folds the lower hemisphere over the diagonals, then rounds to nearest even as convert_uint2_rte
+        float octahedral_x = z >= 0 ? x : (1.0f - std::fabs(y)) * std::copysign(1.0f, x);
+        float octahedral_y = z >= 0 ? y : (1.0f - std::fabs(x)) * std::copysign(1.0f, y);
+        uint32_t fixed_x = (uint32_t) std::nearbyint((octahedral_x * 0.5f + 0.5f) * 65534.0f) + 1;
+        uint32_t fixed_y = (uint32_t) std::nearbyint((octahedral_y * 0.5f + 0.5f) * 65534.0f) + 1;
+        return fixed_x | (fixed_y << 16);
+}
+
+void KernelReference::decodeNormal(uint32_t code, float normal[3])
+{
+        if (code == 0)
+        {
+                normal[0] = normal[1] = normal[2] = 0;
+                return;
+        }
+
+        normal[0] = ((float) (code & 0xFFFF) - 1.0f) / 65534.0f * 2.0f - 1.0f;
+        normal[1] = ((float) (code >> 16) - 1.0f) / 65534.0f * 2.0f - 1.0f;
+        normal[2] = 1.0f - std::fabs(normal[0]) - std::fabs(normal[1]);
+
+        float fold = std::max(-normal[2], 0.0f);
+        normal[0] += normal[0] >= 0 ? -fold : fold;
+        normal[1] += normal[1] >= 0 ? -fold : fold;
+        float normal_length = length(normal);
+        for (int axis = 0; axis < 3; axis++)
+        {
+                normal[axis] /= normal_length;
+        }
+}
+
+uint16_t KernelReference::floatToHalf(float value)
+{
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint16_t sign = (bits >> 16) & 0x8000;
+        int exponent = (int) ((bits >> 23) & 0xFF) - 127 + 15;
+        uint32_t mantissa = bits & 0x7FFFFF;
+
+        if (((bits >> 23) & 0xFF) == 0xFF)
+        {
+                return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+        }
+        if (exponent >= 31)
+        {
+                return sign | 0x7C00;
+        }
+
+        // Rounds to nearest even, as writes to CL_HALF_FLOAT images do
+        if (exponent <= 0)
+        {
+                if (exponent < -10)
+                {
+                        return sign;
+                }
+                mantissa |= 0x800000;
+                unsigned int shift = 14 - exponent;
+                uint32_t half_mantissa = mantissa >> shift;
+                uint32_t remainder = mantissa & ((1u << shift) - 1);
+                uint32_t halfway = 1u << (shift - 1);
+                if (remainder > halfway || (remainder == halfway && (half_mantissa & 1)))
+                {
+                        half_mantissa++;
+                }
+                return sign | half_mantissa;
+        }
+
+        uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+        uint32_t remainder = mantissa & 0x1FFF;
+        if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+        {
+                half++;
+        }
+        return half;
+}
+
+float KernelReference::halfToFloat(uint16_t half)
+{
+        uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+        uint32_t exponent = (half >> 10) & 0x1F;
+        uint32_t mantissa = half & 0x3FF;
+
+        uint32_t bits;
+        if (exponent == 0)
+        {
+                float value = std::ldexp((float) mantissa, -24);
+                return sign ? -value : value;
+        }
+        else if (exponent == 31)
+        {
+                bits = sign | 0x7F800000 | (mantissa << 13);
+        }
+        else
+        {
+                bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+}
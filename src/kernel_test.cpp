@@ -0,0 +1,1446 @@
+#include <CL/cl.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "census_matcher.hpp"
+#include "disparity_format.hpp"
+#include "image_memory.hpp"
+#include "image_ops.hpp"
+#include "kernel_reference.hpp"
+#include "kernel_variants.hpp"
+#include "util.hpp"
+#include "volume_shift.hpp"
+
+// Runs every kernel of reconstruction.cl, and the optimised host paths, on synthetic inputs and
+// checks their outputs against the scalar versions in KernelReference within per-kernel
+// tolerances. Each is then timed and compared against the baseline recorded for the device, and
+// the run fails if any output is wrong or any kernel has slowed down by more than the threshold.
+namespace
+{
+        // Per kernel error allowed. Outputs of float kernels that go through a threshold or a
+        // rounding (projection, ray marching) may differ in a small fraction of elements.
+        struct Tolerance
+        {
+                double absolute;
+                double relative;
+                double mismatch_fraction;
+        };
+
+        const Tolerance EXACT = { 0, 0, 0 };
+
+        struct Result
+        {
+                std::string name;
+                bool passed;
+                std::string detail;
+                double ms;
+                double baseline_ms;
+        };
+
+        class KernelTest
+        {
+                public:
+                        KernelTest(unsigned int width, unsigned int height, unsigned int iterations, double threshold);
+                        bool initialise();
+                        void run();
+                        void checkTimings(std::string baseline_filename, bool update_baselines);
+                        bool report();
+
+                private:
+                        void generateInputs();
+                        void testLuminance();
+                        void testRectify();
+                        void testExpandLuminance();
+                        void testExpandDisparity();
+                        void testDisparity(std::string name, cl::Program& program);
+                        void testDisparityTemporal(std::string name, cl::Program& program);
+                        void testDisparityAggregated();
+                        void testSubPixelGroundTruth();
+                        void testCensus(std::string name, cl::Program& program);
+                        void testCensusMatcher();
+                        void testValidityMask();
+                        void testDisparityToDepth();
+                        void testVertexMap();
+                        void testNormalMap();
+                        void testCorrespondences();
+                        void testCompaction();
+                        void testResiduals();
+                        void testRender(std::string name, cl::Program& program);
+                        void testUpsampleRender();
+                        void testVolumeShift();
+                        void testImageMemoryFill();
+                        void testImageOps();
+
+                        cl::Image2D createImage(cl::ImageFormat format, const void* pixels);
+                        cl::Image2D createImage(cl::ImageFormat format);
+                        void readImage(cl::Image2D& image, void* pixels);
+                        void launch(cl::Kernel& kernel, unsigned int width, unsigned int height);
+                        double time(const std::function<void()>& run);
+                        template <typename T> void compare(std::string name, const T* expected, const T* actual, size_t count,
+                                const Tolerance& tolerance, const std::function<void()>& run);
+                        void addResult(std::string name, bool passed, std::string detail, const std::function<void()>& run);
+
+                        cl::Device m_device;
+                        cl::Context m_context;
+                        cl::CommandQueue m_command_queue;
+                        KernelVariants m_kernel_variants;
+                        std::string m_device_key;
+
+                        unsigned int m_width;
+                        unsigned int m_height;
+                        size_t m_pixel_count;
+                        unsigned int m_iterations;
+                        double m_threshold;
+                        std::vector<Result> m_results;
+
+                        // Configuration exercised, as the defaults of Manager and Algorithm
+                        const int m_window_size = 9;
+                        const int m_max_disparity = 32;
+                        const unsigned int m_aggregated_disparities = 64;
+                        const unsigned int m_disparity_batch_size = 16;
+                        const int m_temporal_band = 2;
+                        const unsigned int m_temporal_cost_threshold = 16;
+                        const int m_focal_length = 615;
+                        const int m_baseline_mm = 10;
+                        const unsigned int m_compaction_group_size = 64;
+                        const int m_volume_dimensions[3] = { 64, 64, 64 };
+                        const float m_voxel_size = 4;
+                        const int m_render_scale = 2;
+
+                        // Synthetic inputs, a textured stereo pair with known disparities and a bumpy surface
+                        std::vector<uint8_t> m_rgba;
+                        std::vector<uint8_t> m_left;
+                        std::vector<uint8_t> m_right;
+                        std::vector<uint32_t> m_remap;
+                        std::vector<uint16_t> m_disparity;
+                        std::vector<uint16_t> m_reverse_disparity;
+                        std::vector<uint32_t> m_disparity_validity;
+                        std::vector<uint32_t> m_validity;
+                        std::vector<uint32_t> m_prev_validity;
+                        std::vector<uint32_t> m_depth;
+                        std::vector<uint16_t> m_vertex_halves;
+                        std::vector<float> m_vertices;
+                        std::vector<uint32_t> m_normals;
+                        std::vector<uint16_t> m_prev_vertex_halves;
+                        std::vector<float> m_prev_vertices;
+                        std::vector<uint32_t> m_prev_normals;
+                        std::vector<float> m_correspondences;
+                        std::vector<KernelReference::Correspondence> m_compact;
+                        unsigned int m_compact_count = 0;
+                        std::vector<int> m_voxels;
+                        std::vector<float> m_render_samples;
+        };
+
+        KernelTest::KernelTest(unsigned int width, unsigned int height, unsigned int iterations, double threshold)
+        {
+                m_width = width;
+                m_height = height;
+                m_pixel_count = (size_t) width * height;
+                m_iterations = std::max(iterations, 1u);
+                m_threshold = threshold;
+        }
+
+        bool KernelTest::initialise()
+        {
+                // Same platform and device as the reconstruction picks
+                std::vector<cl::Platform> platforms;
+                cl::Platform::get(&platforms);
+                if (platforms.size() == 0)
+                {
+                        std::cerr << "No platforms found, check OpencL installation." << std::endl;
+                        return false;
+                }
+                std::vector<cl::Device> devices;
+                platforms.at(0).getDevices(CL_DEVICE_TYPE_DEFAULT, &devices);
+                if (devices.size() == 0)
+                {
+                        std::cerr << "No devices found, check OpencL installation." << std::endl;
+                        return false;
+                }
+                m_device = devices.at(0);
+                std::string device_name = m_device.getInfo<CL_DEVICE_NAME>();
+                std::string driver_version = m_device.getInfo<CL_DRIVER_VERSION>();
+                m_device_key = std::string(device_name.c_str()) + " " + std::string(driver_version.c_str());
+                std::cout << "Using device: " << m_device_key << std::endl;
+
+                m_context = cl::Context({m_device});
+                m_command_queue = cl::CommandQueue(m_context, m_device);
+
+                std::ifstream stream("src/kernels/reconstruction.cl");
+                if (!stream.good())
+                {
+                        std::cerr << "Could not open src/kernels/reconstruction.cl, run from the repository root" << std::endl;
+                        return false;
+                }
+                std::stringstream source;
+                source << stream.rdbuf();
+                m_kernel_variants.initialise(m_context, m_device, source.str());
+                return true;
+        }
+
+        void KernelTest::run()
+        {
+                generateInputs();
+
+                // Specialised builds are checked alongside the generic build they replace
+                cl::Program& generic = m_kernel_variants.getProgram("");
+                cl::Program& sad = m_kernel_variants.getProgram(KernelVariants::define("WINDOW_SIZE", m_window_size) +
+                        KernelVariants::define("MAX_DISPARITY", m_max_disparity));
+                cl::Program& census = m_kernel_variants.getProgram(KernelVariants::define("MAX_DISPARITY", m_max_disparity));
+                cl::Program& volume = m_kernel_variants.getProgram(KernelVariants::define("VOLUME_X", m_volume_dimensions[0]) +
+                        KernelVariants::define("VOLUME_Y", m_volume_dimensions[1]) + KernelVariants::define("VOLUME_Z", m_volume_dimensions[2]));
+
+                testLuminance();
+                testRectify();
+                testExpandLuminance();
+                testExpandDisparity();
+                testDisparity("disparity", generic);
+                testDisparity("disparity (specialised)", sad);
+                testDisparityTemporal("disparityTemporal", generic);
+                testDisparityTemporal("disparityTemporal (specialised)", sad);
+                testDisparityAggregated();
+                testSubPixelGroundTruth();
+                testCensus("census", generic);
+                testCensus("census (specialised)", census);
+                testCensusMatcher();
+                testValidityMask();
+                testDisparityToDepth();
+                testVertexMap();
+                testNormalMap();
+                testCorrespondences();
+                testCompaction();
+                testResiduals();
+                testRender("render", generic);
+                testRender("render (specialised)", volume);
+                testUpsampleRender();
+                testVolumeShift();
+                testImageMemoryFill();
+                testImageOps();
+        }
+
+        void KernelTest::generateInputs()
+        {
+                // Fixed seed, so failures reproduce and timings compare like with like
+                std::mt19937 random(12345);
+
+                m_rgba.resize(m_pixel_count * 4);
+                for (uint8_t& value : m_rgba)
+                {
+                        value = random() & 0xFF;
+                }
+
+                // Random texture for the right view, seen shifted by a disparity that varies across the
+                // frame in the left view, with noise so matches are not exact
+                m_right.resize(m_pixel_count);
+                m_left.resize(m_pixel_count);
+                for (uint8_t& value : m_right)
+                {
+                        value = random() & 0xFF;
+                }
+                for (unsigned int y = 0; y < m_height; y++)
+                {
+                        for (unsigned int x = 0; x < m_width; x++)
+                        {
+                                int disparity = 4 + (int) (x * 16 / m_width) + (int) (y * 8 / m_height);
+                                int source_x = std::max((int) x - disparity, 0);
+                                int value = m_right[y * m_width + source_x] + (int) (random() % 7) - 3;
+                                m_left[y * m_width + x] = std::min(std::max(value, 0), 255);
+                        }
+                }
+
+                // Gently warped remap table in 12.4 fixed point, with the border mapped nowhere
+                m_remap.resize(m_pixel_count);
+                for (unsigned int y = 0; y < m_height; y++)
+                {
+                        for (unsigned int x = 0; x < m_width; x++)
+                        {
+                                float source_x = x + 1.5f * std::sin(y * 0.05f);
+                                float source_y = y + 1.5f * std::cos(x * 0.05f);
+                                bool inside = source_x >= 0 && source_y >= 0 && source_x < m_width - 1 && source_y < m_height - 1;
+                                uint32_t fixed_x = (uint32_t) (source_x * (1 << KernelReference::REMAP_FRACTION_BITS));
+                                uint32_t fixed_y = (uint32_t) (source_y * (1 << KernelReference::REMAP_FRACTION_BITS));
+                                m_remap[y * m_width + x] = inside ? (fixed_y << 16) | fixed_x : 0xFFFFFFFF;
+                        }
+                }
+
+                m_disparity.resize(m_pixel_count);
+                KernelReference::disparity(m_left.data(), m_right.data(), m_width, m_height, m_window_size, m_max_disparity, m_disparity.data());
+
+                // The left view matched against the right, and the pixels that match consistently both ways
+                m_reverse_disparity.resize(m_pixel_count);
+                KernelReference::disparity(m_right.data(), m_left.data(), m_width, m_height, m_window_size, m_max_disparity, m_reverse_disparity.data());
+                size_t validity_word_count = (size_t) KernelReference::getValidityWordsPerRow(m_width) * m_height;
+                m_disparity_validity.resize(validity_word_count);
+                KernelReference::validityMask(m_disparity.data(), m_reverse_disparity.data(), m_width, m_height, true, m_disparity_validity.data());
+
+                // A tilted, rippled surface 1-2 metres away with a hole of missing depth
+                m_depth.resize(m_pixel_count);
+                for (unsigned int y = 0; y < m_height; y++)
+                {
+                        for (unsigned int x = 0; x < m_width; x++)
+                        {
+                                bool hole = x > m_width / 4 && x < m_width / 3 && y > m_height / 4 && y < m_height / 3;
+                                float depth = 1000 + 500.0f * x / m_width + 300.0f * y / m_height + 20 * std::sin(x * 0.1f) * std::cos(y * 0.1f);
+                                m_depth[y * m_width + x] = hole ? 0 : (uint32_t) depth;
+                        }
+                }
+
+                // Vertex maps as the device stores them, half floats, with the previous frame 5mm further away
+                std::vector<float> vertices(m_pixel_count * 3);
+                std::vector<uint32_t> prev_depth(m_depth);
+                for (uint32_t& depth : prev_depth)
+                {
+                        depth = depth == 0 ? 0 : depth + 5;
+                }
+                float principal_point_x = m_width / 2.0f;
+                float principal_point_y = m_height / 2.0f;
+
+                // Masks as the pipeline leaves them, valid wherever there is depth
+                std::vector<uint16_t> has_depth(m_pixel_count);
+                std::vector<uint16_t> had_depth(m_pixel_count);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        has_depth[i] = m_depth[i] != 0;
+                        had_depth[i] = prev_depth[i] != 0;
+                }
+                m_validity.resize(validity_word_count);
+                m_prev_validity.resize(validity_word_count);
+                KernelReference::validityMask(has_depth.data(), NULL, m_width, m_height, false, m_validity.data());
+                KernelReference::validityMask(had_depth.data(), NULL, m_width, m_height, false, m_prev_validity.data());
+
+                m_vertex_halves.assign(m_pixel_count * 4, 0);
+                m_prev_vertex_halves.assign(m_pixel_count * 4, 0);
+                m_vertices.resize(m_pixel_count * 3);
+                m_prev_vertices.resize(m_pixel_count * 3);
+                for (int frame = 0; frame < 2; frame++)
+                {
+                        std::vector<uint16_t>& halves = frame == 0 ? m_vertex_halves : m_prev_vertex_halves;
+                        std::vector<float>& rounded = frame == 0 ? m_vertices : m_prev_vertices;
+                        KernelReference::generateVertexMap(frame == 0 ? m_depth.data() : prev_depth.data(),
+                                frame == 0 ? m_validity.data() : m_prev_validity.data(), m_width, m_height,
+                                m_focal_length, 1, 1, 0, principal_point_x, principal_point_y, vertices.data());
+                        for (size_t i = 0; i < m_pixel_count; i++)
+                        {
+                                for (int axis = 0; axis < 3; axis++)
+                                {
+                                        halves[i * 4 + axis] = KernelReference::floatToHalf(vertices[i * 3 + axis]);
+                                        rounded[i * 3 + axis] = KernelReference::halfToFloat(halves[i * 4 + axis]);
+                                }
+                        }
+                }
+                m_normals.resize(m_pixel_count);
+                m_prev_normals.resize(m_pixel_count);
+                KernelReference::generateNormalMap(m_vertices.data(), m_validity.data(), m_width, m_height, m_normals.data());
+                KernelReference::generateNormalMap(m_prev_vertices.data(), m_prev_validity.data(), m_width, m_height, m_prev_normals.data());
+
+                // Volume holding a shaded sphere
+                size_t voxel_count = (size_t) m_volume_dimensions[0] * m_volume_dimensions[1] * m_volume_dimensions[2];
+                m_voxels.assign(voxel_count, 0);
+                for (int z = 0; z < m_volume_dimensions[2]; z++)
+                {
+                        for (int y = 0; y < m_volume_dimensions[1]; y++)
+                        {
+                                for (int x = 0; x < m_volume_dimensions[0]; x++)
+                                {
+                                        int dx = x - m_volume_dimensions[0] / 2;
+                                        int dy = y - m_volume_dimensions[1] / 2;
+                                        int dz = z - m_volume_dimensions[2] / 2;
+                                        if (dx * dx + dy * dy + dz * dz < 30 * 30)
+                                        {
+                                                m_voxels[((size_t) z * m_volume_dimensions[1] + y) * m_volume_dimensions[0] + x] = 1 + (x * 7 + y * 3 + z) % 254;
+                                        }
+                                }
+                        }
+                }
+        }
+
+        void KernelTest::testLuminance()
+        {
+                std::vector<uint8_t> expected(m_pixel_count);
+                KernelReference::luminance(m_rgba.data(), m_width, m_height, expected.data());
+
+                cl::Image2D rgba = createImage(cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), m_rgba.data());
+                cl::Image2D luminance = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "luminance");
+                kernel.setArg(0, rgba);
+                kernel.setArg(1, luminance);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint8_t> actual(m_pixel_count);
+                readImage(luminance, actual.data());
+                Tolerance tolerance = { 1, 0, 0 };
+                compare("luminance", expected.data(), actual.data(), m_pixel_count, tolerance, run);
+        }
+
+        void KernelTest::testRectify()
+        {
+                // The left frame is RGBA and the right single channel, both are accepted
+                std::vector<uint8_t> expected_left(m_pixel_count);
+                std::vector<uint8_t> expected_right(m_pixel_count);
+                KernelReference::rectify(m_rgba.data(), 4, m_remap.data(), m_width, m_height, expected_left.data());
+                KernelReference::rectify(m_right.data(), 1, m_remap.data(), m_width, m_height, expected_right.data());
+
+                cl::Image2D raw_left = createImage(cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8), m_rgba.data());
+                cl::Image2D raw_right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Buffer remap(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_pixel_count, m_remap.data());
+                cl::Image2D left = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8));
+                cl::Image2D right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "rectify");
+                kernel.setArg(0, raw_left);
+                kernel.setArg(1, raw_right);
+                kernel.setArg(2, remap);
+                kernel.setArg(3, remap);
+                kernel.setArg(4, left);
+                kernel.setArg(5, right);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Both outputs are checked as one, the luminance weights may round either way
+                std::vector<uint8_t> expected(expected_left);
+                expected.insert(expected.end(), expected_right.begin(), expected_right.end());
+                std::vector<uint8_t> actual(m_pixel_count * 2);
+                readImage(left, actual.data());
+                readImage(right, actual.data() + m_pixel_count);
+                Tolerance tolerance = { 1, 0, 0 };
+                compare("rectify", expected.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testExpandLuminance()
+        {
+                std::vector<uint8_t> expected(m_pixel_count * 4);
+                KernelReference::expandLuminance(m_right.data(), m_width, m_height, expected.data());
+
+                cl::Image2D luminance = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Image2D rgba = createImage(cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "expandLuminance");
+                kernel.setArg(0, luminance);
+                kernel.setArg(1, rgba);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint8_t> actual(m_pixel_count * 4);
+                readImage(rgba, actual.data());
+                compare("expandLuminance", expected.data(), actual.data(), actual.size(), EXACT, run);
+        }
+
+        void KernelTest::testExpandDisparity()
+        {
+                // The first row ramps through every disparity the format holds, so the display saturates at 255
+                std::vector<uint16_t> disparities(m_disparity);
+                for (unsigned int x = 0; x < m_width; x++)
+                {
+                        disparities[x] = (uint16_t) ((uint64_t) x * 0xFFFF / (m_width - 1));
+                }
+                std::vector<uint8_t> expected(m_pixel_count * 4);
+                KernelReference::expandDisparity(disparities.data(), m_width, m_height, expected.data());
+
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), disparities.data());
+                cl::Image2D rgba = createImage(cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "expandDisparity");
+                kernel.setArg(0, disparity);
+                kernel.setArg(1, rgba);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint8_t> actual(m_pixel_count * 4);
+                readImage(rgba, actual.data());
+                compare("expandDisparity", expected.data(), actual.data(), actual.size(), EXACT, run);
+        }
+
+        void KernelTest::testDisparity(std::string name, cl::Program& program)
+        {
+                cl::Image2D left = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_left.data());
+                cl::Image2D right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16));
+                cl::Kernel kernel(program, "disparity");
+                kernel.setArg(0, disparity);
+                kernel.setArg(1, left);
+                kernel.setArg(2, right);
+                kernel.setArg(3, m_window_size);
+                kernel.setArg(4, m_max_disparity);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint16_t> actual(m_pixel_count);
+                readImage(disparity, actual.data());
+                compare(name, m_disparity.data(), actual.data(), m_pixel_count, EXACT, run);
+        }
+
+        void KernelTest::testDisparityTemporal(std::string name, cl::Program& program)
+        {
+                // Seeded from the full search, warped as for a small sideways and upwards camera motion
+                const float warp_x = 0.05f;
+                const float warp_y = 0.02f;
+                std::vector<uint16_t> expected(m_pixel_count);
+                KernelReference::disparityTemporal(m_disparity.data(), m_left.data(), m_right.data(), m_width, m_height, m_window_size,
+                        m_temporal_band, m_temporal_cost_threshold, warp_x, warp_y, m_max_disparity, expected.data());
+
+                cl::Image2D previous = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), m_disparity.data());
+                cl::Image2D left = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_left.data());
+                cl::Image2D right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16));
+                cl::Kernel kernel(program, "disparityTemporal");
+                kernel.setArg(0, disparity);
+                kernel.setArg(1, previous);
+                kernel.setArg(2, left);
+                kernel.setArg(3, right);
+                kernel.setArg(4, m_window_size);
+                kernel.setArg(5, m_temporal_band);
+                kernel.setArg(6, m_temporal_cost_threshold);
+                kernel.setArg(7, warp_x);
+                kernel.setArg(8, warp_y);
+                kernel.setArg(9, m_max_disparity);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint16_t> actual(m_pixel_count);
+                readImage(disparity, actual.data());
+                compare(name, expected.data(), actual.data(), m_pixel_count, EXACT, run);
+
+                // That prior is smooth, so where it is sampled hardly shows. A checkered prior with the fallback to
+                // the full search turned off makes the output follow the warp, here of a camera moving half the
+                // baseline sideways and a quarter down.
+                const float moved_warp_x = 0.5f;
+                const float moved_warp_y = -0.25f;
+                const unsigned int no_fallback = 1 << 20;
+                std::vector<uint16_t> checkered(m_pixel_count);
+                for (unsigned int y = 0; y < m_height; y++)
+                {
+                        for (unsigned int x = 0; x < m_width; x++)
+                        {
+                                checkered[y * m_width + x] = ((x / 8 + y / 8) % 2 == 0 ? 6 : 20) << Disparity::FRACTION_BITS;
+                        }
+                }
+                std::vector<uint16_t> expected_moved(m_pixel_count);
+                KernelReference::disparityTemporal(checkered.data(), m_left.data(), m_right.data(), m_width, m_height, m_window_size,
+                        m_temporal_band, no_fallback, moved_warp_x, moved_warp_y, m_max_disparity, expected_moved.data());
+                std::vector<uint16_t> unwarped(m_pixel_count);
+                KernelReference::disparityTemporal(checkered.data(), m_left.data(), m_right.data(), m_width, m_height, m_window_size,
+                        m_temporal_band, no_fallback, 0, 0, m_max_disparity, unwarped.data());
+                if (expected_moved == unwarped)
+                {
+                        addResult(name + " (moving camera)", false, "the warp changes no disparity", []() {});
+                        return;
+                }
+
+                cl::Image2D checkered_previous = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), checkered.data());
+                kernel.setArg(1, checkered_previous);
+                kernel.setArg(6, no_fallback);
+                kernel.setArg(7, moved_warp_x);
+                kernel.setArg(8, moved_warp_y);
+                run();
+                readImage(disparity, actual.data());
+                compare(name + " (moving camera)", expected_moved.data(), actual.data(), m_pixel_count, EXACT, run);
+        }
+
+        void KernelTest::testDisparityAggregated()
+        {
+                std::vector<uint16_t> expected(m_pixel_count);
+                KernelReference::disparityAggregated(m_left.data(), m_right.data(), m_width, m_height, m_window_size,
+                        m_aggregated_disparities, expected.data());
+
+                // The three passes run together as Algorithm::aggregateDisparity does
+                cl::Image2D left = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_left.data());
+                cl::Image2D right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16));
+                cl::Buffer row_sums(m_context, CL_MEM_READ_WRITE, sizeof(uint32_t) * m_pixel_count * m_disparity_batch_size);
+                std::vector<uint32_t> no_costs(m_pixel_count, 0xFFFFFFFF);
+                cl::Buffer best_costs(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_pixel_count, no_costs.data());
+                cl::Program& program = m_kernel_variants.getProgram("");
+                std::function<void()> run = [&]()
+                {
+                        for (unsigned int first_disparity = 0; first_disparity < m_aggregated_disparities; first_disparity += m_disparity_batch_size)
+                        {
+                                unsigned int batch_size = std::min(m_disparity_batch_size, m_aggregated_disparities - first_disparity);
+                                cl::Kernel rows_kernel(program, "aggregateRows");
+                                rows_kernel.setArg(0, left);
+                                rows_kernel.setArg(1, right);
+                                rows_kernel.setArg(2, m_window_size);
+                                rows_kernel.setArg(3, (int) first_disparity);
+                                rows_kernel.setArg(4, 1);
+                                rows_kernel.setArg(5, row_sums);
+                                m_command_queue.enqueueNDRangeKernel(rows_kernel, cl::NullRange, cl::NDRange(m_height, batch_size), cl::NullRange);
+
+                                cl::Kernel columns_kernel(program, "aggregateColumns");
+                                columns_kernel.setArg(0, row_sums);
+                                columns_kernel.setArg(1, (int) m_width);
+                                columns_kernel.setArg(2, (int) m_height);
+                                columns_kernel.setArg(3, m_window_size);
+                                columns_kernel.setArg(4, (int) first_disparity);
+                                columns_kernel.setArg(5, best_costs);
+                                m_command_queue.enqueueNDRangeKernel(columns_kernel, cl::NullRange, cl::NDRange(m_width, batch_size), cl::NullRange);
+                        }
+                        cl::Kernel resolve_kernel(program, "resolveAggregatedDisparity");
+                        resolve_kernel.setArg(0, best_costs);
+                        resolve_kernel.setArg(1, left);
+                        resolve_kernel.setArg(2, right);
+                        resolve_kernel.setArg(3, m_window_size);
+                        resolve_kernel.setArg(4, 1);
+                        resolve_kernel.setArg(5, (int) m_aggregated_disparities);
+                        resolve_kernel.setArg(6, disparity);
+                        launch(resolve_kernel, m_width, m_height);
+                };
+                run();
+
+                std::vector<uint16_t> actual(m_pixel_count);
+                readImage(disparity, actual.data());
+                compare("aggregateRows/Columns/resolveAggregatedDisparity", expected.data(), actual.data(), m_pixel_count, EXACT, run);
+        }
+
+        void KernelTest::testSubPixelGroundTruth()
+        {
+                // Smooth texture seen 2.5 pixels apart, which whole disparities can only get to within half a
+                // pixel. Pixels near the left edge have no match and may be off by more.
+                const float shift = 2.5f;
+                std::function<uint8_t(float, float)> texture = [](float x, float y)
+                {
+                        return (uint8_t) std::lround(128 + 50 * std::sin(x * 0.37f + y * 0.11f) + 40 * std::sin(x * 0.19f - y * 0.23f) +
+                                25 * std::sin(x * 0.83f + y * 0.29f));
+                };
+                std::vector<uint8_t> left(m_pixel_count);
+                std::vector<uint8_t> right(m_pixel_count);
+                for (unsigned int y = 0; y < m_height; y++)
+                {
+                        for (unsigned int x = 0; x < m_width; x++)
+                        {
+                                left[y * m_width + x] = texture(x - shift, y);
+                                right[y * m_width + x] = texture(x, y);
+                        }
+                }
+                std::vector<uint16_t> expected(m_pixel_count, (uint16_t) (shift * (1 << Disparity::FRACTION_BITS)));
+
+                cl::Image2D left_image = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), left.data());
+                cl::Image2D right_image = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), right.data());
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "disparity");
+                kernel.setArg(0, disparity);
+                kernel.setArg(1, left_image);
+                kernel.setArg(2, right_image);
+                kernel.setArg(3, m_window_size);
+                kernel.setArg(4, m_max_disparity);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Within an eighth of a pixel
+                std::vector<uint16_t> actual(m_pixel_count);
+                readImage(disparity, actual.data());
+                Tolerance tolerance = { 2, 0, 0.05 };
+                compare("disparity sub-pixel ground truth", expected.data(), actual.data(), m_pixel_count, tolerance, run);
+        }
+
+        void KernelTest::testCensus(std::string name, cl::Program& program)
+        {
+                std::vector<uint64_t> expected(m_pixel_count * 2);
+                KernelReference::census(m_left.data(), m_width, m_height, expected.data());
+                KernelReference::census(m_right.data(), m_width, m_height, expected.data() + m_pixel_count);
+                std::vector<uint16_t> expected_disparity(m_pixel_count);
+                KernelReference::disparityCensus(expected.data(), expected.data() + m_pixel_count, m_width, m_height, m_max_disparity, expected_disparity.data());
+
+                cl::Image2D left = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_left.data());
+                cl::Image2D right = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), m_right.data());
+                cl::Buffer left_census(m_context, CL_MEM_READ_WRITE, sizeof(uint64_t) * m_pixel_count);
+                cl::Buffer right_census(m_context, CL_MEM_READ_WRITE, sizeof(uint64_t) * m_pixel_count);
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16));
+
+                cl::Kernel left_kernel(program, "census");
+                left_kernel.setArg(0, left);
+                left_kernel.setArg(1, left_census);
+                cl::Kernel right_kernel(program, "census");
+                right_kernel.setArg(0, right);
+                right_kernel.setArg(1, right_census);
+                std::function<void()> run_census = [&]()
+                {
+                        launch(left_kernel, m_width, m_height);
+                        launch(right_kernel, m_width, m_height);
+                };
+                run_census();
+
+                std::vector<uint64_t> actual(m_pixel_count * 2);
+                m_command_queue.enqueueReadBuffer(left_census, CL_FALSE, 0, sizeof(uint64_t) * m_pixel_count, actual.data());
+                m_command_queue.enqueueReadBuffer(right_census, CL_TRUE, 0, sizeof(uint64_t) * m_pixel_count, actual.data() + m_pixel_count);
+                compare(name, expected.data(), actual.data(), actual.size(), EXACT, run_census);
+
+                cl::Kernel match_kernel(program, "disparityCensus");
+                match_kernel.setArg(0, disparity);
+                match_kernel.setArg(1, left_census);
+                match_kernel.setArg(2, right_census);
+                match_kernel.setArg(3, m_max_disparity);
+                std::function<void()> run_match = [&]() { launch(match_kernel, m_width, m_height); };
+                run_match();
+
+                std::vector<uint16_t> actual_disparity(m_pixel_count);
+                readImage(disparity, actual_disparity.data());
+                compare("disparityCensus" + name.substr(std::string("census").size()), expected_disparity.data(), actual_disparity.data(),
+                        m_pixel_count, EXACT, run_match);
+        }
+
+        void KernelTest::testCensusMatcher()
+        {
+                // Host path of --matching census-host, multithreaded with hardware popcount
+                std::vector<uint64_t> descriptors(m_pixel_count * 2);
+                KernelReference::census(m_left.data(), m_width, m_height, descriptors.data());
+                KernelReference::census(m_right.data(), m_width, m_height, descriptors.data() + m_pixel_count);
+                std::vector<uint16_t> expected(m_pixel_count);
+                KernelReference::disparityCensus(descriptors.data(), descriptors.data() + m_pixel_count, m_width, m_height, m_max_disparity, expected.data());
+
+                CensusMatcher census_matcher;
+                std::vector<uint16_t> actual(m_pixel_count);
+                std::function<void()> run = [&]() { census_matcher.match(m_left.data(), m_right.data(), m_width, m_height, m_max_disparity, actual.data()); };
+                run();
+                compare("CensusMatcher (host)", expected.data(), actual.data(), m_pixel_count, EXACT, run);
+        }
+
+        void KernelTest::testValidityMask()
+        {
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), m_disparity.data());
+                cl::Image2D reverse_disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), m_reverse_disparity.data());
+                unsigned int words_per_row = KernelReference::getValidityWordsPerRow(m_width);
+                cl::Buffer validity(m_context, CL_MEM_READ_WRITE, sizeof(uint32_t) * m_disparity_validity.size());
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "validityMask");
+                kernel.setArg(0, disparity);
+                kernel.setArg(1, reverse_disparity);
+                kernel.setArg(2, 1);
+                kernel.setArg(3, validity);
+                std::function<void()> run = [&]() { launch(kernel, words_per_row, m_height); };
+                run();
+
+                std::vector<uint32_t> actual(m_disparity_validity.size());
+                m_command_queue.enqueueReadBuffer(validity, CL_TRUE, 0, sizeof(uint32_t) * actual.size(), actual.data());
+                compare("validityMask", m_disparity_validity.data(), actual.data(), actual.size(), EXACT, run);
+        }
+
+        void KernelTest::testDisparityToDepth()
+        {
+                std::vector<uint32_t> expected(m_pixel_count);
+                KernelReference::disparityToDepth(m_disparity.data(), m_disparity_validity.data(), m_width, m_height, m_focal_length, m_baseline_mm, expected.data());
+
+                cl::Image2D disparity = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT16), m_disparity.data());
+                cl::Image2D depth = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32));
+                cl::Buffer validity(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_disparity_validity.size(), m_disparity_validity.data());
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "disparityToDepth");
+                kernel.setArg(0, depth);
+                kernel.setArg(1, disparity);
+                kernel.setArg(2, validity);
+                kernel.setArg(3, m_focal_length);
+                kernel.setArg(4, m_baseline_mm);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                std::vector<uint32_t> actual(m_pixel_count);
+                readImage(depth, actual.data());
+                compare("disparityToDepth", expected.data(), actual.data(), m_pixel_count, EXACT, run);
+        }
+
+        void KernelTest::testVertexMap()
+        {
+                // Off-centre principal point and skew, so every term of the inverse camera matrix counts
+                const float principal_point_x = m_width / 2.0f + 3.5f;
+                const float principal_point_y = m_height / 2.0f - 2.5f;
+                const int skew_coeff = 2;
+                std::vector<float> expected(m_pixel_count * 3);
+                KernelReference::generateVertexMap(m_depth.data(), m_validity.data(), m_width, m_height, m_focal_length, 1, 1, skew_coeff,
+                        principal_point_x, principal_point_y, expected.data());
+
+                cl::Image2D depth = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), m_depth.data());
+                cl::Buffer validity(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_validity.size(), m_validity.data());
+                cl::Image2D vertices = createImage(cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "generateVertexMap");
+                kernel.setArg(0, depth);
+                kernel.setArg(1, validity);
+                kernel.setArg(2, m_focal_length);
+                kernel.setArg(3, 1);
+                kernel.setArg(4, 1);
+                kernel.setArg(5, skew_coeff);
+                kernel.setArg(6, principal_point_x);
+                kernel.setArg(7, principal_point_y);
+                kernel.setArg(8, vertices);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Half floats hold 11 significant bits
+                std::vector<uint16_t> halves(m_pixel_count * 4);
+                readImage(vertices, halves.data());
+                std::vector<float> actual(m_pixel_count * 3);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        for (int axis = 0; axis < 3; axis++)
+                        {
+                                actual[i * 3 + axis] = KernelReference::halfToFloat(halves[i * 4 + axis]);
+                        }
+                }
+                Tolerance tolerance = { 1e-7, 1e-3, 0 };
+                compare("generateVertexMap", expected.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testNormalMap()
+        {
+                cl::Image2D vertices = createImage(cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT), m_vertex_halves.data());
+                cl::Buffer validity(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_validity.size(), m_validity.data());
+                cl::Image2D normals = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "generateNormalMap");
+                kernel.setArg(0, vertices);
+                kernel.setArg(1, validity);
+                kernel.setArg(2, normals);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Compared decoded, a last bit rounding differently is a negligible change of direction
+                std::vector<uint32_t> codes(m_pixel_count);
+                readImage(normals, codes.data());
+                std::vector<float> expected(m_pixel_count * 3);
+                std::vector<float> actual(m_pixel_count * 3);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        KernelReference::decodeNormal(m_normals[i], &expected[i * 3]);
+                        KernelReference::decodeNormal(codes[i], &actual[i * 3]);
+                }
+                Tolerance tolerance = { 1e-3, 0, 0.001 };
+                compare("generateNormalMap", expected.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testCorrespondences()
+        {
+                // A small rotation and translation, so projection and both transforms are exercised
+                Util::Vector3D rotation;
+                rotation.x = 0.002;
+                rotation.y = -0.003;
+                rotation.z = 0.001;
+                float rotation_matrix[9];
+                Util::getRotationMatrix(rotation, rotation_matrix);
+                float translation[3] = { 0.002f, -0.001f, 0.003f };
+                float focal_length = m_focal_length;
+                float principal_point_x = m_width / 2.0f;
+                float principal_point_y = m_height / 2.0f;
+
+                m_correspondences.resize(m_pixel_count * 4);
+                KernelReference::findCorrespondences(m_validity.data(), m_prev_vertices.data(), m_prev_normals.data(), m_vertices.data(),
+                        m_normals.data(), m_width, m_height, translation, rotation_matrix, focal_length, principal_point_x, principal_point_y,
+                        m_correspondences.data());
+
+                cl::Buffer validity(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint32_t) * m_validity.size(), m_validity.data());
+                cl::Image2D prev_vertices = createImage(cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT), m_prev_vertex_halves.data());
+                cl::Image2D prev_normals = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), m_prev_normals.data());
+                cl::Image2D vertices = createImage(cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT), m_vertex_halves.data());
+                cl::Image2D normals = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), m_normals.data());
+                cl::Buffer correspondences(m_context, CL_MEM_READ_WRITE, sizeof(float) * 4 * m_pixel_count);
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "findCorrespondences");
+                kernel.setArg(0, validity);
+                kernel.setArg(1, prev_vertices);
+                kernel.setArg(2, prev_normals);
+                kernel.setArg(3, vertices);
+                kernel.setArg(4, normals);
+                kernel.setArg(5, translation[0]);
+                kernel.setArg(6, translation[1]);
+                kernel.setArg(7, translation[2]);
+                for (unsigned int row = 0; row < 3; row++)
+                {
+                        cl_float4 rotation_row = {{ rotation_matrix[row * 3], rotation_matrix[row * 3 + 1], rotation_matrix[row * 3 + 2], 0.0f }};
+                        kernel.setArg(8 + row, rotation_row);
+                }
+                kernel.setArg(11, focal_length);
+                kernel.setArg(12, principal_point_x);
+                kernel.setArg(13, principal_point_y);
+                kernel.setArg(14, correspondences);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Projections landing on a pixel boundary may round to the neighbouring pixel
+                std::vector<float> actual(m_pixel_count * 4);
+                m_command_queue.enqueueReadBuffer(correspondences, CL_TRUE, 0, sizeof(float) * actual.size(), actual.data());
+                Tolerance tolerance = { 1e-5, 1e-4, 0.005 };
+                compare("findCorrespondences", m_correspondences.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testCompaction()
+        {
+                m_compact.resize(m_pixel_count);
+                m_compact_count = KernelReference::compactCorrespondences(m_correspondences.data(), m_prev_vertices.data(), m_prev_normals.data(),
+                        m_width, m_height, m_compact.data());
+
+                cl::Buffer dense(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * m_correspondences.size(), m_correspondences.data());
+                cl::Image2D prev_vertices = createImage(cl::ImageFormat(CL_RGBA, CL_HALF_FLOAT), m_prev_vertex_halves.data());
+                cl::Image2D prev_normals = createImage(cl::ImageFormat(CL_R, CL_UNSIGNED_INT32), m_prev_normals.data());
+                cl::Buffer compact(m_context, CL_MEM_READ_WRITE, sizeof(KernelReference::Correspondence) * m_pixel_count);
+                cl::Buffer count(m_context, CL_MEM_READ_WRITE, sizeof(uint32_t));
+                cl::Kernel kernel(m_kernel_variants.getProgram(KernelVariants::define("COMPACTION_GROUP_SIZE", m_compaction_group_size)), "compactCorrespondences");
+                kernel.setArg(0, dense);
+                kernel.setArg(1, prev_vertices);
+                kernel.setArg(2, prev_normals);
+                kernel.setArg(3, (uint32_t) m_pixel_count);
+                kernel.setArg(4, compact);
+                kernel.setArg(5, count);
+                size_t range = (m_pixel_count + m_compaction_group_size - 1) / m_compaction_group_size * m_compaction_group_size;
+                uint32_t zero = 0;
+                std::function<void()> run = [&]()
+                {
+                        m_command_queue.enqueueWriteBuffer(count, CL_FALSE, 0, sizeof(uint32_t), &zero);
+                        m_command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(range), cl::NDRange(m_compaction_group_size));
+                };
+                run();
+
+                uint32_t actual_count = 0;
+                m_command_queue.enqueueReadBuffer(count, CL_TRUE, 0, sizeof(uint32_t), &actual_count);
+                if (actual_count != m_compact_count)
+                {
+                        std::ostringstream detail;
+                        detail << actual_count << " correspondences packed, expected " << m_compact_count;
+                        addResult("compactCorrespondences", false, detail.str(), run);
+                        return;
+                }
+
+                // Work-groups claim their runs in any order, pixel order is restored before comparing
+                std::vector<KernelReference::Correspondence> packed(actual_count);
+                m_command_queue.enqueueReadBuffer(compact, CL_TRUE, 0, sizeof(KernelReference::Correspondence) * actual_count, packed.data());
+                std::sort(packed.begin(), packed.end(),
+                        [](const KernelReference::Correspondence& a, const KernelReference::Correspondence& b) { return a.pixel_index < b.pixel_index; });
+                std::vector<float> expected;
+                std::vector<float> actual;
+                for (unsigned int i = 0; i < actual_count; i++)
+                {
+                        const float* expected_fields = m_compact[i].source;
+                        const float* actual_fields = packed[i].source;
+                        expected.insert(expected.end(), expected_fields, expected_fields + 9);
+                        actual.insert(actual.end(), actual_fields, actual_fields + 9);
+                        expected.push_back(m_compact[i].pixel_index);
+                        actual.push_back(packed[i].pixel_index);
+                }
+                Tolerance tolerance = { 1e-5, 1e-5, 0 };
+                compare("compactCorrespondences", expected.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testResiduals()
+        {
+                unsigned int count = std::max(m_compact_count, 1u);
+                std::vector<float> expected(count, 0.0f);
+                KernelReference::pointToPlaneResiduals(m_compact.data(), m_compact_count, expected.data());
+
+                cl::Buffer correspondences(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(KernelReference::Correspondence) * count, m_compact.data());
+                cl::Buffer residuals(m_context, CL_MEM_READ_WRITE, sizeof(float) * count);
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "pointToPlaneResiduals");
+                kernel.setArg(0, correspondences);
+                kernel.setArg(1, m_compact_count);
+                kernel.setArg(2, residuals);
+                std::function<void()> run = [&]() { m_command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(count), cl::NullRange); };
+                run();
+
+                std::vector<float> actual(count, 0.0f);
+                if (m_compact_count > 0)
+                {
+                        m_command_queue.enqueueReadBuffer(residuals, CL_TRUE, 0, sizeof(float) * count, actual.data());
+                }
+                Tolerance tolerance = { 1e-6, 1e-4, 0 };
+                compare("pointToPlaneResiduals", expected.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testRender(std::string name, cl::Program& program)
+        {
+                // The default view of Manager::renderVolume, orbited part way round
+                const int eye_z = 340;
+                const int screen_z = 280;
+                const float angle = 0.6f;
+                const float cam_distance = 240;
+                const int origin[3] = { 0, 0, 0 };
+                int samples_width = (m_width + m_render_scale - 1) / m_render_scale;
+                int samples_height = (m_height + m_render_scale - 1) / m_render_scale;
+                size_t sample_count = (size_t) samples_width * samples_height;
+                m_render_samples.resize(sample_count * 2);
+                KernelReference::render(m_voxels.data(), m_volume_dimensions, m_voxel_size, origin, 0, 0, eye_z, screen_z, angle, cam_distance,
+                        m_render_scale, m_width, m_height, m_render_samples.data());
+
+                cl::Buffer voxels(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(int) * m_voxels.size(), m_voxels.data());
+                cl::Buffer samples(m_context, CL_MEM_READ_WRITE, sizeof(float) * 2 * sample_count);
+                cl::Kernel kernel(program, "render");
+                kernel.setArg(0, voxels);
+                kernel.setArg(1, m_volume_dimensions[0]);
+                kernel.setArg(2, m_volume_dimensions[1]);
+                kernel.setArg(3, m_volume_dimensions[2]);
+                kernel.setArg(4, m_voxel_size);
+                kernel.setArg(5, origin[0]);
+                kernel.setArg(6, origin[1]);
+                kernel.setArg(7, origin[2]);
+                kernel.setArg(8, 0);
+                kernel.setArg(9, 0);
+                kernel.setArg(10, eye_z);
+                kernel.setArg(11, screen_z);
+                kernel.setArg(12, angle);
+                kernel.setArg(13, cam_distance);
+                kernel.setArg(14, m_render_scale);
+                kernel.setArg(15, (int) m_width);
+                kernel.setArg(16, (int) m_height);
+                kernel.setArg(17, samples);
+                std::function<void()> run = [&]() { launch(kernel, samples_width, samples_height); };
+                run();
+
+                // Rays grazing a voxel boundary may step into the neighbouring voxel
+                std::vector<float> actual(sample_count * 2);
+                m_command_queue.enqueueReadBuffer(samples, CL_TRUE, 0, sizeof(float) * actual.size(), actual.data());
+                Tolerance tolerance = { 1e-3, 1e-4, 0.01 };
+                compare(name, m_render_samples.data(), actual.data(), actual.size(), tolerance, run);
+        }
+
+        void KernelTest::testUpsampleRender()
+        {
+                int samples_width = (m_width + m_render_scale - 1) / m_render_scale;
+                int samples_height = (m_height + m_render_scale - 1) / m_render_scale;
+                std::vector<uint8_t> expected(m_pixel_count);
+                KernelReference::upsampleRender(m_render_samples.data(), m_render_scale, samples_width, samples_height, m_voxel_size,
+                        m_width, m_height, expected.data());
+
+                cl::Buffer samples(m_context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * m_render_samples.size(), m_render_samples.data());
+                cl::Image2D screen = createImage(cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT8));
+                cl::Kernel kernel(m_kernel_variants.getProgram(""), "upsampleRender");
+                kernel.setArg(0, samples);
+                kernel.setArg(1, m_render_scale);
+                kernel.setArg(2, samples_width);
+                kernel.setArg(3, samples_height);
+                kernel.setArg(4, m_voxel_size);
+                kernel.setArg(5, screen);
+                std::function<void()> run = [&]() { launch(kernel, m_width, m_height); };
+                run();
+
+                // Every channel holds the shade
+                std::vector<uint8_t> rgba(m_pixel_count * 4);
+                readImage(screen, rgba.data());
+                std::vector<uint8_t> actual(m_pixel_count);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        actual[i] = rgba[i * 4];
+                }
+                Tolerance tolerance = { 1, 0, 0 };
+                compare("upsampleRender", expected.data(), actual.data(), m_pixel_count, tolerance, run);
+        }
+
+        void KernelTest::testVolumeShift()
+        {
+                // Nothing tracks the camera yet, so a synthetic pose drives the volume off along x and y and back,
+                // the second time through bricks flushed to the store's file
+                BrickStore brick_store;
+                std::string filename = "/tmp/kernel_test.bricks";
+                int brick_width = 16;
+                if (!brick_store.open(filename, brick_width))
+                {
+                        addResult("VolumeShift (host)", false, "could not open " + filename, []() {});
+                        return;
+                }
+
+                // Every world voxel has its own value, with runs of empty space for the store's encoding
+                std::function<int(int, int, int)> world_voxel = [](int x, int y, int z)
+                {
+                        return (x + y + z) % 5 == 0 ? 0 : 1 + ((x * 73 + y * 37 + z * 11) & 0xFFFF);
+                };
+                std::vector<int> voxels(m_volume_dimensions[0] * m_volume_dimensions[1] * m_volume_dimensions[2]);
+                std::vector<int> initial(voxels.size());
+                for (int z = 0; z < m_volume_dimensions[2]; z++)
+                {
+                        for (int y = 0; y < m_volume_dimensions[1]; y++)
+                        {
+                                for (int x = 0; x < m_volume_dimensions[0]; x++)
+                                {
+                                        initial[((size_t) z * m_volume_dimensions[1] + y) * m_volume_dimensions[0] + x] = world_voxel(x, y, z);
+                                }
+                        }
+                }
+                Volume volume;
+                volume.voxels = voxels.data();
+                std::copy(m_volume_dimensions, m_volume_dimensions + 3, volume.dimensions);
+                volume.voxel_size = m_voxel_size;
+                volume.brick_width = brick_width;
+
+                // Under a quarter of the volume away stays put, 40 voxels along x and 24 up (down the voxel y axis) moves
+                Util::Transformation still_pose = { { 5 * m_voxel_size, 0, 0 }, { 0, 0, 0 } };
+                Util::Transformation moved_pose = { { 40 * m_voxel_size, 24 * m_voxel_size, 0 }, { 0, 0, 0 } };
+                Util::Transformation home_pose = { { 0, 0, 0 }, { 0, 0, 0 } };
+                int still_origin[3];
+                int moved_origin[3];
+                int home_origin[3];
+                bool stays = !VolumeShift::getOrigin(volume, still_pose, still_origin);
+                bool moves = VolumeShift::getOrigin(volume, moved_pose, moved_origin);
+                std::ostringstream detail;
+                detail << "origin (" << moved_origin[0] << ", " << moved_origin[1] << ", " << moved_origin[2] << ")";
+                addResult("VolumeShift::getOrigin (host)", stays && moves && moved_origin[0] == 32 && moved_origin[1] == -32 && moved_origin[2] == 0,
+                        detail.str(), []() {});
+
+                // Bricks left behind empty their slots, those kept hold their voxels at the same world position
+                std::vector<int> expected_moved(voxels.size());
+                for (int z = 0; z < m_volume_dimensions[2]; z++)
+                {
+                        for (int y = moved_origin[1]; y < moved_origin[1] + m_volume_dimensions[1]; y++)
+                        {
+                                for (int x = moved_origin[0]; x < moved_origin[0] + m_volume_dimensions[0]; x++)
+                                {
+                                        bool kept = x < m_volume_dimensions[0] && y >= 0;
+                                        size_t slot = ((size_t) z * m_volume_dimensions[1] + ((y % m_volume_dimensions[1]) + m_volume_dimensions[1]) % m_volume_dimensions[1]) *
+                                                m_volume_dimensions[0] + x % m_volume_dimensions[0];
+                                        expected_moved[slot] = kept ? world_voxel(x, y, z) : 0;
+                                }
+                        }
+                }
+                std::copy(initial.begin(), initial.end(), voxels.begin());
+                unsigned int bricks_out = 0;
+                unsigned int bricks_in = 0;
+                VolumeShift::shift(volume, moved_origin, brick_store, bricks_out, bricks_in);
+                std::vector<int> moved(voxels);
+
+                // Coming home reloads every brick that left, from the file once the writer has caught up
+                brick_store.flush();
+                VolumeShift::getOrigin(volume, home_pose, home_origin);
+                unsigned int bricks_back = 0;
+                unsigned int bricks_reloaded = 0;
+                VolumeShift::shift(volume, home_origin, brick_store, bricks_back, bricks_reloaded);
+                std::vector<int> back(voxels);
+                detail.str("");
+                detail << bricks_out << " bricks out, " << bricks_reloaded << " reloaded";
+                addResult("BrickStore reload (host)", bricks_in == 0 && bricks_out > 0 && bricks_reloaded == bricks_out, detail.str(), []() {});
+
+                std::function<void()> run = [&]()
+                {
+                        std::copy(initial.begin(), initial.end(), voxels.begin());
+                        std::fill(volume.origin, volume.origin + 3, 0);
+                        VolumeShift::shift(volume, moved_origin, brick_store, bricks_out, bricks_in);
+                        VolumeShift::shift(volume, home_origin, brick_store, bricks_back, bricks_reloaded);
+                };
+                compare("VolumeShift::shift out (host)", expected_moved.data(), moved.data(), moved.size(), EXACT, run);
+                compare("VolumeShift::shift back (host)", initial.data(), back.data(), back.size(), EXACT, run);
+
+                brick_store.close();
+                unlink(filename.c_str());
+        }
+
+        void KernelTest::testImageMemoryFill()
+        {
+                // Multi-word pixels, as the vertex maps use, must be filled whole and nothing else touched
+                const unsigned int words_per_pixel = 2;
+                ImageMemory image(m_width, m_height, words_per_pixel);
+                size_t word_count = m_pixel_count * words_per_pixel;
+                std::fill(image.getPixels(), image.getPixels() + word_count, 0u);
+                std::function<void()> run = [&]() { image.fill(0xDEADBEEF); };
+                run();
+
+                std::vector<uint32_t> expected(word_count, 0xDEADBEEF);
+                compare("ImageMemory::fill (host)", expected.data(), image.getPixels(), word_count, EXACT, run);
+        }
+
+        void KernelTest::testImageOps()
+        {
+                // The vectorised conversions must match the scalar ones exactly, whichever instruction set is picked
+                std::string suffix = " (host " + ImageOps::getInstructionSet() + ")";
+
+                std::vector<uint8_t> expected_luminance(m_pixel_count);
+                KernelReference::luminance(m_rgba.data(), m_width, m_height, expected_luminance.data());
+                std::vector<uint8_t> luminance(m_pixel_count);
+                std::function<void()> run_luminance = [&]()
+                {
+                        ImageOps::convert(m_rgba.data(), ImageOps::Format::ABGR, luminance.data(), ImageOps::Format::R8, m_pixel_count);
+                };
+                run_luminance();
+                compare("ImageOps::convert ABGR to R8" + suffix, expected_luminance.data(), luminance.data(), m_pixel_count, EXACT, run_luminance);
+
+                std::vector<uint8_t> expected_rgba(m_pixel_count * 4);
+                KernelReference::expandLuminance(m_right.data(), m_width, m_height, expected_rgba.data());
+                std::vector<uint8_t> rgba(m_pixel_count * 4);
+                std::function<void()> run_expand = [&]()
+                {
+                        ImageOps::convert(m_right.data(), ImageOps::Format::R8, rgba.data(), ImageOps::Format::ABGR, m_pixel_count);
+                };
+                run_expand();
+                compare("ImageOps::convert R8 to ABGR" + suffix, expected_rgba.data(), rgba.data(), rgba.size(), EXACT, run_expand);
+
+                // Only red and blue trade places
+                std::vector<uint8_t> expected_swapped(m_rgba);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        std::swap(expected_swapped[i * 4], expected_swapped[i * 4 + 2]);
+                }
+                std::vector<uint8_t> swapped(m_pixel_count * 4);
+                std::function<void()> run_swap = [&]()
+                {
+                        ImageOps::convert(m_rgba.data(), ImageOps::Format::ABGR, swapped.data(), ImageOps::Format::ARGB, m_pixel_count);
+                };
+                run_swap();
+                compare("ImageOps::convert ABGR to ARGB" + suffix, expected_swapped.data(), swapped.data(), swapped.size(), EXACT, run_swap);
+
+                // Grayscale in place of the ARGB surfaces, the swapped frame holds the same colours
+                std::vector<uint32_t> expected_gray(m_pixel_count);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        expected_gray[i] = 0xFF000000 | expected_luminance[i] * 0x010101;
+                }
+                std::vector<uint32_t> gray(m_pixel_count);
+                std::function<void()> run_grayscale = [&]()
+                {
+                        memcpy(gray.data(), swapped.data(), sizeof(uint32_t) * m_pixel_count);
+                        ImageOps::grayscale(gray.data(), ImageOps::Format::ARGB, m_pixel_count);
+                };
+                run_grayscale();
+                compare("ImageOps::grayscale ARGB" + suffix, expected_gray.data(), gray.data(), m_pixel_count, EXACT, run_grayscale);
+
+                // Depths over the whole 32-bit range, so half take the path past the signed range, scaled as
+                // tempSetVoxels always has
+                std::mt19937 random(54321);
+                std::vector<uint32_t> depths(m_pixel_count);
+                std::vector<uint8_t> expected_quantized(m_pixel_count);
+                for (size_t i = 0; i < m_pixel_count; i++)
+                {
+                        depths[i] = random();
+                        unsigned int value = ((float) depths[i] / 300.0f) * 244.0f;
+                        expected_quantized[i] = value & 0xFF;
+                }
+                std::vector<uint8_t> quantized(m_pixel_count);
+                std::function<void()> run_quantize = [&]() { ImageOps::quantizeDepth(depths.data(), m_pixel_count, quantized.data()); };
+                run_quantize();
+                compare("ImageOps::quantizeDepth" + suffix, expected_quantized.data(), quantized.data(), m_pixel_count, EXACT, run_quantize);
+
+                // A count that leaves a scalar remainder, with the words past the end left alone
+                size_t fill_count = m_pixel_count - 3;
+                std::vector<uint32_t> expected_words(m_pixel_count, 0xDEADBEEF);
+                std::fill(expected_words.begin() + fill_count, expected_words.end(), 0);
+                std::vector<uint32_t> words(m_pixel_count, 0);
+                std::function<void()> run_fill = [&]() { ImageOps::fill(words.data(), fill_count, 0xDEADBEEF); };
+                run_fill();
+                compare("ImageOps::fill" + suffix, expected_words.data(), words.data(), m_pixel_count, EXACT, run_fill);
+        }
+
+        cl::Image2D KernelTest::createImage(cl::ImageFormat format, const void* pixels)
+        {
+                return cl::Image2D(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, format, m_width, m_height, 0, (void*) pixels);
+        }
+
+        cl::Image2D KernelTest::createImage(cl::ImageFormat format)
+        {
+                return cl::Image2D(m_context, CL_MEM_READ_WRITE, format, m_width, m_height);
+        }
+
+        void KernelTest::readImage(cl::Image2D& image, void* pixels)
+        {
+                cl::size_t<3> origin;
+                origin[0] = 0;
+                origin[1] = 0;
+                origin[2] = 0;
+
+                cl::size_t<3> region;
+                region[0] = m_width;
+                region[1] = m_height;
+                region[2] = 1;
+
+                m_command_queue.enqueueReadImage(image, CL_TRUE, origin, region, 0, 0, pixels);
+        }
+
+        void KernelTest::launch(cl::Kernel& kernel, unsigned int width, unsigned int height)
+        {
+                // Exact ranges, the driver picks the work-group size
+                m_command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+        }
+
+        double KernelTest::time(const std::function<void()>& run)
+        {
+                // Median of the timed runs, so a single interruption does not count
+                std::vector<double> times;
+                for (unsigned int i = 0; i < m_iterations; i++)
+                {
+                        m_command_queue.finish();
+                        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                        run();
+                        m_command_queue.finish();
+                        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+                }
+                std::sort(times.begin(), times.end());
+                return times[times.size() / 2];
+        }
+
+        template <typename T> void KernelTest::compare(std::string name, const T* expected, const T* actual, size_t count,
+                const Tolerance& tolerance, const std::function<void()>& run)
+        {
+                size_t mismatches = 0;
+                size_t first_mismatch = 0;
+                double maximum_error = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                        double error = std::fabs((double) actual[i] - (double) expected[i]);
+                        bool equal = actual[i] == expected[i];
+                        if (!equal && !(error <= tolerance.absolute + tolerance.relative * std::fabs((double) expected[i])))
+                        {
+                                if (mismatches == 0)
+                                {
+                                        first_mismatch = i;
+                                }
+                                mismatches++;
+                        }
+                        if (!equal)
+                        {
+                                maximum_error = std::max(maximum_error, error);
+                        }
+                }
+
+                std::ostringstream detail;
+                detail << mismatches << "/" << count << " outside tolerance, maximum error " << maximum_error;
+                if (mismatches > 0)
+                {
+                        detail << ", first at " << first_mismatch << " (expected " << +expected[first_mismatch] << ", got " << +actual[first_mismatch] << ")";
+                }
+                addResult(name, mismatches <= tolerance.mismatch_fraction * count, detail.str(), run);
+        }
+
+        void KernelTest::addResult(std::string name, bool passed, std::string detail, const std::function<void()>& run)
+        {
+                Result result;
+                result.name = name;
+                result.passed = passed;
+                result.detail = detail;
+                result.ms = time(run);
+                result.baseline_ms = 0;
+                m_results.push_back(result);
+                std::cout << (passed ? "pass " : "FAIL ") << name << ": " << detail << std::endl;
+        }
+
+        void KernelTest::checkTimings(std::string baseline_filename, bool update_baselines)
+        {
+                // Each line is the device, kernel, image width and height and milliseconds separated by
+                // tabs, as the work-group cache. Kernels without a baseline on this device record one.
+                std::map<std::string, double> baselines;
+                std::vector<std::string> other_lines;
+                std::ifstream stream(baseline_filename.c_str());
+                std::string line;
+                while (std::getline(stream, line))
+                {
+                        std::istringstream fields(line);
+                        std::string device_key;
+                        std::string name;
+                        unsigned int width;
+                        unsigned int height;
+                        double ms;
+                        if (!std::getline(fields, device_key, '\t') || !std::getline(fields, name, '\t') || !(fields >> width >> height >> ms))
+                        {
+                                continue;
+                        }
+                        if (device_key != m_device_key || width != m_width || height != m_height)
+                        {
+                                other_lines.push_back(line);
+                                continue;
+                        }
+                        baselines[name] = ms;
+                }
+
+                bool changed = false;
+                for (Result& result : m_results)
+                {
+                        std::map<std::string, double>::iterator baseline = baselines.find(result.name);
+                        if (baseline == baselines.end() || update_baselines)
+                        {
+                                baselines[result.name] = result.ms;
+                                changed = true;
+                                continue;
+                        }
+                        result.baseline_ms = baseline->second;
+                }
+
+                if (changed)
+                {
+                        std::ofstream output(baseline_filename.c_str());
+                        if (!output.good())
+                        {
+                                std::cerr << "Could not save kernel timing baselines to " << baseline_filename << std::endl;
+                                return;
+                        }
+                        for (const std::string& other_line : other_lines)
+                        {
+                                output << other_line << std::endl;
+                        }
+                        for (const std::pair<const std::string, double>& entry : baselines)
+                        {
+                                output << m_device_key << "\t" << entry.first << "\t" << m_width << "\t" << m_height << "\t" << entry.second << std::endl;
+                        }
+                        std::cout << "Recorded kernel timing baselines in " << baseline_filename << std::endl;
+                }
+        }
+
+        bool KernelTest::report()
+        {
+                bool passed = true;
+                std::cout << std::endl << std::left << std::setw(52) << "Kernel" << std::right << std::setw(8) << "Output"
+                        << std::setw(12) << "ms" << std::setw(12) << "Baseline" << std::setw(10) << "Ratio" << std::endl;
+                for (const Result& result : m_results)
+                {
+                        bool slow = result.baseline_ms > 0 && result.ms > result.baseline_ms * m_threshold;
+                        passed = passed && result.passed && !slow;
+                        std::cout << std::left << std::setw(52) << result.name << std::right << std::setw(8) << (result.passed ? "pass" : "FAIL")
+                                << std::fixed << std::setprecision(3) << std::setw(12) << result.ms;
+                        if (result.baseline_ms > 0)
+                        {
+                                std::cout << std::setw(12) << result.baseline_ms << std::setw(9) << std::setprecision(2)
+                                        << result.ms / result.baseline_ms << (slow ? "!" : " ");
+                        }
+                        std::cout << std::endl;
+                }
+                std::cout << std::endl << (passed ? "All kernels passed" : "Some kernels failed") << " (slowdown threshold " << m_threshold << "x)" << std::endl;
+                return passed;
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        unsigned int width = 320;
+        unsigned int height = 240;
+        unsigned int iterations = 10;
+        double threshold = 1.5;
+        std::string baseline_filename = "out/kernel_baselines.txt";
+        bool update_baselines = false;
+
+        for (int i = 1; i < argc; i++)
+        {
+                std::string argument = argv[i];
+                bool has_value = i + 1 < argc;
+                if (argument == "--size" && has_value)
+                {
+                        if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0)
+                        {
+                                std::cerr << "Image size must be given as WxH" << std::endl;
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (argument == "--iterations" && has_value)
+                {
+                        iterations = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--threshold" && has_value)
+                {
+                        threshold = atof(argv[++i]);
+                }
+                else if (argument == "--baselines" && has_value)
+                {
+                        baseline_filename = argv[++i];
+                }
+                else if (argument == "--update-baselines")
+                {
+                        update_baselines = true;
+                }
+                else
+                {
+                        std::cerr << "Usage: " << argv[0] << " [--size WxH] [--iterations count] [--threshold slowdown] [--baselines file] [--update-baselines]" << std::endl;
+                        return EXIT_FAILURE;
+                }
+        }
+
+        KernelTest kernel_test(width, height, iterations, threshold);
+        if (!kernel_test.initialise())
+        {
+                return EXIT_FAILURE;
+        }
+        kernel_test.run();
+        kernel_test.checkTimings(baseline_filename, update_baselines);
+        return kernel_test.report() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
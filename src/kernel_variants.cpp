@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#include "kernel_variants.hpp"
+
+void KernelVariants::initialise(const cl::Context& context, const cl::Device& device, std::string source)
+{
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_context = context;
+        m_device = device;
+        m_source = source;
+        m_programs.clear();
+}
+
+cl::Program& KernelVariants::getProgram(std::string options)
+{
+        // Map entries stay put as variants are added, so the reference outlives the lock
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::map<std::string, cl::Program>::iterator found = m_programs.find(options);
+        if (found != m_programs.end())
+        {
+                return found->second;
+        }
+
+        // Builds the variant the first time its configuration is used
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        cl::Program::Sources sources;
+        sources.push_back({m_source.c_str(), m_source.length()});
+        cl::Program program(m_context, sources);
+        if (program.build({m_device}, options.c_str()) != CL_SUCCESS)
+        {
+                std::cerr << "Error building kernels" << (options.empty() ? "" : " with") << options << ": " << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device) << std::endl;
+                exit(EXIT_FAILURE);
+        }
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Built kernels" << (options.empty() ? "" : " with") << options << " in " << elapsed_ms << " ms" << std::endl;
+
+        return m_programs[options] = program;
+}
+
+std::string KernelVariants::define(std::string name, int value)
+{
+        std::ostringstream option;
+        option << " -D " << name << "=" << value;
+        return option.str();
+}
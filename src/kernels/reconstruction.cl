@@ -1,102 +1,698 @@
 const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP | CLK_FILTER_NEAREST;
 
-__kernel void disparity(__write_only image2d_t disparity, __read_only image2d_t left, __read_only image2d_t right, const int window_size)
+// Image kernels are launched over global ranges padded to whole work-groups (see WorkGroupTuner),
+// so work items past the edge of the image they cover return straight away
+#define OUTSIDE_IMAGE(image, x, y) ((x) >= get_image_width(image) || (y) >= get_image_height(image))
+
+// Specialised variants are built with the active configuration defined (see KernelVariants), so
+// loops over it unroll and divisions by it fold. Generic builds take the kernel arguments.
+#ifdef WINDOW_SIZE
+#define WINDOW_SIZE_OR(argument) WINDOW_SIZE
+#else
+#define WINDOW_SIZE_OR(argument) (argument)
+#endif
+#ifdef MAX_DISPARITY
+#define MAX_DISPARITY_OR(argument) MAX_DISPARITY
+#else
+#define MAX_DISPARITY_OR(argument) (argument)
+#endif
+#ifdef VOLUME_X
+#define VOLUME_X_OR(argument) VOLUME_X
+#define VOLUME_Y_OR(argument) VOLUME_Y
+#define VOLUME_Z_OR(argument) VOLUME_Z
+#else
+#define VOLUME_X_OR(argument) (argument)
+#define VOLUME_Y_OR(argument) (argument)
+#define VOLUME_Z_OR(argument) (argument)
+#endif
+
+// Luminance of an RGBA pixel, or the value of a frame that is already single channel
+uint pixelLuminance(__read_only image2d_t image, int2 coord)
 {
-        const int width = get_image_width(disparity);
-        const int height = get_image_width(disparity);
+        uint4 pixel = read_imageui(image, sampler, coord);
+        if (get_image_channel_order(image) == CLK_R)
+        {
+                return pixel.x;
+        }
+        uint value = 0.212671f * pixel.x + 0.715160f * pixel.y + 0.072169f * pixel.z;
+        return min(value, 255u);
+}
+
+// Converts an RGBA frame into a single channel luminance image for stereo matching
+__kernel void luminance(__read_only image2d_t rgba, __write_only image2d_t luminance)
+{
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(luminance, coord.x, coord.y))
+        {
+                return;
+        }
+
+        write_imageui(luminance, coord, (uint4) (pixelLuminance(rgba, coord)));
+}
+
+// Fixed point precision of the remap tables, matches StereoCalibration::REMAP_FRACTION_BITS
+#define REMAP_FRACTION_BITS 4
+#define REMAP_SCALE (1 << REMAP_FRACTION_BITS)
+
+// Bilinearly samples the luminance of a raw frame at the packed 12.4 fixed point coordinates of a
+// remap entry. Entries of all ones mark rectified pixels with no source, which are black.
+uint sampleRemapped(__read_only image2d_t raw, uint entry)
+{
+        if (entry == 0xFFFFFFFF)
+        {
+                return 0;
+        }
+
+        int fixed_x = entry & 0xFFFF;
+        int fixed_y = entry >> 16;
+        int2 coord = (int2) (fixed_x >> REMAP_FRACTION_BITS, fixed_y >> REMAP_FRACTION_BITS);
+        uint weight_x = fixed_x & (REMAP_SCALE - 1);
+        uint weight_y = fixed_y & (REMAP_SCALE - 1);
+
+        uint top = pixelLuminance(raw, coord) * (REMAP_SCALE - weight_x) + pixelLuminance(raw, coord + (int2) (1, 0)) * weight_x;
+        uint bottom = pixelLuminance(raw, coord + (int2) (0, 1)) * (REMAP_SCALE - weight_x) + pixelLuminance(raw, coord + (int2) (1, 1)) * weight_x;
+        return (top * (REMAP_SCALE - weight_y) + bottom * weight_y + REMAP_SCALE * REMAP_SCALE / 2) >> (2 * REMAP_FRACTION_BITS);
+}
+
+// Rectifies both raw frames and reduces them to luminance in a single pass
+__kernel void rectify(__read_only image2d_t raw_left, __read_only image2d_t raw_right, __global const uint* left_remap,
+        __global const uint* right_remap, __write_only image2d_t left_luminance, __write_only image2d_t right_luminance)
+{
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(left_luminance, coord.x, coord.y))
+        {
+                return;
+        }
+        int index = coord.y * get_image_width(left_luminance) + coord.x;
+
+        write_imageui(left_luminance, coord, (uint4) (sampleRemapped(raw_left, left_remap[index])));
+        write_imageui(right_luminance, coord, (uint4) (sampleRemapped(raw_right, right_remap[index])));
+}
+
+// Replicates a single channel image into every channel of an RGBA image for display
+__kernel void expandLuminance(__read_only image2d_t luminance, __write_only image2d_t rgba)
+{
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(rgba, coord.x, coord.y))
+        {
+                return;
+        }
+
+        uint value = read_imageui(luminance, sampler, coord).x;
+
+        write_imageui(rgba, coord, (uint4) (value));
+}
+
+// Disparity maps are CL_R/CL_UNSIGNED_INT16 in 12.4 fixed point, matches
+// KernelReference::DISPARITY_FRACTION_BITS. Disparities too large for the 12 integer bits are
+// written as 0, no match, rather than wrapping round.
+#define DISPARITY_FRACTION_BITS 4
+#define DISPARITY_SCALE (1 << DISPARITY_FRACTION_BITS)
+#define MAX_STORED_DISPARITY (0xFFFF >> DISPARITY_FRACTION_BITS)
+
+// Nearest whole disparity of a fixed point one
+int wholeDisparity(int disparity)
+{
+        return (disparity + DISPARITY_SCALE / 2) >> DISPARITY_FRACTION_BITS;
+}
+
+// Writes the whole part of a disparity map into every channel of an RGBA image for display,
+// saturating at 255
+__kernel void expandDisparity(__read_only image2d_t disparity, __write_only image2d_t rgba)
+{
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(rgba, coord.x, coord.y))
+        {
+                return;
+        }
+
+        uint value = read_imageui(disparity, sampler, coord).x >> DISPARITY_FRACTION_BITS;
+
+        write_imageui(rgba, coord, (uint4) (min(value, 255u)));
+}
+
+/**
+ * Fixed point disparity of the match at window_x for the base window at x, moved to the vertex of
+ * the parabola through its cost and the costs of the windows either side of it along the row. The
+ * vertex is never more than half a pixel away since the match is the cheapest of the three. Matches
+ * at the end of the search, passed a negative cost for the missing side, and those with flat costs
+ * keep a whole disparity.
+**/
+uint subPixelDisparity(int window_x, int x, int cost_before, int cost, int cost_after)
+{
+        int disparity = abs(window_x - x);
+        if (disparity == 0 || disparity > MAX_STORED_DISPARITY)
+        {
+                return 0;
+        }
+
+        int fixed_disparity = disparity * DISPARITY_SCALE;
+        int curvature = cost_before - 2 * cost + cost_after;
+        if (cost_before < 0 || cost_after < 0 || curvature <= 0)
+        {
+                return fixed_disparity;
+        }
+
+        // Offset of the vertex along the row, rounded to the nearest step
+        int numerator = (cost_before - cost_after) * DISPARITY_SCALE;
+        int offset = (numerator >= 0 ? numerator + curvature : numerator - curvature) / (2 * curvature);
+        return window_x > x ? fixed_disparity + offset : fixed_disparity - offset;
+}
+
+// Sum of absolute differences between the window centred on (x, y) in the right image and the one
+// centred on (window_x, y) in the left image
+uint windowSad(__read_only image2d_t left, __read_only image2d_t right, int window_x, int x, int y, int window_size)
+{
+        uint sum_of_absolute_differences = 0;
+        for (int i = -window_size / 2; i < window_size / 2; i++)
+        {
+                for (int j = -window_size / 2; j < window_size / 2; j++)
+                {
+                        int2 left_coordinate = (int2) (window_x + i, y + j);
+                        int2 right_coordinate = (int2) (x + i, y + j);
+
+                        int left_pixel = read_imageui(left, sampler, left_coordinate).x;
+                        int right_pixel = read_imageui(right, sampler, right_coordinate).x;
+
+                        // Performs the SAD computation
+                        int difference = left_pixel - right_pixel;
+                        sum_of_absolute_differences += abs(difference);
+                }
+        }
+        return sum_of_absolute_differences;
+}
+
+// Walks the image horizontally comparing every moving window within max_disparity of x against the
+// base window at x, returns the sub-pixel disparity of the most similar and its cost through
+// minimum_sad
+uint searchRow(__read_only image2d_t left, __read_only image2d_t right, int x, int y, int window_size, int max_disparity, uint* minimum_sad)
+{
+        const int width = get_image_width(left);
+
+        unsigned int minumum_sum_of_absolute_differences = 1000000000;
+        int best_window_x = x;
+        int previous_sad = -1;
+        int sad_before = -1;
+        int sad_after = -1;
+        for (int window_x = max(x - max_disparity, 0); window_x < min(x + max_disparity + 1, width); window_x++)
+        {
+                uint sum_of_absolute_differences = windowSad(left, right, window_x, x, y, window_size);
+
+                // Keeps track of which movining window was most similar to the base window, and the
+                // costs of the windows either side of it for the sub-pixel fit
+                if (sum_of_absolute_differences < minumum_sum_of_absolute_differences)
+                {
+                        minumum_sum_of_absolute_differences = sum_of_absolute_differences;
+                        best_window_x = window_x;
+                        sad_before = previous_sad;
+                        sad_after = -1;
+                }
+                else if (window_x == best_window_x + 1)
+                {
+                        sad_after = sum_of_absolute_differences;
+                }
+                previous_sad = sum_of_absolute_differences;
+        }
 
+        *minimum_sad = minumum_sum_of_absolute_differences;
+        return subPixelDisparity(best_window_x, x, sad_before, minumum_sum_of_absolute_differences, sad_after);
+}
+
+// Left, right and disparity images are all single channel (CL_R)
+__kernel void disparity(__write_only image2d_t disparity, __read_only image2d_t left, __read_only image2d_t right, const int window_size, const int max_disparity)
+{
         // Defines the center of the 'base window' as well as the pixel to be shaded
         int x = get_global_id(0);
         int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(disparity, x, y))
+        {
+                return;
+        }
 
-        unsigned int minumum_sum_of_absolute_differences = 1000000000;
-        unsigned int disparity_value = 0;
+        uint minimum_sad;
+        unsigned int disparity_value = searchRow(left, right, x, y, WINDOW_SIZE_OR(window_size), MAX_DISPARITY_OR(max_disparity), &minimum_sad);
 
-        // Walks the image horizontally, defines the center of the 'moving window'
-        for (int window_x = 0; window_x < width; window_x++)
+        write_imageui(disparity, (int2) (x, y), (uint4) (disparity_value));
+}
+
+/**
+ * Temporally seeded SAD matching. Only the disparities within band of the pixel's disparity in the
+ * previous frame are tried, on either side as the full search does. The previous disparity map is
+ * sampled where the pixel is predicted to have been, a point at disparity d moves d * warp pixels
+ * for a camera translation of warp baselines. Pixels whose best mean absolute difference is still
+ * above cost_threshold fall back to the full search.
+**/
+__kernel void disparityTemporal(__write_only image2d_t disparity, __read_only image2d_t previous_disparity,
+        __read_only image2d_t left, __read_only image2d_t right, const int window_size_argument, const int band,
+        const uint cost_threshold, const float warp_x, const float warp_y, const int max_disparity_argument)
+{
+        int x = get_global_id(0);
+        int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(disparity, x, y))
         {
-                // Computes the total sum of absolute differences between corresponding pixels in the
-                // moving window and the base window
-                int running_sum_of_absolute_differences = 0;
-                for (int i = -window_size / 2; i < window_size / 2; i++)
+                return;
+        }
+        const int window_size = WINDOW_SIZE_OR(window_size_argument);
+        const int max_disparity = MAX_DISPARITY_OR(max_disparity_argument);
+
+        int prior = wholeDisparity(read_imageui(previous_disparity, sampler, (int2) (x, y)).x);
+        int2 previous_coordinate = (int2) (x + (int) round(prior * warp_x), y - (int) round(prior * warp_y));
+        prior = wholeDisparity(read_imageui(previous_disparity, sampler, previous_coordinate).x);
+
+        uint minimum_sad = UINT_MAX;
+        int best_window_x = x;
+        for (int candidate = max(prior - band, 0); candidate <= min(prior + band, max_disparity); candidate++)
+        {
+                for (int side = -1; side <= 1; side += 2)
                 {
-                        for (int j = -window_size / 2; j < window_size / 2; j++)
+                        if (candidate == 0 && side > 0)
+                        {
+                                continue;
+                        }
+
+                        uint sad = windowSad(left, right, x + side * candidate, x, y, window_size);
+                        if (sad < minimum_sad)
                         {
-                                int2 left_coordinate = (int2) (window_x + i, y + j);
-                                int2 right_coordinate = (int2) (x + i, y + j);
+                                minimum_sad = sad;
+                                best_window_x = x + side * candidate;
+                        }
+                }
+        }
+
+        // The prior no longer matches (occlusion, new surface), searches from scratch
+        int window_width = window_size / 2 * 2;
+        uint disparity_value;
+        if (minimum_sad > cost_threshold * window_width * window_width)
+        {
+                disparity_value = searchRow(left, right, x, y, window_size, max_disparity, &minimum_sad);
+        }
+        else
+        {
+                // The windows either side of the match may not have been tried, costs them for the
+                // sub-pixel fit as long as the full search would have
+                int first_x = max(x - max_disparity, 0);
+                int end_x = min(x + max_disparity + 1, get_image_width(left));
+                int sad_before = best_window_x - 1 >= first_x ? (int) windowSad(left, right, best_window_x - 1, x, y, window_size) : -1;
+                int sad_after = best_window_x + 1 < end_x ? (int) windowSad(left, right, best_window_x + 1, x, y, window_size) : -1;
+                disparity_value = subPixelDisparity(best_window_x, x, sad_before, minimum_sad, sad_after);
+        }
+
+        write_imageui(disparity, (int2) (x, y), (uint4) (disparity_value));
+}
+
+// Absolute difference between a right image pixel and the left image pixel a disparity along
+uint absoluteDifference(__read_only image2d_t left, __read_only image2d_t right, int x, int y, int disparity)
+{
+        int left_pixel = read_imageui(left, sampler, (int2) (x + disparity, y)).x;
+        int right_pixel = read_imageui(right, sampler, (int2) (x, y)).x;
+        return abs(left_pixel - right_pixel);
+}
+
+/**
+ * First pass of window aggregated SAD. Each work item walks one row for one disparity of the batch,
+ * keeping a running sum of the absolute differences in the window around x, so every pixel costs
+ * an add and a subtract whatever the window size. The window is windowSad's, [x - window_size / 2,
+ * x + window_size / 2) on each axis, so both SAD paths cost a match alike. Matches are looked for
+ * direction (1 or -1) times the disparity along the row of left, -1 when matching the left view
+ * against the right for the consistency check. Unlike searchRow and the census search, which try
+ * both sides of x, only the side a rectified pair can match on is searched, halving the batches.
+**/
+__kernel void aggregateRows(__read_only image2d_t left, __read_only image2d_t right, const int window_size,
+        const int first_disparity, const int direction, __global uint* row_sums)
+{
+        const int width = get_image_width(right);
+        const int height = get_image_height(right);
+
+        int y = get_global_id(0);
+        int batch_index = get_global_id(1);
+        int disparity = direction * (first_disparity + batch_index);
+        int radius = window_size / 2;
+
+        // Primes the window of the first pixel
+        uint sum = 0;
+        for (int i = -radius; i < radius; i++)
+        {
+                sum += absoluteDifference(left, right, i, y, disparity);
+        }
+
+        __global uint* sums = row_sums + (batch_index * height + y) * width;
+        for (int x = 0; x < width; x++)
+        {
+                sums[x] = sum;
+                sum += absoluteDifference(left, right, x + radius, y, disparity);
+                sum -= absoluteDifference(left, right, x - radius, y, disparity);
+        }
+}
+
+/**
+ * Second pass of window aggregated SAD. Each work item runs the same running sum down one column of
+ * the row sums, giving the full window cost, and keeps the cheapest disparity of every pixel as
+ * (cost << 8 | disparity) so a single atomic minimum picks it. Costs saturate at
+ * MAX_AGGREGATED_COST rather than spilling out of their 24 bits.
+**/
+#define MAX_AGGREGATED_COST 0xFFFFFF
+
+__kernel void aggregateColumns(__global const uint* row_sums, const int width, const int height, const int window_size,
+        const int first_disparity, __global uint* best_costs)
+{
+        int x = get_global_id(0);
+        int batch_index = get_global_id(1);
+        uint disparity = first_disparity + batch_index;
+        int radius = window_size / 2;
+
+        __global const uint* sums = row_sums + batch_index * height * width;
+
+        // Rows outside the image contribute nothing, as with the clamping sampler
+        uint sum = 0;
+        for (int j = 0; j < radius && j < height; j++)
+        {
+                sum += sums[j * width + x];
+        }
+
+        for (int y = 0; y < height; y++)
+        {
+                atomic_min(&best_costs[y * width + x], (min(sum, (uint) MAX_AGGREGATED_COST) << 8) | disparity);
+
+                if (y + radius < height)
+                {
+                        sum += sums[(y + radius) * width + x];
+                }
+                if (y - radius >= 0)
+                {
+                        sum -= sums[(y - radius) * width + x];
+                }
+        }
+}
+
+// Full window cost of one disparity as aggregateRows and aggregateColumns sum and saturate it, rows
+// outside the image contributing nothing
+int aggregatedCost(__read_only image2d_t left, __read_only image2d_t right, int x, int y, int window_size, int disparity)
+{
+        const int height = get_image_height(right);
+        int radius = window_size / 2;
+
+        uint sum = 0;
+        for (int j = max(y - radius, 0); j < min(y + radius, height); j++)
+        {
+                for (int i = x - radius; i < x + radius; i++)
+                {
+                        sum += absoluteDifference(left, right, i, j, disparity);
+                }
+        }
+        return min(sum, (uint) MAX_AGGREGATED_COST);
+}
+
+/**
+ * Writes the disparities chosen by aggregateColumns and resets the costs for the next frame. Only
+ * the cheapest cost of each pixel is kept, so the costs of its neighbouring disparities for the
+ * sub-pixel fit are summed again here, two windows per pixel rather than a cost buffer per
+ * disparity. Neighbours outside the disparity_count searched are left out as in searchRow.
+**/
+__kernel void resolveAggregatedDisparity(__global uint* best_costs, __read_only image2d_t left, __read_only image2d_t right,
+        const int window_size, const int direction, const int disparity_count, __write_only image2d_t disparity)
+{
+        int x = get_global_id(0);
+        int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(disparity, x, y))
+        {
+                return;
+        }
+        int index = y * get_image_width(disparity) + x;
 
-                                int left_pixel = read_imageui(left, sampler, left_coordinate).x;
-                                int right_pixel = read_imageui(right, sampler, right_coordinate).x;
+        uint best = best_costs[index];
+        best_costs[index] = 0xFFFFFFFF;
 
-                                // Performs the SAD computation
-                                int difference = left_pixel - right_pixel;
-                                running_sum_of_absolute_differences += abs(difference);
+        int best_disparity = best & 0xFF;
+        uint disparity_value = 0;
+        if (best_disparity != 0)
+        {
+                int cost_below = aggregatedCost(left, right, x, y, window_size, direction * (best_disparity - 1));
+                int cost_above = best_disparity + 1 < disparity_count ?
+                        aggregatedCost(left, right, x, y, window_size, direction * (best_disparity + 1)) : -1;
+
+                // Costs either side of the match along the row, which runs the other way for the reverse search
+                int cost_before = direction > 0 ? cost_below : cost_above;
+                int cost_after = direction > 0 ? cost_above : cost_below;
+                disparity_value = subPixelDisparity(x + direction * best_disparity, x, cost_before, best >> 8, cost_after);
+        }
+
+        write_imageui(disparity, (int2) (x, y), (uint4) (disparity_value));
+}
+
+// Describes each pixel by which of its neighbours in a 9x7 window are darker than it, packed into
+// 62 bits in row-major window order (see CensusMatcher for the host version)
+__kernel void census(__read_only image2d_t luminance, __global ulong* descriptors)
+{
+        int x = get_global_id(0);
+        int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(luminance, x, y))
+        {
+                return;
+        }
+
+        uint centre = read_imageui(luminance, sampler, (int2) (x, y)).x;
+        ulong descriptor = 0;
+        for (int j = -3; j <= 3; j++)
+        {
+                for (int i = -4; i <= 4; i++)
+                {
+                        if (i == 0 && j == 0)
+                        {
+                                continue;
                         }
+
+                        uint neighbour = read_imageui(luminance, sampler, (int2) (x + i, y + j)).x;
+                        descriptor = (descriptor << 1) | (neighbour < centre);
+                }
+        }
+
+        descriptors[y * get_image_width(luminance) + x] = descriptor;
+}
+
+// Matches census descriptors along the row, the cost of a candidate is the Hamming distance
+// between descriptors
+__kernel void disparityCensus(__write_only image2d_t disparity, __global const ulong* left, __global const ulong* right, const int max_disparity_argument)
+{
+        const int max_disparity = MAX_DISPARITY_OR(max_disparity_argument);
+        const int width = get_image_width(disparity);
+
+        int x = get_global_id(0);
+        int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(disparity, x, y))
+        {
+                return;
+        }
+
+        __global const ulong* left_row = left + y * width;
+        ulong descriptor = right[y * width + x];
+
+        int minimum_distance = 65;
+        int best_window_x = x;
+        int previous_distance = -1;
+        int distance_before = -1;
+        int distance_after = -1;
+        for (int window_x = max(x - max_disparity, 0); window_x < min(x + max_disparity + 1, width); window_x++)
+        {
+                int distance = popcount(left_row[window_x] ^ descriptor);
+                if (distance < minimum_distance)
+                {
+                        minimum_distance = distance;
+                        best_window_x = window_x;
+                        distance_before = previous_distance;
+                        distance_after = -1;
                 }
+                else if (window_x == best_window_x + 1)
+                {
+                        distance_after = distance;
+                }
+                previous_distance = distance;
+        }
+
+        uint disparity_value = subPixelDisparity(best_window_x, x, distance_before, minimum_distance, distance_after);
+        write_imageui(disparity, (int2) (x, y), (uint4) (disparity_value));
+}
 
-                // Keeps track of which movining window was most similar to the base window
-                if (running_sum_of_absolute_differences < minumum_sum_of_absolute_differences)
+// Validity masks hold a bit per pixel, each row packed into 32-bit words with the leftmost pixel of
+// a word in its lowest bit. A zero word is a run of 32 pixels with nothing to process.
+#define VALIDITY_WORDS_PER_ROW(width) (((width) + 31) / 32)
+
+// Largest difference between the fixed point disparities of a pixel and of its match in the other
+// view, one whole disparity
+#define CONSISTENCY_TOLERANCE DISPARITY_SCALE
+
+bool isValid(__global const uint* validity, int width, int height, int x, int y)
+{
+        if (x < 0 || y < 0 || x >= width || y >= height)
+        {
+                return false;
+        }
+        return (validity[y * VALIDITY_WORDS_PER_ROW(width) + x / 32] >> (x % 32)) & 1;
+}
+
+/**
+ * Marks the pixels of the disparity map that found a match, one work item per word of the mask.
+ * With check_consistency set a match must also be found again by matching the left view against
+ * the right, reverse_disparity holding the disparity of every left view pixel. The searches run
+ * both ways along the row, so the match may lie on either side of the pixel. Occluded pixels and
+ * those in textureless regions, which match somewhere different each way, are dropped.
+**/
+__kernel void validityMask(__read_only image2d_t disparity, __read_only image2d_t reverse_disparity,
+        const int check_consistency, __global uint* validity)
+{
+        const int width = get_image_width(disparity);
+        int word_index = get_global_id(0);
+        int y = get_global_id(1);
+        if (word_index >= VALIDITY_WORDS_PER_ROW(width) || y >= get_image_height(disparity))
+        {
+                return;
+        }
+
+        uint word = 0;
+        for (int bit = 0; bit < 32 && word_index * 32 + bit < width; bit++)
+        {
+                int x = word_index * 32 + bit;
+                int disparity_value = read_imageui(disparity, sampler, (int2) (x, y)).x;
+                bool valid = disparity_value != 0;
+                if (valid && check_consistency)
                 {
-                        minumum_sum_of_absolute_differences = running_sum_of_absolute_differences;
-                        disparity_value = abs(window_x - x);
+                        int match_offset = wholeDisparity(disparity_value);
+                        bool ahead = x + match_offset < width &&
+                                abs((int) read_imageui(reverse_disparity, sampler, (int2) (x + match_offset, y)).x - disparity_value) <= CONSISTENCY_TOLERANCE;
+                        bool behind = x - match_offset >= 0 &&
+                                abs((int) read_imageui(reverse_disparity, sampler, (int2) (x - match_offset, y)).x - disparity_value) <= CONSISTENCY_TOLERANCE;
+                        valid = ahead || behind;
                 }
+                word |= (uint) valid << bit;
         }
 
-        // Writes the disparity value to the image (clamped between 0 to 255)
-        disparity_value &= 0xFF;
-        uint4 write_pixel = (uint4) (disparity_value);
-        write_imageui(disparity, (int2) (x, y), write_pixel);
+        validity[y * VALIDITY_WORDS_PER_ROW(width) + word_index] = word;
 }
 
 // Converts disparity values to depth in millimeters
-__kernel void disparityToDepth(__write_only image2d_t depth_map, __read_only image2d_t disparity_map, const int focal_length, const int baseline_mm)
+__kernel void disparityToDepth(__write_only image2d_t depth_map, __read_only image2d_t disparity_map,
+        __global const uint* validity, const int focal_length, const int baseline_mm)
 {
         int x = get_global_id(0);
         int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(depth_map, x, y))
+        {
+                return;
+        }
 
-        // Implements the equation "Z = f * B / d"
+        // Pixels without a valid match have no depth
+        if (!isValid(validity, get_image_width(depth_map), get_image_height(depth_map), x, y))
+        {
+                write_imageui(depth_map, (int2) (x, y), (uint4) (0));
+                return;
+        }
+
+        // Implements the equation "Z = f * B / d", with d in fixed point
         uint disp = read_imageui(disparity_map, sampler, (int2) (x, y)).x;
-        uint depth = (focal_length * baseline_mm) / disp;
-        uint write_pixel = depth;
+        uint depth = (focal_length * baseline_mm * DISPARITY_SCALE) / disp;
+        write_imageui(depth_map, (int2) (x, y), (uint4) (depth));
+}
+
+// Vertex maps are CL_RGBA/CL_HALF_FLOAT in metres, 8 bytes per pixel
+float3 readVertex(__read_only image2d_t vertex_map, int2 coord)
+{
+        return read_imagef(vertex_map, sampler, coord).xyz;
+}
+
+void writeVertex(__write_only image2d_t vertex_map, int2 coord, float3 vertex)
+{
+        write_imagef(vertex_map, coord, (float4) (vertex, 0.0f));
+}
+
+// Normal maps are CL_R/CL_UNSIGNED_INT32, each unit normal folded onto an octahedron and the two
+// octahedral coordinates stored as 16-bit fixed point from 1 to 65535, leaving 0 for no normal
+uint encodeNormal(float3 normal)
+{
+        float sum = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+        if (!(sum > 0))
+        {
+                return 0;
+        }
+        normal /= sum;
+
+        // The lower hemisphere is folded over the diagonals
+        float2 octahedral = normal.z >= 0 ? normal.xy : (1.0f - fabs(normal.yx)) * copysign((float2) (1.0f), normal.xy);
+        uint2 fixed_point = convert_uint2_rte((octahedral * 0.5f + 0.5f) * 65534.0f) + 1;
+        return fixed_point.x | (fixed_point.y << 16);
+}
+
+float3 decodeNormal(uint code)
+{
+        if (code == 0)
+        {
+                return (float3) (0.0f);
+        }
+
+        float2 octahedral = (convert_float2((uint2) (code & 0xFFFF, code >> 16)) - 1.0f) / 65534.0f * 2.0f - 1.0f;
+        float3 normal = (float3) (octahedral, 1.0f - fabs(octahedral.x) - fabs(octahedral.y));
+
+        // Unfolds the lower hemisphere
+        float fold = max(-normal.z, 0.0f);
+        normal.x += normal.x >= 0 ? -fold : fold;
+        normal.y += normal.y >= 0 ? -fold : fold;
+        return normalize(normal);
+}
 
-        write_imageui(depth_map, (int2) (x, y), write_pixel);
+float3 readNormal(__read_only image2d_t normal_map, int2 coord)
+{
+        return decodeNormal(read_imageui(normal_map, sampler, coord).x);
 }
 
-__kernel void generateVertexMap(__read_only image2d_t depth_map, const int focal_length,
-        const int scale_x, const int scale_y, const int skew_coeff, const int principal_point_x,
-        const int principal_point_y, __write_only image2d_t vertex_map)
+// Back-projects each depth (in millimetres) through the inverse camera matrix to a vertex in metres
+__kernel void generateVertexMap(__read_only image2d_t depth_map, __global const uint* validity, const int focal_length,
+        const int scale_x, const int scale_y, const int skew_coeff, const float principal_point_x,
+        const float principal_point_y, __write_only image2d_t vertex_map)
 {
         int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(vertex_map, coord.x, coord.y))
+        {
+                return;
+        }
 
-        uint depth = read_imageui(depth_map, sampler, coord).x;
+        // Pixels without depth are left at the origin
+        if (!isValid(validity, get_image_width(vertex_map), get_image_height(vertex_map), coord.x, coord.y))
+        {
+                writeVertex(vertex_map, coord, (float3) (0.0f));
+                return;
+        }
+
+        float depth = read_imageui(depth_map, sampler, coord).x / 1000.0f;
 
         // Implements depth(x, y) * K_inverse * [x, y, 1]
-        uint4 vertex = (uint4) (
-                (uint) (focal_length * scale_x * coord.x) * depth ,
-                (uint) (skew_coeff * coord.x + focal_length * scale_y * coord.y) * depth,
-                (uint) (principal_point_x * coord.x + principal_point_y * coord.y + 1) * depth,
-                0
-        );
+        float normalised_y = (coord.y - principal_point_y) / (focal_length * scale_y);
+        float normalised_x = (coord.x - principal_point_x - skew_coeff * normalised_y) / (focal_length * scale_x);
 
-        write_imageui(vertex_map, coord, vertex);
+        writeVertex(vertex_map, coord, (float3) (normalised_x, normalised_y, 1.0f) * depth);
 }
 
-__kernel void generateNormalMap(__read_only image2d_t vertex_map, __write_only image2d_t normal_map)
+__kernel void generateNormalMap(__read_only image2d_t vertex_map, __global const uint* validity, __write_only image2d_t normal_map)
 {
         int x = get_global_id(0);
         int y = get_global_id(1);
+        if (OUTSIDE_IMAGE(normal_map, x, y))
+        {
+                return;
+        }
 
-        uint4 center = read_imageui(vertex_map, sampler, (int2) (x, y));
-        uint4 right = read_imageui(vertex_map, sampler, (int2) (x + 1, y));
-        uint4 down = read_imageui(vertex_map, sampler, (int2) (x, y + 1));
-
-        float4 vector_right = (float4) (right.x - center.x, right.y - center.y, right.z - center.z, 0.0f);
-        float4 vector_down = (float4) (down.x - center.x, down.y - center.y, down.z - center.z, 0.0f);
+        // Missing depth at the pixel or either neighbour leaves no normal
+        int width = get_image_width(normal_map);
+        int height = get_image_height(normal_map);
+        if (!isValid(validity, width, height, x, y) || !isValid(validity, width, height, x + 1, y) || !isValid(validity, width, height, x, y + 1))
+        {
+                write_imageui(normal_map, (int2) (x, y), (uint4) (0));
+                return;
+        }
 
-        float4 cross_product = cross(vector_right, vector_down);
-        float4 normal = normalize(cross_product);
+        float3 center = readVertex(vertex_map, (int2) (x, y));
+        float3 right = readVertex(vertex_map, (int2) (x + 1, y));
+        float3 down = readVertex(vertex_map, (int2) (x, y + 1));
 
-        write_imagef(normal_map, (int2) (x, y), normal);
+        float3 normal = cross(right - center, down - center);
+        write_imageui(normal_map, (int2) (x, y), (uint4) (encodeNormal(normal)));
 }
 
 /**
@@ -104,144 +700,161 @@ __kernel void generateNormalMap(__read_only image2d_t vertex_map, __write_only i
  * the previous frame and the current frame. The initial translation and rotation should be
  * set to the estimated global pose values for the previous frame (i.e. we assume the camera
  * has not moved much between frames). Subsequent pose inputs should be the output of the
- * previous iteration of ICP.
+ * previous iteration of ICP. The rows of the camera-to-global rotation matrix are computed once
+ * on the host, its inverse is the transpose. Every pixel is written, matches with w set to 1.
 **/
-__kernel void findCorrespondences(__read_only image2d_t depth_map,
+__kernel void findCorrespondences(__global const uint* validity,
         __read_only image2d_t prev_vertex_map, __read_only image2d_t prev_normal_map,
         __read_only image2d_t vertex_map, __read_only image2d_t normal_map,
         float translation_x, float translation_y, float translation_z,
-        float rot_x, float rot_y, float rot_z, __global float3* correspondences)
+        float4 rotation_row_x, float4 rotation_row_y, float4 rotation_row_z, const float focal_length,
+        const float principal_point_x, const float principal_point_y, __global float4* correspondences)
 {
+        const int width = get_image_width(vertex_map);
+        const int height = get_image_height(vertex_map);
+        if (OUTSIDE_IMAGE(vertex_map, get_global_id(0), get_global_id(1)))
+        {
+                return;
+        }
+        uint index = get_global_id(1) * width + get_global_id(0);
+        correspondences[index] = (float4) (0.0f);
+
         // We only find correspondences for coordinates with valid depth
-        uint depth = read_imageui(depth_map, sampler, (int2) (get_global_id(0), get_global_id(1))).x;
-        if (depth == 0)
+        if (!isValid(validity, width, height, get_global_id(0), get_global_id(1)))
         {
                 return;
         }
 
+        float3 translation = (float3) (translation_x, translation_y, translation_z);
+        float3 row_x = rotation_row_x.xyz;
+        float3 row_y = rotation_row_y.xyz;
+        float3 row_z = rotation_row_z.xyz;
+
         // Retrieves the vertex from the previous frame
-        float3 prev_global_vertex = (float3) ((float) get_global_id(0), (float) get_global_id(1), 0.0f);
-        prev_global_vertex.z = (float) (read_imageui(prev_vertex_map, sampler, (int2) (prev_global_vertex.x, prev_global_vertex.y)).x);
-
-        // Transforms this vertex from global coords into camera coords
-        // The equations are the result of an inverse 4x4 transformation matrix multiplied with
-        // a 4x1 point (ignores the fourth row of the output vector)
-        float3 prev_camera_vertex;
-        prev_camera_vertex.x =
-                prev_global_vertex.x * (cos(rot_z) * cos(rot_y) + sin(rot_x) * sin(rot_y)) +
-                prev_global_vertex.y * (-sin(rot_z) * cos(rot_x)) +
-                prev_global_vertex.z * (sin(rot_z) * sin(rot_x) * cos(rot_x) - cos(rot_z) * sin(rot_y)) +
-                translation_x;
-        prev_camera_vertex.y =
-                prev_global_vertex.x * (sin(rot_z) * cos(rot_y) - cos(rot_z) * sin(rot_x) * sin(rot_y)) +
-                prev_global_vertex.y * (cos(rot_z) * cos(rot_x)) +
-                prev_global_vertex.z * (-cos(rot_z) * sin(rot_x) * cos(rot_y) - sin(rot_z) * sin(rot_y)) +
-                translation_y;
-        prev_camera_vertex.z =
-                prev_global_vertex.x * (cos(rot_x) * sin(rot_y)) +
-                prev_global_vertex.y * (sin(rot_x)) +
-                prev_global_vertex.z * (cos(rot_x) * cos(rot_y)) +
-                translation_z;
-
-        // Perspective projects the vector into image coordinates
-        // ?? To do: Unsure what viewer vector is and if this is correct. Projection code based on
-        // perspective projection section of <https://en.wikipedia.org/?title=3D_projection>
-        float3 viewer = (float3) (0.0f, 0.0f, 1.0f);
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        float3 prev_global_vertex = readVertex(prev_vertex_map, coord);
+
+        // Transforms this vertex from global coords into camera coords with the inverse transformation
+        float3 offset = prev_global_vertex - translation;
+        float3 prev_camera_vertex = row_x * offset.x + row_y * offset.y + row_z * offset.z;
+
+        // Perspective projects the vertex into image coordinates of the current frame
         int2 prev_image_vertex;
-        prev_image_vertex.x = (viewer.z/prev_global_vertex.z) * prev_global_vertex.x - viewer.x;
-        prev_image_vertex.y = (viewer.z/prev_global_vertex.z) * prev_global_vertex.y - viewer.y;
+        prev_image_vertex.x = (int) round(focal_length * prev_camera_vertex.x / prev_camera_vertex.z + principal_point_x);
+        prev_image_vertex.y = (int) round(focal_length * prev_camera_vertex.y / prev_camera_vertex.z + principal_point_y);
 
         // If prev_image_vertex is within the bounds of the vertex map
-        if (prev_image_vertex.x >= 0 && prev_image_vertex.x < get_image_width(depth_map) &&
-                prev_image_vertex.y >= 0 && prev_image_vertex.y < get_image_height(depth_map))
+        if (prev_image_vertex.x >= 0 && prev_image_vertex.x < width &&
+                prev_image_vertex.y >= 0 && prev_image_vertex.y < height)
         {
                 // Retrieves a vertex from the current frame using the perspective projected vector
-                float3 camera_vertex = (float3) (prev_image_vertex.x, prev_image_vertex.y, 0.0f);
-                camera_vertex.z = (float) (read_imageui(vertex_map, sampler, (int2) ((int) camera_vertex.x, (int) camera_vertex.y)).x);
+                float3 camera_vertex = readVertex(vertex_map, prev_image_vertex);
 
                 // Transforms this vertex from camera coords into global coordinates
-                float3 global_vertex;
-                global_vertex.x =
-                        camera_vertex.x * (cos(rot_z) * cos(rot_y) + sin(rot_x) * sin(rot_y)) +
-                        camera_vertex.y * (sin(rot_z) * cos(rot_y) - cos(rot_z) * sin(rot_x) * sin(rot_y)) +
-                        camera_vertex.z * (cos(rot_x) * sin(rot_y)) +
-                        translation_x;
-                global_vertex.y =
-                        camera_vertex.x * (-sin(rot_z) * cos(rot_x)) +
-                        camera_vertex.y * (cos(rot_z) * cos(rot_x)) +
-                        camera_vertex.z * (sin(rot_x)) +
-                        translation_y;
-                global_vertex.z =
-                        camera_vertex.x * (sin(rot_z) * sin(rot_x) * cos(rot_y) - cos(rot_z) * sin(rot_y)) +
-                        camera_vertex.y * (-cos(rot_z) * sin(rot_x) * cos(rot_y) - sin(rot_z) * sin(rot_y)) +
-                        camera_vertex.z * (cos(rot_x) * cos(rot_y)) +
-                        translation_z;
+                float3 global_vertex = (float3) (dot(row_x, camera_vertex), dot(row_y, camera_vertex), dot(row_z, camera_vertex)) + translation;
 
                 // Retrieves a normal from the current frame using the perspective projected vector
-                float3 camera_normal = (float3) (prev_image_vertex.x, prev_image_vertex.y, 0.0f);
-                camera_normal.z = (float) (read_imageui(normal_map, sampler, (int2) ((int) camera_normal.x, (int) camera_normal.y)).x);
+                float3 camera_normal = readNormal(normal_map, prev_image_vertex);
 
                 // Rotates this normal using the 3x3 rotation matrix of the
                 // camera-coords-to-global-coords transformation
-                float3 global_normal;
-                global_normal.x =
-                        camera_normal.x * (cos(rot_z) * cos(rot_y) + sin(rot_x) * sin(rot_y)) +
-                        camera_normal.y * (sin(rot_z) * cos(rot_y) - cos(rot_z) * sin(rot_x) * sin(rot_y)) +
-                        camera_normal.z * (cos(rot_x) * sin(rot_y));
-                global_normal.y =
-                        camera_normal.x * (-sin(rot_z) * cos(rot_x)) +
-                        camera_normal.y * (cos(rot_z) * cos(rot_x)) +
-                        camera_normal.z * (sin(rot_x));
-                global_normal.z =
-                        camera_normal.x * (sin(rot_z) * sin(rot_x) * cos(rot_y) - cos(rot_z) * sin(rot_y)) +
-                        camera_normal.y * (-cos(rot_z) * sin(rot_x) * cos(rot_y) - sin(rot_z) * sin(rot_y)) +
-                        camera_normal.z * (cos(rot_x) * cos(rot_y));
-
-                // ?? To do: Determine best thresholds for camera tracking by varing them
-                const uint distance_threshold = 1;
+                float3 global_normal = (float3) (dot(row_x, camera_normal), dot(row_y, camera_normal), dot(row_z, camera_normal));
+
+                // ?? To do: Determine best thresholds for camera tracking by varing them (distance in metres)
+                const float distance_threshold = 0.1f;
                 const float normal_threshold = 1.0f;
-                float3 prev_global_normal = (float3) ((float) get_global_id(0), (float) get_global_id(1), 0.0f);
-                prev_global_normal.z = (float) (read_imageui(prev_normal_map, sampler, (int2) (prev_global_normal.x, prev_global_normal.y)).x);
+                float3 prev_global_normal = readNormal(prev_normal_map, coord);
 
                 if (length(global_vertex - prev_global_vertex) < distance_threshold &&
                         fabs(dot(global_normal, prev_global_normal)) < normal_threshold)
                 {
                         // Correspondence found
-                        uint width = get_image_width(depth_map);
-                        uint x = get_global_id(0);
-                        uint y = get_global_id(1);
-                        uint index = y * width + x;
-                        correspondences[index] = global_vertex;
+                        correspondences[index] = (float4) (global_vertex, 1.0f);
                 }
         }
 }
 
-// Outputs the A matrix and b vector of the equation |Ax + b|, used to compute transformation
-__kernel void computeMatricesForTransformation(__read_only image2d_t vertex_map,
-        __read_only image2d_t normal_map, __global const float3* correspondences,
-        __global float* matrix_a, __global float* vector_b)
+// Packed correspondence of 40 bytes, plain arrays so there is no float3 padding. Laid out as
+// KernelReference::Correspondence, Algorithm sizes the buffer with correspondence_size_in_bytes.
+typedef struct
 {
-        uint x = get_global_id(0);
-        uint y = get_global_id(1);
-        uint width = get_image_width(vertex_map);
-        uint index = y * width + x;
-        uint row_index = index * 6;
+        float source[3];
+        float destination[3];
+        float normal[3];
+        uint pixel_index;
+} Correspondence;
 
-        float3 source = correspondences[index];
-        uint4 dest = read_imageui(vertex_map, sampler, (int2) (x, y));
-        uint4 normal = read_imageui(normal_map, sampler, (int2) (x, y));
+// Work-group size of the compaction, built to fit the device (see Algorithm::trackCamera). The
+// generic build never launches it, the default only has to be valid on any device.
+#ifndef COMPACTION_GROUP_SIZE
+#define COMPACTION_GROUP_SIZE 64
+#endif
 
-        // ?? To do: Why would I need a tree reduction here?
-        // Calculates the elements of a row of matrix A
-        matrix_a[row_index + 0] = normal.z * source.y - normal.y * source.z;
-        matrix_a[row_index + 1] = normal.x * source.z - normal.z * source.x;
-        matrix_a[row_index + 2] = normal.y * source.x - normal.x * source.y;
-        matrix_a[row_index + 3] = normal.x;
-        matrix_a[row_index + 4] = normal.y;
-        matrix_a[row_index + 5] = normal.z;
+/**
+ * Packs the matches of findCorrespondences into a list of (pixel index, source, destination,
+ * normal) tuples. Each work-group prefix sums its valid flags in local memory and reserves its
+ * run of the list with a single atomic add to the count, so the list is unordered between
+ * work-groups. The destination and normal are the previous frame's at the pixel.
+**/
+__kernel __attribute__((reqd_work_group_size(COMPACTION_GROUP_SIZE, 1, 1)))
+void compactCorrespondences(__global const float4* dense, __read_only image2d_t prev_vertex_map,
+        __read_only image2d_t prev_normal_map, const uint pixel_count, __global Correspondence* compact,
+        __global uint* compact_count)
+{
+        __local uint scan[COMPACTION_GROUP_SIZE];
+        __local uint group_offset;
+
+        uint index = get_global_id(0);
+        uint local_index = get_local_id(0);
+        float4 source = index < pixel_count ? dense[index] : (float4) (0.0f);
+        uint valid = source.w != 0.0f;
+
+        // Inclusive scan of the valid flags across the work-group
+        scan[local_index] = valid;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (uint stride = 1; stride < COMPACTION_GROUP_SIZE; stride *= 2)
+        {
+                uint addend = local_index >= stride ? scan[local_index - stride] : 0;
+                barrier(CLK_LOCAL_MEM_FENCE);
+                scan[local_index] += addend;
+                barrier(CLK_LOCAL_MEM_FENCE);
+        }
+
+        if (local_index == COMPACTION_GROUP_SIZE - 1)
+        {
+                group_offset = atomic_add(compact_count, scan[local_index]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        if (valid)
+        {
+                int width = get_image_width(prev_vertex_map);
+                int2 coord = (int2) (index % width, index / width);
+                float3 destination = readVertex(prev_vertex_map, coord);
+                float3 normal = readNormal(prev_normal_map, coord);
+
+                __global Correspondence* correspondence = compact + group_offset + scan[local_index] - 1;
+                vstore3(source.xyz, 0, correspondence->source);
+                vstore3(destination, 0, correspondence->destination);
+                vstore3(normal, 0, correspondence->normal);
+                correspondence->pixel_index = index;
+        }
+}
+
+// Signed distance of each packed correspondence's source from the plane through its destination,
+// along the destination normal
+__kernel void pointToPlaneResiduals(__global const Correspondence* correspondences, const uint count, __global float* residuals)
+{
+        uint index = get_global_id(0);
+        if (index >= count)
+        {
+                return;
+        }
 
-        // Calculates the componets of the Nx1 vector b
-        vector_b[index] = normal.x * dest.x + normal.y * dest.y + normal.z * dest.z
+        float3 source = vload3(0, correspondences[index].source);
+        float3 dest = vload3(0, correspondences[index].destination);
+        float3 normal = vload3(0, correspondences[index].normal);
+        residuals[index] = normal.x * dest.x + normal.y * dest.y + normal.z * dest.z
                 - normal.x * source.x - normal.y * source.y - normal.z * source.z;
 }
 
@@ -286,12 +899,27 @@ bool intersect(float3 ray_origin, float3 ray_direction, float3 box_a, float3 box
         return false;
 }
 
-__kernel void render(__global const int* voxels, int volume_size, int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, __write_only image2d_t screen)
+// Depth written to the samples of rays that miss the volume, far enough that upsampleRender never
+// blends them with a hit
+#define MISS_DEPTH 1e30f
+
+// Casts one ray per block of render_scale pixels, writing its shade and hit depth to the samples
+__kernel void render(__global const int* voxels, int volume_x_argument, int volume_y_argument, int volume_z_argument, float voxel_size, int origin_x, int origin_y, int origin_z, int eye_x, int eye_y, int eye_z, int screen_z, float angle, float cam_distance, int render_scale, int screen_width, int screen_height, __global float2* samples)
 {
-        int screen_width = get_image_dim(screen).x;
-        int screen_height = get_image_dim(screen).y;
-        int screen_x = get_global_id(0) - screen_width/2;
-        int screen_y = screen_height/2 - get_global_id(1);
+        const int volume_x = VOLUME_X_OR(volume_x_argument);
+        const int volume_y = VOLUME_Y_OR(volume_y_argument);
+        const int volume_z = VOLUME_Z_OR(volume_z_argument);
+
+        int2 sample_coord = (int2) (get_global_id(0), get_global_id(1));
+        int samples_width = (screen_width + render_scale - 1) / render_scale;
+        int samples_height = (screen_height + render_scale - 1) / render_scale;
+        if (sample_coord.x >= samples_width || sample_coord.y >= samples_height)
+        {
+                return;
+        }
+        int2 block = sample_coord * render_scale;
+        int screen_x = block.x - screen_width/2;
+        int screen_y = screen_height/2 - block.y;
 
         float3 eye = (float3) (eye_x, eye_y, eye_z);
         float3 pixel = (float3) (screen_x, screen_y, screen_z);
@@ -309,30 +937,41 @@ __kernel void render(__global const int* voxels, int volume_size, int eye_x, int
         dir.x = new_dir_x;
         dir.z = new_dir_z;
 
-        // Determines where the ray intersects with the volume bounding box
+        // Determines where the ray intersects with the bounding box of the rolling volume
+        // (voxel y and z run opposite to the world axes)
         float distance = 0;
+        float depth = MISS_DEPTH;
         float3 box_intersection = (float3) (0, 0, 0);
-	float3 box_a = (float3) (-volume_size/2, -volume_size/2, -volume_size/2);
-	float3 box_b = (float3) (volume_size/2, volume_size/2, volume_size/2);
-        if (intersect(origin, dir, box_a, box_b, &box_intersection))
+        float3 box_centre = (float3) (origin_x, -origin_y, -origin_z) * voxel_size;
+        float3 box_half = (float3) (volume_x/2, volume_y/2, volume_z/2) * voxel_size;
+        if (intersect(origin, dir, box_centre - box_half, box_centre + box_half, &box_intersection))
         {
-                // Walks the ray through the volume until it hits a non-zero voxel
-                for (int i= 0; i < volume_size; i++)
+                // Walks the ray through the volume a voxel at a time until it hits a non-zero voxel
+                int max_steps = volume_x + volume_y + volume_z;
+                for (int i= 0; i < max_steps; i++)
                 {
-                        unsigned int voxel_coord_x = (int) (box_intersection.x + dir.x * i + volume_size/2);
-                        unsigned int voxel_coord_y = volume_size - (int) (box_intersection.y + dir.y * i + volume_size/2);
-                        unsigned int voxel_coord_z = volume_size - (int) (box_intersection.z + dir.z * i + volume_size/2);
-                        if (voxel_coord_x > volume_size || voxel_coord_y > volume_size || voxel_coord_z > volume_size)
+                        float3 position = (box_intersection + dir * (i * voxel_size)) / voxel_size;
+                        int voxel_coord_x = (int) (position.x + volume_x/2);
+                        int voxel_coord_y = volume_y - (int) (position.y + volume_y/2);
+                        int voxel_coord_z = volume_z - (int) (position.z + volume_z/2);
+                        if (voxel_coord_x < origin_x || voxel_coord_x >= origin_x + volume_x ||
+                                voxel_coord_y < origin_y || voxel_coord_y >= origin_y + volume_y ||
+                                voxel_coord_z < origin_z || voxel_coord_z >= origin_z + volume_z)
                         {
                                 distance = 0;
                         }
                         else
                         {
-                                unsigned int index = voxel_coord_z * volume_size * volume_size + voxel_coord_y * volume_size + voxel_coord_x;
+                                // Wraps the world voxel coordinates into the cyclic buffer
+                                uint slot_x = ((voxel_coord_x % volume_x) + volume_x) % volume_x;
+                                uint slot_y = ((voxel_coord_y % volume_y) + volume_y) % volume_y;
+                                uint slot_z = ((voxel_coord_z % volume_z) + volume_z) % volume_z;
+                                uint index = (slot_z * volume_y + slot_y) * volume_x + slot_x;
                                 int voxel = voxels[index];
                                 if (voxel != 0)
                                 {
                                         distance = 255 - voxel;//(1 - length(origin - box_intersection) / 300) * 255;
+                                        depth = length(box_intersection + dir * (i * voxel_size) - origin);
                                         break;
                                 }
                         }
@@ -341,7 +980,45 @@ __kernel void render(__global const int* voxels, int volume_size, int eye_x, int
                 //distance = (1 - length(origin - box_intersection) / 300) * 255;//255 - (length(origin - box_intersection))/2;
         }
 
-        // Draws the pixel based on the voxel's depth (black if ray did not intersect bounding box)
-        uint4 write_pixel = (uint4) (distance);
-        write_imageui(screen, (int2) (get_global_id(0), get_global_id(1)), write_pixel);
+        // Shades the block based on the voxel's depth (black if ray did not intersect bounding box)
+        samples[sample_coord.y * samples_width + sample_coord.x] = (float2) (distance, depth);
+}
+
+// Upsamples the render samples to the screen. Each pixel blends the four nearest samples
+// bilinearly, weighted down by how many voxels their depth is from the nearest sample's, so
+// shading does not bleed across silhouettes.
+__kernel void upsampleRender(__global const float2* samples, int render_scale, int samples_width, int samples_height, float voxel_size, __write_only image2d_t screen)
+{
+        int2 coord = (int2) (get_global_id(0), get_global_id(1));
+        if (OUTSIDE_IMAGE(screen, coord.x, coord.y))
+        {
+                return;
+        }
+
+        // Samples sit at the corner of their block
+        float2 position = convert_float2(coord) / render_scale;
+        int2 base = convert_int2(floor(position));
+        float2 fraction = position - convert_float2(base);
+        int2 limit = (int2) (samples_width - 1, samples_height - 1);
+        int2 nearest = min(convert_int2(round(position)), limit);
+        float reference_depth = samples[nearest.y * samples_width + nearest.x].y;
+
+        float shade = 0;
+        float total_weight = 0;
+        for (int j = 0; j < 2; j++)
+        {
+                for (int i = 0; i < 2; i++)
+                {
+                        int2 sample_coord = min(base + (int2) (i, j), limit);
+                        float2 sample = samples[sample_coord.y * samples_width + sample_coord.x];
+                        float bilinear = (i ? fraction.x : 1 - fraction.x) * (j ? fraction.y : 1 - fraction.y);
+                        float weight = bilinear / (1 + fabs(sample.y - reference_depth) / voxel_size);
+                        shade += sample.x * weight;
+                        total_weight += weight;
+                }
+        }
+
+        // The nearest sample always carries at least a quarter of the bilinear weight
+        uint value = shade / total_weight + 0.5f;
+        write_imageui(screen, coord, (uint4) (min(value, 255u)));
 }
@@ -1,15 +1,145 @@
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string>
 
+#include "frame_source_png.hpp"
+#include "frame_source_sequence.hpp"
+#include "frame_source_stream.hpp"
 #include "graphics_factory_sdl.hpp"
 #include "manager.hpp"
+#include "stereo_calibration.hpp"
 #include "util.hpp"
 
 int main(int argc, char* argv[])
 {
-        // Footage location
+        // Footage location, a PNG directory prefix, a packed .seq file or a stream address (see Stream)
         std::string footage_directory = "res/rectified_";
 
+        // Volume geometry, left at zero the planner sizes the volume to the frames and available memory
+        Util::VolumeConfig volume_config = {};
+        volume_config.voxel_size = 1.0f;
+
+        // Stereo matching cost, sad, sad-aggregated, census or census-host, and the SAD window size
+        Algorithm::MatchingCost matching_cost = Algorithm::MatchingCost::SAD;
+        unsigned int window_size = 9;
+
+        // Disparities searched by sad-aggregated when the range is not lowered, and how many are summed per launch
+        unsigned int aggregated_range = 64;
+        unsigned int aggregated_batch = 16;
+
+        // Disparities searched either side of the previous frame's, 0 searches every frame from scratch
+        unsigned int temporal_band = 0;
+
+        // Keeps only disparities found again by matching the left view against the right
+        bool consistency_check = false;
+
+        // Live frame rate to keep up with, 0 processes every frame however long it takes
+        double real_time_fps = 0;
+
+        // Pixels per rendered ray on each axis once the view is idle
+        unsigned int render_scale = 1;
+
+        // Stereo calibration of raw footage, rectified on the device, empty when the footage is rectified
+        std::string calibration_filename;
+
+        // Per frame telemetry is appended to a file, or streamed to monitors through unix:<path>
+        std::string telemetry_destination;
+
+        for (int i = 1; i < argc; i++)
+        {
+                std::string argument = argv[i];
+                bool has_value = i + 1 < argc;
+                if (argument == "--dimensions" && has_value)
+                {
+                        unsigned int* dimensions = volume_config.dimensions;
+                        if (sscanf(argv[++i], "%ux%ux%u", &dimensions[0], &dimensions[1], &dimensions[2]) != 3)
+                        {
+                                std::cerr << "Volume dimensions must be given as XxYxZ voxels" << std::endl;
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (argument == "--extent" && has_value)
+                {
+                        float* extent = volume_config.extent;
+                        if (sscanf(argv[++i], "%fx%fx%f", &extent[0], &extent[1], &extent[2]) != 3)
+                        {
+                                std::cerr << "Volume extent must be given as XxYxZ" << std::endl;
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (argument == "--voxel-size" && has_value)
+                {
+                        volume_config.voxel_size = atof(argv[++i]);
+                }
+                else if (argument == "--matching" && has_value)
+                {
+                        std::string cost = argv[++i];
+                        if (cost == "sad")
+                        {
+                                matching_cost = Algorithm::MatchingCost::SAD;
+                        }
+                        else if (cost == "sad-aggregated")
+                        {
+                                matching_cost = Algorithm::MatchingCost::SAD_AGGREGATED;
+                        }
+                        else if (cost == "census")
+                        {
+                                matching_cost = Algorithm::MatchingCost::CENSUS;
+                        }
+                        else if (cost == "census-host")
+                        {
+                                matching_cost = Algorithm::MatchingCost::CENSUS_HOST;
+                        }
+                        else
+                        {
+                                std::cerr << "Unknown matching cost " << cost << ", expected sad, sad-aggregated, census or census-host" << std::endl;
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (argument == "--temporal-band" && has_value)
+                {
+                        temporal_band = atoi(argv[++i]);
+                }
+                else if (argument == "--consistency-check")
+                {
+                        consistency_check = true;
+                }
+                else if (argument == "--real-time" && has_value)
+                {
+                        real_time_fps = atof(argv[++i]);
+                }
+                else if (argument == "--render-scale" && has_value)
+                {
+                        render_scale = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--calibration" && has_value)
+                {
+                        calibration_filename = argv[++i];
+                }
+                else if (argument == "--telemetry" && has_value)
+                {
+                        telemetry_destination = argv[++i];
+                }
+                else if (argument == "--window-size" && has_value)
+                {
+                        window_size = std::max(1, atoi(argv[++i]));
+                }
+                else if (argument == "--aggregated-range" && has_value)
+                {
+                        aggregated_range = std::max(0, atoi(argv[++i]));
+                }
+                else if (argument == "--aggregated-batch" && has_value)
+                {
+                        aggregated_batch = std::max(0, atoi(argv[++i]));
+                }
+                else
+                {
+                        footage_directory = argument;
+                }
+        }
+
         // Camera configuration details
         int tsu_baseline_mm = 10;
         int tsu_focal_length = 615;
@@ -21,16 +151,84 @@ int main(int argc, char* argv[])
         Util::CameraConfig camera_config;
         camera_config.baseline = tsu_baseline_mm;
         camera_config.focal_length = tsu_focal_length;
+        camera_config.principal_point_x = 0;
+        camera_config.principal_point_y = 0;
         camera_config.scale_x = 1;
         camera_config.scale_y = 1;
         camera_config.skew_coeff = 0;
 
+        // Packed sequences and streams carry their own camera configuration
+        FrameSource* frame_source = NULL;
+        std::string sequence_extension = ".seq";
+        if (Stream::isAddress(footage_directory))
+        {
+                FrameSourceStream* frame_source_stream = new FrameSourceStream(footage_directory);
+                if (!frame_source_stream->isOpen())
+                {
+                        return EXIT_FAILURE;
+                }
+                camera_config = frame_source_stream->getCameraConfig();
+                frame_source = frame_source_stream;
+        }
+        else if (footage_directory.size() > sequence_extension.size() &&
+                footage_directory.compare(footage_directory.size() - sequence_extension.size(), sequence_extension.size(), sequence_extension) == 0)
+        {
+                FrameSourceSequence* frame_source_sequence = new FrameSourceSequence(footage_directory);
+                if (!frame_source_sequence->isOpen())
+                {
+                        return EXIT_FAILURE;
+                }
+                camera_config = frame_source_sequence->getCameraConfig();
+                frame_source = frame_source_sequence;
+        }
+        else
+        {
+                frame_source = new FrameSourcePng(footage_directory);
+        }
+
+        // Depth is measured in the rectified cameras described by the calibration
+        StereoCalibration calibration;
+        if (!calibration_filename.empty())
+        {
+                if (!calibration.load(calibration_filename))
+                {
+                        return EXIT_FAILURE;
+                }
+                camera_config = calibration.getCameraConfig();
+        }
+
         // Factory to create GUI toolkit specific classes
         GraphicsFactorySdl graphics_factory = GraphicsFactorySdl();
 
         // Initialises and begins the scene reconstruction pipeline
-        Manager manager = Manager(&graphics_factory, footage_directory, camera_config);
+        Manager manager(&graphics_factory, frame_source, camera_config, volume_config);
+        if (!manager.isValid())
+        {
+                return EXIT_FAILURE;
+        }
+        manager.setMatchingCost(matching_cost, window_size);
+        if (!manager.setAggregation(aggregated_range, aggregated_batch))
+        {
+                return EXIT_FAILURE;
+        }
+        if (!calibration_filename.empty())
+        {
+                manager.setRectification(calibration);
+        }
+        manager.setTemporalSeeding(temporal_band);
+        manager.setConsistencyCheck(consistency_check);
+        manager.setRenderScale(render_scale);
+        if (real_time_fps > 0)
+        {
+                manager.setRealTime(real_time_fps);
+        }
+        if (!telemetry_destination.empty() && !manager.setTelemetry(telemetry_destination))
+        {
+                return EXIT_FAILURE;
+        }
         manager.start();
 
+        delete frame_source;
+
         return EXIT_SUCCESS;
 }
@@ -1,7 +1,6 @@
-#include <fstream>
-#include <iomanip>
+#include <algorithm>
+#include <chrono>
 #include <iostream>
-#include <sstream>
 #include <string>
 
 #include "manager.hpp"
@@ -9,74 +8,364 @@
 // ?? To do: Decouple from SDL input (Use composition? Would that double up on SDL init()?)
 #include <SDL2/SDL.h>
 
-Manager::Manager(GraphicsFactory* graphics_factory, std::string footage_directory, Util::CameraConfig& camera_config)
+Manager::Manager(GraphicsFactory* graphics_factory, FrameSource* frame_source, Util::CameraConfig& camera_config,
+        const Util::VolumeConfig& volume_config, ComputeDevice* compute_device) : m_algorithm(compute_device)
 {
-        m_footage_directory = footage_directory;
+        m_graphics_factory = graphics_factory;
+        m_frame_source = frame_source;
         m_camera_config = camera_config;
 
         // Loads the rectified images
-        m_left_rectified = graphics_factory->createImage(1, 1, 1);
-        m_right_rectified = graphics_factory->createImage(1, 1, 1);
+        m_left_rectified = m_frame_source->createFrameImage(graphics_factory);
+        m_right_rectified = m_frame_source->createFrameImage(graphics_factory);
         m_more_frames = loadNextFrame();
         if (!m_more_frames)
         {
-                std::cerr << "Could not locate footage in directory " << m_footage_directory << std::endl;
-                exit(EXIT_FAILURE);
+                std::cerr << "Could not load the first frame of footage" << std::endl;
+                return;
         }
 
-        // Allocates memory for temporary outputs after each pipeline stage
+        // Checks everything fits before allocating the rest of the pipeline
         unsigned int width = m_left_rectified->getWidth();
         unsigned int height = m_left_rectified->getHeight();
+        uint64_t pixel_count = (uint64_t) width * height;
+        MemoryPlanner planner = m_algorithm.createMemoryPlanner();
+        planner.addHost("Rectified frames", pixel_count * m_left_rectified->getBytesPerPixel() * 2);
+        planner.addHost("Disparity and depth maps", pixel_count * 4 * 2);
+        planner.addHost("Vertex and normal maps", pixel_count * (Algorithm::VERTEX_WORDS_PER_PIXEL + Algorithm::NORMAL_WORDS_PER_PIXEL) * 4);
+        planner.addHost("Triple buffered renders", pixel_count * 4 * 3);
+        planner.addDevice("Render", pixel_count * 4);
+        Util::VolumeConfig planned_volume_config;
+        if (!m_algorithm.planMemory(planner, width, height, volume_config, planned_volume_config))
+        {
+                return;
+        }
+
+        // Allocates memory for temporary outputs after each pipeline stage
         m_disparity_map = graphics_factory->createImage(width, height, 1);
         m_depth_map = graphics_factory->createImage(width, height, 1);
-        m_vertex_map = graphics_factory->createImageMemory(width, height, 4);
-        m_normal_map = graphics_factory->createImageMemory(width, height, 4);
-        m_render = graphics_factory->createImage(width, height, 1);
-        m_output = m_render;
+        m_vertex_map = graphics_factory->createImageMemory(width, height, Algorithm::VERTEX_WORDS_PER_PIXEL);
+        m_normal_map = graphics_factory->createImageMemory(width, height, Algorithm::NORMAL_WORDS_PER_PIXEL);
+        for (unsigned int i = 0; i < 3; i++)
+        {
+                m_renders[i] = graphics_factory->createImage(width, height, 1);
+        }
+        m_output = m_renders[m_render_buffer.getReadIndex()];
 
         // Allocates memory for the algorithms
-        m_algorithm.initialise(graphics_factory, width, height);
+        m_algorithm.initialise(graphics_factory, width, height, planned_volume_config);
+        m_valid = true;
+}
 
-        // Creates the window for output
-        m_window_manager = graphics_factory->createWindowManager();
-        Window::PixelFormat pixel_format = Window::PixelFormat::ABGR;
-        std::string title = "Scene Reconstruction";
-        m_window_manager->createWindow(m_output, pixel_format, title);
+bool Manager::isValid()
+{
+        return m_valid;
 }
 
 Manager::~Manager()
 {
-        delete [] m_voxels;
+        delete m_scheduler;
+        delete m_telemetry;
+}
+
+void Manager::setMatchingCost(Algorithm::MatchingCost matching_cost, unsigned int window_size)
+{
+        m_matching_cost = matching_cost;
+        m_window_size = window_size;
+}
+
+bool Manager::setAggregation(unsigned int range, unsigned int batch_size)
+{
+        return m_algorithm.setAggregation(range, batch_size);
+}
+
+void Manager::setRectification(const StereoCalibration& calibration)
+{
+        // The remap tables map every rectified pixel into a raw frame of the calibrated size
+        if (calibration.getWidth() != m_left_rectified->getWidth() || calibration.getHeight() != m_left_rectified->getHeight())
+        {
+                std::cerr << "Calibration is for " << calibration.getWidth() << "x" << calibration.getHeight() << " frames but the footage is "
+                        << m_left_rectified->getWidth() << "x" << m_left_rectified->getHeight() << std::endl;
+                exit(EXIT_FAILURE);
+        }
+        m_algorithm.setRectification(calibration, m_left_rectified->getBytesPerPixel());
+}
+
+void Manager::setTemporalSeeding(unsigned int band)
+{
+        m_algorithm.setTemporalSeeding(band);
+}
+
+void Manager::setConsistencyCheck(bool enabled)
+{
+        m_algorithm.setConsistencyCheck(enabled);
+}
+
+void Manager::setRenderScale(unsigned int render_scale)
+{
+        // Resolution of an idle view, a moving view is rendered at least this coarsely
+        m_render_scale = std::max(render_scale, 1u);
+}
+
+void Manager::setRealTime(double frames_per_second)
+{
+        // Starts from the configured quality and only ever lowers from there. Aggregated SAD searches
+        // its own range rather than the whole row, so its range is lowered from that.
+        RealTimeScheduler::Quality full_quality;
+        full_quality.disparity_range = m_matching_cost == Algorithm::MatchingCost::SAD_AGGREGATED ? m_algorithm.getAggregatedRange() : 0;
+        full_quality.window_size = m_window_size;
+        full_quality.render_scale = m_render_scale;
+
+        delete m_scheduler;
+        m_scheduler = new RealTimeScheduler(frames_per_second, full_quality);
+
+        // Aggregated SAD costs the same whatever the window, and census has none
+        if (m_matching_cost != Algorithm::MatchingCost::SAD)
+        {
+                m_scheduler->holdKnob(RealTimeScheduler::Knob::WINDOW_SIZE);
+        }
+
+        // Builds every matching variant the ladder can reach now, rather than in the middle of the stream
+        for (const RealTimeScheduler::Quality& quality : m_scheduler->getDisparityLadder())
+        {
+                m_algorithm.prepareDisparityMap(m_disparity_map->getWidth(), quality.window_size, m_matching_cost, quality.disparity_range);
+        }
+}
+
+bool Manager::setTelemetry(std::string destination)
+{
+        delete m_telemetry;
+        m_telemetry = new Telemetry();
+        if (!m_telemetry->open(destination))
+        {
+                delete m_telemetry;
+                m_telemetry = NULL;
+                return false;
+        }
+        return true;
+}
+
+void Manager::setOutputDirectory(std::string directory)
+{
+        // Snapshots, meshes and streamed bricks are kept apart from other pipelines running side by side
+        m_snapshot_filename = directory + "/volume.snapshot";
+        m_mesh_filename = directory + "/mesh.ply";
+        m_algorithm.setBrickStoreFilename(directory + "/volume.bricks");
+}
+
+void Manager::setFrameRange(unsigned int first_frame, unsigned int frame_count)
+{
+        // Segments of a sequence reconstructed side by side each start tracking afresh at their first frame
+        m_frame_index = first_frame;
+        m_end_frame = first_frame + frame_count;
+        m_camera_poses.clear();
+        m_more_frames = loadNextFrame();
+}
+
+const Manager::Timings& Manager::getTimings()
+{
+        return m_timings;
+}
+
+const std::vector<Util::Transformation>& Manager::getCameraPoses()
+{
+        return m_camera_poses;
 }
 
 void Manager::start()
 {
+        // Creates the window for output
+        m_window_manager = m_graphics_factory->createWindowManager();
+        Window::PixelFormat pixel_format = Window::PixelFormat::ABGR;
+        std::string title = "Scene Reconstruction";
+        m_window = m_window_manager->createWindow(m_output, pixel_format, title);
+
+        // Reconstruction runs at its own pace, this thread owns the window and input
+        m_reconstruction_thread = std::thread(&Manager::reconstruct, this);
+
+        while (!m_done)
+        {
+                Uint32 start_ticks = SDL_GetTicks();
+
+                getInput();
+                if (m_render_buffer.acquire())
+                {
+                        m_window->setImage(m_renders[m_render_buffer.getReadIndex()]);
+                }
+                refreshWindow();
+
+                // Keeps a steady refresh rate where vsync is unavailable
+                Uint32 elapsed_ms = SDL_GetTicks() - start_ticks;
+                if (elapsed_ms < m_display_period_ms)
+                {
+                        SDL_Delay(m_display_period_ms - elapsed_ms);
+                }
+        }
+
+        // A stream may be waiting on a sender that has stalled
+        m_frame_source->stop();
+        m_reconstruction_thread.join();
+}
+
+void Manager::reconstruct()
+{
+        if (m_scheduler != NULL)
+        {
+                m_scheduler->start();
+        }
+
         while (!m_done)
         {
+                handleRequests();
+
                 if (m_more_frames)
                 {
-                        // Performs the stages of reconstruction
-                        computeDisparity();
-                        disparityToDepth();
-                        trackCamera();
-                        fuseIntoVolume();
-
-                        // Loads in the next frame for processing
-                        m_more_frames = loadNextFrame();
+                        reconstructFrame(true);
+                }
+                else
+                {
+                        // Only the view can change once the footage has ended, no need to outpace the display.
+                        // Renders are skipped while nothing changes.
+                        std::this_thread::sleep_for(std::chrono::milliseconds(m_display_period_ms));
+                        renderVolume();
                 }
+        }
+}
 
-                // Draws to the screen and gets user input
-                renderVolume();
-                refreshWindow();
-                getInput();
+void Manager::process()
+{
+        // Reconstructs the whole footage on this thread without a window, then keeps the volume
+        while (m_more_frames)
+        {
+                reconstructFrame(false);
+        }
+        saveSnapshot();
+}
+
+void Manager::extractMesh()
+{
+        m_algorithm.extractMesh(m_mesh_filename);
+}
+
+void Manager::reconstructFrame(bool render)
+{
+        if (m_scheduler != NULL)
+        {
+                m_scheduler->beginFrame();
+        }
+        m_telemetry_record = Telemetry::Record();
+        m_telemetry_record.frame_index = m_frame_index - 1;
+        std::chrono::steady_clock::time_point frame_start = std::chrono::steady_clock::now();
+
+        // Performs the stages of reconstruction, there is nothing to render into without a window
+        runStage("Disparity", &Manager::computeDisparity);
+        runStage("Depth", &Manager::disparityToDepth);
+        runStage("Tracking", &Manager::trackCamera);
+        m_camera_poses.push_back(m_camera_pose);
+        runStage("Fusion", &Manager::fuseIntoVolume);
+        if (render)
+        {
+                runStage("Render", &Manager::renderVolume);
+        }
+
+        // Adjusts quality for the next frame if it was late or had time to spare
+        if (m_scheduler != NULL && m_scheduler->endFrame())
+        {
+                applyQuality();
+        }
+
+        double frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count();
+        m_timings.frame_count++;
+        m_timings.total_ms += frame_ms;
+        if (m_telemetry != NULL)
+        {
+                recordTelemetry(frame_ms);
+        }
+
+        // Loads in the next frame for processing
+        m_more_frames = loadNextFrame();
+}
+
+void Manager::runStage(std::string stage, void (Manager::*function)())
+{
+        // Stage timings drive the real-time scheduler and are exported with the telemetry
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (m_scheduler != NULL)
+        {
+                m_scheduler->beginStage(stage);
+                (this->*function)();
+                m_scheduler->endStage(stage);
+        }
+        else
+        {
+                (this->*function)();
+        }
+
+        int telemetry_stage = Telemetry::findStage(stage);
+        if (telemetry_stage >= 0)
+        {
+                double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                m_telemetry_record.stage_ms[telemetry_stage] = elapsed_ms;
+                m_timings.stage_ms[telemetry_stage] += elapsed_ms;
+        }
+}
+
+void Manager::recordTelemetry(double frame_ms)
+{
+        // Gathers what the stages left behind into the record of the frame just processed
+        const Algorithm::TrackingStatistics& tracking = m_algorithm.getTrackingStatistics();
+        Algorithm::FrameStatistics frame = m_algorithm.takeFrameStatistics();
+
+        m_telemetry_record.frame_ms = frame_ms;
+        m_telemetry_record.bytes_uploaded = frame.bytes_uploaded;
+        m_telemetry_record.bytes_downloaded = frame.bytes_downloaded;
+        m_telemetry_record.valid_depth_pixels = frame.valid_depth_pixels;
+        m_telemetry_record.correspondence_count = tracking.correspondence_count;
+        m_telemetry_record.icp_residual_rms = tracking.residual_rms;
+        m_telemetry_record.icp_iterations = 1;
+        m_telemetry_record.occupied_voxels = frame.occupied_voxels;
+        m_telemetry_record.volume_occupancy = frame.voxel_count == 0 ? 0 : (double) frame.occupied_voxels / frame.voxel_count;
+        m_telemetry_record.dropped_frames = m_scheduler != NULL ? m_scheduler->getDroppedFrames() : 0;
+        m_telemetry->record(m_telemetry_record);
+}
+
+void Manager::applyQuality()
+{
+        const RealTimeScheduler::Quality& quality = m_scheduler->getQuality();
+        m_algorithm.setDisparityRange(quality.disparity_range);
+        m_window_size = quality.window_size;
+        m_render_scale = quality.render_scale;
+}
+
+void Manager::handleRequests()
+{
+        // Key presses that touch the volume are carried out between frames on the reconstruction thread
+        if (m_save_requested.exchange(false))
+        {
+                saveSnapshot();
+        }
+        if (m_load_requested.exchange(false))
+        {
+                loadSnapshot();
+        }
+        if (m_mesh_requested.exchange(false))
+        {
+                m_algorithm.extractMesh(m_mesh_filename);
         }
 }
 
 void Manager::computeDisparity()
 {
-        // Generates a disparity map from a stereo pair of images
-        const int window_size = 9;
-        m_algorithm.generateDisparityMap(m_left_rectified, m_right_rectified, window_size, m_disparity_map);
+        // Generates a disparity map from a stereo pair of images, predicting the camera keeps its last motion
+        m_algorithm.generateDisparityMap(
+                m_left_rectified,
+                m_right_rectified,
+                m_window_size,
+                m_matching_cost,
+                m_camera_motion,
+                m_camera_config.baseline,
+                m_disparity_map
+        );
 }
 
 void Manager::disparityToDepth()
@@ -93,20 +382,29 @@ void Manager::disparityToDepth()
 void Manager::trackCamera()
 {
         // Tracks the camera between frames
-        Util::Transformation transformation;
         m_algorithm.trackCamera(
                 m_depth_map,
                 m_vertex_map,
                 m_normal_map,
                 m_camera_config,
-                transformation
+                m_camera_pose
         );
+
+        // Motion since the last frame
+        m_camera_motion.x = m_camera_pose.translation.x - m_previous_camera_position.x;
+        m_camera_motion.y = m_camera_pose.translation.y - m_previous_camera_position.y;
+        m_camera_motion.z = m_camera_pose.translation.z - m_previous_camera_position.z;
+        m_previous_camera_position = m_camera_pose.translation;
 }
 
 void Manager::fuseIntoVolume()
 {
+        // Keeps the rolling volume centred on the tracked camera
+        m_algorithm.shiftVolume(m_camera_pose);
+
         // ?? To do: Volumetric integration of depth map into signed distance function 3D representation
         m_algorithm.tempSetVoxels(m_disparity_map);
+        m_volume_changed = true;
 }
 
 void Manager::renderVolume()
@@ -116,44 +414,85 @@ void Manager::renderVolume()
         int eye_y = 0;
         int eye_z = 340;
         int screen_z = 280;
-        float radians = m_degrees * (M_PI / 180.0);
+        int degrees = m_degrees;
+        float cam_distance = m_cam_distance;
+        float radians = degrees * (M_PI / 180.0);
+
+        // A moving view is raycast at reduced resolution, then refined once it comes to rest
+        bool view_moved = degrees != m_rendered_degrees || cam_distance != m_rendered_cam_distance;
+        unsigned int render_scale = view_moved ? std::max(m_render_scale, m_moving_render_scale) : m_render_scale;
 
-        // Performs ray tracing on the GPU
-        m_algorithm.render(eye_x, eye_y, eye_z, screen_z, radians, m_cam_distance, m_render);
+        // An idle view of an unchanged volume is already on screen
+        if (!view_moved && !m_volume_changed && render_scale == m_rendered_scale)
+        {
+                return;
+        }
+
+        // Performs ray tracing on the GPU, reading back into the free buffer and handing it to the display
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_algorithm.render(eye_x, eye_y, eye_z, screen_z, radians, cam_distance, render_scale, m_renders[m_render_buffer.getWriteIndex()]);
+        m_render_buffer.publish();
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // Keeps interaction at the display rate, quartering the rays if halving them is not enough
+        if (view_moved)
+        {
+                if (elapsed_ms > m_display_period_ms && m_moving_render_scale < m_max_moving_render_scale)
+                {
+                        m_moving_render_scale *= 2;
+                }
+                else if (elapsed_ms * 4 < m_display_period_ms && m_moving_render_scale > m_min_moving_render_scale)
+                {
+                        m_moving_render_scale /= 2;
+                }
+        }
+
+        m_rendered_degrees = degrees;
+        m_rendered_cam_distance = cam_distance;
+        m_rendered_scale = render_scale;
+        m_volume_changed = false;
 }
 
 void Manager::refreshWindow()
 {
         // Updates the output window
         m_window_manager->refresh();
-        SDL_Delay(16);
 }
 
-bool Manager::loadNextFrame()
+void Manager::saveSnapshot()
 {
-        std::string extension = ".png";
-        std::stringstream filename_stream;
+        // Checkpoints the volume and camera pose so a long reconstruction can be resumed
+        if (m_algorithm.saveVolume(m_snapshot_filename, m_camera_pose))
+        {
+                std::cout << "Saved volume snapshot to " << m_snapshot_filename << std::endl;
+        }
+}
 
-        // Loads the left frame
-        filename_stream << m_footage_directory << "l_" << std::setfill('0') << std::setw(4) << m_frame_index << extension;
-        std::ifstream image_stream = std::ifstream(filename_stream.str().c_str());
-        if (!image_stream.good())
+void Manager::loadSnapshot()
+{
+        if (m_algorithm.loadVolume(m_snapshot_filename, m_camera_pose))
+        {
+                m_volume_changed = true;
+                std::cout << "Restored volume snapshot from " << m_snapshot_filename << std::endl;
+        }
+}
+
+bool Manager::loadNextFrame()
+{
+        // A live stream moves on without waiting for the pipeline
+        if (m_scheduler != NULL)
+        {
+                m_frame_index = m_scheduler->selectFrame(m_frame_index);
+        }
+        if (m_end_frame != 0 && m_frame_index >= m_end_frame)
         {
-                std::cout << "End of footage" << std::endl;
                 return false;
         }
-        m_left_rectified->load(filename_stream.str());
 
-        // Loads the right frame
-        filename_stream = std::stringstream(std::string());
-        filename_stream << m_footage_directory << "r_" << std::setfill('0') << std::setw(4) << m_frame_index << extension;
-        image_stream = std::ifstream(filename_stream.str().c_str());
-        if (!image_stream.good())
+        if (!m_frame_source->loadFrame(m_frame_index, m_left_rectified, m_right_rectified))
         {
-                std::cout << std::endl << "End of footage" << std::endl;
                 return false;
         }
-        m_right_rectified->load(filename_stream.str());
 
         std::cout << std::endl << "Frame " << m_frame_index << std::endl;
         m_frame_index++;
@@ -187,6 +526,15 @@ void Manager::getInput()
                                         case SDLK_DOWN:
                                                 m_down = true;
                                                 break;
+                                        case SDLK_s:
+                                                m_save_requested = true;
+                                                break;
+                                        case SDLK_l:
+                                                m_load_requested = true;
+                                                break;
+                                        case SDLK_m:
+                                                m_mesh_requested = true;
+                                                break;
                                         case SDLK_ESCAPE:
                                                 m_done = true;
                                                 continue;
@@ -221,7 +569,7 @@ void Manager::getInput()
         }
         if (m_up)
         {
-                m_cam_distance -= 4;
+                m_cam_distance = m_cam_distance - 4;
         }
         if (m_right)
         {
@@ -229,6 +577,6 @@ void Manager::getInput()
         }
         if (m_down)
         {
-                m_cam_distance += 4;
+                m_cam_distance = m_cam_distance + 4;
         }
 }
@@ -0,0 +1,106 @@
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unistd.h>
+
+#include "memory_planner.hpp"
+
+namespace
+{
+        // Leaves headroom for the driver, the window system and everything else on the machine
+        const double DEVICE_BUDGET = 0.9;
+        const double HOST_BUDGET = 0.75;
+
+        std::string toMegabytes(uint64_t size_in_bytes)
+        {
+                std::stringstream stream;
+                stream << std::fixed << std::setprecision(1) << size_in_bytes / (1024.0 * 1024.0) << " MB";
+                return stream.str();
+        }
+}
+
+MemoryPlanner::MemoryPlanner(uint64_t device_global_bytes, uint64_t device_max_allocation_bytes, uint64_t host_bytes)
+{
+        m_device_global_bytes = device_global_bytes;
+        m_device_max_allocation_bytes = device_max_allocation_bytes;
+        m_host_bytes = host_bytes;
+}
+
+void MemoryPlanner::addHost(std::string name, uint64_t size_in_bytes)
+{
+        m_allocations.push_back({ name, size_in_bytes, false });
+}
+
+void MemoryPlanner::addDevice(std::string name, uint64_t size_in_bytes)
+{
+        m_allocations.push_back({ name, size_in_bytes, true });
+}
+
+bool MemoryPlanner::fits(std::string* reason)
+{
+        std::stringstream stream;
+        for (const Allocation& allocation : m_allocations)
+        {
+                if (allocation.device && allocation.size_in_bytes > m_device_max_allocation_bytes)
+                {
+                        stream << allocation.name << " needs " << toMegabytes(allocation.size_in_bytes)
+                                << " but the device allows at most " << toMegabytes(m_device_max_allocation_bytes) << " in one allocation";
+                        *reason = stream.str();
+                        return false;
+                }
+        }
+
+        if (getDeviceBytes() > m_device_global_bytes * DEVICE_BUDGET)
+        {
+                stream << "Device memory needed is " << toMegabytes(getDeviceBytes()) << " of " << toMegabytes(m_device_global_bytes);
+                *reason = stream.str();
+                return false;
+        }
+
+        if (getHostBytes() > m_host_bytes * HOST_BUDGET)
+        {
+                stream << "Host memory needed is " << toMegabytes(getHostBytes()) << " of " << toMegabytes(m_host_bytes);
+                *reason = stream.str();
+                return false;
+        }
+
+        return true;
+}
+
+uint64_t MemoryPlanner::getHostBytes()
+{
+        uint64_t total = 0;
+        for (const Allocation& allocation : m_allocations)
+        {
+                total += allocation.device ? 0 : allocation.size_in_bytes;
+        }
+        return total;
+}
+
+uint64_t MemoryPlanner::getDeviceBytes()
+{
+        uint64_t total = 0;
+        for (const Allocation& allocation : m_allocations)
+        {
+                total += allocation.device ? allocation.size_in_bytes : 0;
+        }
+        return total;
+}
+
+void MemoryPlanner::print()
+{
+        std::cout << "Memory plan:" << std::endl;
+        for (const Allocation& allocation : m_allocations)
+        {
+                std::cout << "  " << (allocation.device ? "device " : "host   ") << std::setw(12) << toMegabytes(allocation.size_in_bytes)
+                        << "  " << allocation.name << std::endl;
+        }
+        std::cout << "  Device total " << toMegabytes(getDeviceBytes()) << " of " << toMegabytes(m_device_global_bytes)
+                << " (largest allocation allowed " << toMegabytes(m_device_max_allocation_bytes) << ")" << std::endl;
+        std::cout << "  Host total " << toMegabytes(getHostBytes()) << " of " << toMegabytes(m_host_bytes) << std::endl;
+}
+
+uint64_t MemoryPlanner::getPhysicalHostBytes()
+{
+        return (uint64_t) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGE_SIZE);
+}
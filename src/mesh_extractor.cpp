@@ -0,0 +1,505 @@
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "mesh_extractor.hpp"
+
+MeshExtractor::MeshExtractor()
+{
+        m_thread_count = std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool MeshExtractor::extract(const int* voxels, const int dimensions[3], float voxel_size, const int origin[3], std::string filename)
+{
+        m_voxels = voxels;
+        m_voxel_size = voxel_size;
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                m_origin[axis] = origin[axis];
+                m_dimensions[axis] = dimensions[axis];
+                m_origin_slot[axis] = ((origin[axis] % m_dimensions[axis]) + m_dimensions[axis]) % m_dimensions[axis];
+        }
+
+        // Cells and the edges they own start one voxel outside the volume, so surfaces touching
+        // the boundary are closed off against empty space
+        m_grid_width = m_dimensions[0] + 1;
+        m_grid_height = m_dimensions[1] + 1;
+        m_empty_row.assign(m_dimensions[0], 0);
+        int first_slice = -1;
+        int last_slice = m_dimensions[2] - 1;
+
+        // Builds the case table before any worker starts, so the workers only ever read it
+        getCaseTable();
+
+        // Classification pass
+        m_slice_vertex_offsets.assign(m_dimensions[2] + 2, 0);
+        m_slice_triangle_offsets.assign(m_dimensions[2] + 2, 0);
+        parallelFor(first_slice, last_slice + 1, [this](int z, unsigned int)
+        {
+                m_slice_vertex_offsets[z + 1] = countSliceVertices(z);
+                m_slice_triangle_offsets[z + 1] = countSliceTriangles(z);
+        });
+
+        // Exclusive prefix sum, the final element holds the totals
+        uint32_t vertex_total = 0;
+        uint32_t triangle_total = 0;
+        for (int i = 0; i <= m_dimensions[2] + 1; i++)
+        {
+                uint32_t vertex_count = m_slice_vertex_offsets[i];
+                uint32_t triangle_count = m_slice_triangle_offsets[i];
+                m_slice_vertex_offsets[i] = vertex_total;
+                m_slice_triangle_offsets[i] = triangle_total;
+                vertex_total += vertex_count;
+                triangle_total += triangle_count;
+        }
+
+        m_stream.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_stream.good())
+        {
+                std::cerr << "Could not open " << filename << " for writing" << std::endl;
+                return false;
+        }
+
+        m_stream << "ply\n"
+                << "format binary_little_endian 1.0\n"
+                << "comment Scene Reconstruction marching cubes mesh\n"
+                << "element vertex " << getVertexCount() << "\n"
+                << "property float x\n"
+                << "property float y\n"
+                << "property float z\n"
+                << "element face " << getTriangleCount() << "\n"
+                << "property list uchar int vertex_indices\n"
+                << "end_header\n";
+
+        // Generation passes, PLY needs every vertex before the first face
+        bool success = streamSlices([this](int z, unsigned int, std::vector<char>& output)
+        {
+                generateSliceVertices(z, output);
+        });
+
+        m_thread_indices.resize(m_thread_count);
+        m_thread_next_indices.resize(m_thread_count);
+        success = success && streamSlices([this](int z, unsigned int thread, std::vector<char>& output)
+        {
+                generateSliceTriangles(z, m_thread_indices[thread], m_thread_next_indices[thread], output);
+        });
+
+        m_thread_indices.clear();
+        m_thread_next_indices.clear();
+        m_empty_row.clear();
+        m_stream.close();
+        return success;
+}
+
+unsigned int MeshExtractor::getVertexCount()
+{
+        return m_slice_vertex_offsets.empty() ? 0 : m_slice_vertex_offsets.back();
+}
+
+unsigned int MeshExtractor::getTriangleCount()
+{
+        return m_slice_triangle_offsets.empty() ? 0 : m_slice_triangle_offsets.back();
+}
+
+const MeshExtractor::CaseTable& MeshExtractor::getCaseTable()
+{
+        // Pipelines running side by side may extract meshes at the same time
+        static CaseTable table;
+        static std::once_flag built;
+        std::call_once(built, buildCaseTable, std::ref(table));
+        return table;
+}
+
+void MeshExtractor::buildCaseTable(CaseTable& table)
+{
+        // Corner i sits at (i & 1, (i >> 1) & 1, (i >> 2) & 1)
+        int edge_lookup[8][3];
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                unsigned int k = 0;
+                for (unsigned int corner = 0; corner < 8; corner++)
+                {
+                        if ((corner & (1 << axis)) == 0)
+                        {
+                                unsigned int edge = axis * 4 + k++;
+                                table.edge_corner[edge] = corner;
+                                table.edge_axis[edge] = axis;
+                                edge_lookup[corner][axis] = edge;
+                                edge_lookup[corner | (1 << axis)][axis] = edge;
+                        }
+                }
+        }
+
+        // Bitmask of the two faces (axis * 2 + side) each edge lies on
+        unsigned int edge_faces[12];
+        for (unsigned int edge = 0; edge < 12; edge++)
+        {
+                edge_faces[edge] = 0;
+                for (unsigned int axis = 0; axis < 3; axis++)
+                {
+                        if (axis != table.edge_axis[edge])
+                        {
+                                unsigned int side = (table.edge_corner[edge] >> axis) & 1;
+                                edge_faces[edge] |= 1 << (axis * 2 + side);
+                        }
+                }
+        }
+
+        // Lists the corners of each face counter-clockwise as seen from outside the cube
+        unsigned int face_corners[6][4];
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                unsigned int u = 1 << ((axis + 1) % 3);
+                unsigned int v = 1 << ((axis + 2) % 3);
+                unsigned int low[4] = { 0, v, u | v, u };
+                unsigned int high[4] = { 0, u, u | v, v };
+                for (unsigned int k = 0; k < 4; k++)
+                {
+                        face_corners[axis * 2][k] = low[k];
+                        face_corners[axis * 2 + 1][k] = high[k] | (1 << axis);
+                }
+        }
+
+        for (unsigned int cube_index = 0; cube_index < 256; cube_index++)
+        {
+                // Each face contributes a segment from every crossing where its boundary enters the solid
+                // to the next crossing, keeping the solid on the right. Ambiguous faces therefore always
+                // separate their solid corners, and neighbouring cubes agree on the shared face.
+                int next_edge[12];
+                for (unsigned int edge = 0; edge < 12; edge++)
+                {
+                        next_edge[edge] = -1;
+                }
+
+                for (unsigned int face = 0; face < 6; face++)
+                {
+                        int crossings[4];
+                        bool entering[4];
+                        unsigned int crossing_count = 0;
+                        for (unsigned int k = 0; k < 4; k++)
+                        {
+                                unsigned int a = face_corners[face][k];
+                                unsigned int b = face_corners[face][(k + 1) % 4];
+                                bool a_inside = cube_index & (1 << a);
+                                bool b_inside = cube_index & (1 << b);
+                                if (a_inside != b_inside)
+                                {
+                                        unsigned int axis = 0;
+                                        while (((a ^ b) >> axis) != 1)
+                                        {
+                                                axis++;
+                                        }
+                                        crossings[crossing_count] = edge_lookup[a][axis];
+                                        entering[crossing_count] = b_inside;
+                                        crossing_count++;
+                                }
+                        }
+
+                        for (unsigned int k = 0; k < crossing_count; k++)
+                        {
+                                if (entering[k])
+                                {
+                                        next_edge[crossings[k]] = crossings[(k + 1) % crossing_count];
+                                }
+                        }
+                }
+
+                // Chains the segments into loops and fans each loop into triangles
+                unsigned int index_count = 0;
+                bool visited[12] = { false };
+                for (unsigned int start = 0; start < 12; start++)
+                {
+                        if (next_edge[start] == -1 || visited[start])
+                        {
+                                continue;
+                        }
+
+                        std::vector<int> loop;
+                        int edge = start;
+                        while (!visited[edge])
+                        {
+                                visited[edge] = true;
+                                loop.push_back(edge);
+                                edge = next_edge[edge];
+                        }
+
+                        // Picks a fan origin that never produces a triangle lying flat on a cube face, as the
+                        // neighbouring cube would emit the same triangle facing the other way
+                        unsigned int origin = 0;
+                        for (unsigned int candidate = 0; candidate < loop.size(); candidate++)
+                        {
+                                bool flat = false;
+                                for (unsigned int k = 1; k + 1 < loop.size(); k++)
+                                {
+                                        unsigned int a = loop[candidate];
+                                        unsigned int b = loop[(candidate + k) % loop.size()];
+                                        unsigned int c = loop[(candidate + k + 1) % loop.size()];
+                                        flat = flat || (edge_faces[a] & edge_faces[b] & edge_faces[c]) != 0;
+                                }
+
+                                if (!flat)
+                                {
+                                        origin = candidate;
+                                        break;
+                                }
+                        }
+
+                        for (unsigned int k = 1; k + 1 < loop.size(); k++)
+                        {
+                                table.triangles[cube_index][index_count++] = loop[origin];
+                                table.triangles[cube_index][index_count++] = loop[(origin + k) % loop.size()];
+                                table.triangles[cube_index][index_count++] = loop[(origin + k + 1) % loop.size()];
+                        }
+                }
+
+                table.triangle_count[cube_index] = index_count / 3;
+                table.triangles[cube_index][index_count] = -1;
+        }
+}
+
+inline const int* MeshExtractor::getRow(int y, int z)
+{
+        // Rows outside the volume read as empty
+        if (y < 0 || z < 0 || y >= m_dimensions[1] || z >= m_dimensions[2])
+        {
+                return m_empty_row.data();
+        }
+
+        int slot_y = (m_origin_slot[1] + y) % m_dimensions[1];
+        int slot_z = (m_origin_slot[2] + z) % m_dimensions[2];
+        return m_voxels + ((size_t) slot_z * m_dimensions[1] + slot_y) * m_dimensions[0];
+}
+
+inline unsigned int MeshExtractor::isInside(const int* row, int x)
+{
+        // Non-zero voxels are solid, everything outside the volume is empty
+        if (x < 0 || x >= m_dimensions[0])
+        {
+                return 0;
+        }
+
+        int slot_x = m_origin_slot[0] + x;
+        if (slot_x >= m_dimensions[0])
+        {
+                slot_x -= m_dimensions[0];
+        }
+        return row[slot_x] != 0;
+}
+
+unsigned int MeshExtractor::countSliceVertices(int z)
+{
+        // Every corner owns the three edges leading away from it along +x, +y and +z
+        unsigned int vertex_count = 0;
+        for (int y = -1; y < m_dimensions[1]; y++)
+        {
+                const int* row = getRow(y, z);
+                const int* row_y = getRow(y + 1, z);
+                const int* row_z = getRow(y, z + 1);
+                for (int x = -1; x < m_dimensions[0]; x++)
+                {
+                        unsigned int inside = isInside(row, x);
+                        vertex_count += inside ^ isInside(row, x + 1);
+                        vertex_count += inside ^ isInside(row_y, x);
+                        vertex_count += inside ^ isInside(row_z, x);
+                }
+        }
+        return vertex_count;
+}
+
+unsigned int MeshExtractor::countSliceTriangles(int z)
+{
+        const CaseTable& table = getCaseTable();
+
+        unsigned int triangle_count = 0;
+        for (int y = -1; y < m_dimensions[1]; y++)
+        {
+                const int* rows[4] = { getRow(y, z), getRow(y + 1, z), getRow(y, z + 1), getRow(y + 1, z + 1) };
+                unsigned int column = getColumn(rows, -1);
+                for (int x = -1; x < m_dimensions[0]; x++)
+                {
+                        unsigned int next_column = getColumn(rows, x + 1);
+                        triangle_count += table.triangle_count[column | (next_column << 1)];
+                        column = next_column;
+                }
+        }
+        return triangle_count;
+}
+
+inline unsigned int MeshExtractor::getColumn(const int* rows[4], int x)
+{
+        // Packs the four corners sharing an x coordinate into the even bits of a cube index
+        return isInside(rows[0], x) | (isInside(rows[1], x) << 2) | (isInside(rows[2], x) << 4) | (isInside(rows[3], x) << 6);
+}
+
+void MeshExtractor::buildVertexIndices(int z, uint32_t first_vertex, std::vector<uint32_t>& vertex_indices)
+{
+        // Numbers the vertices owned by a slice in the same order generateSliceVertices() emits them
+        vertex_indices.assign((size_t) m_grid_width * m_grid_height * 3, UINT32_MAX);
+        if (z >= m_dimensions[2])
+        {
+                return;
+        }
+
+        uint32_t vertex_index = first_vertex;
+        for (int y = -1; y < m_dimensions[1]; y++)
+        {
+                const int* row = getRow(y, z);
+                const int* row_y = getRow(y + 1, z);
+                const int* row_z = getRow(y, z + 1);
+                for (int x = -1; x < m_dimensions[0]; x++)
+                {
+                        unsigned int inside = isInside(row, x);
+                        bool crossings[3] = {
+                                (inside ^ isInside(row, x + 1)) != 0,
+                                (inside ^ isInside(row_y, x)) != 0,
+                                (inside ^ isInside(row_z, x)) != 0
+                        };
+
+                        size_t cell = ((size_t) (y + 1) * m_grid_width + (x + 1)) * 3;
+                        for (unsigned int axis = 0; axis < 3; axis++)
+                        {
+                                if (crossings[axis])
+                                {
+                                        vertex_indices[cell + axis] = vertex_index++;
+                                }
+                        }
+                }
+        }
+}
+
+void MeshExtractor::generateSliceVertices(int z, std::vector<char>& output)
+{
+        output.resize((m_slice_vertex_offsets[z + 2] - m_slice_vertex_offsets[z + 1]) * 3 * sizeof(float));
+        float* vertices = (float*) output.data();
+
+        // Vertices sit halfway along each crossed edge, in the same frame the render kernel uses
+        float half_dimensions[3] = { (float) (m_dimensions[0] / 2), (float) (m_dimensions[1] / 2), (float) (m_dimensions[2] / 2) };
+        for (int y = -1; y < m_dimensions[1]; y++)
+        {
+                const int* row = getRow(y, z);
+                const int* row_y = getRow(y + 1, z);
+                const int* row_z = getRow(y, z + 1);
+                for (int x = -1; x < m_dimensions[0]; x++)
+                {
+                        unsigned int inside = isInside(row, x);
+                        bool crossings[3] = {
+                                (inside ^ isInside(row, x + 1)) != 0,
+                                (inside ^ isInside(row_y, x)) != 0,
+                                (inside ^ isInside(row_z, x)) != 0
+                        };
+
+                        for (unsigned int axis = 0; axis < 3; axis++)
+                        {
+                                if (crossings[axis])
+                                {
+                                        float voxel[3] = { (float) (m_origin[0] + x), (float) (m_origin[1] + y), (float) (m_origin[2] + z) };
+                                        voxel[axis] += 0.5f;
+                                        *vertices++ = (voxel[0] - half_dimensions[0]) * m_voxel_size;
+                                        *vertices++ = (half_dimensions[1] - voxel[1]) * m_voxel_size;
+                                        *vertices++ = (half_dimensions[2] - voxel[2]) * m_voxel_size;
+                                }
+                        }
+                }
+        }
+}
+
+void MeshExtractor::generateSliceTriangles(int z, std::vector<uint32_t>& indices, std::vector<uint32_t>& next_indices, std::vector<char>& output)
+{
+        const CaseTable& table = getCaseTable();
+
+        const size_t face_size = sizeof(uint8_t) + 3 * sizeof(int32_t);
+        output.resize((m_slice_triangle_offsets[z + 2] - m_slice_triangle_offsets[z + 1]) * face_size);
+        if (output.empty())
+        {
+                return;
+        }
+        char* faces = output.data();
+
+        // Cells in this slice reference edges owned by this slice and the one above it
+        buildVertexIndices(z, m_slice_vertex_offsets[z + 1], indices);
+        buildVertexIndices(z + 1, m_slice_vertex_offsets[z + 2], next_indices);
+
+        for (int y = -1; y < m_dimensions[1]; y++)
+        {
+                const int* rows[4] = { getRow(y, z), getRow(y + 1, z), getRow(y, z + 1), getRow(y + 1, z + 1) };
+                unsigned int column = getColumn(rows, -1);
+                for (int x = -1; x < m_dimensions[0]; x++)
+                {
+                        unsigned int next_column = getColumn(rows, x + 1);
+                        unsigned int cube_index = column | (next_column << 1);
+                        column = next_column;
+
+                        const int8_t* triangles = table.triangles[cube_index];
+                        for (unsigned int i = 0; triangles[i] != -1; i += 3)
+                        {
+                                *faces++ = 3;
+                                for (unsigned int k = 0; k < 3; k++)
+                                {
+                                        // Looks up the welded vertex by the edge's owning corner and axis
+                                        unsigned int edge = triangles[i + k];
+                                        unsigned int corner = table.edge_corner[edge];
+                                        int owner_x = x + 1 + (corner & 1);
+                                        int owner_y = y + 1 + ((corner >> 1) & 1);
+                                        const std::vector<uint32_t>& owner_indices = (corner & 4) ? next_indices : indices;
+                                        int32_t vertex_index = owner_indices[((size_t) owner_y * m_grid_width + owner_x) * 3 + table.edge_axis[edge]];
+                                        memcpy(faces, &vertex_index, sizeof(vertex_index));
+                                        faces += sizeof(vertex_index);
+                                }
+                        }
+                }
+        }
+}
+
+void MeshExtractor::parallelFor(int begin, int end, std::function<void(int, unsigned int)> function)
+{
+        // Hands out indices one at a time, slices vary a lot in how much surface they contain
+        std::atomic<int> next(begin);
+        std::vector<std::thread> threads;
+        for (unsigned int thread = 0; thread < m_thread_count; thread++)
+        {
+                threads.push_back(std::thread([&next, end, &function, thread]()
+                {
+                        for (int i = next++; i < end; i = next++)
+                        {
+                                function(i, thread);
+                        }
+                }));
+        }
+
+        for (std::thread& thread : threads)
+        {
+                thread.join();
+        }
+}
+
+bool MeshExtractor::streamSlices(std::function<void(int, unsigned int, std::vector<char>&)> generate)
+{
+        // Generates a bounded batch of slices in parallel, then writes them out in order
+        int batch_size = m_thread_count * 4;
+        std::vector<std::vector<char> > outputs(batch_size);
+        for (int batch_start = -1; batch_start < m_dimensions[2]; batch_start += batch_size)
+        {
+                int batch_end = std::min(batch_start + batch_size, m_dimensions[2]);
+                parallelFor(batch_start, batch_end, [&](int z, unsigned int thread)
+                {
+                        generate(z, thread, outputs[z - batch_start]);
+                });
+
+                for (int z = batch_start; z < batch_end; z++)
+                {
+                        std::vector<char>& output = outputs[z - batch_start];
+                        m_stream.write(output.data(), output.size());
+                }
+
+                if (!m_stream.good())
+                {
+                        std::cerr << "Failed to write mesh" << std::endl;
+                        return false;
+                }
+        }
+
+        return true;
+}
@@ -0,0 +1,164 @@
+#include <cstring>
+#include <iostream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "frame_source_png.hpp"
+#include "image_ops.hpp"
+#include "sequence_file.hpp"
+#include "util.hpp"
+
+// Converts a directory of l_NNNN.png/r_NNNN.png pairs into a packed sequence file
+namespace
+{
+        // Decodes a PNG into tightly packed RGBA8 pixels (byte order R, G, B, A)
+        bool decode(std::string filename, unsigned int* width, unsigned int* height, std::vector<uint32_t>& pixels)
+        {
+                SDL_Surface* loaded = IMG_Load(filename.c_str());
+                if (loaded == NULL)
+                {
+                        return false;
+                }
+
+                SDL_Surface* converted = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ABGR8888, 0);
+                SDL_FreeSurface(loaded);
+                if (converted == NULL)
+                {
+                        std::cerr << "Failed to convert " << filename << ", SDL error " << SDL_GetError() << std::endl;
+                        return false;
+                }
+
+                *width = converted->w;
+                *height = converted->h;
+                pixels.resize(converted->w * converted->h);
+                for (int y = 0; y < converted->h; y++)
+                {
+                        const uint8_t* row = (const uint8_t*) converted->pixels + y * converted->pitch;
+                        memcpy(&pixels[y * converted->w], row, converted->w * sizeof(uint32_t));
+                }
+
+                SDL_FreeSurface(converted);
+                return true;
+        }
+
+        // Converts RGBA8 pixels to 8-bit luminance, using the same weights as the device conversion
+        void toLuminance(const std::vector<uint32_t>& pixels, std::vector<uint8_t>& luminance)
+        {
+                luminance.resize(pixels.size());
+                ImageOps::convert(pixels.data(), ImageOps::Format::ABGR, luminance.data(), ImageOps::Format::R8, pixels.size());
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        if (argc < 5)
+        {
+                std::cerr << "Usage: " << argv[0] << " <footage_prefix> <output.seq> <baseline_mm> <focal_length> [--luminance]" << std::endl;
+                std::cerr << "  e.g. " << argv[0] << " res/rectified_ res/tsukuba.seq 10 615" << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        std::string footage_directory = argv[1];
+        std::string output_filename = argv[2];
+
+        Util::CameraConfig camera_config;
+        camera_config.baseline = atoi(argv[3]);
+        camera_config.focal_length = atoi(argv[4]);
+        camera_config.principal_point_x = 0;
+        camera_config.principal_point_y = 0;
+        camera_config.scale_x = 1;
+        camera_config.scale_y = 1;
+        camera_config.skew_coeff = 0;
+
+        // Luminance sequences are uploaded straight into the single channel matching images
+        uint32_t pixel_format = Sequence::RGBA8;
+        if (argc > 5 && std::string(argv[5]) == "--luminance")
+        {
+                pixel_format = Sequence::LUMA8;
+        }
+
+        int flags = IMG_INIT_PNG;
+        if ((IMG_Init(flags) & flags) != flags)
+        {
+                std::cerr << "Failed to initialise SDL_image" << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        SequenceWriter writer;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        std::vector<uint32_t> left;
+        std::vector<uint32_t> right;
+        std::vector<uint8_t> left_luminance;
+        std::vector<uint8_t> right_luminance;
+        unsigned int frame_index = 0;
+        while (true)
+        {
+                unsigned int left_width, left_height, right_width, right_height;
+                std::string left_filename = FrameSourcePng::getFilename(footage_directory, "l_", frame_index);
+                std::string right_filename = FrameSourcePng::getFilename(footage_directory, "r_", frame_index);
+                if (!decode(left_filename, &left_width, &left_height, left) ||
+                        !decode(right_filename, &right_width, &right_height, right))
+                {
+                        break;
+                }
+
+                if (left_width != right_width || left_height != right_height)
+                {
+                        std::cerr << "Frame " << frame_index << " has mismatched left and right dimensions" << std::endl;
+                        return EXIT_FAILURE;
+                }
+
+                // The first frame determines the dimensions of the sequence
+                if (frame_index == 0)
+                {
+                        width = left_width;
+                        height = left_height;
+                        if (!writer.open(output_filename, width, height, pixel_format, camera_config))
+                        {
+                                return EXIT_FAILURE;
+                        }
+                }
+                else if (left_width != width || left_height != height)
+                {
+                        std::cerr << "Frame " << frame_index << " differs in size from the first frame" << std::endl;
+                        return EXIT_FAILURE;
+                }
+
+                bool appended;
+                if (pixel_format == Sequence::LUMA8)
+                {
+                        toLuminance(left, left_luminance);
+                        toLuminance(right, right_luminance);
+                        appended = writer.appendFrame(left_luminance.data(), right_luminance.data());
+                }
+                else
+                {
+                        appended = writer.appendFrame(left.data(), right.data());
+                }
+
+                if (!appended)
+                {
+                        return EXIT_FAILURE;
+                }
+                frame_index++;
+        }
+
+        if (frame_index == 0)
+        {
+                std::cerr << "Could not locate footage in directory " << footage_directory << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        if (!writer.close())
+        {
+                std::cerr << "Failed to finalise " << output_filename << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        std::cout << "Packed " << frame_index << " frames of " << width << "x" << height << " into " << output_filename << std::endl;
+        return EXIT_SUCCESS;
+}
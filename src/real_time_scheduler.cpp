@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+#include "real_time_scheduler.hpp"
+
+namespace
+{
+        // Weight of the newest frame in the running averages
+        const double SMOOTHING = 0.2;
+
+        // Consecutive frames over the deadline before lowering quality, and under the headroom
+        // fraction of it before raising it again
+        const unsigned int FRAMES_BEFORE_LOWERING = 3;
+        const unsigned int FRAMES_BEFORE_RAISING = 30;
+        const double HEADROOM = 0.6;
+
+        // Limits of each knob, an unlimited disparity range is first lowered to the initial range
+        const unsigned int INITIAL_DISPARITY_RANGE = 64;
+        const unsigned int MINIMUM_DISPARITY_RANGE = 16;
+        const unsigned int MINIMUM_WINDOW_SIZE = 3;
+        const unsigned int MAXIMUM_RENDER_SCALE = 8;
+}
+
+RealTimeScheduler::RealTimeScheduler(double frames_per_second, const Quality& full_quality)
+{
+        m_frame_period_ms = 1000.0 / frames_per_second;
+        m_quality = full_quality;
+}
+
+void RealTimeScheduler::holdKnob(Knob knob)
+{
+        // For knobs the pipeline's matching cost does not use, lowering them would gain nothing
+        m_held_knobs.insert(knob);
+}
+
+std::vector<RealTimeScheduler::Quality> RealTimeScheduler::getDisparityLadder()
+{
+        // Every disparity quality lowering can reach, in the order lower() steps through them
+        std::vector<Quality> ladder(1, m_quality);
+        for (Knob knob : { Knob::DISPARITY_RANGE, Knob::WINDOW_SIZE })
+        {
+                if (m_held_knobs.count(knob) != 0)
+                {
+                        continue;
+                }
+                Quality quality = ladder.back();
+                unsigned int& value = knob == Knob::DISPARITY_RANGE ? quality.disparity_range : quality.window_size;
+                for (unsigned int lowered = getLowered(knob, value); lowered != value; lowered = getLowered(knob, value))
+                {
+                        value = lowered;
+                        ladder.push_back(quality);
+                }
+        }
+        return ladder;
+}
+
+void RealTimeScheduler::start()
+{
+        m_start = std::chrono::steady_clock::now();
+}
+
+unsigned int RealTimeScheduler::selectFrame(unsigned int next_index)
+{
+        // Waits for frames that have not arrived yet, as a live source would
+        double elapsed_ms = getElapsedMs(m_start);
+        double arrival_ms = next_index * m_frame_period_ms;
+        if (arrival_ms > elapsed_ms)
+        {
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(arrival_ms - elapsed_ms));
+                return next_index;
+        }
+
+        // Skips to the newest frame, anything older is stale
+        unsigned int newest_index = elapsed_ms / m_frame_period_ms;
+        if (newest_index > next_index)
+        {
+                m_dropped_frames += newest_index - next_index;
+                std::cout << "Real-time: dropped " << newest_index - next_index << " stale frames ("
+                        << m_dropped_frames << " in total)" << std::endl;
+        }
+        return newest_index;
+}
+
+void RealTimeScheduler::beginFrame()
+{
+        m_frame_start = std::chrono::steady_clock::now();
+}
+
+void RealTimeScheduler::beginStage(std::string stage)
+{
+        m_stage_starts[stage] = std::chrono::steady_clock::now();
+}
+
+void RealTimeScheduler::endStage(std::string stage)
+{
+        double stage_ms = getElapsedMs(m_stage_starts[stage]);
+        std::map<std::string, double>::iterator average = m_stage_average_ms.find(stage);
+        if (average == m_stage_average_ms.end())
+        {
+                m_stage_average_ms[stage] = stage_ms;
+        }
+        else
+        {
+                average->second += SMOOTHING * (stage_ms - average->second);
+        }
+}
+
+bool RealTimeScheduler::endFrame()
+{
+        double frame_ms = getElapsedMs(m_frame_start);
+        m_average_frame_ms = m_average_frame_ms == 0 ? frame_ms : m_average_frame_ms + SMOOTHING * (frame_ms - m_average_frame_ms);
+
+        m_frames_over = m_average_frame_ms > m_frame_period_ms ? m_frames_over + 1 : 0;
+        m_frames_under = m_average_frame_ms < m_frame_period_ms * HEADROOM ? m_frames_under + 1 : 0;
+
+        if (m_frames_over >= FRAMES_BEFORE_LOWERING)
+        {
+                // Lowers the knob of whichever adjustable stage takes the longest
+                m_frames_over = 0;
+                std::string slowest = getAverageStageMs("Disparity") >= getAverageStageMs("Render") ? "Disparity" : "Render";
+                std::string other = slowest == "Disparity" ? "Render" : "Disparity";
+                return lower(slowest) || lower(other);
+        }
+
+        if (m_frames_under >= FRAMES_BEFORE_RAISING && !m_changes.empty())
+        {
+                m_frames_under = 0;
+                raise();
+                return true;
+        }
+
+        return false;
+}
+
+const RealTimeScheduler::Quality& RealTimeScheduler::getQuality()
+{
+        return m_quality;
+}
+
+unsigned int RealTimeScheduler::getDroppedFrames()
+{
+        return m_dropped_frames;
+}
+
+double RealTimeScheduler::getAverageFrameMs()
+{
+        return m_average_frame_ms;
+}
+
+bool RealTimeScheduler::lower(const std::string& stage)
+{
+        if (stage == "Render")
+        {
+                return lowerKnob(Knob::RENDER_SCALE);
+        }
+        return lowerKnob(Knob::DISPARITY_RANGE) || lowerKnob(Knob::WINDOW_SIZE);
+}
+
+bool RealTimeScheduler::lowerKnob(Knob knob)
+{
+        unsigned int& value = getValue(knob);
+        unsigned int lowered = getLowered(knob, value);
+        if (lowered == value || m_held_knobs.count(knob) != 0)
+        {
+                return false;
+        }
+
+        std::cout << "Real-time: " << m_average_frame_ms << "ms per frame over the " << m_frame_period_ms
+                << "ms deadline, " << getName(knob) << " lowered from " << value << " to " << lowered << std::endl;
+        m_changes.push_back({ knob, value });
+        value = lowered;
+        return true;
+}
+
+unsigned int RealTimeScheduler::getLowered(Knob knob, unsigned int value)
+{
+        switch (knob)
+        {
+                case Knob::DISPARITY_RANGE:
+                        return value == 0 ? INITIAL_DISPARITY_RANGE : std::max(value / 2, MINIMUM_DISPARITY_RANGE);
+                case Knob::WINDOW_SIZE:
+                        return value > MINIMUM_WINDOW_SIZE + 2 ? value - 2 : MINIMUM_WINDOW_SIZE;
+                case Knob::RENDER_SCALE:
+                default:
+                        return std::min(value * 2, MAXIMUM_RENDER_SCALE);
+        }
+}
+
+void RealTimeScheduler::raise()
+{
+        // Undoes the most recent change first
+        Change change = m_changes.back();
+        m_changes.pop_back();
+
+        unsigned int& value = getValue(change.knob);
+        std::cout << "Real-time: " << m_average_frame_ms << "ms per frame within the " << m_frame_period_ms
+                << "ms deadline, " << getName(change.knob) << " raised from " << value << " to " << change.previous_value << std::endl;
+        value = change.previous_value;
+}
+
+unsigned int& RealTimeScheduler::getValue(Knob knob)
+{
+        switch (knob)
+        {
+                case Knob::DISPARITY_RANGE:
+                        return m_quality.disparity_range;
+                case Knob::WINDOW_SIZE:
+                        return m_quality.window_size;
+                case Knob::RENDER_SCALE:
+                default:
+                        return m_quality.render_scale;
+        }
+}
+
+std::string RealTimeScheduler::getName(Knob knob)
+{
+        switch (knob)
+        {
+                case Knob::DISPARITY_RANGE:
+                        return "disparity range";
+                case Knob::WINDOW_SIZE:
+                        return "window size";
+                case Knob::RENDER_SCALE:
+                default:
+                        return "render scale";
+        }
+}
+
+double RealTimeScheduler::getAverageStageMs(const std::string& stage)
+{
+        std::map<std::string, double>::iterator average = m_stage_average_ms.find(stage);
+        return average == m_stage_average_ms.end() ? 0 : average->second;
+}
+
+double RealTimeScheduler::getElapsedMs(std::chrono::steady_clock::time_point since)
+{
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
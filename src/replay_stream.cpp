@@ -0,0 +1,189 @@
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+#include "frame_source_png.hpp"
+#include "sequence_file.hpp"
+#include "stream_protocol.hpp"
+
+// Replays recorded footage down a pipe or socket in the live stream format, standing in for a
+// capture process. Packed sequences are sent as raw frames, PNG directories as the PNG files.
+namespace
+{
+        bool readFile(std::string filename, std::vector<uint8_t>& bytes)
+        {
+                std::ifstream stream(filename.c_str(), std::ios::binary);
+                if (!stream.good())
+                {
+                        return false;
+                }
+                bytes.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+                return true;
+        }
+
+        bool sendFrame(int fd, unsigned int frame_index, const void* left, size_t left_size, const void* right, size_t right_size)
+        {
+                Stream::FrameHeader frame_header;
+                memset(&frame_header, 0, sizeof(frame_header));
+                frame_header.frame_index = frame_index;
+                frame_header.left_size_in_bytes = left_size;
+                frame_header.right_size_in_bytes = right_size;
+                return Stream::writeFully(fd, &frame_header, sizeof(frame_header)) &&
+                        Stream::writeFully(fd, left, left_size) && Stream::writeFully(fd, right, right_size);
+        }
+}
+
+int main(int argc, char* argv[])
+{
+        if (argc < 3)
+        {
+                std::cerr << "Usage: " << argv[0] << " <footage> <address> [--fps rate] [--camera baseline_mm focal_length]" << std::endl;
+                std::cerr << "  e.g. " << argv[0] << " res/tsukuba.seq tcp://localhost:5000 --fps 30" << std::endl;
+                return EXIT_FAILURE;
+        }
+
+        std::string footage = argv[1];
+        std::string address = argv[2];
+
+        // Camera configuration for PNG footage, packed sequences carry their own
+        Util::CameraConfig camera_config;
+        camera_config.baseline = 10;
+        camera_config.focal_length = 615;
+        camera_config.principal_point_x = 0;
+        camera_config.principal_point_y = 0;
+        camera_config.scale_x = 1;
+        camera_config.scale_y = 1;
+        camera_config.skew_coeff = 0;
+
+        // Sends as fast as the receiver takes frames unless a rate is given
+        double frames_per_second = 0;
+        for (int i = 3; i < argc; i++)
+        {
+                std::string argument = argv[i];
+                if (argument == "--fps" && i + 1 < argc)
+                {
+                        frames_per_second = atof(argv[++i]);
+                }
+                else if (argument == "--camera" && i + 2 < argc)
+                {
+                        camera_config.baseline = atoi(argv[++i]);
+                        camera_config.focal_length = atoi(argv[++i]);
+                }
+        }
+
+        Stream::Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, Stream::MAGIC, sizeof(header.magic));
+        header.version = Stream::VERSION;
+
+        SequenceReader reader;
+        std::string sequence_extension = ".seq";
+        bool sequence = footage.size() > sequence_extension.size() &&
+                footage.compare(footage.size() - sequence_extension.size(), sequence_extension.size(), sequence_extension) == 0;
+        if (sequence)
+        {
+                if (!reader.open(footage))
+                {
+                        return EXIT_FAILURE;
+                }
+                header.width = reader.getWidth();
+                header.height = reader.getHeight();
+                header.pixel_format = reader.getPixelFormat();
+                header.compression = Stream::RAW;
+                camera_config = reader.getCameraConfig();
+        }
+        else
+        {
+                // The first frame determines the dimensions of the stream
+                int flags = IMG_INIT_PNG;
+                if ((IMG_Init(flags) & flags) != flags)
+                {
+                        std::cerr << "Failed to initialise SDL_image" << std::endl;
+                        return EXIT_FAILURE;
+                }
+                SDL_Surface* first = IMG_Load(FrameSourcePng::getFilename(footage, "l_", 0).c_str());
+                if (first == NULL)
+                {
+                        std::cerr << "Could not locate footage in directory " << footage << std::endl;
+                        return EXIT_FAILURE;
+                }
+                header.width = first->w;
+                header.height = first->h;
+                header.pixel_format = Sequence::RGBA8;
+                header.compression = Stream::PNG;
+                SDL_FreeSurface(first);
+        }
+        header.baseline = camera_config.baseline;
+        header.focal_length = camera_config.focal_length;
+        header.principal_point_x = camera_config.principal_point_x;
+        header.principal_point_y = camera_config.principal_point_y;
+        header.scale_x = camera_config.scale_x;
+        header.scale_y = camera_config.scale_y;
+        header.skew_coeff = camera_config.skew_coeff;
+
+        // A receiver going away ends the replay rather than the process
+        signal(SIGPIPE, SIG_IGN);
+
+        std::cerr << "Waiting for the receiver on " << address << std::endl;
+        int fd = Stream::openOutput(address);
+        if (fd < 0 || !Stream::writeFully(fd, &header, sizeof(header)))
+        {
+                return EXIT_FAILURE;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t frame_size = (size_t) header.width * header.height * Sequence::getBytesPerPixel(header.pixel_format);
+        std::vector<uint8_t> left;
+        std::vector<uint8_t> right;
+        unsigned int frame_index = 0;
+        while (true)
+        {
+                if (frames_per_second > 0)
+                {
+                        std::this_thread::sleep_until(start + std::chrono::duration<double>(frame_index / frames_per_second));
+                }
+
+                bool sent;
+                if (sequence)
+                {
+                        if (frame_index >= reader.getFrameCount())
+                        {
+                                break;
+                        }
+                        sent = sendFrame(fd, frame_index, reader.getLeftPixels(frame_index), frame_size, reader.getRightPixels(frame_index), frame_size);
+                }
+                else
+                {
+                        if (!readFile(FrameSourcePng::getFilename(footage, "l_", frame_index), left) ||
+                                !readFile(FrameSourcePng::getFilename(footage, "r_", frame_index), right))
+                        {
+                                break;
+                        }
+                        sent = sendFrame(fd, frame_index, left.data(), left.size(), right.data(), right.size());
+                }
+
+                if (!sent)
+                {
+                        std::cerr << "Receiver closed the stream after " << frame_index << " frames" << std::endl;
+                        break;
+                }
+                frame_index++;
+        }
+
+        std::cerr << "Replayed " << frame_index << " frames to " << address << std::endl;
+        if (fd > STDERR_FILENO)
+        {
+                close(fd);
+        }
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "memory_planner.hpp"
+#include "mesh_extractor.hpp"
+#include "segment_stitcher.hpp"
+#include "volume_snapshot.hpp"
+
+namespace
+{
+        size_t getSlotIndex(const int dimensions[3], int x, int y, int z)
+        {
+                // Wraps world voxel coordinates into the cyclic buffer, as Algorithm::getVoxelIndex
+                size_t slot_x = ((x % dimensions[0]) + dimensions[0]) % dimensions[0];
+                size_t slot_y = ((y % dimensions[1]) + dimensions[1]) % dimensions[1];
+                size_t slot_z = ((z % dimensions[2]) + dimensions[2]) % dimensions[2];
+                return (slot_z * dimensions[1] + slot_y) * dimensions[0] + slot_x;
+        }
+}
+
+SegmentStitcher::SegmentStitcher()
+{
+        m_thread_count = std::max(1u, std::thread::hardware_concurrency());
+}
+
+std::vector<SegmentStitcher::Segment> SegmentStitcher::split(unsigned int frame_count, unsigned int segment_length, unsigned int overlap)
+{
+        // A segment starts every segment_length frames and runs overlap frames into the next
+        std::vector<Segment> segments;
+        segment_length = std::max(segment_length, 1u);
+        for (unsigned int first_frame = 0; first_frame < frame_count; first_frame += segment_length)
+        {
+                // A tail no longer than the overlap is already covered by the previous segment
+                if (!segments.empty() && frame_count - first_frame <= overlap)
+                {
+                        break;
+                }
+
+                Segment segment;
+                segment.first_frame = first_frame;
+                segment.frame_count = std::min(segment_length + overlap, frame_count - first_frame);
+                segments.push_back(segment);
+        }
+        return segments;
+}
+
+bool SegmentStitcher::stitch(const std::vector<Segment>& segments, std::string snapshot_filename, std::string mesh_filename)
+{
+        if (segments.empty())
+        {
+                return false;
+        }
+
+        // Places every segment in the frame of the first, through the chain of its neighbours
+        std::vector<Pose> offsets(1, toPose(Util::Transformation()));
+        for (unsigned int i = 1; i < segments.size(); i++)
+        {
+                offsets.push_back(compose(offsets[i - 1], align(segments[i - 1], segments[i])));
+        }
+
+        // Sizes the global volume to the union of the segment volumes, from their headers alone
+        int minimum[3] = { INT32_MAX, INT32_MAX, INT32_MAX };
+        int maximum[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+        uint64_t largest_segment_bytes = 0;
+        for (unsigned int i = 0; i < segments.size(); i++)
+        {
+                SegmentVolume volume;
+                if (!loadVolume(segments[i].snapshot_filename, true, volume))
+                {
+                        return false;
+                }
+                if (i == 0)
+                {
+                        m_voxel_size = volume.voxel_size;
+                }
+                findBounds(volume, offsets[i], minimum, maximum);
+                largest_segment_bytes = std::max(largest_segment_bytes,
+                        (uint64_t) volume.dimensions[0] * volume.dimensions[1] * volume.dimensions[2] * sizeof(int));
+        }
+
+        // Whole bricks, so the stitched volume can be resumed and streamed like any other
+        uint64_t voxel_count = 1;
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                m_origin[axis] = minimum[axis];
+                m_dimensions[axis] = (maximum[axis] - minimum[axis] + 15) / 16 * 16;
+                voxel_count *= m_dimensions[axis];
+        }
+        uint64_t needed_bytes = voxel_count * (sizeof(int) + sizeof(uint8_t)) + largest_segment_bytes;
+        if (needed_bytes > MemoryPlanner::getPhysicalHostBytes())
+        {
+                std::cerr << "Stitched volume of " << m_dimensions[0] << "x" << m_dimensions[1] << "x" << m_dimensions[2]
+                        << " voxels does not fit in host memory" << std::endl;
+                return false;
+        }
+        m_voxels.assign(voxel_count, 0);
+        m_weights.assign(voxel_count, 0);
+
+        // Only one segment volume is held at a time
+        for (unsigned int i = 0; i < segments.size(); i++)
+        {
+                SegmentVolume volume;
+                if (!loadVolume(segments[i].snapshot_filename, false, volume))
+                {
+                        return false;
+                }
+                mergeVolume(volume, offsets[i]);
+        }
+
+        // The camera is left where the last segment ended, so the volume can be resumed from there
+        Util::Transformation camera_pose = Util::Transformation();
+        if (!segments.back().camera_poses.empty())
+        {
+                camera_pose = toTransformation(compose(offsets.back(), toPose(segments.back().camera_poses.back())));
+        }
+
+        SnapshotWriter writer;
+        if (!writer.open(snapshot_filename, m_dimensions, m_voxel_size, m_origin, camera_pose))
+        {
+                return false;
+        }
+        size_t slice_voxel_count = (size_t) m_dimensions[0] * m_dimensions[1];
+        unsigned int slices_per_chunk = Snapshot::getSlicesPerChunk(slice_voxel_count);
+        for (unsigned int first_slice = 0; first_slice < (unsigned int) m_dimensions[2]; first_slice += slices_per_chunk)
+        {
+                unsigned int slice_count = std::min(slices_per_chunk, m_dimensions[2] - first_slice);
+                if (!writer.writeChunk(first_slice, slice_count, m_voxels.data() + first_slice * slice_voxel_count))
+                {
+                        std::cerr << "Failed to write volume snapshot " << snapshot_filename << std::endl;
+                        return false;
+                }
+        }
+        if (!writer.close())
+        {
+                return false;
+        }
+        std::cout << "Stitched " << segments.size() << " segments into a volume of " << m_dimensions[0] << "x"
+                << m_dimensions[1] << "x" << m_dimensions[2] << " voxels in " << snapshot_filename << std::endl;
+
+        MeshExtractor mesh_extractor;
+        return mesh_extractor.extract(m_voxels.data(), m_dimensions, m_voxel_size, m_origin, mesh_filename);
+}
+
+SegmentStitcher::Pose SegmentStitcher::toPose(const Util::Transformation& transformation)
+{
+        float rotation[9];
+        Util::getRotationMatrix(transformation.rotation, rotation);
+
+        Pose pose;
+        std::copy(rotation, rotation + 9, pose.rotation);
+        pose.translation[0] = transformation.translation.x;
+        pose.translation[1] = transformation.translation.y;
+        pose.translation[2] = transformation.translation.z;
+        return pose;
+}
+
+Util::Transformation SegmentStitcher::toTransformation(const Pose& pose)
+{
+        // Inverts Rz * Ry * Rx (see Util::getRotationMatrix)
+        const double* r = pose.rotation;
+        Util::Transformation transformation;
+        transformation.rotation.x = std::atan2(r[7], r[8]);
+        transformation.rotation.y = std::asin(std::max(-1.0, std::min(1.0, -r[6])));
+        transformation.rotation.z = std::atan2(r[3], r[0]);
+        transformation.translation.x = pose.translation[0];
+        transformation.translation.y = pose.translation[1];
+        transformation.translation.z = pose.translation[2];
+        return transformation;
+}
+
+SegmentStitcher::Pose SegmentStitcher::compose(const Pose& a, const Pose& b)
+{
+        // a after b
+        Pose pose;
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                for (unsigned int column = 0; column < 3; column++)
+                {
+                        pose.rotation[row * 3 + column] = a.rotation[row * 3] * b.rotation[column] +
+                                a.rotation[row * 3 + 1] * b.rotation[3 + column] + a.rotation[row * 3 + 2] * b.rotation[6 + column];
+                }
+        }
+        apply(a, b.translation, pose.translation);
+        return pose;
+}
+
+SegmentStitcher::Pose SegmentStitcher::invert(const Pose& pose)
+{
+        Pose inverse;
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                for (unsigned int column = 0; column < 3; column++)
+                {
+                        inverse.rotation[row * 3 + column] = pose.rotation[column * 3 + row];
+                }
+        }
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                inverse.translation[row] = -(inverse.rotation[row * 3] * pose.translation[0] +
+                        inverse.rotation[row * 3 + 1] * pose.translation[1] + inverse.rotation[row * 3 + 2] * pose.translation[2]);
+        }
+        return inverse;
+}
+
+void SegmentStitcher::apply(const Pose& pose, const double point[3], double transformed[3])
+{
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                transformed[row] = pose.rotation[row * 3] * point[0] + pose.rotation[row * 3 + 1] * point[1] +
+                        pose.rotation[row * 3 + 2] * point[2] + pose.translation[row];
+        }
+}
+
+SegmentStitcher::Pose SegmentStitcher::align(const Segment& earlier, const Segment& later)
+{
+        // Each shared frame gives the offset from the later segment's frame to the earlier's
+        Pose mean = Pose();
+        unsigned int shared_count = 0;
+        unsigned int shared_end = std::min(earlier.first_frame + (unsigned int) earlier.camera_poses.size(),
+                later.first_frame + (unsigned int) later.camera_poses.size());
+        for (unsigned int frame = std::max(earlier.first_frame, later.first_frame); frame < shared_end; frame++)
+        {
+                Pose earlier_pose = toPose(earlier.camera_poses[frame - earlier.first_frame]);
+                Pose later_pose = toPose(later.camera_poses[frame - later.first_frame]);
+                Pose offset = compose(earlier_pose, invert(later_pose));
+                for (unsigned int i = 0; i < 9; i++)
+                {
+                        mean.rotation[i] += offset.rotation[i];
+                }
+                for (unsigned int i = 0; i < 3; i++)
+                {
+                        mean.translation[i] += offset.translation[i];
+                }
+                shared_count++;
+        }
+
+        if (shared_count == 0)
+        {
+                std::cerr << "Segments at frames " << earlier.first_frame << " and " << later.first_frame
+                        << " share no tracked frames, placing them at the same origin" << std::endl;
+                return toPose(Util::Transformation());
+        }
+        for (unsigned int i = 0; i < 3; i++)
+        {
+                mean.translation[i] /= shared_count;
+        }
+
+        // The mean of rotations is no longer a rotation, the nearest one is recovered by
+        // orthonormalising its rows (the offsets of neighbouring frames barely differ)
+        double* rows = mean.rotation;
+        for (unsigned int row = 0; row < 3; row++)
+        {
+                for (unsigned int previous = 0; previous < row; previous++)
+                {
+                        double dot = rows[row * 3] * rows[previous * 3] + rows[row * 3 + 1] * rows[previous * 3 + 1] +
+                                rows[row * 3 + 2] * rows[previous * 3 + 2];
+                        for (unsigned int column = 0; column < 3; column++)
+                        {
+                                rows[row * 3 + column] -= dot * rows[previous * 3 + column];
+                        }
+                }
+                double length = std::sqrt(rows[row * 3] * rows[row * 3] + rows[row * 3 + 1] * rows[row * 3 + 1] +
+                        rows[row * 3 + 2] * rows[row * 3 + 2]);
+                for (unsigned int column = 0; column < 3; column++)
+                {
+                        rows[row * 3 + column] /= length;
+                }
+        }
+        return mean;
+}
+
+bool SegmentStitcher::loadVolume(std::string filename, bool header_only, SegmentVolume& volume)
+{
+        SnapshotReader reader;
+        if (!reader.open(filename))
+        {
+                return false;
+        }
+        reader.getDimensions(volume.dimensions);
+        reader.getOrigin(volume.origin);
+        volume.voxel_size = reader.getVoxelSize();
+        if (header_only)
+        {
+                return true;
+        }
+
+        size_t slice_voxel_count = (size_t) volume.dimensions[0] * volume.dimensions[1];
+        volume.voxels.assign(slice_voxel_count * volume.dimensions[2], 0);
+        unsigned int first_slice;
+        unsigned int slice_count;
+        std::vector<int> chunk;
+        while (reader.readChunk(&first_slice, &slice_count, chunk))
+        {
+                std::copy(chunk.begin(), chunk.end(), volume.voxels.begin() + first_slice * slice_voxel_count);
+        }
+        if (!reader.isFinished())
+        {
+                std::cerr << "Volume snapshot " << filename << " is truncated" << std::endl;
+                return false;
+        }
+        return true;
+}
+
+void SegmentStitcher::findBounds(const SegmentVolume& volume, const Pose& offset, int minimum[3], int maximum[3])
+{
+        // Corners of the segment volume in global voxels. Voxel y and z run opposite to the world axes.
+        for (unsigned int corner = 0; corner < 8; corner++)
+        {
+                double point[3];
+                for (unsigned int axis = 0; axis < 3; axis++)
+                {
+                        int voxel = volume.origin[axis] + ((corner >> axis) & 1) * volume.dimensions[axis];
+                        point[axis] = (axis == 0 ? 1 : -1) * voxel * (double) volume.voxel_size;
+                }
+
+                double global[3];
+                apply(offset, point, global);
+                for (unsigned int axis = 0; axis < 3; axis++)
+                {
+                        double voxel = (axis == 0 ? 1 : -1) * global[axis] / m_voxel_size;
+                        minimum[axis] = std::min(minimum[axis], (int) std::floor(voxel));
+                        maximum[axis] = std::max(maximum[axis], (int) std::ceil(voxel));
+                }
+        }
+}
+
+void SegmentStitcher::mergeVolume(const SegmentVolume& volume, const Pose& offset)
+{
+        // Only the global voxels the segment can reach are visited
+        int minimum[3] = { INT32_MAX, INT32_MAX, INT32_MAX };
+        int maximum[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+        findBounds(volume, offset, minimum, maximum);
+        for (unsigned int axis = 0; axis < 3; axis++)
+        {
+                minimum[axis] = std::max(minimum[axis], m_origin[axis]);
+                maximum[axis] = std::min(maximum[axis], m_origin[axis] + m_dimensions[axis]);
+        }
+
+        // Each global voxel samples the segment voxel under its centre, slices are merged in parallel
+        Pose inverse = invert(offset);
+        parallelFor(minimum[2], maximum[2], [&](int z)
+        {
+                for (int y = minimum[1]; y < maximum[1]; y++)
+                {
+                        for (int x = minimum[0]; x < maximum[0]; x++)
+                        {
+                                double point[3] = { (x + 0.5) * m_voxel_size, -(y + 0.5) * m_voxel_size, -(z + 0.5) * m_voxel_size };
+                                double local[3];
+                                apply(inverse, point, local);
+
+                                int voxel[3];
+                                bool inside = true;
+                                for (unsigned int axis = 0; axis < 3; axis++)
+                                {
+                                        voxel[axis] = (int) std::floor((axis == 0 ? 1 : -1) * local[axis] / volume.voxel_size);
+                                        inside = inside && voxel[axis] >= volume.origin[axis] &&
+                                                voxel[axis] < volume.origin[axis] + volume.dimensions[axis];
+                                }
+                                if (!inside)
+                                {
+                                        continue;
+                                }
+                                int value = volume.voxels[getSlotIndex(volume.dimensions, voxel[0], voxel[1], voxel[2])];
+                                if (value == 0)
+                                {
+                                        continue;
+                                }
+
+                                // Running mean of the segments that saw the voxel occupied
+                                size_t index = getSlotIndex(m_dimensions, x, y, z);
+                                uint8_t weight = m_weights[index];
+                                m_voxels[index] = ((int64_t) m_voxels[index] * weight + value) / (weight + 1);
+                                m_weights[index] = std::min(weight + 1, 255);
+                        }
+                }
+        });
+}
+
+void SegmentStitcher::parallelFor(int begin, int end, std::function<void(int)> function)
+{
+        // Hands out indices one at a time, slices vary in how much of them a segment covers
+        std::atomic<int> next(begin);
+        std::vector<std::thread> threads;
+        for (unsigned int thread = 0; thread < m_thread_count; thread++)
+        {
+                threads.push_back(std::thread([&next, end, &function]()
+                {
+                        for (int i = next++; i < end; i = next++)
+                        {
+                                function(i);
+                        }
+                }));
+        }
+
+        for (std::thread& thread : threads)
+        {
+                thread.join();
+        }
+}
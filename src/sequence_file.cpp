@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sequence_file.hpp"
+
+namespace
+{
+        // Whether [offset, offset + size) lies within the file, without offset + size wrapping
+        bool isInside(uint64_t offset, uint64_t size, uint64_t file_size)
+        {
+                return offset <= file_size && size <= file_size - offset;
+        }
+}
+
+namespace Sequence
+{
+        unsigned int getBytesPerPixel(uint32_t pixel_format)
+        {
+                switch (pixel_format)
+                {
+                        case RGBA8:
+                                return 4;
+                        case LUMA8:
+                                return 1;
+                        default:
+                                return 0;
+                }
+        }
+}
+
+SequenceWriter::SequenceWriter()
+{
+        memset(&m_header, 0, sizeof(m_header));
+}
+
+SequenceWriter::~SequenceWriter()
+{
+        if (m_stream.is_open())
+        {
+                close();
+        }
+}
+
+bool SequenceWriter::open(std::string filename, unsigned int width, unsigned int height, uint32_t pixel_format, const Util::CameraConfig& camera_config)
+{
+        if (Sequence::getBytesPerPixel(pixel_format) == 0)
+        {
+                std::cerr << "Unknown sequence pixel format " << pixel_format << std::endl;
+                return false;
+        }
+
+        m_stream.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_stream.good())
+        {
+                std::cerr << "Could not open " << filename << " for writing" << std::endl;
+                return false;
+        }
+
+        memcpy(m_header.magic, Sequence::MAGIC, sizeof(m_header.magic));
+        m_header.version = Sequence::VERSION;
+        m_header.width = width;
+        m_header.height = height;
+        m_header.pixel_format = pixel_format;
+        m_header.frame_count = 0;
+        m_header.baseline = camera_config.baseline;
+        m_header.focal_length = camera_config.focal_length;
+        m_header.principal_point_x = camera_config.principal_point_x;
+        m_header.principal_point_y = camera_config.principal_point_y;
+        m_header.scale_x = camera_config.scale_x;
+        m_header.scale_y = camera_config.scale_y;
+        m_header.skew_coeff = camera_config.skew_coeff;
+        m_header.index_offset = 0;
+        m_index.clear();
+
+        // Placeholder header, rewritten once the frame index is known
+        m_stream.write((const char*) &m_header, sizeof(m_header));
+        return m_stream.good();
+}
+
+bool SequenceWriter::appendFrame(const void* left, const void* right)
+{
+        Sequence::FrameEntry entry;
+        entry.size_in_bytes = m_header.width * m_header.height * Sequence::getBytesPerPixel(m_header.pixel_format);
+        entry.compression = Sequence::NONE;
+
+        if (!writeAligned(left, entry.size_in_bytes, &entry.left_offset) ||
+                !writeAligned(right, entry.size_in_bytes, &entry.right_offset))
+        {
+                std::cerr << "Failed to write frame " << m_index.size() << std::endl;
+                return false;
+        }
+
+        m_index.push_back(entry);
+        return true;
+}
+
+bool SequenceWriter::close()
+{
+        // Appends the frame index after the frame data
+        uint64_t index_offset;
+        size_t index_size = m_index.size() * sizeof(Sequence::FrameEntry);
+        if (!writeAligned(m_index.data(), index_size, &index_offset))
+        {
+                m_stream.close();
+                return false;
+        }
+
+        // Finalises the header
+        m_header.frame_count = m_index.size();
+        m_header.index_offset = index_offset;
+        m_stream.seekp(0);
+        m_stream.write((const char*) &m_header, sizeof(m_header));
+
+        bool success = m_stream.good();
+        m_stream.close();
+        return success;
+}
+
+bool SequenceWriter::writeAligned(const void* data, size_t size_in_bytes, uint64_t* offset)
+{
+        // Pads the stream so mapped pointers are suitably aligned for uploading
+        uint64_t position = m_stream.tellp();
+        uint64_t padding = (Sequence::ALIGNMENT - position % Sequence::ALIGNMENT) % Sequence::ALIGNMENT;
+        const char zeros[Sequence::ALIGNMENT] = { 0 };
+        m_stream.write(zeros, padding);
+
+        *offset = position + padding;
+        m_stream.write((const char*) data, size_in_bytes);
+        return m_stream.good();
+}
+
+SequenceReader::SequenceReader()
+{
+        // Default empty constructor
+}
+
+SequenceReader::~SequenceReader()
+{
+        close();
+}
+
+bool SequenceReader::open(std::string filename)
+{
+        close();
+
+        int file_descriptor = ::open(filename.c_str(), O_RDONLY);
+        if (file_descriptor == -1)
+        {
+                std::cerr << "Could not open sequence " << filename << std::endl;
+                return false;
+        }
+
+        struct stat file_stat;
+        if (fstat(file_descriptor, &file_stat) == -1 || (size_t) file_stat.st_size < sizeof(Sequence::Header))
+        {
+                std::cerr << "Sequence " << filename << " is too small" << std::endl;
+                ::close(file_descriptor);
+                return false;
+        }
+
+        // Private writable mapping, so consumers may modify frames in place without touching the file
+        m_mapping_size = file_stat.st_size;
+        void* mapping = mmap(NULL, m_mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file_descriptor, 0);
+        ::close(file_descriptor);
+        if (mapping == MAP_FAILED)
+        {
+                std::cerr << "Could not map sequence " << filename << std::endl;
+                m_mapping_size = 0;
+                return false;
+        }
+        m_mapping = (uint8_t*) mapping;
+        m_header = (const Sequence::Header*) m_mapping;
+
+        // Validates the header and the frame index. A frame must fit in the file, which also keeps its
+        // size from wrapping.
+        uint64_t index_size = (uint64_t) m_header->frame_count * sizeof(Sequence::FrameEntry);
+        unsigned int bytes_per_pixel = Sequence::getBytesPerPixel(m_header->pixel_format);
+        if (memcmp(m_header->magic, Sequence::MAGIC, sizeof(Sequence::MAGIC)) != 0 ||
+                m_header->version != Sequence::VERSION || bytes_per_pixel == 0 ||
+                (uint64_t) m_header->width * m_header->height > m_mapping_size / bytes_per_pixel ||
+                !isInside(m_header->index_offset, index_size, m_mapping_size))
+        {
+                std::cerr << "Sequence " << filename << " is invalid or was not finalised" << std::endl;
+                close();
+                return false;
+        }
+        m_index = (const Sequence::FrameEntry*) (m_mapping + m_header->index_offset);
+
+        uint64_t frame_size = (uint64_t) m_header->width * m_header->height * bytes_per_pixel;
+        for (unsigned int i = 0; i < m_header->frame_count; i++)
+        {
+                if (m_index[i].compression != Sequence::NONE || m_index[i].size_in_bytes != frame_size ||
+                        !isInside(m_index[i].left_offset, frame_size, m_mapping_size) ||
+                        !isInside(m_index[i].right_offset, frame_size, m_mapping_size))
+                {
+                        std::cerr << "Sequence " << filename << " has a corrupt entry for frame " << i << std::endl;
+                        close();
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+void SequenceReader::close()
+{
+        if (m_mapping != NULL)
+        {
+                munmap(m_mapping, m_mapping_size);
+        }
+        m_mapping = NULL;
+        m_mapping_size = 0;
+        m_header = NULL;
+        m_index = NULL;
+}
+
+unsigned int SequenceReader::getWidth()
+{
+        return m_header->width;
+}
+
+unsigned int SequenceReader::getHeight()
+{
+        return m_header->height;
+}
+
+unsigned int SequenceReader::getFrameCount()
+{
+        return m_header == NULL ? 0 : m_header->frame_count;
+}
+
+uint32_t SequenceReader::getPixelFormat()
+{
+        return m_header->pixel_format;
+}
+
+Util::CameraConfig SequenceReader::getCameraConfig()
+{
+        Util::CameraConfig camera_config;
+        camera_config.baseline = m_header->baseline;
+        camera_config.focal_length = m_header->focal_length;
+        camera_config.principal_point_x = m_header->principal_point_x;
+        camera_config.principal_point_y = m_header->principal_point_y;
+        camera_config.scale_x = m_header->scale_x;
+        camera_config.scale_y = m_header->scale_y;
+        camera_config.skew_coeff = m_header->skew_coeff;
+        return camera_config;
+}
+
+uint32_t* SequenceReader::getLeftPixels(unsigned int frame_index)
+{
+        if (frame_index >= getFrameCount())
+        {
+                return NULL;
+        }
+        return (uint32_t*) (m_mapping + m_index[frame_index].left_offset);
+}
+
+uint32_t* SequenceReader::getRightPixels(unsigned int frame_index)
+{
+        if (frame_index >= getFrameCount())
+        {
+                return NULL;
+        }
+        return (uint32_t*) (m_mapping + m_index[frame_index].right_offset);
+}
+
+void SequenceReader::prefetch(unsigned int frame_index)
+{
+        // Asks the kernel to start paging in a frame ahead of its use
+        if (frame_index >= getFrameCount())
+        {
+                return;
+        }
+
+        const Sequence::FrameEntry& entry = m_index[frame_index];
+        uint64_t page_size = sysconf(_SC_PAGESIZE);
+        uint64_t start = std::min(entry.left_offset, entry.right_offset) / page_size * page_size;
+        uint64_t end = std::max(entry.left_offset, entry.right_offset) + entry.size_in_bytes;
+        madvise(m_mapping + start, end - start, MADV_WILLNEED);
+}
@@ -0,0 +1,171 @@
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "stereo_calibration.hpp"
+
+namespace
+{
+        bool readValues(std::istringstream& line, double* values, unsigned int count)
+        {
+                for (unsigned int i = 0; i < count; i++)
+                {
+                        if (!(line >> values[i]))
+                        {
+                                return false;
+                        }
+                }
+                return true;
+        }
+}
+
+bool StereoCalibration::load(std::string filename)
+{
+        std::ifstream stream(filename.c_str());
+        if (!stream.good())
+        {
+                std::cerr << "Could not open calibration " << filename << std::endl;
+                return false;
+        }
+
+        // Every value must be given, distortion and rotation default to none
+        bool has_size = false;
+        bool has_intrinsics[2] = { false, false };
+        bool has_rectified = false;
+        bool has_baseline = false;
+
+        std::string text;
+        unsigned int line_number = 0;
+        while (std::getline(stream, text))
+        {
+                line_number++;
+                std::istringstream line(text);
+                std::string key;
+                if (!(line >> key) || key[0] == '#')
+                {
+                        continue;
+                }
+
+                // Keys for either camera are prefixed with its side
+                Side side = key.compare(0, 6, "right_") == 0 ? RIGHT : LEFT;
+                bool valid = true;
+                if (key == "size")
+                {
+                        valid = static_cast<bool>(line >> m_width >> m_height);
+                        has_size = true;
+                }
+                else if (key == "left_intrinsics" || key == "right_intrinsics")
+                {
+                        valid = readValues(line, m_cameras[side].intrinsics, 4);
+                        has_intrinsics[side] = true;
+                }
+                else if (key == "left_distortion" || key == "right_distortion")
+                {
+                        valid = readValues(line, m_cameras[side].distortion, 5);
+                }
+                else if (key == "left_rotation" || key == "right_rotation")
+                {
+                        valid = readValues(line, m_cameras[side].rotation, 9);
+                }
+                else if (key == "rectified")
+                {
+                        valid = readValues(line, m_rectified, 4);
+                        has_rectified = true;
+                }
+                else if (key == "baseline")
+                {
+                        valid = readValues(line, &m_baseline, 1);
+                        has_baseline = true;
+                }
+                else
+                {
+                        std::cerr << filename << ":" << line_number << ": Unknown calibration key " << key << std::endl;
+                        return false;
+                }
+
+                if (!valid)
+                {
+                        std::cerr << filename << ":" << line_number << ": Expected more values for " << key << std::endl;
+                        return false;
+                }
+        }
+
+        if (!has_size || !has_intrinsics[LEFT] || !has_intrinsics[RIGHT] || !has_rectified || !has_baseline)
+        {
+                std::cerr << "Calibration " << filename << " needs the size, both intrinsics, the rectified projection and the baseline" << std::endl;
+                return false;
+        }
+        if (m_width == 0 || m_height == 0 || m_width > MAX_REMAP_WIDTH || m_height > MAX_REMAP_WIDTH)
+        {
+                std::cerr << "Calibration " << filename << " must be for frames between 1 and " << MAX_REMAP_WIDTH << " pixels on each side" << std::endl;
+                return false;
+        }
+        return true;
+}
+
+void StereoCalibration::buildRemapTable(Side side, std::vector<uint32_t>& table) const
+{
+        const Camera& camera = m_cameras[side];
+        const double* r = camera.rotation;
+        const double* k = camera.distortion;
+        double scale = 1 << REMAP_FRACTION_BITS;
+
+        table.resize((size_t) m_width * m_height);
+        for (unsigned int v = 0; v < m_height; v++)
+        {
+                for (unsigned int u = 0; u < m_width; u++)
+                {
+                        // Ray through the rectified pixel, rotated back into the raw camera by the transpose
+                        double x = (u - m_rectified[2]) / m_rectified[0];
+                        double y = (v - m_rectified[3]) / m_rectified[1];
+                        double camera_x = r[0] * x + r[3] * y + r[6];
+                        double camera_y = r[1] * x + r[4] * y + r[7];
+                        double camera_z = r[2] * x + r[5] * y + r[8];
+                        x = camera_x / camera_z;
+                        y = camera_y / camera_z;
+
+                        // Brown-Conrady lens distortion, in OpenCV's coefficient order
+                        double r2 = x * x + y * y;
+                        double radial = 1 + r2 * (k[0] + r2 * (k[1] + r2 * k[4]));
+                        double distorted_x = x * radial + 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+                        double distorted_y = y * radial + k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+                        double source_x = camera.intrinsics[0] * distorted_x + camera.intrinsics[2];
+                        double source_y = camera.intrinsics[1] * distorted_y + camera.intrinsics[3];
+
+                        uint32_t& entry = table[(size_t) v * m_width + u];
+                        if (camera_z <= 0 || !(source_x >= 0 && source_x <= m_width - 1 && source_y >= 0 && source_y <= m_height - 1))
+                        {
+                                entry = INVALID_REMAP;
+                                continue;
+                        }
+                        uint32_t fixed_x = std::lround(source_x * scale);
+                        uint32_t fixed_y = std::lround(source_y * scale);
+                        entry = fixed_y << 16 | fixed_x;
+                }
+        }
+}
+
+unsigned int StereoCalibration::getWidth() const
+{
+        return m_width;
+}
+
+unsigned int StereoCalibration::getHeight() const
+{
+        return m_height;
+}
+
+Util::CameraConfig StereoCalibration::getCameraConfig() const
+{
+        // Depth is recovered in the rectified cameras
+        Util::CameraConfig camera_config;
+        camera_config.baseline = std::lround(m_baseline);
+        camera_config.focal_length = std::lround(m_rectified[0]);
+        camera_config.principal_point_x = std::lround(m_rectified[2]);
+        camera_config.principal_point_y = std::lround(m_rectified[3]);
+        camera_config.scale_x = 1;
+        camera_config.scale_y = 1;
+        camera_config.skew_coeff = 0;
+        return camera_config;
+}
@@ -0,0 +1,256 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "stream_protocol.hpp"
+
+namespace
+{
+        const std::string PIPE_PREFIX = "pipe:";
+        const std::string TCP_PREFIX = "tcp://";
+        const std::string UNIX_PREFIX = "unix:";
+
+        bool startsWith(const std::string& text, const std::string& prefix)
+        {
+                return text.compare(0, prefix.size(), prefix) == 0;
+        }
+
+        // Splits "host:port", an empty host means any interface when listening
+        bool splitHostPort(std::string address, std::string* host, std::string* port)
+        {
+                size_t colon = address.rfind(':');
+                if (colon == std::string::npos)
+                {
+                        return false;
+                }
+                *host = address.substr(0, colon);
+                *port = address.substr(colon + 1);
+                return !port->empty();
+        }
+
+        int openTcp(std::string address, bool listening)
+        {
+                std::string host;
+                std::string port;
+                if (!splitHostPort(address, &host, &port))
+                {
+                        std::cerr << "Expected tcp://<host>:<port>, got tcp://" << address << std::endl;
+                        return -1;
+                }
+
+                struct addrinfo hints;
+                memset(&hints, 0, sizeof(hints));
+                hints.ai_family = AF_UNSPEC;
+                hints.ai_socktype = SOCK_STREAM;
+                hints.ai_flags = listening ? AI_PASSIVE : 0;
+                struct addrinfo* addresses = NULL;
+                if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &addresses) != 0)
+                {
+                        std::cerr << "Could not resolve " << address << std::endl;
+                        return -1;
+                }
+
+                int fd = -1;
+                for (struct addrinfo* candidate = addresses; candidate != NULL && fd < 0; candidate = candidate->ai_next)
+                {
+                        fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+                        if (fd < 0)
+                        {
+                                continue;
+                        }
+
+                        int reuse = 1;
+                        bool ready = listening ?
+                                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == 0 &&
+                                bind(fd, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(fd, 1) == 0 :
+                                connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0;
+                        if (!ready)
+                        {
+                                ::close(fd);
+                                fd = -1;
+                        }
+                }
+                freeaddrinfo(addresses);
+                return fd;
+        }
+
+        int openUnix(std::string path, bool listening)
+        {
+                struct sockaddr_un socket_address;
+                memset(&socket_address, 0, sizeof(socket_address));
+                socket_address.sun_family = AF_UNIX;
+                if (path.size() >= sizeof(socket_address.sun_path))
+                {
+                        std::cerr << "Socket path " << path << " is too long" << std::endl;
+                        return -1;
+                }
+                strncpy(socket_address.sun_path, path.c_str(), sizeof(socket_address.sun_path) - 1);
+
+                int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (fd < 0)
+                {
+                        return -1;
+                }
+
+                // A socket file left behind by an earlier sender is replaced
+                if (listening)
+                {
+                        unlink(path.c_str());
+                }
+                bool ready = listening ?
+                        bind(fd, (struct sockaddr*) &socket_address, sizeof(socket_address)) == 0 && listen(fd, 1) == 0 :
+                        connect(fd, (struct sockaddr*) &socket_address, sizeof(socket_address)) == 0;
+                if (!ready)
+                {
+                        ::close(fd);
+                        return -1;
+                }
+                return fd;
+        }
+
+        // Waits for the reconstructor to connect to a listening socket
+        int acceptOne(int listening_fd)
+        {
+                if (listening_fd < 0)
+                {
+                        return -1;
+                }
+
+                int fd = accept(listening_fd, NULL, NULL);
+                ::close(listening_fd);
+                return fd;
+        }
+}
+
+namespace Stream
+{
+        bool isAddress(std::string address)
+        {
+                return address == "-" || startsWith(address, PIPE_PREFIX) || startsWith(address, TCP_PREFIX) || startsWith(address, UNIX_PREFIX);
+        }
+
+        int openInput(std::string address)
+        {
+                int fd = -1;
+                if (address == "-")
+                {
+                        fd = STDIN_FILENO;
+                }
+                else if (startsWith(address, PIPE_PREFIX))
+                {
+                        fd = open(address.substr(PIPE_PREFIX.size()).c_str(), O_RDONLY);
+                }
+                else if (startsWith(address, TCP_PREFIX))
+                {
+                        fd = openTcp(address.substr(TCP_PREFIX.size()), false);
+                }
+                else if (startsWith(address, UNIX_PREFIX))
+                {
+                        fd = openUnix(address.substr(UNIX_PREFIX.size()), false);
+                }
+
+                if (fd < 0)
+                {
+                        std::cerr << "Could not open stream " << address << ": " << strerror(errno) << std::endl;
+                }
+                return fd;
+        }
+
+        int openOutput(std::string address)
+        {
+                int fd = -1;
+                if (address == "-")
+                {
+                        fd = STDOUT_FILENO;
+                }
+                else if (startsWith(address, PIPE_PREFIX))
+                {
+                        fd = open(address.substr(PIPE_PREFIX.size()).c_str(), O_WRONLY);
+                }
+                else if (startsWith(address, TCP_PREFIX))
+                {
+                        fd = acceptOne(openTcp(address.substr(TCP_PREFIX.size()), true));
+                }
+                else if (startsWith(address, UNIX_PREFIX))
+                {
+                        fd = acceptOne(openUnix(address.substr(UNIX_PREFIX.size()), true));
+                }
+
+                if (fd < 0)
+                {
+                        std::cerr << "Could not open stream " << address << ": " << strerror(errno) << std::endl;
+                }
+                return fd;
+        }
+
+        bool readFully(int fd, void* data, size_t size_in_bytes, const std::atomic<bool>* cancelled)
+        {
+                uint8_t* bytes = (uint8_t*) data;
+                while (size_in_bytes > 0)
+                {
+                        // Wakes up periodically so a blocked reader can be cancelled
+                        struct pollfd poll_fd = { fd, POLLIN, 0 };
+                        int ready = poll(&poll_fd, 1, 100);
+                        if (cancelled != NULL && *cancelled)
+                        {
+                                return false;
+                        }
+                        if (ready == 0 || (ready < 0 && errno == EINTR))
+                        {
+                                continue;
+                        }
+
+                        ssize_t count = read(fd, bytes, size_in_bytes);
+                        if (count < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if (count <= 0)
+                        {
+                                return false;
+                        }
+                        bytes += count;
+                        size_in_bytes -= count;
+                }
+                return true;
+        }
+
+        bool writeFully(int fd, const void* data, size_t size_in_bytes)
+        {
+                const uint8_t* bytes = (const uint8_t*) data;
+                while (size_in_bytes > 0)
+                {
+                        ssize_t count = write(fd, bytes, size_in_bytes);
+                        if (count < 0 && errno == EINTR)
+                        {
+                                continue;
+                        }
+                        if (count <= 0)
+                        {
+                                return false;
+                        }
+                        bytes += count;
+                        size_in_bytes -= count;
+                }
+                return true;
+        }
+
+        Util::CameraConfig getCameraConfig(const Header& header)
+        {
+                Util::CameraConfig camera_config;
+                camera_config.baseline = header.baseline;
+                camera_config.focal_length = header.focal_length;
+                camera_config.principal_point_x = header.principal_point_x;
+                camera_config.principal_point_y = header.principal_point_y;
+                camera_config.scale_x = header.scale_x;
+                camera_config.scale_y = header.scale_y;
+                camera_config.skew_coeff = header.skew_coeff;
+                return camera_config;
+        }
+}
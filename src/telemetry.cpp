@@ -0,0 +1,234 @@
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "telemetry.hpp"
+
+namespace
+{
+        const char* STAGE_NAMES[Telemetry::STAGE_COUNT] = { "Disparity", "Depth", "Tracking", "Fusion", "Render" };
+        const std::string UNIX_PREFIX = "unix:";
+
+        // JSON has no infinities or NaNs, a value that is not finite is written as null
+        std::string formatNumber(double value)
+        {
+                if (!std::isfinite(value))
+                {
+                        return "null";
+                }
+                std::ostringstream number;
+                number << value;
+                return number.str();
+        }
+}
+
+Telemetry::Telemetry() : m_records(CAPACITY)
+{
+        m_start = std::chrono::steady_clock::now();
+}
+
+Telemetry::~Telemetry()
+{
+        if (m_exporter.joinable())
+        {
+                {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_stopping = true;
+                }
+                m_condition.notify_one();
+                m_exporter.join();
+        }
+
+        for (int monitor : m_monitors)
+        {
+                close(monitor);
+        }
+        if (m_listener >= 0)
+        {
+                close(m_listener);
+                unlink(m_socket_path.c_str());
+        }
+}
+
+bool Telemetry::open(std::string destination)
+{
+        if (destination.compare(0, UNIX_PREFIX.size(), UNIX_PREFIX) == 0)
+        {
+                // Monitors connect whenever they like, accepted without blocking at each flush
+                m_socket_path = destination.substr(UNIX_PREFIX.size());
+                struct sockaddr_un address;
+                memset(&address, 0, sizeof(address));
+                address.sun_family = AF_UNIX;
+                if (m_socket_path.size() >= sizeof(address.sun_path))
+                {
+                        std::cerr << "Telemetry socket path " << m_socket_path << " is too long" << std::endl;
+                        return false;
+                }
+                strncpy(address.sun_path, m_socket_path.c_str(), sizeof(address.sun_path) - 1);
+                unlink(m_socket_path.c_str());
+
+                m_listener = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (m_listener < 0 || bind(m_listener, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(m_listener, 4) != 0)
+                {
+                        std::cerr << "Could not listen for telemetry monitors on " << m_socket_path << ": " << strerror(errno) << std::endl;
+                        return false;
+                }
+                fcntl(m_listener, F_SETFL, fcntl(m_listener, F_GETFL) | O_NONBLOCK);
+        }
+        else
+        {
+                m_file.open(destination.c_str(), std::ios::app);
+                if (!m_file.good())
+                {
+                        std::cerr << "Could not open telemetry file " << destination << std::endl;
+                        return false;
+                }
+        }
+
+        m_exporter = std::thread(&Telemetry::exportRecords, this);
+        std::cout << "Exporting telemetry to " << destination << std::endl;
+        return true;
+}
+
+void Telemetry::record(const Record& record)
+{
+        // Only the reconstruction thread records, the slot is published by advancing the head
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == CAPACITY)
+        {
+                m_dropped_records++;
+                return;
+        }
+        m_records[head % CAPACITY] = record;
+        m_records[head % CAPACITY].timestamp_ms =
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+        m_head.store(head + 1, std::memory_order_release);
+}
+
+int Telemetry::findStage(const std::string& name)
+{
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+        {
+                if (name == STAGE_NAMES[stage])
+                {
+                        return stage;
+                }
+        }
+        return -1;
+}
+
+bool Telemetry::pop(Record& record)
+{
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire))
+        {
+                return false;
+        }
+        record = m_records[tail % CAPACITY];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+}
+
+void Telemetry::exportRecords()
+{
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_stopping)
+        {
+                m_condition.wait_for(lock, std::chrono::milliseconds(m_flush_period_ms));
+                flush();
+        }
+
+        // Whatever was recorded since the last flush is written before exiting
+        flush();
+}
+
+void Telemetry::flush()
+{
+        std::string lines;
+        Record record;
+        while (pop(record))
+        {
+                lines += format(record);
+        }
+
+        if (m_file.is_open())
+        {
+                m_file << lines;
+                m_file.flush();
+        }
+        if (m_listener >= 0)
+        {
+                acceptMonitors();
+                send(lines);
+        }
+}
+
+void Telemetry::acceptMonitors()
+{
+        int monitor;
+        while ((monitor = accept(m_listener, NULL, NULL)) >= 0)
+        {
+                m_monitors.push_back(monitor);
+        }
+}
+
+void Telemetry::send(const std::string& lines)
+{
+        // Monitors that disconnect or fall a whole flush behind are dropped
+        for (size_t i = 0; i < m_monitors.size();)
+        {
+                const char* data = lines.data();
+                size_t remaining = lines.size();
+                while (remaining > 0)
+                {
+                        ssize_t sent = ::send(m_monitors[i], data, remaining, MSG_NOSIGNAL | MSG_DONTWAIT);
+                        if (sent <= 0)
+                        {
+                                break;
+                        }
+                        data += sent;
+                        remaining -= sent;
+                }
+
+                if (remaining > 0)
+                {
+                        close(m_monitors[i]);
+                        m_monitors.erase(m_monitors.begin() + i);
+                }
+                else
+                {
+                        i++;
+                }
+        }
+}
+
+std::string Telemetry::format(const Record& record)
+{
+        std::ostringstream line;
+        line << "{\"frame\":" << record.frame_index
+                << ",\"time_ms\":" << formatNumber(record.timestamp_ms)
+                << ",\"frame_ms\":" << formatNumber(record.frame_ms)
+                << ",\"stage_ms\":{";
+        for (int stage = 0; stage < STAGE_COUNT; stage++)
+        {
+                line << (stage == 0 ? "" : ",") << "\"" << STAGE_NAMES[stage] << "\":" << formatNumber(record.stage_ms[stage]);
+        }
+        line << "},\"bytes_uploaded\":" << record.bytes_uploaded
+                << ",\"bytes_downloaded\":" << record.bytes_downloaded
+                << ",\"valid_depth_pixels\":" << record.valid_depth_pixels
+                << ",\"correspondences\":" << record.correspondence_count
+                << ",\"icp_residual_rms\":" << formatNumber(record.icp_residual_rms)
+                << ",\"icp_iterations\":" << record.icp_iterations
+                << ",\"occupied_voxels\":" << record.occupied_voxels
+                << ",\"volume_occupancy\":" << formatNumber(record.volume_occupancy)
+                << ",\"dropped_frames\":" << record.dropped_frames
+                << ",\"dropped_records\":" << m_dropped_records.load()
+                << "}\n";
+        return line.str();
+}
@@ -0,0 +1,31 @@
+#include "triple_buffer.hpp"
+
+unsigned int TripleBuffer::getWriteIndex()
+{
+        return m_write_index;
+}
+
+void TripleBuffer::publish()
+{
+        // Swaps the finished buffer into the middle, taking back whichever buffer was there
+        unsigned int previous = m_middle.exchange(m_write_index | FRESH, std::memory_order_acq_rel);
+        m_write_index = previous & INDEX_MASK;
+}
+
+bool TripleBuffer::acquire()
+{
+        // Only swaps when there is something newer than the buffer being read
+        if ((m_middle.load(std::memory_order_acquire) & FRESH) == 0)
+        {
+                return false;
+        }
+
+        unsigned int previous = m_middle.exchange(m_read_index, std::memory_order_acq_rel);
+        m_read_index = previous & INDEX_MASK;
+        return true;
+}
+
+unsigned int TripleBuffer::getReadIndex()
+{
+        return m_read_index;
+}
@@ -1,4 +1,5 @@
-#include <ctime>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <map>
 
@@ -6,12 +7,34 @@
 
 namespace Util
 {
-        std::map<std::string, std::clock_t> debugTimerStartTicks;
+        // Each pipeline thread times its own stages in wall time, CPU time would count every thread
+        thread_local std::map<std::string, std::chrono::steady_clock::time_point> debugTimerStartTicks;
+
+        void getRotationMatrix(const Vector3D& rotation, float matrix[9])
+        {
+                // Rz * Ry * Rx
+                double cos_x = std::cos(rotation.x);
+                double sin_x = std::sin(rotation.x);
+                double cos_y = std::cos(rotation.y);
+                double sin_y = std::sin(rotation.y);
+                double cos_z = std::cos(rotation.z);
+                double sin_z = std::sin(rotation.z);
+
+                matrix[0] = cos_z * cos_y;
+                matrix[1] = cos_z * sin_y * sin_x - sin_z * cos_x;
+                matrix[2] = cos_z * sin_y * cos_x + sin_z * sin_x;
+                matrix[3] = sin_z * cos_y;
+                matrix[4] = sin_z * sin_y * sin_x + cos_z * cos_x;
+                matrix[5] = sin_z * sin_y * cos_x - cos_z * sin_x;
+                matrix[6] = -sin_y;
+                matrix[7] = cos_y * sin_x;
+                matrix[8] = cos_y * cos_x;
+        }
 
         void startDebugTimer(std::string tag)
         {
                 // Starts a timer
-                debugTimerStartTicks[tag] = std::clock();
+                debugTimerStartTicks[tag] = std::chrono::steady_clock::now();
         }
 
         void endDebugTimer(std::string tag)
@@ -27,10 +50,8 @@ namespace Util
                         else
                         {
                                 // Prints the time taken
-                                std::clock_t timerEndTicks = std::clock();
-                                std::clock_t clockTicksTaken = timerEndTicks - debugTimerStartTicks[tag];
-                                double timeInSeconds = clockTicksTaken / (double) CLOCKS_PER_SEC;
-                                double timeInMillis = timeInSeconds * 1000.0;
+                                std::chrono::steady_clock::time_point timerEndTicks = std::chrono::steady_clock::now();
+                                double timeInMillis = std::chrono::duration<double, std::milli>(timerEndTicks - debugTimerStartTicks[tag]).count();
                                 std::cout << tag << " took " << timeInMillis  << "ms" << std::endl;
 
                                 // Removes the timer from the map
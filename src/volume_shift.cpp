@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#include "volume_shift.hpp"
+
+namespace
+{
+        size_t getVoxelIndex(const Volume& volume, int x, int y, int z)
+        {
+                // Wraps world voxel coordinates into the cyclic buffer, as Algorithm::getVoxelIndex
+                const int* dimensions = volume.dimensions;
+                size_t slot_x = ((x % dimensions[0]) + dimensions[0]) % dimensions[0];
+                size_t slot_y = ((y % dimensions[1]) + dimensions[1]) % dimensions[1];
+                size_t slot_z = ((z % dimensions[2]) + dimensions[2]) % dimensions[2];
+                return (slot_z * dimensions[1] + slot_y) * dimensions[0] + slot_x;
+        }
+
+        void copyBrick(Volume& volume, int brick_x, int brick_y, int brick_z, int* brick, bool to_volume)
+        {
+                // Copies a brick between the volume and a dense brick_width^3 buffer, a row at a time
+                int brick_width = volume.brick_width;
+                for (int z = 0; z < brick_width; z++)
+                {
+                        for (int y = 0; y < brick_width; y++)
+                        {
+                                int* row = volume.voxels + getVoxelIndex(volume, brick_x * brick_width, brick_y * brick_width + y, brick_z * brick_width + z);
+                                int* brick_row = brick + ((size_t) z * brick_width + y) * brick_width;
+                                if (to_volume)
+                                {
+                                        std::copy(brick_row, brick_row + brick_width, row);
+                                }
+                                else
+                                {
+                                        std::copy(row, row + brick_width, brick_row);
+                                }
+                        }
+                }
+        }
+
+        bool isInside(const int first[3], const int bricks_per_axis[3], int bx, int by, int bz)
+        {
+                return bx >= first[0] && bx < first[0] + bricks_per_axis[0] &&
+                        by >= first[1] && by < first[1] + bricks_per_axis[1] &&
+                        bz >= first[2] && bz < first[2] + bricks_per_axis[2];
+        }
+}
+
+namespace VolumeShift
+{
+        bool getOrigin(const Volume& volume, const Util::Transformation& camera_pose, int origin[3])
+        {
+                double camera_voxel[3] = {
+                        camera_pose.translation.x / volume.voxel_size,
+                        -camera_pose.translation.y / volume.voxel_size,
+                        -camera_pose.translation.z / volume.voxel_size
+                };
+                bool shift = false;
+                for (int axis = 0; axis < 3; axis++)
+                {
+                        origin[axis] = (int) std::floor(camera_voxel[axis] / volume.brick_width) * volume.brick_width;
+                        shift = shift || std::abs(origin[axis] - volume.origin[axis]) >= volume.dimensions[axis] / 4;
+                }
+                return shift;
+        }
+
+        void shift(Volume& volume, const int origin[3], BrickStore& brick_store, unsigned int& bricks_out, unsigned int& bricks_in)
+        {
+                // Brick ranges of the old and new regions
+                int brick_width = volume.brick_width;
+                int bricks_per_axis[3];
+                int old_first[3];
+                int new_first[3];
+                for (int axis = 0; axis < 3; axis++)
+                {
+                        bricks_per_axis[axis] = volume.dimensions[axis] / brick_width;
+                        old_first[axis] = volume.origin[axis] / brick_width;
+                        new_first[axis] = origin[axis] / brick_width;
+                }
+
+                // Streams out the bricks leaving the region, their slots are then reused by the bricks entering it
+                std::vector<int> brick((size_t) brick_width * brick_width * brick_width);
+                bricks_out = 0;
+                for (int bz = old_first[2]; bz < old_first[2] + bricks_per_axis[2]; bz++)
+                {
+                        for (int by = old_first[1]; by < old_first[1] + bricks_per_axis[1]; by++)
+                        {
+                                for (int bx = old_first[0]; bx < old_first[0] + bricks_per_axis[0]; bx++)
+                                {
+                                        if (!isInside(new_first, bricks_per_axis, bx, by, bz))
+                                        {
+                                                copyBrick(volume, bx, by, bz, brick.data(), false);
+                                                brick_store.store(bx, by, bz, brick.data());
+                                                bricks_out++;
+                                        }
+                                }
+                        }
+                }
+
+                // Reloads bricks seen before, anything else enters empty
+                bricks_in = 0;
+                for (int bz = new_first[2]; bz < new_first[2] + bricks_per_axis[2]; bz++)
+                {
+                        for (int by = new_first[1]; by < new_first[1] + bricks_per_axis[1]; by++)
+                        {
+                                for (int bx = new_first[0]; bx < new_first[0] + bricks_per_axis[0]; bx++)
+                                {
+                                        if (!isInside(old_first, bricks_per_axis, bx, by, bz))
+                                        {
+                                                if (brick_store.load(bx, by, bz, brick.data()))
+                                                {
+                                                        bricks_in++;
+                                                }
+                                                else
+                                                {
+                                                        std::fill(brick.begin(), brick.end(), 0);
+                                                }
+                                                copyBrick(volume, bx, by, bz, brick.data(), true);
+                                        }
+                                }
+                        }
+                }
+
+                for (int axis = 0; axis < 3; axis++)
+                {
+                        volume.origin[axis] = origin[axis];
+                }
+        }
+};
@@ -0,0 +1,217 @@
+#include <cstring>
+#include <iostream>
+
+#include "volume_snapshot.hpp"
+
+namespace Snapshot
+{
+        unsigned int getSlicesPerChunk(size_t slice_voxel_count)
+        {
+                uint64_t slice_size = (uint64_t) slice_voxel_count * sizeof(int);
+                uint64_t slices = CHUNK_SIZE_IN_BYTES / slice_size;
+                return slices == 0 ? 1 : slices;
+        }
+
+        void encode(const int* voxels, size_t voxel_count, std::vector<int>& encoded)
+        {
+                encoded.clear();
+
+                size_t i = 0;
+                while (i < voxel_count)
+                {
+                        // Counts the empty voxels
+                        size_t zero_run = 0;
+                        while (i < voxel_count && voxels[i] == 0 && zero_run < INT32_MAX)
+                        {
+                                zero_run++;
+                                i++;
+                        }
+
+                        // Collects the following occupied voxels
+                        size_t literal_start = i;
+                        while (i < voxel_count && voxels[i] != 0 && i - literal_start < INT32_MAX)
+                        {
+                                i++;
+                        }
+
+                        encoded.push_back(zero_run);
+                        encoded.push_back(i - literal_start);
+                        encoded.insert(encoded.end(), voxels + literal_start, voxels + i);
+                }
+        }
+
+        bool decode(const std::vector<int>& encoded, int* voxels, size_t voxel_count)
+        {
+                size_t voxel_index = 0;
+                size_t i = 0;
+                while (i + 1 < encoded.size())
+                {
+                        size_t zero_run = (uint32_t) encoded[i];
+                        size_t literal_count = (uint32_t) encoded[i + 1];
+                        i += 2;
+
+                        if (voxel_index + zero_run + literal_count > voxel_count || i + literal_count > encoded.size())
+                        {
+                                return false;
+                        }
+
+                        memset(voxels + voxel_index, 0, zero_run * sizeof(int));
+                        voxel_index += zero_run;
+                        memcpy(voxels + voxel_index, &encoded[i], literal_count * sizeof(int));
+                        voxel_index += literal_count;
+                        i += literal_count;
+                }
+
+                return voxel_index == voxel_count && i == encoded.size();
+        }
+}
+
+bool SnapshotWriter::open(std::string filename, const int dimensions[3], float voxel_size, const int origin[3], const Util::Transformation& camera_pose)
+{
+        m_stream.open(filename.c_str(), std::ios::binary | std::ios::trunc);
+        if (!m_stream.good())
+        {
+                std::cerr << "Could not open " << filename << " for writing" << std::endl;
+                return false;
+        }
+
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(m_header.magic, Snapshot::MAGIC, sizeof(m_header.magic));
+        m_header.version = Snapshot::VERSION;
+        m_header.dimensions[0] = dimensions[0];
+        m_header.dimensions[1] = dimensions[1];
+        m_header.dimensions[2] = dimensions[2];
+        m_header.voxel_size = voxel_size;
+        m_header.bytes_per_voxel = sizeof(int);
+        m_header.origin[0] = origin[0];
+        m_header.origin[1] = origin[1];
+        m_header.origin[2] = origin[2];
+        m_header.translation[0] = camera_pose.translation.x;
+        m_header.translation[1] = camera_pose.translation.y;
+        m_header.translation[2] = camera_pose.translation.z;
+        m_header.rotation[0] = camera_pose.rotation.x;
+        m_header.rotation[1] = camera_pose.rotation.y;
+        m_header.rotation[2] = camera_pose.rotation.z;
+
+        // Placeholder header, the chunk count is filled in on close
+        m_stream.write((const char*) &m_header, sizeof(m_header));
+        return m_stream.good();
+}
+
+bool SnapshotWriter::writeChunk(unsigned int first_slice, unsigned int slice_count, const int* voxels)
+{
+        size_t voxel_count = (size_t) slice_count * m_header.dimensions[0] * m_header.dimensions[1];
+        Snapshot::encode(voxels, voxel_count, m_encoded);
+
+        Snapshot::ChunkHeader chunk_header;
+        chunk_header.first_slice = first_slice;
+        chunk_header.slice_count = slice_count;
+        chunk_header.encoded_size_in_bytes = m_encoded.size() * sizeof(int);
+
+        m_stream.write((const char*) &chunk_header, sizeof(chunk_header));
+        m_stream.write((const char*) m_encoded.data(), chunk_header.encoded_size_in_bytes);
+        m_header.chunk_count++;
+
+        return m_stream.good();
+}
+
+bool SnapshotWriter::close()
+{
+        m_stream.seekp(0);
+        m_stream.write((const char*) &m_header, sizeof(m_header));
+
+        bool success = m_stream.good();
+        m_stream.close();
+        return success;
+}
+
+bool SnapshotReader::open(std::string filename)
+{
+        m_stream.open(filename.c_str(), std::ios::binary);
+        if (!m_stream.good())
+        {
+                std::cerr << "Could not open snapshot " << filename << std::endl;
+                return false;
+        }
+
+        m_stream.read((char*) &m_header, sizeof(m_header));
+        if (!m_stream.good() || memcmp(m_header.magic, Snapshot::MAGIC, sizeof(Snapshot::MAGIC)) != 0 ||
+                m_header.version != Snapshot::VERSION || m_header.bytes_per_voxel != sizeof(int))
+        {
+                std::cerr << "Snapshot " << filename << " is invalid" << std::endl;
+                return false;
+        }
+
+        m_chunks_read = 0;
+        return true;
+}
+
+void SnapshotReader::getDimensions(int dimensions[3])
+{
+        dimensions[0] = m_header.dimensions[0];
+        dimensions[1] = m_header.dimensions[1];
+        dimensions[2] = m_header.dimensions[2];
+}
+
+float SnapshotReader::getVoxelSize()
+{
+        return m_header.voxel_size;
+}
+
+Util::Transformation SnapshotReader::getCameraPose()
+{
+        Util::Transformation camera_pose;
+        camera_pose.translation.x = m_header.translation[0];
+        camera_pose.translation.y = m_header.translation[1];
+        camera_pose.translation.z = m_header.translation[2];
+        camera_pose.rotation.x = m_header.rotation[0];
+        camera_pose.rotation.y = m_header.rotation[1];
+        camera_pose.rotation.z = m_header.rotation[2];
+        return camera_pose;
+}
+
+void SnapshotReader::getOrigin(int origin[3])
+{
+        origin[0] = m_header.origin[0];
+        origin[1] = m_header.origin[1];
+        origin[2] = m_header.origin[2];
+}
+
+bool SnapshotReader::readChunk(unsigned int* first_slice, unsigned int* slice_count, std::vector<int>& voxels)
+{
+        if (m_chunks_read >= m_header.chunk_count)
+        {
+                return false;
+        }
+
+        Snapshot::ChunkHeader chunk_header;
+        m_stream.read((char*) &chunk_header, sizeof(chunk_header));
+        if (!m_stream.good() || chunk_header.first_slice > m_header.dimensions[2] ||
+                chunk_header.slice_count > m_header.dimensions[2] - chunk_header.first_slice ||
+                chunk_header.encoded_size_in_bytes % sizeof(int) != 0)
+        {
+                std::cerr << "Snapshot chunk " << m_chunks_read << " is corrupt" << std::endl;
+                return false;
+        }
+
+        m_encoded.resize(chunk_header.encoded_size_in_bytes / sizeof(int));
+        m_stream.read((char*) m_encoded.data(), chunk_header.encoded_size_in_bytes);
+
+        size_t voxel_count = (size_t) chunk_header.slice_count * m_header.dimensions[0] * m_header.dimensions[1];
+        voxels.resize(voxel_count);
+        if (!m_stream.good() || !Snapshot::decode(m_encoded, voxels.data(), voxel_count))
+        {
+                std::cerr << "Snapshot chunk " << m_chunks_read << " is corrupt" << std::endl;
+                return false;
+        }
+
+        *first_slice = chunk_header.first_slice;
+        *slice_count = chunk_header.slice_count;
+        m_chunks_read++;
+        return true;
+}
+
+bool SnapshotReader::isFinished()
+{
+        return m_chunks_read == m_header.chunk_count;
+}
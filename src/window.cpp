@@ -4,3 +4,10 @@ Window::Window(Image* image, const PixelFormat& pixel_format, std::string title)
 {
         m_image = image;
 }
+
+void Window::setImage(Image* image)
+{
+        // Takes effect on the next refresh
+        m_image = image;
+        m_image_changed = true;
+}
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include <string>
 
@@ -59,11 +60,19 @@ void WindowSdl::createWindow(unsigned int width, unsigned int height, const Pixe
 
 void WindowSdl::refresh()
 {
-        // ?? To do: Is this the way concrete classes created from a factory access extended functionality?
-        SDL_Surface* surface = static_cast<ImageSdl*>(m_image)->getSurface();
-        if (surface != NULL)
+        // Copies a new image straight into the streaming texture, unchanged images are not uploaded again
+        void* texture_pixels;
+        int texture_pitch;
+        if (m_image_changed && m_image != NULL && SDL_LockTexture(m_texture, NULL, &texture_pixels, &texture_pitch) == 0)
         {
-                SDL_UpdateTexture(m_texture, NULL, surface->pixels, surface->pitch);
+                const uint8_t* image_pixels = (const uint8_t*) m_image->getPixels();
+                size_t row_size = m_image->getWidth() * m_image->getBytesPerPixel();
+                for (unsigned int y = 0; y < m_image->getHeight(); y++)
+                {
+                        memcpy((uint8_t*) texture_pixels + y * texture_pitch, image_pixels + y * row_size, row_size);
+                }
+                SDL_UnlockTexture(m_texture);
+                m_image_changed = false;
         }
 
         // Renders using the GPU
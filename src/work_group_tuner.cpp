@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include "work_group_tuner.hpp"
+
+namespace
+{
+        // Timed launches of each candidate, the fastest is kept to filter out interruptions
+        const unsigned int TRIALS_PER_CANDIDATE = 3;
+
+        // Candidate shapes, wide rows suit the row-wise image access of the stencil kernels
+        const size_t CANDIDATE_WIDTHS[] = { 8, 16, 32, 64 };
+        const size_t CANDIDATE_HEIGHTS[] = { 1, 2, 4, 8, 16 };
+        const size_t MINIMUM_GROUP_SIZE = 64;
+        const size_t MAXIMUM_GROUP_SIZE = 256;
+
+        // Pipelines running side by side share the cache file
+        std::mutex cache_mutex;
+
+        std::string getKernelName(cl::Kernel& kernel)
+        {
+                // Some bindings keep the terminating null in the returned string
+                std::string name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>();
+                return std::string(name.c_str());
+        }
+
+        size_t padRange(size_t range, size_t local)
+        {
+                return (range + local - 1) / local * local;
+        }
+}
+
+void WorkGroupTuner::load(const cl::Device& device, std::string cache_filename)
+{
+        m_device = device;
+        std::string device_name = device.getInfo<CL_DEVICE_NAME>();
+        std::string driver_version = device.getInfo<CL_DRIVER_VERSION>();
+        m_device_key = std::string(device_name.c_str()) + " " + std::string(driver_version.c_str());
+        m_cache_filename = cache_filename;
+
+        // Each line is the device, kernel, image width and height, and local width and height
+        // separated by tabs, a local size of 0x0 leaves the choice to the driver
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        std::ifstream stream(cache_filename.c_str());
+        std::string line;
+        unsigned int loaded = 0;
+        while (std::getline(stream, line))
+        {
+                std::istringstream fields(line);
+                std::string device_key;
+                std::string kernel_name;
+                unsigned int width;
+                unsigned int height;
+                size_t local_width;
+                size_t local_height;
+                if (!std::getline(fields, device_key, '\t') || !std::getline(fields, kernel_name, '\t') ||
+                        !(fields >> width >> height >> local_width >> local_height))
+                {
+                        continue;
+                }
+                if (device_key != m_device_key)
+                {
+                        continue;
+                }
+
+                std::ostringstream key;
+                key << kernel_name << "\t" << width << "\t" << height;
+                Tuning& tuning = m_tunings[key.str()];
+                tuning.tuned = true;
+                tuning.local = local_width == 0 ? cl::NullRange : cl::NDRange(local_width, local_height);
+                loaded++;
+        }
+
+        if (loaded > 0)
+        {
+                std::cout << "Loaded " << loaded << " tuned work-group sizes from " << cache_filename << std::endl;
+        }
+}
+
+void WorkGroupTuner::enqueue(cl::CommandQueue& command_queue, cl::Kernel& kernel, unsigned int width, unsigned int height)
+{
+        std::ostringstream key_stream;
+        key_stream << getKernelName(kernel) << "\t" << width << "\t" << height;
+        std::string key = key_stream.str();
+        Tuning& tuning = m_tunings[key];
+
+        if (tuning.tuned)
+        {
+                if (tuning.local.dimensions() == 0)
+                {
+                        command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(width, height), cl::NullRange);
+                }
+                else
+                {
+                        cl::NDRange global(padRange(width, tuning.local[0]), padRange(height, tuning.local[1]));
+                        command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, tuning.local);
+                }
+                return;
+        }
+
+        if (tuning.candidates.empty())
+        {
+                createCandidates(kernel, tuning);
+        }
+
+        // Times this launch on its own with the next candidate in turn
+        unsigned int candidate = tuning.trials % tuning.candidates.size();
+        const cl::NDRange& local = tuning.candidates[candidate];
+        cl::NDRange global = local.dimensions() == 0 ? cl::NDRange(width, height) : cl::NDRange(padRange(width, local[0]), padRange(height, local[1]));
+
+        command_queue.finish();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        command_queue.enqueueNDRangeKernel(kernel, cl::NullRange, global, local);
+        command_queue.finish();
+        double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        tuning.best_ms[candidate] = std::min(tuning.best_ms[candidate], elapsed_ms);
+        tuning.trials++;
+        if (tuning.trials == tuning.candidates.size() * TRIALS_PER_CANDIDATE)
+        {
+                choose(key, tuning);
+        }
+}
+
+void WorkGroupTuner::createCandidates(cl::Kernel& kernel, Tuning& tuning)
+{
+        // Shapes the kernel can be launched with on this device, in multiples of its preferred size
+        size_t kernel_group_size = kernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(m_device);
+        size_t preferred_multiple = kernel.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(m_device);
+        std::vector<size_t> max_item_sizes = m_device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+        // The driver's choice is always a candidate, so tuning never does worse than it
+        tuning.candidates.push_back(cl::NullRange);
+        for (size_t local_width : CANDIDATE_WIDTHS)
+        {
+                for (size_t local_height : CANDIDATE_HEIGHTS)
+                {
+                        size_t group_size = local_width * local_height;
+                        if (group_size < MINIMUM_GROUP_SIZE || group_size > MAXIMUM_GROUP_SIZE || group_size > kernel_group_size ||
+                                local_width > max_item_sizes[0] || local_height > max_item_sizes[1] ||
+                                (preferred_multiple > 0 && group_size % preferred_multiple != 0))
+                        {
+                                continue;
+                        }
+                        tuning.candidates.push_back(cl::NDRange(local_width, local_height));
+                }
+        }
+        tuning.best_ms.assign(tuning.candidates.size(), 1e30);
+}
+
+void WorkGroupTuner::choose(std::string key, Tuning& tuning)
+{
+        unsigned int best = std::min_element(tuning.best_ms.begin(), tuning.best_ms.end()) - tuning.best_ms.begin();
+        tuning.local = tuning.candidates[best];
+        tuning.tuned = true;
+
+        std::string name = key.substr(0, key.find('\t'));
+        std::cout << "Tuned " << name << " work-groups to " << formatLocal(tuning.local) << " (" << tuning.best_ms[best]
+                << " ms, driver choice " << tuning.best_ms[0] << " ms)" << std::endl;
+
+        // Frees the timings, only the choice is kept
+        tuning.candidates.clear();
+        tuning.best_ms.clear();
+        save();
+}
+
+void WorkGroupTuner::save()
+{
+        // Lines for other devices, and any other tuner of this device wrote since the cache was
+        // loaded, are written back unless this tuner has its own choice for them
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        std::vector<std::string> kept_lines;
+        std::ifstream existing(m_cache_filename.c_str());
+        std::string line;
+        while (std::getline(existing, line))
+        {
+                std::istringstream fields(line);
+                std::string device_key;
+                std::string kernel_name;
+                std::string width;
+                std::string height;
+                if (!std::getline(fields, device_key, '\t') || !std::getline(fields, kernel_name, '\t') ||
+                        !std::getline(fields, width, '\t') || !std::getline(fields, height, '\t'))
+                {
+                        continue;
+                }
+                std::map<std::string, Tuning>::const_iterator found = m_tunings.find(kernel_name + "\t" + width + "\t" + height);
+                if (device_key != m_device_key || found == m_tunings.end() || !found->second.tuned)
+                {
+                        kept_lines.push_back(line);
+                }
+        }
+        existing.close();
+
+        std::ofstream stream(m_cache_filename.c_str());
+        if (!stream.good())
+        {
+                std::cerr << "Could not save tuned work-group sizes to " << m_cache_filename << std::endl;
+                return;
+        }
+
+        for (const std::string& kept_line : kept_lines)
+        {
+                stream << kept_line << std::endl;
+        }
+        for (const std::pair<const std::string, Tuning>& entry : m_tunings)
+        {
+                if (!entry.second.tuned)
+                {
+                        continue;
+                }
+                const cl::NDRange& local = entry.second.local;
+                size_t local_width = local.dimensions() == 0 ? 0 : local[0];
+                size_t local_height = local.dimensions() == 0 ? 0 : local[1];
+                stream << m_device_key << "\t" << entry.first << "\t" << local_width << "\t" << local_height << std::endl;
+        }
+}
+
+std::string WorkGroupTuner::formatLocal(const cl::NDRange& local)
+{
+        if (local.dimensions() == 0)
+        {
+                return "the driver's choice";
+        }
+        std::ostringstream text;
+        text << local[0] << "x" << local[1];
+        return text.str();
+}